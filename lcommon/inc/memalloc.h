@@ -214,5 +214,43 @@ static inline void mem_free(void *a)
   free_pointer(a);
 }
 
+/*!
+ ************************************************************************
+ * \brief
+ *    Arena of the frame sized buffers. Memory is mapped in chunks of at
+ *    least MEM_ARENA_CHUNK bytes, optionally backed by huge pages
+ *    (HugePages), allocations are MEM_ARENA_ALIGNMENT aligned and zeroed
+ *    and are only freed all at once with free_mem_arena(). The bytes
+ *    allocated are counted per MemTag.
+ ************************************************************************
+ */
+#define MEM_ARENA_ALIGNMENT       64
+#define MEM_ARENA_CHUNK           (2 << 20)
+#define MEM_HUGE_PAGES_OFF        0
+#define MEM_HUGE_PAGES_THP        1         //!< transparent huge pages, madvise(MADV_HUGEPAGE)
+#define MEM_HUGE_PAGES_EXPLICIT   2         //!< mmap(MAP_HUGETLB), transparent ones if the pool is empty
+
+typedef struct mem_arena_chunk
+{
+  struct mem_arena_chunk *next;
+  size_t size;           //!< whole mapping, the chunk header included
+  size_t used;
+  int    explicit_huge;  //!< mapped from the huge page pool
+} MemArenaChunk;
+
+typedef struct mem_arena
+{
+  MemArenaChunk *chunks; //!< the chunk allocated from first
+  int    huge_pages;     //!< MEM_HUGE_PAGES_*
+  int64  tag_bytes[MEM_TAG_COUNT];
+  int64  mapped;
+  int64  huge_mapped;    //!< of mapped, from the huge page pool
+} MemArena;
+
+extern void  init_mem_arena (MemArena *arena, int huge_pages);
+extern void *arena_calloc   (MemArena *arena, size_t nitems, size_t size, MemTag tag);
+extern void  free_mem_arena (MemArena *arena);
+extern int   get_mem4D_arena(MemArena *arena, byte *****array4D, int dim0, int dim1, int dim2, int dim3, MemTag tag);
+
 #endif
 
@@ -61,6 +61,7 @@ typedef struct nalu_t
   NalRefIdc nal_reference_idc;     //!< NALU_PRIORITY_xxxx  
   byte     *buf;                   //!< contains the first byte followed by the EBSP
   uint16    lost_packets;          //!< true, if packet loss is detected
+  int64     file_pos;              //!< file offset of the first byte (RTP input only)
 #if (MVC_EXTENSION_ENABLE)
   int       svc_extension_flag;    //!< should be always 0, for MVC
   int       non_idr_flag;          //!< 0 = current is IDR
@@ -79,7 +79,11 @@ typedef int   intptr_t;
 # else
 #  define inline /* nothing */
 # endif
-# define  forceinline inline
+# if defined(__GNUC__)
+#  define  forceinline inline __attribute__((always_inline))
+# else
+#  define  forceinline inline
+# endif
 #endif
 
 #if (defined(WIN32) || defined(WIN64)) && !defined(__GNUC__)
@@ -18,6 +18,10 @@
 #include "global.h"
 #include "memalloc.h"
 
+#if !(defined(WIN32) || defined(WIN64))
+#include <sys/mman.h>
+#endif
+
 /*!
  ************************************************************************
  * \brief
@@ -2720,3 +2724,169 @@ void free_mem2Ddistblk(distblk **array2D)
     error ("free_mem2Ddistblk: trying to free unused memory",100);
   }
 }
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Initialize an empty arena
+ ************************************************************************
+ */
+void init_mem_arena(MemArena *arena, int huge_pages)
+{
+  memset(arena, 0, sizeof(MemArena));
+  arena->huge_pages = huge_pages;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Map a chunk of at least size bytes. With huge pages the chunk is
+ *    a multiple of MEM_ARENA_CHUNK and aligned to it, the kernel can
+ *    only back whole aligned 2 MB ranges with a huge page.
+ ************************************************************************
+ */
+static MemArenaChunk *map_arena_chunk(MemArena *arena, size_t size)
+{
+  MemArenaChunk *chunk = NULL;
+  size_t map_size = (size + MEM_ARENA_CHUNK - 1) & ~((size_t) MEM_ARENA_CHUNK - 1);
+  int explicit_huge = 0;
+
+#if defined(WIN32) || defined(WIN64)
+  if ((chunk = (MemArenaChunk *) _aligned_malloc(map_size, MEM_ARENA_ALIGNMENT)) == NULL)
+    no_mem_exit("map_arena_chunk: chunk");
+  memset(chunk, 0, map_size);
+#else
+#ifdef MAP_HUGETLB
+  if (arena->huge_pages == MEM_HUGE_PAGES_EXPLICIT)
+  {
+    void *p = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED)
+    {
+      chunk = (MemArenaChunk *) p;
+      explicit_huge = 1;
+    }
+  }
+#endif
+  if (chunk == NULL && arena->huge_pages != MEM_HUGE_PAGES_OFF)
+  {
+    // over map and trim to a 2 MB aligned range
+    byte *p = (byte *) mmap(NULL, map_size + MEM_ARENA_CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    byte *start;
+
+    if (p == MAP_FAILED)
+      no_mem_exit("map_arena_chunk: chunk");
+    start = (byte *) (((uintptr_t) p + MEM_ARENA_CHUNK - 1) & ~((uintptr_t) MEM_ARENA_CHUNK - 1));
+    if (start > p)
+      munmap(p, start - p);
+    if (start + map_size < p + map_size + MEM_ARENA_CHUNK)
+      munmap(start + map_size, (p + map_size + MEM_ARENA_CHUNK) - (start + map_size));
+#ifdef MADV_HUGEPAGE
+    madvise(start, map_size, MADV_HUGEPAGE);
+#endif
+    chunk = (MemArenaChunk *) start;
+  }
+  if (chunk == NULL)
+  {
+    void *p = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+      no_mem_exit("map_arena_chunk: chunk");
+    chunk = (MemArenaChunk *) p;
+  }
+#endif
+
+  chunk->size = map_size;
+  chunk->used = (sizeof(MemArenaChunk) + MEM_ARENA_ALIGNMENT - 1) & ~((size_t) MEM_ARENA_ALIGNMENT - 1);
+  chunk->explicit_huge = explicit_huge;
+  arena->mapped += map_size;
+  if (explicit_huge)
+    arena->huge_mapped += map_size;
+  return chunk;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Allocate nitems * size zeroed bytes from the arena, aligned at
+ *    MEM_ARENA_ALIGNMENT, and count them for tag
+ ************************************************************************
+ */
+void *arena_calloc(MemArena *arena, size_t nitems, size_t size, MemTag tag)
+{
+  size_t bytes = (nitems * size + MEM_ARENA_ALIGNMENT - 1) & ~((size_t) MEM_ARENA_ALIGNMENT - 1);
+  MemArenaChunk *chunk = arena->chunks;
+  void *d;
+
+  if (chunk == NULL || chunk->used + bytes > chunk->size)
+  {
+    MemArenaChunk *fresh = map_arena_chunk(arena, bytes + MEM_ARENA_ALIGNMENT);
+
+    // a chunk that still has more room than the new one keeps being allocated from
+    if (chunk != NULL && chunk->size - chunk->used > fresh->size - fresh->used - bytes)
+    {
+      fresh->next = chunk->next;
+      chunk->next = fresh;
+      chunk = fresh;
+    }
+    else
+    {
+      fresh->next = arena->chunks;
+      arena->chunks = chunk = fresh;
+    }
+  }
+  d = (byte *) chunk + chunk->used;
+  chunk->used += bytes;
+  arena->tag_bytes[tag] += nitems * size;
+  return d;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Free everything allocated from the arena, the arena stays usable
+ ************************************************************************
+ */
+void free_mem_arena(MemArena *arena)
+{
+  MemArenaChunk *chunk = arena->chunks;
+
+  while (chunk != NULL)
+  {
+    MemArenaChunk *next = chunk->next;
+#if defined(WIN32) || defined(WIN64)
+    _aligned_free(chunk);
+#else
+    munmap(chunk, chunk->size);
+#endif
+    chunk = next;
+  }
+  init_mem_arena(arena, arena->huge_pages);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Allocate 4D memory array -> unsigned char array4D[dim0][dim1][dim2][dim3]
+ *    from an arena, the pointer arrays included. It is freed with the
+ *    arena, not with free_mem4D().
+ *
+ * \par Output:
+ *    memory size in bytes
+ ************************************************************************
+ */
+int get_mem4D_arena(MemArena *arena, byte *****array4D, int dim0, int dim1, int dim2, int dim3, MemTag tag)
+{
+  int i, n2 = dim0 * dim1, n3 = n2 * dim2;
+  byte ***array3D = (byte ***) arena_calloc(arena, n2, sizeof(byte **), tag);
+  byte  **array2D = (byte  **) arena_calloc(arena, n3, sizeof(byte *), tag);
+  byte   *data    = (byte   *) arena_calloc(arena, n3 * dim3, sizeof(byte), tag);
+
+  *array4D = (byte ****) arena_calloc(arena, dim0, sizeof(byte ***), tag);
+  for (i = 0; i < dim0; i++)
+    (*array4D)[i] = array3D + i * dim1;
+  for (i = 0; i < n2; i++)
+    array3D[i] = array2D + i * dim2;
+  for (i = 0; i < n3; i++)
+    array2D[i] = data + i * dim3;
+
+  return dim0 * sizeof(byte***) + n2 * sizeof(byte**) + n3 * (sizeof(byte*) + dim3 * sizeof(byte));
+}
@@ -0,0 +1,1542 @@
+
+/*!
+ ***********************************************************************
+ *  \file
+ *     h264gen.c
+ *  \brief
+ *     Synthetic H.264 Annex B stream generator (Main profile, or
+ *     Extended profile with data partitioning, 4:2:0, progressive
+ *     frames), so the decoder, the key generator and the
+ *     throughput benchmarks can be stressed without outside data.
+ *
+ *     usage: h264gen.exe [-o out.264] [-s WxH] [-n frames] [-S slices]
+ *                        [-b bframes] [-g idr_period] [-c 0|1] [-q qp]
+ *                        [-k skip%] [-d direct%] [-p w16x16,w16x8,w8x16,w8x8]
+ *                        [-P w8x8,w8x4,w4x8,w4x4] [-m zero|uniform:N|laplace:M]
+ *                        [-r cbp%,coeffs] [-e bytes] [-D 0|1] [-x seed]
+ *
+ *       -o  output file (default synth.264)
+ *       -s  picture size, cropped from whole macroblocks (default 352x288)
+ *       -n  number of frames (default 30)
+ *       -S  slices per picture, macroblocks split evenly (default 1)
+ *       -b  B frames between two anchor frames (default 2)
+ *       -g  IDR period in frames, 0 = first frame only (default 0)
+ *       -c  0 = CAVLC, 1 = CABAC (default 1)
+ *       -q  slice QP (default 28)
+ *       -k  percentage of skipped macroblocks in P/B slices (default 10)
+ *       -d  percentage of B_Direct_16x16 macroblocks and direct 8x8
+ *           sub-macroblocks in B slices (default 10)
+ *       -p  relative weights of the inter partition sizes (default 4,2,2,1)
+ *       -P  relative weights of the sub-partition sizes (default 4,1,1,1)
+ *       -m  MVD component distribution in quarter samples
+ *           (default laplace:4, magnitudes are limited to 1023)
+ *       -r  percentage of coded 8x8 luma blocks and mean number of
+ *           coefficients per coded 4x4 block (default 25,2)
+ *       -e  code an I_PCM macroblock holding 00 00 0x sequences about
+ *           every <bytes> bytes of slice data, one emulation prevention
+ *           byte per sequence (default 0 = off)
+ *       -D  1 = data partitioning (CAVLC only): the slice data in
+ *           partition A, intra residual and I_PCM samples in B, inter
+ *           residual in C (default 0); IDR pictures stay unpartitioned,
+ *           a partition A NAL unit has no idr_pic_id
+ *       -x  random seed
+ *
+ *     I pictures are I_16x16 (DC prediction, no residual), P/B pictures
+ *     use one reference per list (num_ref_idx_active = 1), B pictures
+ *     are not used for reference and use spatial direct prediction.
+ *     Chroma has no residual. Deblocking is disabled.
+ *     The context selection mirrors the decoder's CABAC and CAVLC
+ *     readers, the context initialisation and the CAVLC tables are the
+ *     decoder's own (context_ini.c, vlc.c).
+ *     The summary ends with the number of key units the decoder is
+ *     expected to record (one per coded macroblock and list with MVDs).
+ ***********************************************************************
+ */
+
+#include <math.h>
+
+#include "global.h"
+#include "memalloc.h"
+#include "nalucommon.h"
+#include "vlc.h"
+#include "biaridecod.h"
+#include "context_ini.h"
+
+#define MAX_PCM_PATTERNS  96     //!< 00 00 0x sequences per I_PCM macroblock, 4 bytes apart
+#define MAX_MVD           1023
+
+enum { MB_SKIP = 0, MB_INTER, MB_I16, MB_IPCM };
+enum { MVD_ZERO = 0, MVD_UNIFORM, MVD_LAPLACE };
+
+// context index offsets of the decoder (cabac.c, type2ctx_* of LUMA_16DC and LUMA_4x4)
+#define CTX_BCBP_16DC     0
+#define CTX_BCBP_4x4      4
+#define CTX_MAP_4x4       5
+#define CTX_LEVEL_4x4     4
+#define MAX_C2_4x4        4
+
+static const int incVlc[] = { 0, 3, 6, 12, 24, 48, 32768 };
+
+//! B mb_type of 16x8 partitions by prediction of the two partitions (L0, L1, Bi), +1 for 8x16
+static const int b_part_mb_type[3][3] = { { 4, 8, 12 }, { 10, 6, 14 }, { 16, 18, 20 } };
+//! B sub_mb_type by prediction (L0, L1, Bi) and shape (8x8, 8x4, 4x8, 4x4)
+static const int b_sub_type[3][4] = { { 1, 4, 5, 10 }, { 2, 6, 7, 11 }, { 3, 8, 9, 12 } };
+//! width and height of the sub-partition shapes in 4x4 blocks
+static const int sub_w[4] = { 2, 2, 1, 1 };
+static const int sub_h[4] = { 2, 1, 2, 1 };
+
+typedef struct gen_param
+{
+  char   out[FILE_NAME_SIZE];
+  int    width;
+  int    height;
+  int    frames;
+  int    slices;
+  int    bframes;
+  int    idr_period;
+  int    cabac;
+  int    qp;
+  int    skip_pct;
+  int    direct_pct;
+  int    part_w[4];
+  int    sub_w[4];
+  int    mvd_mode;
+  double mvd_scale;
+  int    cbp_pct;
+  double coeff_mean;
+  int    ep_interval;
+  int    dp;
+  uint32 seed;
+} GenParam;
+
+typedef struct bit_writer
+{
+  byte  *buf;
+  int    size;
+  int    len;          //!< complete bytes
+  uint64 acc;
+  int    bits;         //!< pending bits in acc (0..7)
+} BitWriter;
+
+typedef struct cabac_encoder
+{
+  BitWriter *bw;
+  uint32 low;
+  uint32 range;
+  int    outstanding;
+  int    first_bit;
+} CabacEncoder;
+
+//! macroblock state the context selection of later macroblocks depends on
+typedef struct gen_mb
+{
+  int   kind;
+  int   direct;        //!< B_Skip or B_Direct_16x16 (mb_type 0 in the decoder)
+  int   cbp;
+  int   cbf;           //!< coded_block_flag, bit 0: I16 DC, bit 1 + 4*by + bx: 4x4 luma block
+  byte  nz[16];        //!< total_coeff per 4x4 luma block
+  short mvd[2][16][2];
+} GenMb;
+
+typedef struct mb_part
+{
+  int x, y, w, h;      //!< in 4x4 blocks
+  int pred;            //!< bit 0: list 0, bit 1: list 1, 0: direct
+} MbPart;
+
+typedef struct mb_plan
+{
+  int    kind;
+  int    mb_type;      //!< mb_type as in the standard
+  int    sub_type[4];
+  int    npart;
+  MbPart part[16];
+  short  mvd[2][16][2];
+  int    cbp;
+  int    coef[16][16]; //!< per 4x4 block, in scan order
+  int    pcm_patterns;
+} MbPlan;
+
+typedef struct gen_stats
+{
+  int64 bytes;
+  int64 ep_bytes;
+  int   pictures[3];   //!< P, B, I
+  int64 slices;
+  int64 mbs[4];        //!< by kind
+  int64 direct;
+  int64 key_units;
+  int64 partitions[2]; //!< B, C NAL units
+} GenStats;
+
+typedef struct generator
+{
+  GenParam     p;
+  int          mb_w;
+  int          mb_h;
+  GenMb       *mb;
+  int          slice_start;
+  int          slice_type;
+  Slice       *ctx_slice;     //!< holds the contexts for init_contexts
+  BitWriter    rbsp;          //!< slice data, partition A with -D 1
+  BitWriter    part[2];       //!< partitions B and C with -D 1
+  int          part_used[2];  //!< B / C hold residual of the slice
+  int          dp;            //!< the slice is partitioned: -D 1 and not IDR
+  int          slice_id;
+  CabacEncoder ce;
+  FILE        *f;
+  int64        ep_debt;
+  byte         inter_cbp_code[16];
+  GenStats     st;
+} Generator;
+
+static uint32 rnd_state = 0x2545F491;
+
+static inline uint32 rnd(void)
+{
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 17;
+  rnd_state ^= rnd_state << 5;
+  return rnd_state;
+}
+
+//! uniform in (0, 1]
+static inline double rnd_unit(void)
+{
+  return ((rnd() >> 8) + 1) * (1.0 / 16777216.0);
+}
+
+static int rnd_weighted(const int w[4])
+{
+  int sum = w[0] + w[1] + w[2] + w[3], i, r;
+
+  if (sum <= 0)
+    return 0;
+  r = (int) (rnd() % (uint32) sum);
+  for (i = 0; r >= w[i]; ++i)
+    r -= w[i];
+  return i;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    bit writer
+ ************************************************************************
+ */
+static void bw_byte(BitWriter *bw, byte b)
+{
+  if (bw->len == bw->size)
+  {
+    bw->size = bw->size ? 2 * bw->size : 65536;
+    if ((bw->buf = (byte *) realloc(bw->buf, bw->size)) == NULL)
+      no_mem_exit("h264gen: bit buffer");
+  }
+  bw->buf[bw->len++] = b;
+}
+
+static void put_bits(BitWriter *bw, int n, uint32 v)
+{
+  bw->acc   = (bw->acc << n) | (v & (uint32) ((1ULL << n) - 1));
+  bw->bits += n;
+  while (bw->bits >= 8)
+  {
+    bw->bits -= 8;
+    bw_byte(bw, (byte) (bw->acc >> bw->bits));
+  }
+}
+
+static void put_ue(BitWriter *bw, uint32 v)
+{
+  uint32 x = v + 1;
+  int n = 0;
+
+  while ((x >> n) > 1)
+    ++n;
+  put_bits(bw, n, 0);
+  put_bits(bw, n + 1, x);
+}
+
+static void put_se(BitWriter *bw, int v)
+{
+  put_ue(bw, v > 0 ? 2 * v - 1 : -2 * v);
+}
+
+static void put_align_zero(BitWriter *bw)
+{
+  put_bits(bw, (8 - bw->bits) & 7, 0);
+}
+
+static void put_trailing_bits(BitWriter *bw)
+{
+  put_bits(bw, 1, 1);
+  put_align_zero(bw);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    CABAC encoding engine (9.3.4)
+ ************************************************************************
+ */
+static void cabac_start(CabacEncoder *ce, BitWriter *bw)
+{
+  ce->bw          = bw;
+  ce->low         = 0;
+  ce->range       = 510;
+  ce->outstanding = 0;
+  ce->first_bit   = 1;
+}
+
+static void cabac_put_bit(CabacEncoder *ce, int b)
+{
+  if (ce->first_bit)
+    ce->first_bit = 0;
+  else
+    put_bits(ce->bw, 1, b);
+  for (; ce->outstanding > 0; --ce->outstanding)
+    put_bits(ce->bw, 1, 1 - b);
+}
+
+static void cabac_renorm(CabacEncoder *ce)
+{
+  while (ce->range < 256)
+  {
+    if (ce->low < 256)
+      cabac_put_bit(ce, 0);
+    else if (ce->low >= 512)
+    {
+      ce->low -= 512;
+      cabac_put_bit(ce, 1);
+    }
+    else
+    {
+      ce->low -= 256;
+      ++ce->outstanding;
+    }
+    ce->range <<= 1;
+    ce->low   <<= 1;
+  }
+}
+
+static void cabac_encode(CabacEncoder *ce, BiContextType *ctx, int bin)
+{
+  uint32 lps = rLPS_table_64x4[ctx->state][(ce->range >> 6) & 3];
+
+  ce->range -= lps;
+  if (bin != ctx->MPS)
+  {
+    ce->low  += ce->range;
+    ce->range = lps;
+    if (ctx->state == 0)
+      ctx->MPS = (unsigned char) (1 - ctx->MPS);
+    ctx->state = AC_next_state_LPS_64[ctx->state];
+  }
+  else
+    ctx->state = AC_next_state_MPS_64[ctx->state];
+  cabac_renorm(ce);
+}
+
+static void cabac_bypass(CabacEncoder *ce, int bin)
+{
+  ce->low <<= 1;
+  if (bin)
+    ce->low += ce->range;
+  if (ce->low >= 1024)
+  {
+    cabac_put_bit(ce, 1);
+    ce->low -= 1024;
+  }
+  else if (ce->low < 512)
+    cabac_put_bit(ce, 0);
+  else
+  {
+    ce->low -= 512;
+    ++ce->outstanding;
+  }
+}
+
+//! end_of_slice_flag and the I_PCM bin of mb_type; a 1 flushes the engine
+static void cabac_terminate(CabacEncoder *ce, int bin)
+{
+  ce->range -= 2;
+  if (bin)
+  {
+    ce->low  += ce->range;
+    ce->range = 2;
+    cabac_renorm(ce);
+    cabac_put_bit(ce, (ce->low >> 9) & 1);
+    put_bits(ce->bw, 2, ((ce->low >> 7) & 3) | 1);
+  }
+  else
+    cabac_renorm(ce);
+}
+
+static void cabac_exp_golomb(CabacEncoder *ce, int v, int k)
+{
+  while (v >= (1 << k))
+  {
+    cabac_bypass(ce, 1);
+    v -= 1 << k;
+    ++k;
+  }
+  cabac_bypass(ce, 0);
+  while (k--)
+    cabac_bypass(ce, (v >> k) & 1);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    neighbours in the current slice (left and above only, no MBAFF)
+ ************************************************************************
+ */
+static GenMb *mb_left(Generator *g, int addr)
+{
+  return ((addr % g->mb_w) != 0 && addr - 1 >= g->slice_start) ? &g->mb[addr - 1] : NULL;
+}
+
+static GenMb *mb_up(Generator *g, int addr)
+{
+  return (addr - g->mb_w >= g->slice_start) ? &g->mb[addr - g->mb_w] : NULL;
+}
+
+static int predict_nc(Generator *g, int addr, int bx, int by)
+{
+  GenMb *cur = &g->mb[addr], *n;
+  int cnt = 0, nc = 0;
+
+  if (bx > 0)
+  {
+    nc = cur->nz[4 * by + bx - 1];
+    ++cnt;
+  }
+  else if ((n = mb_left(g, addr)) != NULL)
+  {
+    nc = n->nz[4 * by + 3];
+    ++cnt;
+  }
+  if (by > 0)
+  {
+    nc += cur->nz[4 * (by - 1) + bx];
+    ++cnt;
+  }
+  else if ((n = mb_up(g, addr)) != NULL)
+  {
+    nc += n->nz[12 + bx];
+    ++cnt;
+  }
+  return cnt == 2 ? (nc + 1) >> 1 : nc;
+}
+
+static int cbf_bit(GenMb *n, int blk)
+{
+  return n->kind == MB_IPCM ? 1 : (n->cbf >> (1 + blk)) & 1;
+}
+
+static int mvd_abs_sum(Generator *g, int addr, int x, int y, int list, int k)
+{
+  GenMb *cur = &g->mb[addr], *n;
+  int sum = 0;
+
+  if (x > 0)
+    sum = iabs(cur->mvd[list][4 * y + x - 1][k]);
+  else if ((n = mb_left(g, addr)) != NULL)
+    sum = iabs(n->mvd[list][4 * y + 3][k]);
+  if (y > 0)
+    sum += iabs(cur->mvd[list][4 * (y - 1) + x][k]);
+  else if ((n = mb_up(g, addr)) != NULL)
+    sum += iabs(n->mvd[list][12 + x][k]);
+  return sum;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    CAVLC residual block (read_coeff_4x4_CAVLC)
+ ************************************************************************
+ */
+static void cavlc_level(BitWriter *bw, int vlc, int c)
+{
+  int a = iabs(c), s = (c < 0);
+
+  if (vlc == 0)
+  {
+    if (a <= 7)
+    {
+      put_bits(bw, 2 * (a - 1) + s, 0);
+      put_bits(bw, 1, 1);
+    }
+    else if (a <= 15)
+    {
+      put_bits(bw, 14, 0);
+      put_bits(bw, 1, 1);
+      put_bits(bw, 4, ((a - 8) << 1) | s);
+    }
+    else
+    {
+      put_bits(bw, 15, 0);
+      put_bits(bw, 1, 1);
+      put_bits(bw, 12, ((a - 16) << 1) | s);
+    }
+  }
+  else
+  {
+    int shift = vlc - 1;
+    int prefix = (a - 1) >> shift;
+
+    if (prefix < 15)
+    {
+      put_bits(bw, prefix, 0);
+      put_bits(bw, 1, 1);
+      put_bits(bw, shift, (a - 1) & ((1 << shift) - 1));
+    }
+    else
+    {
+      put_bits(bw, 15, 0);
+      put_bits(bw, 1, 1);
+      put_bits(bw, 11, a - 1 - (15 << shift));
+    }
+    put_bits(bw, 1, s);
+  }
+}
+
+static int cavlc_block(BitWriter *bw, const int coef[16], int nc)
+{
+  int lev[16], run[16], pos[16];
+  int tc = 0, t1 = 0, tz, i, k, vlc, zeros_left, first;
+
+  for (i = 15; i >= 0; --i)
+  {
+    if (coef[i])
+    {
+      pos[tc]   = i;
+      lev[tc++] = coef[i];
+    }
+  }
+  for (k = 0; k < tc && k < 3 && iabs(lev[k]) == 1; ++k)
+    ++t1;
+
+  if (nc >= 8)
+    put_bits(bw, 6, tc ? ((tc - 1) << 2) | t1 : 3);
+  else
+  {
+    vlc = nc < 2 ? 0 : nc < 4 ? 1 : 2;
+    put_bits(bw, coeff_token_lentab[vlc][t1][tc], coeff_token_codtab[vlc][t1][tc]);
+  }
+  if (tc == 0)
+    return 0;
+
+  for (k = 0; k < t1; ++k)
+    put_bits(bw, 1, lev[k] < 0);
+
+  first = (t1 < 3);
+  vlc = (tc > 10 && t1 < 3) ? 1 : 0;
+  for (k = t1; k < tc; ++k)
+  {
+    int a = iabs(lev[k]);
+    cavlc_level(bw, vlc, first ? (lev[k] > 0 ? lev[k] - 1 : lev[k] + 1) : lev[k]);
+    first = 0;
+    if (a > incVlc[vlc])
+      ++vlc;
+    if (k == t1 && a > 3)
+      vlc = 2;
+  }
+
+  tz = pos[0] + 1 - tc;
+  if (tc < 16)
+    put_bits(bw, total_zeros_lentab[tc - 1][tz], total_zeros_codtab[tc - 1][tz]);
+
+  for (k = 0; k < tc - 1; ++k)
+    run[k] = pos[k] - pos[k + 1] - 1;
+  for (k = 0, zeros_left = tz; k < tc - 1 && zeros_left > 0; ++k)
+  {
+    vlc = imin(zeros_left - 1, RUNBEFORE_NUM_M1);
+    put_bits(bw, run_before_lentab[vlc][run[k]], run_before_codtab[vlc][run[k]]);
+    zeros_left -= run[k];
+  }
+  return tc;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    CABAC residual block of type LUMA_4x4, coded_block_flag excluded
+ *    (read_significance_map, read_significant_coefficients)
+ ************************************************************************
+ */
+static void cabac_block(CabacEncoder *ce, TextureInfoContexts *tex, const int coef[16])
+{
+  BiContextType *map  = tex->map_contexts[0][CTX_MAP_4x4];
+  BiContextType *last = tex->last_contexts[0][CTX_MAP_4x4];
+  BiContextType *one  = tex->one_contexts[CTX_LEVEL_4x4];
+  BiContextType *abs  = tex->abs_contexts[CTX_LEVEL_4x4];
+  int i, t, c1 = 1, c2 = 0, last_pos = 15;
+
+  while (last_pos > 0 && coef[last_pos] == 0)
+    --last_pos;
+  for (i = 0; i < 15; ++i)
+  {
+    cabac_encode(ce, map + i, coef[i] != 0);
+    if (coef[i])
+    {
+      cabac_encode(ce, last + i, i == last_pos);
+      if (i == last_pos)
+        break;
+    }
+  }
+
+  for (i = last_pos; i >= 0; --i)
+  {
+    int a = iabs(coef[i]);
+    if (a == 0)
+      continue;
+    cabac_encode(ce, one + c1, a > 1);
+    if (a > 1)
+    {
+      int m = a - 2;
+      cabac_encode(ce, abs + c2, m != 0);
+      for (t = 1; m && t < 13; ++t)
+      {
+        cabac_encode(ce, abs + c2, t < m);
+        if (t >= m)
+          break;
+      }
+      if (m >= 13)
+        cabac_exp_golomb(ce, m - 13, 0);
+      c2 = imin(c2 + 1, MAX_C2_4x4);
+      c1 = 0;
+    }
+    else if (c1)
+      c1 = imin(c1 + 1, 4);
+    cabac_bypass(ce, coef[i] < 0);
+  }
+}
+
+//! read_MVD_CABAC
+static void cabac_mvd(CabacEncoder *ce, MotionInfoContexts *mc, int k, int sum, int mvd)
+{
+  int a = sum < 3 ? 5 * k : sum > 32 ? 5 * k + 3 : 5 * k + 2;
+  int v = iabs(mvd);
+
+  cabac_encode(ce, &mc->mv_res_contexts[0][a], v != 0);
+  if (v)
+  {
+    BiContextType *ctx = &mc->mv_res_contexts[1][5 * k];
+    int m = v - 1, t;
+
+    cabac_encode(ce, ctx, m != 0);
+    for (t = 1; m && t < 8; ++t)
+    {
+      cabac_encode(ce, ctx + imin(t, 3), t < m);
+      if (t >= m)
+        break;
+    }
+    if (m >= 8)
+      cabac_exp_golomb(ce, m - 8, 3);
+    cabac_bypass(ce, mvd < 0);
+  }
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    macroblock decisions
+ ************************************************************************
+ */
+static int gen_mvd(GenParam *p)
+{
+  int v = 0;
+
+  if (p->mvd_mode == MVD_UNIFORM)
+    v = (int) (rnd() % (uint32) (2 * (int) p->mvd_scale + 1)) - (int) p->mvd_scale;
+  else if (p->mvd_mode == MVD_LAPLACE)
+  {
+    v = (int) (-p->mvd_scale * log(rnd_unit()) + 0.5);
+    if (rnd() & 1)
+      v = -v;
+  }
+  return iClip3(-MAX_MVD, MAX_MVD, v);
+}
+
+static void gen_block(GenParam *p, int coef[16])
+{
+  int idx[16], tc, i;
+
+  memset(coef, 0, 16 * sizeof(int));
+  tc = imin(16, (int) (-p->coeff_mean * log(rnd_unit()) + 0.5));
+  for (i = 0; i < 16; ++i)
+    idx[i] = i;
+  for (i = 0; i < tc; ++i)
+  {
+    int j = i + (int) (rnd() % (uint32) (16 - i)), t = idx[i], a = 1;
+
+    idx[i] = idx[j];
+    idx[j] = t;
+    if ((rnd() & 63) == 0)
+      a = 16 + (int) (rnd() % 200);
+    else
+      while ((rnd() & 3) == 0 && a < 64)
+        ++a;
+    coef[idx[i]] = (rnd() & 1) ? -a : a;
+  }
+}
+
+static void add_part(MbPlan *pl, int x, int y, int w, int h, int pred)
+{
+  MbPart *pt = &pl->part[pl->npart++];
+
+  pt->x = x;
+  pt->y = y;
+  pt->w = w;
+  pt->h = h;
+  pt->pred = pred;
+}
+
+static void plan_mb(Generator *g, MbPlan *pl)
+{
+  GenParam *p = &g->p;
+  int bslice = (g->slice_type == B_SLICE);
+  int i, n, list;
+
+  memset(pl, 0, sizeof(MbPlan));
+
+  if (p->ep_interval > 0 && g->ep_debt >= p->ep_interval)
+  {
+    pl->kind = MB_IPCM;
+    pl->pcm_patterns = (int) (g->ep_debt / p->ep_interval < MAX_PCM_PATTERNS ? g->ep_debt / p->ep_interval : MAX_PCM_PATTERNS);
+    g->ep_debt -= (int64) pl->pcm_patterns * p->ep_interval;
+    return;
+  }
+  if (g->slice_type == I_SLICE)
+  {
+    pl->kind    = MB_I16;
+    pl->mb_type = 3;           // I_16x16_2_0_0: DC prediction, no coded luma AC and chroma
+    return;
+  }
+  if ((int) (rnd() % 100) < p->skip_pct)
+  {
+    pl->kind = MB_SKIP;
+    return;
+  }
+
+  pl->kind = MB_INTER;
+  if (bslice && (int) (rnd() % 100) < p->direct_pct)
+    pl->mb_type = 0;           // B_Direct_16x16
+  else
+  {
+    int shape = rnd_weighted(p->part_w);
+    int pred0 = bslice ? 1 + (int) (rnd() % 3) : 1;
+    int pred1 = bslice ? 1 + (int) (rnd() % 3) : 1;
+
+    switch (shape)
+    {
+    case 0:
+      pl->mb_type = bslice ? pred0 : 0;
+      add_part(pl, 0, 0, 4, 4, pred0);
+      break;
+    case 1:
+      pl->mb_type = bslice ? b_part_mb_type[pred0 - 1][pred1 - 1] : 1;
+      add_part(pl, 0, 0, 4, 2, pred0);
+      add_part(pl, 0, 2, 4, 2, pred1);
+      break;
+    case 2:
+      pl->mb_type = bslice ? b_part_mb_type[pred0 - 1][pred1 - 1] + 1 : 2;
+      add_part(pl, 0, 0, 2, 4, pred0);
+      add_part(pl, 2, 0, 2, 4, pred1);
+      break;
+    default:
+      pl->mb_type = bslice ? 22 : 3;
+      for (i = 0; i < 4; ++i)
+      {
+        int x0 = 2 * (i & 1), y0 = 2 * (i >> 1), x, y;
+        int sub = rnd_weighted(p->sub_w);
+        int pred = bslice ? 1 + (int) (rnd() % 3) : 1;
+
+        if (bslice && (int) (rnd() % 100) < p->direct_pct)
+        {
+          pl->sub_type[i] = 0;
+          continue;
+        }
+        pl->sub_type[i] = bslice ? b_sub_type[pred - 1][sub] : sub;
+        for (y = y0; y < y0 + 2; y += sub_h[sub])
+          for (x = x0; x < x0 + 2; x += sub_w[sub])
+            add_part(pl, x, y, sub_w[sub], sub_h[sub], pred);
+      }
+      break;
+    }
+  }
+
+  for (list = 0; list < 2; ++list)
+    for (n = 0; n < pl->npart; ++n)
+      if (pl->part[n].pred & (1 << list))
+      {
+        pl->mvd[list][n][0] = (short) gen_mvd(p);
+        pl->mvd[list][n][1] = (short) gen_mvd(p);
+      }
+
+  for (i = 0; i < 4; ++i)
+  {
+    if ((int) (rnd() % 100) < p->cbp_pct)
+    {
+      int b;
+      pl->cbp |= 1 << i;
+      for (b = 0; b < 4; ++b)
+        gen_block(p, pl->coef[4 * (2 * (i >> 1) + (b >> 1)) + 2 * (i & 1) + (b & 1)]);
+    }
+  }
+}
+
+static int plan_key_units(MbPlan *pl)
+{
+  int used = 0, n;
+
+  for (n = 0; n < pl->npart; ++n)
+    used |= pl->part[n].pred;
+  return (used & 1) + ((used >> 1) & 1);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    macroblock layer
+ ************************************************************************
+ */
+
+//! the writer of intra (partition B) or inter (partition C) residual
+static BitWriter *residual_writer(Generator *g, int intra)
+{
+  if (!g->dp)
+    return &g->rbsp;
+  g->part_used[!intra] = 1;
+  return &g->part[!intra];
+}
+
+static void code_pcm(Generator *g, MbPlan *pl)
+{
+  BitWriter *bw = residual_writer(g, TRUE);
+  byte pcm[384];
+  int i;
+
+  memset(pcm, 0x80, sizeof(pcm));
+  for (i = 0; i < pl->pcm_patterns; ++i)
+  {
+    int at = i * (int) (sizeof(pcm) / MAX_PCM_PATTERNS);
+    pcm[at]     = 0;
+    pcm[at + 1] = 0;
+    pcm[at + 2] = (byte) (rnd() & 3);
+  }
+  put_align_zero(bw);
+  for (i = 0; i < (int) sizeof(pcm); ++i)
+    put_bits(bw, 8, pcm[i]);
+}
+
+static void code_mvds(Generator *g, int addr, MbPlan *pl)
+{
+  GenMb *cur = &g->mb[addr];
+  int list, n, k, x, y;
+
+  for (list = 0; list < 2; ++list)
+  {
+    for (n = 0; n < pl->npart; ++n)
+    {
+      MbPart *pt = &pl->part[n];
+
+      if (!(pt->pred & (1 << list)))
+        continue;
+      for (k = 0; k < 2; ++k)
+      {
+        if (g->p.cabac)
+          cabac_mvd(&g->ce, g->ctx_slice->mot_ctx, k, mvd_abs_sum(g, addr, pt->x, pt->y, list, k), pl->mvd[list][n][k]);
+        else
+          put_se(&g->rbsp, pl->mvd[list][n][k]);
+      }
+      for (y = pt->y; y < pt->y + pt->h; ++y)
+        for (x = pt->x; x < pt->x + pt->w; ++x)
+        {
+          cur->mvd[list][4 * y + x][0] = pl->mvd[list][n][0];
+          cur->mvd[list][4 * y + x][1] = pl->mvd[list][n][1];
+        }
+    }
+  }
+}
+
+static void code_residual(Generator *g, int addr, MbPlan *pl)
+{
+  GenMb *cur = &g->mb[addr];
+  int b8, b, bx, by;
+
+  for (b8 = 0; b8 < 4; ++b8)
+  {
+    if (!(pl->cbp & (1 << b8)))
+      continue;
+    for (b = 0; b < 4; ++b)
+    {
+      int blk;
+      bx  = 2 * (b8 & 1) + (b & 1);
+      by  = 2 * (b8 >> 1) + (b >> 1);
+      blk = 4 * by + bx;
+      if (g->p.cabac)
+      {
+        GenMb *n;
+        int left, upper, coded = 0, i;
+
+        if (bx > 0)
+          left = cbf_bit(cur, blk - 1);
+        else
+          left = (n = mb_left(g, addr)) != NULL ? cbf_bit(n, blk + 3) : 0;
+        if (by > 0)
+          upper = cbf_bit(cur, blk - 4);
+        else
+          upper = (n = mb_up(g, addr)) != NULL ? cbf_bit(n, blk + 12) : 0;
+        for (i = 0; i < 16; ++i)
+          coded |= (pl->coef[blk][i] != 0);
+        cabac_encode(&g->ce, g->ctx_slice->tex_ctx->bcbp_contexts[CTX_BCBP_4x4] + 2 * upper + left, coded);
+        if (coded)
+        {
+          cur->cbf |= 1 << (1 + blk);
+          cabac_block(&g->ce, g->ctx_slice->tex_ctx, pl->coef[blk]);
+        }
+      }
+      else
+        cur->nz[blk] = (byte) cavlc_block(residual_writer(g, FALSE), pl->coef[blk], predict_nc(g, addr, bx, by));
+    }
+  }
+}
+
+static void code_mb_cavlc(Generator *g, int addr, MbPlan *pl, int *skip_run)
+{
+  BitWriter *bw = &g->rbsp;
+  GenMb *cur = &g->mb[addr];
+  int i;
+
+  if (pl->kind == MB_SKIP)
+  {
+    ++(*skip_run);
+    return;
+  }
+  if (g->slice_type != I_SLICE)
+  {
+    put_ue(bw, *skip_run);
+    *skip_run = 0;
+  }
+
+  if (pl->kind == MB_IPCM)
+  {
+    put_ue(bw, g->slice_type == I_SLICE ? 25 : g->slice_type == P_SLICE ? 30 : 48);
+    code_pcm(g, pl);
+    memset(cur->nz, 16, sizeof(cur->nz));
+    return;
+  }
+  put_ue(bw, pl->mb_type);
+  if (pl->kind == MB_I16)
+  {
+    put_ue(bw, 0);                                        // intra_chroma_pred_mode DC
+    put_se(bw, 0);                                        // mb_qp_delta
+    cavlc_block(residual_writer(g, TRUE), pl->coef[0], predict_nc(g, addr, 0, 0));   // Intra16x16DCLevel, empty
+    return;
+  }
+
+  if ((g->slice_type == P_SLICE && pl->mb_type == 3) || (g->slice_type == B_SLICE && pl->mb_type == 22))
+  {
+    for (i = 0; i < 4; ++i)
+      put_ue(bw, pl->sub_type[i]);
+  }
+  code_mvds(g, addr, pl);
+  put_ue(bw, g->inter_cbp_code[pl->cbp]);
+  if (pl->cbp)
+  {
+    put_se(bw, 0);
+    code_residual(g, addr, pl);
+  }
+}
+
+static void cabac_mb_type(Generator *g, int addr, MbPlan *pl)
+{
+  CabacEncoder *ce = &g->ce;
+  MotionInfoContexts *mc = g->ctx_slice->mot_ctx;
+  GenMb *left = mb_left(g, addr), *up = mb_up(g, addr);
+  int m = pl->mb_type;
+
+  if (g->slice_type == I_SLICE)
+  {
+    BiContextType *c = mc->mb_type_contexts[0];
+    // I16 and I_PCM neighbours only
+    cabac_encode(ce, &c[(left != NULL) + (up != NULL)], 1);
+    cabac_terminate(ce, pl->kind == MB_IPCM);
+    if (pl->kind == MB_IPCM)
+      return;
+    cabac_encode(ce, &c[4], 0);                       // no luma AC
+    cabac_encode(ce, &c[5], 0);                       // chroma cbp 0
+    cabac_encode(ce, &c[7], 1);                       // pred mode 2 (DC)
+    cabac_encode(ce, &c[8], 0);
+  }
+  else if (g->slice_type == P_SLICE)
+  {
+    BiContextType *c = mc->mb_type_contexts[1];
+    if (pl->kind == MB_IPCM)
+    {
+      cabac_encode(ce, &c[4], 1);
+      cabac_encode(ce, &c[7], 1);
+      cabac_terminate(ce, 1);
+      return;
+    }
+    cabac_encode(ce, &c[4], 0);
+    if (m == 0 || m == 3)
+    {
+      cabac_encode(ce, &c[5], 0);
+      cabac_encode(ce, &c[6], m == 3);
+    }
+    else
+    {
+      cabac_encode(ce, &c[5], 1);
+      cabac_encode(ce, &c[7], m == 1);
+    }
+  }
+  else
+  {
+    BiContextType *c = mc->mb_type_contexts[2];
+    int a = (left != NULL && !left->direct), b = (up != NULL && !up->direct);
+    int bits, v;
+
+    cabac_encode(ce, &c[a + b], pl->kind == MB_IPCM || m != 0);
+    if (pl->kind != MB_IPCM && m == 0)
+      return;
+    if (pl->kind != MB_IPCM && m <= 2)
+    {
+      cabac_encode(ce, &c[4], 0);
+      cabac_encode(ce, &c[6], m == 2);
+      return;
+    }
+    cabac_encode(ce, &c[4], 1);
+    if (pl->kind != MB_IPCM && m <= 10)
+    {
+      v = m - 3;
+      cabac_encode(ce, &c[5], 0);
+      cabac_encode(ce, &c[6], (v >> 2) & 1);
+      cabac_encode(ce, &c[6], (v >> 1) & 1);
+      cabac_encode(ce, &c[6], v & 1);
+      return;
+    }
+    cabac_encode(ce, &c[5], 1);
+    bits = pl->kind == MB_IPCM ? 5 : m == 11 ? 6 : m == 22 ? 7 : (m - 12) >> 1;
+    cabac_encode(ce, &c[6], (bits >> 2) & 1);
+    cabac_encode(ce, &c[6], (bits >> 1) & 1);
+    cabac_encode(ce, &c[6], bits & 1);
+    if (pl->kind == MB_IPCM)
+    {
+      cabac_encode(ce, &c[6], 1);                     // not I_NxN
+      cabac_terminate(ce, 1);
+    }
+    else if (bits < 5)
+      cabac_encode(ce, &c[6], (m - 12) & 1);
+  }
+}
+
+static void cabac_sub_type(Generator *g, int s)
+{
+  CabacEncoder *ce = &g->ce;
+
+  if (g->slice_type == P_SLICE)
+  {
+    BiContextType *c = g->ctx_slice->mot_ctx->b8_type_contexts[0];
+    cabac_encode(ce, &c[1], s == 0);
+    if (s == 0)
+      return;
+    cabac_encode(ce, &c[3], s != 1);
+    if (s != 1)
+      cabac_encode(ce, &c[4], s == 2);
+  }
+  else
+  {
+    BiContextType *c = g->ctx_slice->mot_ctx->b8_type_contexts[1];
+    cabac_encode(ce, &c[0], s != 0);
+    if (s == 0)
+      return;
+    if (s <= 2)
+    {
+      cabac_encode(ce, &c[1], 0);
+      cabac_encode(ce, &c[3], s == 2);
+      return;
+    }
+    cabac_encode(ce, &c[1], 1);
+    if (s <= 6)
+    {
+      cabac_encode(ce, &c[2], 0);
+      cabac_encode(ce, &c[3], ((s - 3) >> 1) & 1);
+      cabac_encode(ce, &c[3], (s - 3) & 1);
+    }
+    else if (s <= 10)
+    {
+      cabac_encode(ce, &c[2], 1);
+      cabac_encode(ce, &c[3], 0);
+      cabac_encode(ce, &c[3], ((s - 7) >> 1) & 1);
+      cabac_encode(ce, &c[3], (s - 7) & 1);
+    }
+    else
+    {
+      cabac_encode(ce, &c[2], 1);
+      cabac_encode(ce, &c[3], 1);
+      cabac_encode(ce, &c[3], s - 11);
+    }
+  }
+}
+
+static void cabac_cbp(Generator *g, int addr, int cbp)
+{
+  TextureInfoContexts *tex = g->ctx_slice->tex_ctx;
+  GenMb *left = mb_left(g, addr), *up = mb_up(g, addr);
+  int b8, a, b;
+
+  for (b8 = 0; b8 < 4; ++b8)
+  {
+    if (b8 < 2)
+      b = (up != NULL && up->kind != MB_IPCM && !(up->cbp & (1 << (b8 + 2)))) ? 2 : 0;
+    else
+      b = (cbp & (1 << (b8 - 2))) ? 0 : 2;
+    if (b8 & 1)
+      a = (cbp & (1 << (b8 - 1))) ? 0 : 1;
+    else
+      a = (left != NULL && left->kind != MB_IPCM && !(left->cbp & (1 << (b8 + 1)))) ? 1 : 0;
+    cabac_encode(&g->ce, tex->cbp_contexts[0] + a + b, (cbp >> b8) & 1);
+  }
+  a = (left != NULL && (left->kind == MB_IPCM || left->cbp > 15));
+  b = (up   != NULL && (up->kind   == MB_IPCM || up->cbp   > 15)) ? 2 : 0;
+  cabac_encode(&g->ce, tex->cbp_contexts[1] + a + b, 0);
+}
+
+static void code_mb_cabac(Generator *g, int addr, MbPlan *pl)
+{
+  CabacEncoder *ce = &g->ce;
+  MotionInfoContexts *mc = g->ctx_slice->mot_ctx;
+  TextureInfoContexts *tex = g->ctx_slice->tex_ctx;
+  GenMb *left = mb_left(g, addr), *up = mb_up(g, addr);
+  int i;
+
+  if (g->slice_type != I_SLICE)
+  {
+    int a = (left != NULL && left->kind != MB_SKIP), b = (up != NULL && up->kind != MB_SKIP);
+    cabac_encode(ce, g->slice_type == P_SLICE ? &mc->mb_type_contexts[1][a + b] : &mc->mb_type_contexts[2][7 + a + b], pl->kind == MB_SKIP);
+    if (pl->kind == MB_SKIP)
+      return;
+  }
+
+  cabac_mb_type(g, addr, pl);
+  if (pl->kind == MB_IPCM)
+  {
+    code_pcm(g, pl);
+    cabac_start(ce, &g->rbsp);
+    return;
+  }
+  if (pl->kind == MB_I16)
+  {
+    int upper = up   != NULL ? (up->kind   == MB_IPCM ? 1 : up->cbf & 1)   : 1;
+    int lft   = left != NULL ? (left->kind == MB_IPCM ? 1 : left->cbf & 1) : 1;
+    cabac_encode(ce, tex->cipr_contexts, 0);          // intra_chroma_pred_mode DC
+    cabac_encode(ce, mc->delta_qp_contexts, 0);       // mb_qp_delta 0
+    cabac_encode(ce, tex->bcbp_contexts[CTX_BCBP_16DC] + 2 * upper + lft, 0);
+    return;
+  }
+
+  if ((g->slice_type == P_SLICE && pl->mb_type == 3) || (g->slice_type == B_SLICE && pl->mb_type == 22))
+  {
+    for (i = 0; i < 4; ++i)
+      cabac_sub_type(g, pl->sub_type[i]);
+  }
+  code_mvds(g, addr, pl);
+  cabac_cbp(g, addr, pl->cbp);
+  if (pl->cbp)
+  {
+    cabac_encode(ce, mc->delta_qp_contexts, 0);
+    code_residual(g, addr, pl);
+  }
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    NAL units
+ ************************************************************************
+ */
+static void write_nal(Generator *g, BitWriter *bw, int ref_idc, int type, int long_start)
+{
+  static const byte start_code[4] = { 0, 0, 0, 1 };
+  byte *out = (byte *) malloc(bw->len + bw->len / 2 + 8);
+  int i, n = 0, zeros = 0;
+
+  if (out == NULL)
+    no_mem_exit("h264gen: NAL unit");
+  memcpy(out, start_code + !long_start, 4 - !long_start);
+  n = 4 - !long_start;
+  out[n++] = (byte) ((ref_idc << 5) | type);
+  for (i = 0; i < bw->len; ++i)
+  {
+    if (zeros == 2 && bw->buf[i] <= 3)
+    {
+      out[n++] = 3;
+      zeros = 0;
+      ++g->st.ep_bytes;
+    }
+    zeros = bw->buf[i] ? 0 : zeros + 1;
+    out[n++] = bw->buf[i];
+  }
+  if (fwrite(out, 1, n, g->f) != (size_t) n)
+  {
+    fprintf(stderr, "h264gen: cannot write %s\n", g->p.out);
+    exit(1);
+  }
+  g->st.bytes += n;
+  free(out);
+  bw->len  = 0;
+  bw->bits = 0;
+}
+
+static void write_parameter_sets(Generator *g)
+{
+  BitWriter *bw = &g->rbsp;
+  int mbs = g->mb_w * g->mb_h;
+  int crop_x = 16 * g->mb_w - g->p.width, crop_y = 16 * g->mb_h - g->p.height;
+
+  put_bits(bw, 8, g->p.dp ? 88 : 77);                   // profile_idc Extended / Main
+  put_bits(bw, 8, 0);                                    // constraint flags
+  put_bits(bw, 8, mbs <= 1620 ? 31 : mbs <= 8192 ? 40 : mbs <= 36864 ? 51 : 61);
+  put_ue(bw, 0);                                         // seq_parameter_set_id
+  put_ue(bw, 12);                                        // log2_max_frame_num_minus4
+  put_ue(bw, 0);                                         // pic_order_cnt_type
+  put_ue(bw, 12);                                        // log2_max_pic_order_cnt_lsb_minus4
+  put_ue(bw, 2);                                         // max_num_ref_frames
+  put_bits(bw, 1, 0);                                    // gaps_in_frame_num_value_allowed_flag
+  put_ue(bw, g->mb_w - 1);
+  put_ue(bw, g->mb_h - 1);
+  put_bits(bw, 1, 1);                                    // frame_mbs_only_flag
+  put_bits(bw, 1, 1);                                    // direct_8x8_inference_flag
+  put_bits(bw, 1, crop_x || crop_y);
+  if (crop_x || crop_y)
+  {
+    put_ue(bw, 0);
+    put_ue(bw, crop_x >> 1);
+    put_ue(bw, 0);
+    put_ue(bw, crop_y >> 1);
+  }
+  put_bits(bw, 1, 0);                                    // vui_parameters_present_flag
+  put_trailing_bits(bw);
+  write_nal(g, bw, 3, NALU_TYPE_SPS, 1);
+
+  put_ue(bw, 0);                                         // pic_parameter_set_id
+  put_ue(bw, 0);                                         // seq_parameter_set_id
+  put_bits(bw, 1, g->p.cabac);
+  put_bits(bw, 1, 0);                                    // bottom_field_pic_order_in_frame_present_flag
+  put_ue(bw, 0);                                         // num_slice_groups_minus1
+  put_ue(bw, 0);                                         // num_ref_idx_l0_default_active_minus1
+  put_ue(bw, 0);                                         // num_ref_idx_l1_default_active_minus1
+  put_bits(bw, 1, 0);                                    // weighted_pred_flag
+  put_bits(bw, 2, 0);                                    // weighted_bipred_idc
+  put_se(bw, 0);                                         // pic_init_qp_minus26
+  put_se(bw, 0);                                         // pic_init_qs_minus26
+  put_se(bw, 0);                                         // chroma_qp_index_offset
+  put_bits(bw, 1, 1);                                    // deblocking_filter_control_present_flag
+  put_bits(bw, 1, 0);                                    // constrained_intra_pred_flag
+  put_bits(bw, 1, 0);                                    // redundant_pic_cnt_present_flag
+  put_trailing_bits(bw);
+  write_nal(g, bw, 3, NALU_TYPE_PPS, 1);
+}
+
+static void write_slice(Generator *g, int first_mb, int end_mb, int idr, int frame_num, int poc_lsb, int idr_id)
+{
+  BitWriter *bw = &g->rbsp;
+  int ref_idc = (g->slice_type == B_SLICE) ? 0 : 2;
+  int skip_run = 0, addr, k;
+  MbPlan plan;
+
+  g->dp = g->p.dp && !idr;
+  put_ue(bw, first_mb);
+  put_ue(bw, g->slice_type);
+  put_ue(bw, 0);                                         // pic_parameter_set_id
+  put_bits(bw, 16, frame_num);
+  if (idr)
+    put_ue(bw, idr_id);
+  put_bits(bw, 16, poc_lsb);
+  if (g->slice_type == B_SLICE)
+    put_bits(bw, 1, 1);                                  // direct_spatial_mv_pred_flag
+  if (g->slice_type != I_SLICE)
+  {
+    put_bits(bw, 1, 0);                                  // num_ref_idx_active_override_flag
+    put_bits(bw, 1, 0);                                  // ref_pic_list_modification_flag_l0
+    if (g->slice_type == B_SLICE)
+      put_bits(bw, 1, 0);                                // ref_pic_list_modification_flag_l1
+  }
+  if (ref_idc)
+  {
+    put_bits(bw, 1, 0);                                  // no_output_of_prior_pics / adaptive_ref_pic_marking_mode
+    if (idr)
+      put_bits(bw, 1, 0);                                // long_term_reference_flag
+  }
+  if (g->p.cabac && g->slice_type != I_SLICE)
+    put_ue(bw, 0);                                       // cabac_init_idc
+  put_se(bw, g->p.qp - 26);
+  put_ue(bw, 1);                                         // disable_deblocking_filter_idc
+  if (g->dp)
+  {
+    put_ue(bw, g->slice_id);
+    for (k = 0; k < 2; ++k)
+    {
+      put_ue(&g->part[k], g->slice_id);
+      g->part_used[k] = 0;
+    }
+  }
+
+  g->slice_start = first_mb;
+  if (g->p.cabac)
+  {
+    while (bw->bits)
+      put_bits(bw, 1, 1);                                // cabac_alignment_one_bit
+    g->ctx_slice->slice_type   = g->slice_type;
+    g->ctx_slice->qp           = g->p.qp;
+    g->ctx_slice->model_number = 0;
+    init_contexts(g->ctx_slice);
+    cabac_start(&g->ce, bw);
+  }
+
+  for (addr = first_mb; addr < end_mb; ++addr)
+  {
+    GenMb *cur = &g->mb[addr];
+    int start = bw->len;
+
+    plan_mb(g, &plan);
+    memset(cur, 0, sizeof(GenMb));
+    cur->kind   = plan.kind;
+    cur->direct = (g->slice_type == B_SLICE) && (plan.kind == MB_SKIP || (plan.kind == MB_INTER && plan.mb_type == 0));
+    cur->cbp    = plan.cbp;
+
+    if (g->p.cabac)
+    {
+      code_mb_cabac(g, addr, &plan);
+      cabac_terminate(&g->ce, addr + 1 == end_mb);     // end_of_slice_flag
+    }
+    else
+      code_mb_cavlc(g, addr, &plan, &skip_run);
+
+    ++g->st.mbs[plan.kind];
+    g->st.direct += cur->direct && plan.kind == MB_INTER;
+    if (plan.kind == MB_INTER)
+      g->st.key_units += plan_key_units(&plan);
+    if (plan.kind != MB_IPCM)
+      g->ep_debt += bw->len - start;
+  }
+
+  if (g->p.cabac)
+    put_align_zero(bw);
+  else
+  {
+    if (skip_run)
+      put_ue(bw, skip_run);
+    put_trailing_bits(bw);
+  }
+  if (g->dp)
+  {
+    // B and C only when they hold residual, the decoder takes them as missing otherwise
+    write_nal(g, bw, ref_idc, NALU_TYPE_DPA, first_mb == 0);
+    for (k = 0; k < 2; ++k)
+    {
+      if (g->part_used[k])
+      {
+        put_trailing_bits(&g->part[k]);
+        write_nal(g, &g->part[k], ref_idc, k ? NALU_TYPE_DPC : NALU_TYPE_DPB, 0);
+        ++g->st.partitions[k];
+      }
+      else
+        g->part[k].len = g->part[k].bits = 0;
+    }
+  }
+  else
+    write_nal(g, bw, ref_idc, idr ? NALU_TYPE_IDR : NALU_TYPE_SLICE, first_mb == 0);
+  ++g->st.slices;
+}
+
+static void write_picture(Generator *g, int slice_type, int idr, int frame_num, int poc_lsb, int idr_id)
+{
+  int mbs = g->mb_w * g->mb_h, s;
+
+  g->slice_type = slice_type;
+  for (s = 0; s < g->p.slices; ++s)
+  {
+    g->slice_id = s;
+    write_slice(g, (int) ((int64) s * mbs / g->p.slices), (int) ((int64) (s + 1) * mbs / g->p.slices), idr, frame_num, poc_lsb, idr_id);
+  }
+  ++g->st.pictures[slice_type];
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    coding order: IDR, then groups of one P anchor followed by the B
+ *    frames displayed before it; a group cut off by the end of the GOP
+ *    is coded as P frames
+ ************************************************************************
+ */
+static void write_sequence(Generator *g)
+{
+  int gop_start, idr_id = 0;
+  int gop = g->p.idr_period > 0 ? g->p.idr_period : g->p.frames;
+
+  for (gop_start = 0; gop_start < g->p.frames; gop_start += gop, ++idr_id)
+  {
+    int end = imin(gop_start + gop, g->p.frames);
+    int refs = 1, cur = gop_start, d;
+
+    write_parameter_sets(g);
+    write_picture(g, I_SLICE, 1, 0, 0, idr_id & 0xFFFF);
+    while (cur + 1 < end)
+    {
+      int anchor = cur + g->p.bframes + 1;
+
+      if (anchor >= end)
+      {
+        for (d = cur + 1; d < end; ++d, ++refs)
+          write_picture(g, P_SLICE, 0, refs & 0xFFFF, (2 * (d - gop_start)) & 0xFFFF, 0);
+        break;
+      }
+      write_picture(g, P_SLICE, 0, refs & 0xFFFF, (2 * (anchor - gop_start)) & 0xFFFF, 0);
+      ++refs;
+      for (d = cur + 1; d < anchor; ++d)
+        write_picture(g, B_SLICE, 0, refs & 0xFFFF, (2 * (d - gop_start)) & 0xFFFF, 0);
+      cur = anchor;
+    }
+  }
+}
+
+static void usage(void)
+{
+  printf("usage: h264gen.exe [-o out.264] [-s WxH] [-n frames] [-S slices]\n"
+         "                   [-b bframes] [-g idr_period] [-c 0|1] [-q qp]\n"
+         "                   [-k skip%%] [-d direct%%] [-p w16x16,w16x8,w8x16,w8x8]\n"
+         "                   [-P w8x8,w8x4,w4x8,w4x4] [-m zero|uniform:N|laplace:M]\n"
+         "                   [-r cbp%%,coeffs] [-e bytes] [-D 0|1] [-x seed]\n");
+  exit(1);
+}
+
+static void parse_weights(const char *s, int w[4])
+{
+  if (sscanf(s, "%d,%d,%d,%d", &w[0], &w[1], &w[2], &w[3]) != 4 || w[0] < 0 || w[1] < 0 || w[2] < 0 || w[3] < 0
+    || w[0] + w[1] + w[2] + w[3] == 0)
+    usage();
+}
+
+static void parse_args(GenParam *p, int argc, char **argv)
+{
+  int i;
+
+  strcpy(p->out, "synth.264");
+  p->width      = 352;
+  p->height     = 288;
+  p->frames     = 30;
+  p->slices     = 1;
+  p->bframes    = 2;
+  p->cabac      = 1;
+  p->qp         = 28;
+  p->skip_pct   = 10;
+  p->direct_pct = 10;
+  p->part_w[0]  = 4; p->part_w[1] = 2; p->part_w[2] = 2; p->part_w[3] = 1;
+  p->sub_w[0]   = 4; p->sub_w[1]  = 1; p->sub_w[2]  = 1; p->sub_w[3]  = 1;
+  p->mvd_mode   = MVD_LAPLACE;
+  p->mvd_scale  = 4.0;
+  p->cbp_pct    = 25;
+  p->coeff_mean = 2.0;
+  p->seed       = 1;
+
+  for (i = 1; i < argc; i += 2)
+  {
+    const char *v = argv[i + 1];
+
+    if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0' || i + 1 >= argc)
+      usage();
+    switch (argv[i][1])
+    {
+    case 'o': strncpy(p->out, v, FILE_NAME_SIZE - 1); break;
+    case 's': if (sscanf(v, "%dx%d", &p->width, &p->height) != 2) usage(); break;
+    case 'n': p->frames     = atoi(v); break;
+    case 'S': p->slices     = atoi(v); break;
+    case 'b': p->bframes    = atoi(v); break;
+    case 'g': p->idr_period = atoi(v); break;
+    case 'c': p->cabac      = atoi(v) != 0; break;
+    case 'q': p->qp         = atoi(v); break;
+    case 'k': p->skip_pct   = atoi(v); break;
+    case 'd': p->direct_pct = atoi(v); break;
+    case 'p': parse_weights(v, p->part_w); break;
+    case 'P': parse_weights(v, p->sub_w); break;
+    case 'm':
+      if (strcmp(v, "zero") == 0)
+        p->mvd_mode = MVD_ZERO;
+      else if (sscanf(v, "uniform:%lf", &p->mvd_scale) == 1)
+        p->mvd_mode = MVD_UNIFORM;
+      else if (sscanf(v, "laplace:%lf", &p->mvd_scale) == 1)
+        p->mvd_mode = MVD_LAPLACE;
+      else
+        usage();
+      break;
+    case 'r': if (sscanf(v, "%d,%lf", &p->cbp_pct, &p->coeff_mean) != 2) usage(); break;
+    case 'e': p->ep_interval = atoi(v); break;
+    case 'D': p->dp         = atoi(v) != 0; break;
+    case 'x': p->seed       = (uint32) strtoul(v, NULL, 0); break;
+    default:  usage();
+    }
+  }
+
+  if (p->width < 16 || p->height < 16 || (p->width & 1) || (p->height & 1) || p->frames < 1 || p->slices < 1
+    || p->bframes < 0 || p->idr_period < 0 || p->qp < 0 || p->qp > 51 || p->mvd_scale < 0 || p->coeff_mean < 0
+    || (p->dp && p->cabac))
+  {
+    fprintf(stderr, "h264gen: invalid parameters\n");
+    usage();
+  }
+}
+
+int main(int argc, char **argv)
+{
+  Generator g;
+  int n;
+
+  memset(&g, 0, sizeof(Generator));
+  parse_args(&g.p, argc, argv);
+  rnd_state = g.p.seed ? g.p.seed : 1;
+
+  g.mb_w = (g.p.width + 15) >> 4;
+  g.mb_h = (g.p.height + 15) >> 4;
+  g.p.slices = imin(g.p.slices, g.mb_w * g.mb_h);
+  for (n = 0; n < 48; ++n)
+    if (NCBP[1][n][1] < 16)
+      g.inter_cbp_code[NCBP[1][n][1]] = (byte) n;
+
+  if ((g.mb = (GenMb *) calloc(g.mb_w * g.mb_h, sizeof(GenMb))) == NULL
+    || (g.ctx_slice = (Slice *) calloc(1, sizeof(Slice))) == NULL
+    || (g.ctx_slice->mot_ctx = (MotionInfoContexts *) calloc(1, sizeof(MotionInfoContexts))) == NULL
+    || (g.ctx_slice->tex_ctx = (TextureInfoContexts *) calloc(1, sizeof(TextureInfoContexts))) == NULL)
+    no_mem_exit("h264gen: picture state");
+  if ((g.f = fopen(g.p.out, "wb")) == NULL)
+  {
+    fprintf(stderr, "h264gen: cannot open %s\n", g.p.out);
+    return 1;
+  }
+
+  write_sequence(&g);
+  fclose(g.f);
+
+  printf("%s: %dx%d %s, %d pictures (I %d, P %d, B %d), %d slices/picture\n", g.p.out, g.p.width, g.p.height,
+    g.p.cabac ? "CABAC" : "CAVLC", g.st.pictures[I_SLICE] + g.st.pictures[P_SLICE] + g.st.pictures[B_SLICE],
+    g.st.pictures[I_SLICE], g.st.pictures[P_SLICE], g.st.pictures[B_SLICE], g.p.slices);
+  printf("bytes: %lld, emulation prevention bytes: %lld\n", (long long) g.st.bytes, (long long) g.st.ep_bytes);
+  printf("macroblocks: skip %lld, inter %lld (direct %lld), I16 %lld, I_PCM %lld\n", (long long) g.st.mbs[MB_SKIP],
+    (long long) g.st.mbs[MB_INTER], (long long) g.st.direct, (long long) g.st.mbs[MB_I16], (long long) g.st.mbs[MB_IPCM]);
+  if (g.p.dp)
+    printf("data partitions: B %lld, C %lld\n", (long long) g.st.partitions[0], (long long) g.st.partitions[1]);
+  printf("expected key units: %lld\n", (long long) g.st.key_units);
+
+  free(g.ctx_slice->mot_ctx);
+  free(g.ctx_slice->tex_ctx);
+  free(g.ctx_slice);
+  free(g.mb);
+  free(g.rbsp.buf);
+  free(g.part[0].buf);
+  free(g.part[1].buf);
+  return 0;
+}
@@ -0,0 +1,756 @@
+
+/*!
+ ***********************************************************************
+ *  \file
+ *     kernel_bench.c
+ *  \brief
+ *     Microbenchmarks of the hot decoder/key kernels on inputs taken
+ *     from a real stream.
+ *
+ *     usage: kernel_bench.exe file.264 [repeats]
+ *
+ *     The stream is copied to a scratch file and decoded once to record
+ *     its key units. The kernels then run in isolation:
+ *       - get_annex_b_NALU over the whole file
+ *       - EBSPtoRBSP over every NAL unit
+ *       - read_ue_v (GetVLCSymbol) over the slice RBSPs
+ *       - readSyntaxElement_NumCoeffTrailingOnes over coeff_token codes
+ *         built from the standard tables (random bits are not valid codes)
+ *       - biari_decode_symbol over the CABAC slice RBSPs, cycling through
+ *         the residual contexts (bins are not syntax driven)
+ *       - init_contexts for every slice type / model / QP
+ *       - the MBAFF field mode lookahead at the top MB of every pair
+ *         (check_next_mb_and_get_field_mode_CABAC_p_slice/_b_slice),
+ *         on a picture of the stream's size with a random mix of frame
+ *         and field pairs, the engine reading the CABAC slice RBSPs
+ *       - Generate_Key (Encrypt) over the recorded key units
+ *       - the per picture reset of the CAVLC neighbour state of a 4K
+ *         picture, the bulk nz_coeff / intra_block clear against the
+ *         epoch bump (init_picture), each followed by the writes the
+ *         parser makes to every MB, see bench_picture_reset()
+ *       - the neighbour reads of mb_data and nz_coeff over an 8K
+ *         picture, with the buffers from malloc and from a MemArena
+ *         with transparent huge pages, see bench_arena_walk()
+ *     For each kernel ns/op and TSC ticks/op are reported as mean and
+ *     standard deviation over the repeats.
+ ***********************************************************************
+ */
+
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "global.h"
+#include "h264decoder.h"
+#include "annexb.h"
+#include "vlc.h"
+#include "biaridecod.h"
+#include "context_ini.h"
+#include "memalloc.h"
+#include "keyunit.h"
+#include "iobackend.h"
+#include "cabac.h"
+#include "mb_access.h"
+
+#define DEFAULT_REPEATS   10
+#define MAX_BENCH_NALUS   100000
+#define NUMCOEFF_CODES    (1 << 20)
+#define BUFFER_PAD        8       //!< lookahead slack after every buffer, filled with 0xFF
+
+typedef struct bench_nalu
+{
+  byte *ebsp;          //!< NAL unit as read from the file (header byte included)
+  byte *rbsp;          //!< after EBSPtoRBSP
+  int   ebsp_len;
+  int   rbsp_len;
+  int   type;
+} BenchNalu;
+
+typedef struct bench_result
+{
+  const char *name;
+  int         repeats;
+  int64       ops;          //!< operations per repeat
+  double      ns[64];
+  double      ticks[64];
+} BenchResult;
+
+static BenchNalu nalus[MAX_BENCH_NALUS];
+static int       nalu_count;
+static int       cabac_stream;
+
+static double now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static inline uint64 ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+static void copy_file(const char *src, const char *dst)
+{
+  static byte buf[1 << 16];
+  int in = open(src, O_RDONLY), out = open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  ssize_t n;
+
+  if (in < 0 || out < 0)
+  {
+    fprintf(stderr, "kernel_bench: cannot copy %s to %s\n", src, dst);
+    exit(1);
+  }
+  while ((n = read(in, buf, sizeof(buf))) > 0)
+  {
+    if (write(out, buf, n) != n)
+    {
+      fprintf(stderr, "kernel_bench: write to %s failed\n", dst);
+      exit(1);
+    }
+  }
+  close(in);
+  close(out);
+}
+
+static byte *padded_copy(const byte *src, int len)
+{
+  byte *p = (byte *) malloc(len + BUFFER_PAD);
+  if (p == NULL)
+    no_mem_exit("padded_copy");
+  memcpy(p, src, len);
+  memset(p + len, 0xFF, BUFFER_PAD);
+  return p;
+}
+
+static void report(BenchResult *r)
+{
+  double mean = 0, var = 0, tmean = 0, tvar = 0, best = 1e30;
+  int i;
+
+  for (i = 0; i < r->repeats; ++i)
+  {
+    r->ns[i]    /= r->ops;
+    r->ticks[i] /= r->ops;
+    mean  += r->ns[i];
+    tmean += r->ticks[i];
+    best   = dmin(best, r->ns[i]);
+  }
+  mean  /= r->repeats;
+  tmean /= r->repeats;
+  for (i = 0; i < r->repeats; ++i)
+  {
+    var  += (r->ns[i] - mean) * (r->ns[i] - mean);
+    tvar += (r->ticks[i] - tmean) * (r->ticks[i] - tmean);
+  }
+  var  /= imax(r->repeats - 1, 1);
+  tvar /= imax(r->repeats - 1, 1);
+
+  printf("%-34s %10lld ops %10.2f ns/op (sd %6.2f, min %10.2f) %10.1f ticks/op (sd %6.1f)\n",
+    r->name, (long long) r->ops, mean, sqrt(var), best, tmean, sqrt(tvar));
+}
+
+#define BENCH_BEGIN()  double t0 = now_ns(); uint64 c0 = ticks()
+#define BENCH_END(r, i) do { (r)->ticks[i] = (double) (ticks() - c0); (r)->ns[i] = now_ns() - t0; } while (0)
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Decode the stream once with key recording on
+ ************************************************************************
+ */
+static void record_key_units(char *path)
+{
+  InputParameters inp;
+  int ret;
+
+  memset(&inp, 0, sizeof(InputParameters));
+  snprintf(inp.infile, FILE_NAME_SIZE, "%s", path);
+  inp.enable_key = 1;
+  inp.silent     = 1;
+#if (MVC_EXTENSION_ENABLE)
+  inp.DecodeAllLayers = 1;
+#endif
+
+  if (OpenDecoder(&inp) != DEC_OPEN_NOERR)
+  {
+    fprintf(stderr, "kernel_bench: cannot open %s\n", path);
+    exit(1);
+  }
+  if ((p_Dec->nalu_pos_array = calloc(NALU_NUM_IN_BITSTREAM, sizeof(int))) == NULL)
+    no_mem_exit("record_key_units: nalu_pos_array");
+  init_key_unit_buffer(&g_KeyUnitBuffer, KEY_UNIT_BUFFER_SIZE);
+
+  do
+  {
+    ret = DecodeOneFrame();
+  } while (ret == DEC_SUCCEED);
+  FinitDecoder();
+}
+
+static void bench_annex_b(char *path, BenchResult *r)
+{
+  ANNEXB_t *annex_b;
+  NALU_t *nalu = p_Dec->p_Vid->nalu;
+  int i, n;
+
+  malloc_annex_b(p_Dec->p_Vid, &annex_b);
+  for (i = 0; i < r->repeats; ++i)
+  {
+    init_annex_b(annex_b);
+    open_annex_b(path, annex_b);
+    {
+      BENCH_BEGIN();
+      for (n = 0; get_annex_b_NALU(p_Dec->p_Vid, nalu, annex_b) > 0; ++n)
+      {
+        if (i == 0 && n < MAX_BENCH_NALUS)
+        {
+          nalus[n].ebsp     = padded_copy(nalu->buf, nalu->len);
+          nalus[n].ebsp_len = nalu->len;
+          nalus[n].type     = nalu->nal_unit_type;
+        }
+      }
+      BENCH_END(r, i);
+    }
+    close_annex_b(annex_b);
+  }
+  free_annex_b(&annex_b);
+
+  nalu_count = imin(n, MAX_BENCH_NALUS);
+  r->ops = n;
+}
+
+static void bench_ebsp(BenchResult *r)
+{
+  int64 bytes = 0;
+  byte **work = (byte **) malloc(nalu_count * sizeof(byte *));
+  int i, n;
+
+  for (n = 0; n < nalu_count; ++n)
+  {
+    work[n] = padded_copy(nalus[n].ebsp, nalus[n].ebsp_len);
+    bytes += nalus[n].ebsp_len;
+  }
+
+  for (i = 0; i < r->repeats; ++i)
+  {
+    for (n = 0; n < nalu_count; ++n)
+      memcpy(work[n], nalus[n].ebsp, nalus[n].ebsp_len);
+    {
+      BENCH_BEGIN();
+      for (n = 0; n < nalu_count; ++n)
+        nalus[n].rbsp_len = EBSPtoRBSP(work[n], nalus[n].ebsp_len, 1);
+      BENCH_END(r, i);
+    }
+  }
+
+  for (n = 0; n < nalu_count; ++n)
+  {
+    memset(work[n] + nalus[n].rbsp_len, 0xFF, BUFFER_PAD);
+    nalus[n].rbsp = work[n];
+  }
+  free(work);
+  r->ops = nalu_count;
+  printf("%d NAL units, %lld bytes\n", nalu_count, (long long) bytes);
+}
+
+static inline int is_slice(int type)
+{
+  return type == NALU_TYPE_SLICE || type == NALU_TYPE_IDR;
+}
+
+static void bench_ue(BenchResult *r)
+{
+  Bitstream bs;
+  int i, n, used = 0;
+  int64 ops = 0;
+  volatile int sink = 0;
+
+  for (i = 0; i < r->repeats; ++i)
+  {
+    BENCH_BEGIN();
+    ops = 0;
+    for (n = 0; n < nalu_count; ++n)
+    {
+      if (!is_slice(nalus[n].type) || nalus[n].rbsp_len < 8)
+        continue;
+      bs.streamBuffer     = nalus[n].rbsp + 1;
+      bs.bitstream_length = nalus[n].rbsp_len - 1;
+      bs.frame_bitoffset  = 0;
+      while (bs.frame_bitoffset < (bs.bitstream_length - 4) * 8)
+      {
+        int start = bs.frame_bitoffset;
+        sink += read_ue_v("bench", &bs, &used);
+        if (bs.frame_bitoffset == start)
+          break;
+        ++ops;
+      }
+    }
+    BENCH_END(r, i);
+  }
+  r->ops = ops;
+}
+
+static void put_bits(byte *buf, int64 *pos, int n, unsigned int v)
+{
+  while (n--)
+  {
+    if ((v >> n) & 1)
+      buf[*pos >> 3] |= (byte) (0x80 >> (*pos & 7));
+    ++(*pos);
+  }
+}
+
+static void bench_numcoeff(BenchResult *r)
+{
+  byte  *buf   = (byte *) calloc(NUMCOEFF_CODES * 2 + BUFFER_PAD, 1);
+  byte  *vlc   = (byte *) malloc(NUMCOEFF_CODES);
+  int64  pos   = 0;
+  uint32 seed  = 12345;
+  SyntaxElement se;
+  Bitstream bs;
+  int i, n;
+
+  if (buf == NULL || vlc == NULL)
+    no_mem_exit("bench_numcoeff");
+
+  // mostly low nC tables and few coefficients, as in inter pictures
+  for (n = 0; n < NUMCOEFF_CODES; ++n)
+  {
+    int tc, t1;
+    seed = seed * 1103515245 + 12345;
+    vlc[n] = (byte) ((seed >> 16) % 10 < 6 ? 0 : (seed >> 16) % 10 < 8 ? 1 : (seed >> 16) % 10 < 9 ? 2 : 3);
+    tc = (int) ((seed >> 8) & 0xFF) < 160 ? (int) ((seed >> 4) & 3) : (int) ((seed >> 4) % 17);
+    t1 = imin(tc, (int) ((seed >> 20) & 3));
+    if (vlc[n] == 3)
+      put_bits(buf, &pos, 6, tc == 0 ? 3 : (unsigned int) (((tc - 1) << 2) | t1));
+    else
+      put_bits(buf, &pos, coeff_token_lentab[vlc[n]][t1][tc], coeff_token_codtab[vlc[n]][t1][tc]);
+  }
+
+  bs.streamBuffer     = buf;
+  bs.bitstream_length = (int) ((pos + 7) >> 3);
+  for (i = 0; i < r->repeats; ++i)
+  {
+    BENCH_BEGIN();
+    bs.frame_bitoffset = 0;
+    for (n = 0; n < NUMCOEFF_CODES; ++n)
+    {
+      se.value1 = vlc[n];
+      readSyntaxElement_NumCoeffTrailingOnes(&se, &bs, "bench");
+    }
+    BENCH_END(r, i);
+    if (bs.frame_bitoffset != pos)
+    {
+      fprintf(stderr, "kernel_bench: coeff_token stream out of sync\n");
+      exit(1);
+    }
+  }
+  free(buf);
+  free(vlc);
+  r->ops = NUMCOEFF_CODES;
+}
+
+static void bench_init_contexts(Slice *slice, BenchResult *r)
+{
+  static const int types[2] = { P_SLICE, I_SLICE };
+  int i, t, m, qp;
+  int64 ops = 0;
+
+  for (i = 0; i < r->repeats; ++i)
+  {
+    BENCH_BEGIN();
+    ops = 0;
+    for (t = 0; t < 2; ++t)
+    {
+      slice->slice_type = types[t];
+      for (m = 0; m < (t == 0 ? 3 : 1); ++m)
+      {
+        slice->model_number = m;
+        for (qp = 0; qp < 52; ++qp, ++ops)
+        {
+          slice->qp = qp;
+          init_contexts(slice);
+        }
+      }
+    }
+    BENCH_END(r, i);
+  }
+  r->ops = ops;
+}
+
+static void bench_biari(Slice *slice, BenchResult *r)
+{
+  BiContextType *ctx = (BiContextType *) slice->tex_ctx;
+  int ctx_count = sizeof(TextureInfoContexts) / sizeof(BiContextType);
+  DecodingEnvironment dep;
+  int i, n, len, c;
+  int64 ops = 0;
+  volatile unsigned int sink = 0;
+
+  slice->slice_type = P_SLICE;
+  slice->model_number = 0;
+  slice->qp = 28;
+  for (i = 0; i < r->repeats; ++i)
+  {
+    init_contexts(slice);
+    {
+      BENCH_BEGIN();
+      ops = 0;
+      for (n = 0; n < nalu_count; ++n)
+      {
+        if (!is_slice(nalus[n].type) || nalus[n].rbsp_len < 16)
+          continue;
+        // the slice header is a few bytes, start the engine past it
+        arideco_start_decoding(&dep, nalus[n].rbsp, 8, &len);
+        for (c = 0; len < nalus[n].rbsp_len - 2; ++ops)
+        {
+          sink += biari_decode_symbol(&dep, &ctx[c]);
+          if (++c == ctx_count)
+            c = 0;
+        }
+      }
+      BENCH_END(r, i);
+    }
+  }
+  r->ops = ops;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    The lookahead needs the neighbours of the bottom MB: a synthetic
+ *    MBAFF picture in one slice, field/frame pairs and skipped MBs at
+ *    random. P and B lookaheads alternate, one context is decoded
+ *    between two of them so the engine moves on through the slice.
+ ************************************************************************
+ */
+static void bench_mbaff_lookahead(Slice *slice, BenchResult *r)
+{
+  VideoParameters *vid = (VideoParameters *) calloc(1, sizeof(VideoParameters));
+  StorablePicture *pic = (StorablePicture *) calloc(1, sizeof(StorablePicture));
+  int w = imax((p_Dec->p_Vid->width + 15) >> 4, 2);
+  int pairs = w * imax((p_Dec->p_Vid->height + 31) >> 5, 2);
+  Macroblock *mbs = (Macroblock *) calloc(2 * pairs, sizeof(Macroblock));
+  BlockPos *pos = (BlockPos *) calloc(pairs + 1, sizeof(BlockPos));
+  DataPartition dp;
+  SyntaxElement se;
+  unsigned int seed = 1;
+  int i, n, len, pair;
+  int64 ops = 0;
+  volatile int sink = 0;
+
+  if (vid == NULL || pic == NULL || mbs == NULL || pos == NULL)
+    no_mem_exit("bench_mbaff_lookahead");
+  vid->PicPos = pos;
+  vid->mb_data = mbs;
+  vid->mb_size[IS_LUMA][0] = vid->mb_size[IS_LUMA][1] = MB_BLOCK_SIZE;
+  vid->getNeighbour = getAffNeighbour;
+  vid->get_mb_block_pos = get_mb_block_pos_mbaff;
+  pic->PicWidthInMbs = w;
+  pic->PicSizeInMbs = 2 * pairs;
+  pic->mb_aff_frame_flag = 1;
+  for (i = 0; i < pairs; ++i)
+  {
+    pos[i].x = (short) (i % w);
+    pos[i].y = (short) (i / w);
+    seed = seed * 1103515245 + 12345;
+    mbs[2 * i].mb_field = mbs[2 * i + 1].mb_field = (seed >> 16) & 1;
+    mbs[2 * i].skip_flag = (seed >> 17) & 1;
+    mbs[2 * i + 1].skip_flag = (seed >> 18) & 1;
+  }
+
+  memset(&dp, 0, sizeof(DataPartition));
+  slice->p_Vid = vid;
+  slice->dec_picture = pic;
+  slice->mb_data = mbs;
+  slice->mb_aff_frame_flag = 1;
+  slice->current_slice_nr = 0;
+  slice->slice_type = B_SLICE;
+  slice->model_number = 0;
+  slice->qp = 28;
+  for (i = 0; i < r->repeats; ++i)
+  {
+    init_contexts(slice);
+    {
+      BENCH_BEGIN();
+      ops = 0;
+      for (n = 0; n < nalu_count; ++n)
+      {
+        if (!is_slice(nalus[n].type) || nalus[n].rbsp_len < 16)
+          continue;
+        arideco_start_decoding(&dp.de_cabac, nalus[n].rbsp, 8, &len);
+        for (pair = 0; len < nalus[n].rbsp_len - 2; ++ops)
+        {
+          slice->current_mb_nr = 2 * pair;
+          if (pair & 1)
+            sink += check_next_mb_and_get_field_mode_CABAC_b_slice(slice, &se, &dp);
+          else
+            sink += check_next_mb_and_get_field_mode_CABAC_p_slice(slice, &se, &dp);
+          sink += biari_decode_symbol(&dp.de_cabac, &slice->mot_ctx->mb_aff_contexts[pair & 3]);
+          if (++pair == pairs)
+            pair = 0;
+        }
+      }
+      BENCH_END(r, i);
+    }
+  }
+  r->ops = ops;
+  slice->mb_data = NULL;
+  slice->dec_picture = NULL;
+  slice->p_Vid = NULL;
+  free(pos);
+  free(mbs);
+  free(pic);
+  free(vid);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Per picture reset of nz_coeff and intra_block (constrained intra
+ *    pred) of a 3840x2160 picture: r[0] clears both arrays up front,
+ *    r[1] starts a new epoch and stamps each MB as it is reached. Both
+ *    then write the nz_coeff entries of every MB as the parser does, so
+ *    an op is a picture and the difference is the cost of the reset.
+ ************************************************************************
+ */
+static void bench_picture_reset(BenchResult *r)
+{
+  int mbs = (3840 / MB_BLOCK_SIZE) * (2160 / MB_BLOCK_SIZE);
+  int pictures = 64;
+  byte ****nz_coeff;
+  char *intra_block = (char *) malloc(mbs);
+  int *nz_epoch = (int *) calloc(mbs, sizeof(int));
+  int epoch = 0;
+  int i, k, pic, mb;
+
+  if (intra_block == NULL || nz_epoch == NULL)
+    no_mem_exit("bench_picture_reset");
+  get_mem4D(&nz_coeff, mbs, 3, BLOCK_SIZE, BLOCK_SIZE);
+  for (k = 0; k < 2; ++k)
+  {
+    for (i = 0; i < r[k].repeats; ++i)
+    {
+      BENCH_BEGIN();
+      for (pic = 0; pic < pictures; ++pic)
+      {
+        if (k == 0)
+        {
+          memset(nz_coeff[0][0][0], -1, mbs * 48 * sizeof(byte));
+          for (mb = 0; mb < mbs; ++mb)
+            intra_block[mb] = 1;
+        }
+        else
+          ++epoch;
+        for (mb = 0; mb < mbs; ++mb)
+        {
+          if (k == 1)
+          {
+            nz_epoch[mb] = epoch;
+            intra_block[mb] = 1;
+          }
+          memset(nz_coeff[mb][0][0], pic & 15, 3 * BLOCK_PIXELS * sizeof(byte));
+        }
+      }
+      BENCH_END(&r[k], i);
+    }
+    r[k].ops = pictures;
+  }
+  printf("picture reset: %d MBs, bulk clear %d bytes, epoch stamps %d bytes per picture\n",
+    mbs, mbs * (48 + 1), mbs * (int) (sizeof(int) + 1));
+  free_mem4D(nz_coeff);
+  free(nz_epoch);
+  free(intra_block);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    kB of anonymous memory the process has backed with huge pages
+ ************************************************************************
+ */
+static long anon_huge_kb(void)
+{
+  FILE *f = fopen("/proc/self/smaps_rollup", "r");
+  char line[256];
+  long kb = -1;
+
+  if (f == NULL)
+    return -1;
+  while (fgets(line, sizeof(line), f))
+  {
+    if (sscanf(line, "AnonHugePages: %ld", &kb) == 1)
+      break;
+  }
+  fclose(f);
+  return kb;
+}
+
+static void arena_walk(Macroblock *mb_data, byte ****nz_coeff, int w, int mbs, BenchResult *r, int i)
+{
+  volatile int sink = 0;
+  int mb;
+
+  {
+    BENCH_BEGIN();
+    for (mb = w + 1; mb < mbs; ++mb)
+    {
+      // what CheckAvailabilityOfNeighbors() and predict_nnz() read of the left and top MB
+      int pred = 0;
+      if (mb_data[mb - 1].slice_nr == mb_data[mb].slice_nr)
+        pred += nz_coeff[mb - 1][0][0][3];
+      if (mb_data[mb - w].slice_nr == mb_data[mb].slice_nr)
+        pred += nz_coeff[mb - w][0][3][0];
+      nz_coeff[mb][0][0][0] = (byte) pred;
+      mb_data[mb].cbp = pred;
+      sink += pred;
+    }
+    BENCH_END(r, i);
+  }
+  r->ops = mbs - w - 1;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    The neighbour reads of the parser over the mb_data and nz_coeff
+ *    of a 7680x4320 picture: r[0] with the buffers from calloc and
+ *    get_mem4D, r[1] from a MemArena with transparent huge pages (the
+ *    TLB reach a walk over mb_data needs is the point). An op is an MB.
+ ************************************************************************
+ */
+static void bench_arena_walk(BenchResult *r)
+{
+  int w = 7680 / MB_BLOCK_SIZE;
+  int mbs = w * (4320 / MB_BLOCK_SIZE);
+  Macroblock *mb_data = (Macroblock *) calloc(mbs, sizeof(Macroblock));
+  byte ****nz_coeff;
+  MemArena arena;
+  long huge_kb = anon_huge_kb();
+  int i;
+
+  if (mb_data == NULL)
+    no_mem_exit("bench_arena_walk");
+  get_mem4D(&nz_coeff, mbs, 3, BLOCK_SIZE, BLOCK_SIZE);
+  for (i = 0; i < r[0].repeats; ++i)
+    arena_walk(mb_data, nz_coeff, w, mbs, &r[0], i);
+  free_mem4D(nz_coeff);
+  free(mb_data);
+
+  init_mem_arena(&arena, MEM_HUGE_PAGES_THP);
+  mb_data = (Macroblock *) arena_calloc(&arena, mbs, sizeof(Macroblock), MEM_MB_DATA);
+  get_mem4D_arena(&arena, &nz_coeff, mbs, 3, BLOCK_SIZE, BLOCK_SIZE, MEM_CAVLC);
+  for (i = 0; i < r[1].repeats; ++i)
+    arena_walk(mb_data, nz_coeff, w, mbs, &r[1], i);
+  printf("arena walk: %d MBs, %lld bytes mapped, %ld kB backed by huge pages\n",
+    mbs, (long long) arena.mapped, huge_kb < 0 ? -1 : anon_huge_kb() - huge_kb);
+  free_mem_arena(&arena);
+}
+
+static void bench_generate_key(const char *scratch, const char *work, BenchResult *r)
+{
+  int i;
+
+  for (i = 0; i < r->repeats; ++i)
+  {
+    copy_file(scratch, work);
+    p_Dec->BitStreamFile = open(work, O_RDWR);
+    p_Dec->p_KeyFile = tmpfile();
+    if (p_Dec->BitStreamFile < 0 || p_Dec->p_KeyFile == NULL)
+    {
+      fprintf(stderr, "kernel_bench: cannot open %s\n", work);
+      exit(1);
+    }
+    p_Dec->key_io = io_open(p_Dec->BitStreamFile, IO_BACKEND_PREAD, 1, 0);
+    {
+      BENCH_BEGIN();
+      Encrypt(&g_KeyUnitBuffer);
+      BENCH_END(r, i);
+    }
+    io_close(p_Dec->key_io);
+    p_Dec->key_io = NULL;
+    close(p_Dec->BitStreamFile);
+    fclose(p_Dec->p_KeyFile);
+  }
+  r->ops = g_KeyUnitBuffer.count;
+}
+
+int main(int argc, char **argv)
+{
+  int repeats = argc > 2 ? imin(imax(atoi(argv[2]), 1), 64) : DEFAULT_REPEATS;
+  char scratch[FILE_NAME_SIZE], work[FILE_NAME_SIZE + 8];
+  BenchResult r[12];
+  Slice slice;
+  int i;
+
+  if (argc < 2)
+  {
+    printf("usage: %s file.264 [repeats]\n", argv[0]);
+    return 1;
+  }
+
+  snprintf(scratch, FILE_NAME_SIZE, "%s/kernel_bench_%d.264", getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", (int) getpid());
+  snprintf(work, sizeof(work), "%s.work", scratch);
+  copy_file(argv[1], scratch);
+
+  record_key_units(scratch);
+  cabac_stream = p_Dec->p_Vid->active_pps ? p_Dec->p_Vid->active_pps->entropy_coding_mode_flag : 0;
+  printf("%s: %d key units recorded, %s\n", argv[1], g_KeyUnitBuffer.count, cabac_stream ? "CABAC" : "CAVLC");
+
+  memset(r, 0, sizeof(r));
+  r[0].name = "get_annex_b_NALU";
+  r[1].name = "EBSPtoRBSP";
+  r[2].name = "read_ue_v (GetVLCSymbol)";
+  r[3].name = "NumCoeffTrailingOnes";
+  r[4].name = "init_contexts";
+  r[5].name = "biari_decode_symbol";
+  r[6].name = "Generate_Key (per key unit)";
+  r[7].name = "MBAFF field mode lookahead";
+  r[8].name = "picture reset 4K: bulk clear";
+  r[9].name = "picture reset 4K: epoch";
+  r[10].name = "8K neighbour walk: malloc";
+  r[11].name = "8K neighbour walk: arena";
+  for (i = 0; i < 12; ++i)
+    r[i].repeats = repeats;
+
+  memset(&slice, 0, sizeof(Slice));
+  if ((slice.mot_ctx = (MotionInfoContexts *) calloc(1, sizeof(MotionInfoContexts))) == NULL
+    || (slice.tex_ctx = (TextureInfoContexts *) calloc(1, sizeof(TextureInfoContexts))) == NULL)
+    no_mem_exit("kernel_bench: contexts");
+
+  bench_annex_b(scratch, &r[0]);
+  bench_ebsp(&r[1]);
+  bench_ue(&r[2]);
+  bench_numcoeff(&r[3]);
+  bench_init_contexts(&slice, &r[4]);
+  if (cabac_stream)
+  {
+    bench_biari(&slice, &r[5]);
+    bench_mbaff_lookahead(&slice, &r[7]);
+  }
+  if (g_KeyUnitBuffer.count > 0)
+    bench_generate_key(scratch, work, &r[6]);
+  bench_picture_reset(&r[8]);
+  bench_arena_walk(&r[10]);
+
+  printf("repeats: %d\n", repeats);
+  for (i = 0; i < 12; ++i)
+  {
+    if (r[i].ops > 0)
+      report(&r[i]);
+  }
+
+  unlink(scratch);
+  unlink(work);
+  return 0;
+}
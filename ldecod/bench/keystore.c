@@ -0,0 +1,82 @@
+/*!
+ ***********************************************************************
+ *  \file
+ *     keystore.c
+ *  \brief
+ *     Key store tool: look up, list and name the clips of a key store
+ *     written with KeyStore (see keystore.h).
+ *
+ *     usage: keystore.exe get <store> <name> > clip.key.txt
+ *            keystore.exe list <store>
+ *            keystore.exe name <file>
+ *
+ *       get   write the key stream of the clip <name> to stdout, the
+ *             same bytes a key file of the clip would hold
+ *       list  one line per clip: record offset, key stream bytes, name
+ *       name  the content name of a scrambled file, for stores written
+ *             with KeyStoreKey = 1
+ ***********************************************************************
+ */
+
+#include <fcntl.h>
+
+#include "global.h"
+#include "keystore.h"
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: keystore.exe get <store> <name> | list <store> | name <file>\n");
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  char name[FILE_NAME_SIZE];
+
+  if (argc == 4 && !strcmp(argv[1], "get"))
+  {
+    KeyStore *ks = open_key_store(argv[2], FALSE);
+    int64 len;
+    byte *keys = key_store_get(ks, argv[3], &len);
+
+    if (keys == NULL)
+    {
+      fprintf(stderr, "keystore: %s has no clip %s\n", argv[2], argv[3]);
+      return 2;
+    }
+    if (len > 0 && fwrite(keys, (size_t) len, 1, stdout) != 1)
+    {
+      fprintf(stderr, "keystore: cannot write the key stream\n");
+      return 1;
+    }
+    free(keys);
+    close_key_store(ks);
+  }
+  else if (argc == 3 && !strcmp(argv[1], "list"))
+  {
+    KeyStore *ks = open_key_store(argv[2], FALSE);
+    KeyStoreSlot entry;
+    int slot = 0;
+
+    while (key_store_next(ks, &slot, name, FILE_NAME_SIZE, &entry))
+      printf("%12llu %10llu %s\n", (unsigned long long) entry.offset,
+        (unsigned long long) (entry.length - KEY_STORE_RECORD_HEADER - strlen(name)), name);
+    close_key_store(ks);
+  }
+  else if (argc == 3 && !strcmp(argv[1], "name"))
+  {
+    int fd = open(argv[2], O_RDONLY);
+
+    if (fd < 0)
+    {
+      fprintf(stderr, "keystore: cannot open %s\n", argv[2]);
+      return 1;
+    }
+    key_store_content_name(fd, name, FILE_NAME_SIZE);
+    close(fd);
+    printf("%s\n", name);
+  }
+  else
+    usage();
+  return 0;
+}
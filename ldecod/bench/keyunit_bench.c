@@ -0,0 +1,251 @@
+
+/*!
+ ***********************************************************************
+ *  \file
+ *     keyunit_bench.c
+ *  \brief
+ *     Encode/decode speed and size of the key unit encodings.
+ *
+ *     usage: keyunit_bench.exe [units] [repeats]
+ *            keyunit_bench.exe -f key.txt
+ *
+ *     A synthetic key unit sequence (small byte deltas with occasional
+ *     long jumps, MVD sized data lengths) is stored as
+ *       - KeyUnit array (reference),
+ *       - LEB128 varint KeyUnitBuffer,
+ *       - fixed width key file records (KeyFormat = 0, size only),
+ *       - adaptive Rice key stream (KeyFormat = 1).
+ *     Every encoding is decoded and checked against the reference.
+ *
+ *     With -f the key units of a KeyFormat = 1 key file written by the
+ *     decoder are measured instead: the size of the same units in the
+ *     fixed format and how much of the Rice file is key data, which is
+ *     stored as read and bounds what any coding of the key unit headers
+ *     can save.
+ ***********************************************************************
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "global.h"
+#include "keyunit.h"
+
+#define DEFAULT_UNITS   4000000
+#define DEFAULT_REPEATS 5
+
+static double now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint32 rnd_state = 0x12345678;
+
+static inline uint32 rnd(void)
+{
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 17;
+  rnd_state ^= rnd_state << 5;
+  return rnd_state;
+}
+
+static void make_units(KeyUnit *ku, uint32 *data, int n)
+{
+  int i;
+  for (i = 0; i < n; ++i)
+  {
+    uint32 r = rnd();
+    // mostly neighbouring macroblocks, sometimes a skipped intra picture
+    ku[i].byte_offset  = (r & 0xFF) < 4 ? (int) (rnd() & 0x3FFFF) : (int) (rnd() % 48);
+    ku[i].bit_offset   = (int) (r >> 8) & 0x07;
+    ku[i].key_data_len = 2 + (int) ((r >> 11) % 14) + (((r >> 16) & 0x0F) == 0 ? (int) ((r >> 20) % 24) : 0);
+    data[i] = rnd();
+  }
+}
+
+static int fixed_unit_bytes(const KeyUnit *ku)
+{
+  int bits = 0, v = ku->byte_offset;
+  do { ++bits; v >>= 1; } while (v);
+  return (8 + bits + 3 + 5 + ku->key_data_len + 7) >> 3;
+}
+
+static void report(const char *name, double best_ns, int n, int64 bytes)
+{
+  if (best_ns > 0.0)
+    printf("%-22s %8.2f ns/unit %8.2f Munits/s", name, best_ns / n, n * 1e3 / best_ns);
+  else
+    printf("%-22s %8s ns/unit %8s Munits/s", name, "-", "-");
+  printf(" %10.2f bytes/unit %12lld bytes\n", (double) bytes / n, (long long) bytes);
+}
+
+static void report_ratio(int n, int64 fixed_bytes, int64 rice_bytes, int64 data_bits)
+{
+  printf("Rice / fixed key file:  %.3f (%.2f of %.2f bytes/unit)\n",
+    (double) rice_bytes / fixed_bytes, (double) rice_bytes / n, (double) fixed_bytes / n);
+  printf("key data in Rice file:  %.1f%% (%.2f bits/unit), unit headers %.2f bits/unit\n",
+    100.0 * data_bits / (8.0 * rice_bytes), (double) data_bits / n, (8.0 * rice_bytes - data_bits) / n);
+}
+
+//! -f: measure the key units of a Rice key file
+static int measure_key_file(const char *path)
+{
+  FILE *fp = fopen(path, "rb");
+  byte *buf;
+  long size;
+  KeyRiceReader rr;
+  KeyUnit ku;
+  byte bits[KEY_UNIT_MAX_DATA_BYTES];
+  int64 fixed_bytes = 2, data_bits = 0;   // the fixed format ends with two terminator bytes
+  int n = 0;
+
+  if (fp == NULL || fseek(fp, 0, SEEK_END) || (size = ftell(fp)) <= 0)
+  {
+    fprintf(stderr, "keyunit_bench: cannot read %s\n", path);
+    return 1;
+  }
+  rewind(fp);
+  if ((buf = (byte *) malloc((size_t) size)) == NULL || fread(buf, 1, (size_t) size, fp) != (size_t) size)
+  {
+    fprintf(stderr, "keyunit_bench: cannot read %s\n", path);
+    return 1;
+  }
+  fclose(fp);
+  if (init_key_rice_reader(&rr, buf, size))
+  {
+    fprintf(stderr, "keyunit_bench: %s is not a KeyFormat = %d key file\n", path, KEY_FORMAT_RICE);
+    return 1;
+  }
+  for (; get_key_unit_rice(&rr, &ku, bits); ++n)
+  {
+    fixed_bytes += fixed_unit_bytes(&ku);
+    data_bits   += ku.key_data_len;
+  }
+  free(buf);
+  if (rr.overrun || n == 0)
+  {
+    fprintf(stderr, "keyunit_bench: %s is cut short or has no key units\n", path);
+    return 1;
+  }
+
+  printf("key file: %s, key units: %d\n", path, n);
+  report("fixed key file", 0.0, n, fixed_bytes);
+  report("Rice key file",  0.0, n, (int64) size);
+  report_ratio(n, fixed_bytes, (int64) size, data_bits);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  int n       = argc > 1 ? atoi(argv[1]) : DEFAULT_UNITS;
+  int repeats = argc > 2 ? atoi(argv[2]) : DEFAULT_REPEATS;
+  KeyUnit *ref;
+  uint32  *data;
+  double t, best_put = 1e30, best_get = 1e30, best_enc = 1e30, best_dec = 1e30;
+  int64 fixed_bytes = 0, rice_bytes = 0, varint_bytes = 0, data_bits = 0;
+  byte *rice_buf = NULL;
+  int i, r, errors = 0;
+
+  if (argc > 2 && strcmp(argv[1], "-f") == 0)
+    return measure_key_file(argv[2]);
+  ref  = (KeyUnit *) malloc(n * sizeof(KeyUnit));
+  data = (uint32 *) malloc(n * sizeof(uint32));
+  if (ref == NULL || data == NULL || n <= 0)
+  {
+    fprintf(stderr, "keyunit_bench: cannot allocate %d units\n", n);
+    return 1;
+  }
+  make_units(ref, data, n);
+  for (i = 0; i < n; ++i)
+  {
+    fixed_bytes += fixed_unit_bytes(&ref[i]);
+    data_bits   += ref[i].key_data_len;
+  }
+
+  for (r = 0; r < repeats; ++r)
+  {
+    KeyUnitBuffer kb;
+    KeyUnitReader reader;
+    KeyRiceWriter w;
+    KeyRiceReader rr;
+    KeyUnit ku;
+    byte bits[KEY_UNIT_MAX_DATA_BYTES];
+    FILE *fp = tmpfile();
+
+    // varint
+    init_key_unit_buffer(&kb, KEY_UNIT_BUFFER_SIZE);
+    t = now_ns();
+    for (i = 0; i < n; ++i)
+      put_key_unit(&kb, ref[i].byte_offset, ref[i].bit_offset, ref[i].key_data_len);
+    best_put = dmin(best_put, now_ns() - t);
+    varint_bytes = kb.size;
+
+    t = now_ns();
+    init_key_unit_reader(&reader, &kb);
+    for (i = 0; get_key_unit(&reader, &ku); ++i)
+    {
+      if (ku.byte_offset != ref[i].byte_offset || ku.bit_offset != ref[i].bit_offset || ku.key_data_len != ref[i].key_data_len)
+        ++errors;
+    }
+    best_get = dmin(best_get, now_ns() - t);
+    errors += (i != n);
+    free_key_unit_buffer(&kb);
+
+    // Rice
+    t = now_ns();
+    init_key_rice_writer(&w, fp, 1024 * 1024);
+    for (i = 0; i < n; ++i)
+    {
+      int len = ref[i].key_data_len, chunk;
+      put_key_unit_rice(&w, ref[i].byte_offset, ref[i].bit_offset, len);
+      for (; len > 0; len -= chunk)
+      {
+        chunk = imin(len, 24);
+        put_key_data_rice(&w, chunk, data[i] >> (32 - chunk));
+      }
+    }
+    close_key_rice_writer(&w);
+    best_enc = dmin(best_enc, now_ns() - t);
+
+    rice_bytes = w.bytes_written;
+    free(rice_buf);
+    rice_buf = (byte *) malloc((size_t) rice_bytes);
+    rewind(fp);
+    if (rice_buf == NULL || fread(rice_buf, 1, (size_t) rice_bytes, fp) != (size_t) rice_bytes)
+    {
+      fprintf(stderr, "keyunit_bench: cannot read back Rice stream\n");
+      return 1;
+    }
+    fclose(fp);
+
+    t = now_ns();
+    if (init_key_rice_reader(&rr, rice_buf, rice_bytes))
+      ++errors;
+    for (i = 0; get_key_unit_rice(&rr, &ku, bits); ++i)
+    {
+      if (ku.byte_offset != ref[i].byte_offset || ku.bit_offset != ref[i].bit_offset || ku.key_data_len != ref[i].key_data_len
+        || bits[0] != (byte) ((data[i] >> 24) & (0xFF00 >> imin(ku.key_data_len, 8))))
+        ++errors;
+    }
+    best_dec = dmin(best_dec, now_ns() - t);
+    errors += (i != n);
+  }
+
+  printf("key units: %d, repeats: %d (best run)\n", n, repeats);
+  report("KeyUnit array",    0.0,      n, (int64) n * sizeof(KeyUnit));
+  report("varint put",       best_put, n, varint_bytes);
+  report("varint get",       best_get, n, varint_bytes);
+  report("fixed key file",   0.0,      n, fixed_bytes);
+  report("Rice key file enc", best_enc, n, rice_bytes);
+  report("Rice key file dec", best_dec, n, rice_bytes);
+  report_ratio(n, fixed_bytes, rice_bytes, data_bits);
+  printf("errors: %d\n", errors);
+
+  free(rice_buf);
+  free(ref);
+  free(data);
+  return errors != 0;
+}
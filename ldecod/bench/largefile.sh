@@ -0,0 +1,140 @@
+#!/bin/sh
+###
+###     largefile.sh
+###
+###     Key generation on an input larger than 2 GiB: offsets past 2^31
+###     must survive the key units, the checkpoints and the resume.
+###
+###     usage: largefile.sh [-d dir] [-m megabytes]
+###
+###     Three h264gen clips are joined with runs of 1 MB filler NAL units,
+###     <megabytes> (default 2100) before the second clip and a tenth of
+###     that before the third. The scrambled result of every run must be
+###     the three clips scrambled without the filler, spliced back in
+###     place, and every run must record as many key units. Runs:
+###       plain   KeyFormat = 1, key units applied after parsing
+###       resume  CheckpointInterval = 1, killed once a checkpoint past
+###               2 GiB is on disk, then run again to completion
+###       follow  Follow = 1 on a copy that grows in steps, one of them
+###               ending inside a picture of the clip past 2 GiB
+###     The work files (about three times the input) go to <dir>
+###     (default $TMPDIR or /tmp) and are removed at the end.
+###
+
+MB=2100
+DIR=${TMPDIR:-/tmp}
+
+while getopts "d:m:" opt; do
+  case $opt in
+    d) DIR=$OPTARG ;;
+    m) MB=$OPTARG ;;
+    *) sed -n 's/^###     usage: /usage: /p' "$0"; exit 1 ;;
+  esac
+done
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+BIN=$HERE/../../bin/ldecod.exe
+GEN=$HERE/../../bin/h264gen.exe
+CFG=$HERE/../../bin/decoder.cfg
+TMP=$(mktemp -d "$DIR/largefile.XXXXXX")
+trap 'kill $PID 2>/dev/null; rm -rf "$TMP"' EXIT
+
+[ -x "$BIN" ] && [ -x "$GEN" ] || { echo "missing $BIN or $GEN, run make and make bench first"; exit 1; }
+
+FAILED=0
+fail() { echo "FAIL: $*"; FAILED=1; }
+
+# clip c, scrambled alone: c.264 (original) and c.scr (scrambled)
+for c in 1 2 3; do
+  "$GEN" -c 1 -n 30 -g 10 -x $c -o "$TMP/c$c.264" > /dev/null || exit 1
+done
+cat "$TMP/c1.264" "$TMP/c2.264" "$TMP/c3.264" > "$TMP/small.264"
+"$BIN" -d "$CFG" -p InputFile="$TMP/small.264" -p KeyFileDir="$TMP/" -p KeyFormat=1 > "$TMP/small.log" 2>&1
+UNITS=$(sed -n 's/^key unit count: //p' "$TMP/small.log")
+[ -n "$UNITS" ] || { echo "decoder failed on the clips"; tail -5 "$TMP/small.log"; exit 1; }
+L1=$(wc -c < "$TMP/c1.264"); L2=$(wc -c < "$TMP/c2.264")
+head -c "$L1" "$TMP/small.264" > "$TMP/c1.scr"
+tail -c +$((L1 + 1)) "$TMP/small.264" | head -c "$L2" > "$TMP/c2.scr"
+tail -c +$((L1 + L2 + 1)) "$TMP/small.264" > "$TMP/c3.scr"
+
+# 1 MB filler NAL unit (nal_unit_type 12): 0xFF payload and the rbsp stop bit
+{ printf '\000\000\000\001\014'; head -c $((1048576 - 6)) /dev/zero | tr '\000' '\377'; printf '\200'; } > "$TMP/fill.nal"
+filler() { i=0; while [ $i -lt "$1" ]; do cat "$TMP/fill.nal"; i=$((i + 1)); done; }
+
+# join part a, b, c of the three clips with the filler runs
+join() { cat "$TMP/c1.$1"; filler "$MB"; cat "$TMP/c2.$1"; filler $((MB / 10)); cat "$TMP/c3.$1"; }
+join 264 > "$TMP/large.264"
+join scr > "$TMP/expect.264"
+rm -f "$TMP/small.264" "$TMP/c1.264" "$TMP/c2.264" "$TMP/c3.264"
+SIZE=$(wc -c < "$TMP/large.264")
+echo "input: $SIZE bytes, $UNITS key units in the clips"
+
+# run <tag> [options]: scramble a copy of large.264 in $TMP/<tag>/, RUN_BG=1 starts
+# the decoder in the background with its pid in PID (the pid of a backgrounded
+# shell function would be that of a subshell, killing it leaves the decoder running)
+run() {
+  tag=$1; shift
+  mkdir -p "$TMP/$tag"
+  [ -f "$TMP/$tag/in.264" ] || cp "$TMP/large.264" "$TMP/$tag/in.264"
+  if [ -n "$RUN_BG" ]; then
+    "$BIN" -d "$CFG" -p InputFile="$TMP/$tag/in.264" -p KeyFileDir="$TMP/$tag/" -p KeyFormat=1 "$@" >> "$TMP/$tag/log" 2>&1 &
+    PID=$!
+  else
+    "$BIN" -d "$CFG" -p InputFile="$TMP/$tag/in.264" -p KeyFileDir="$TMP/$tag/" -p KeyFormat=1 "$@" >> "$TMP/$tag/log" 2>&1
+  fi
+}
+
+# check <tag>: the scrambled file and the key unit count of the last run
+check() {
+  n=$(sed -n 's/^key unit count: //p' "$TMP/$1/log" | tail -1)
+  # a distance past the key formats' 2^31 - 1 is bridged by key units without data
+  [ -n "$n" ] && [ "$n" -ge "$UNITS" ] && [ "$n" -le $((UNITS + 2)) ] || fail "$1: $n key units, expected $UNITS (+ bridges)"
+  cmp -s "$TMP/$1/in.264" "$TMP/expect.264" || fail "$1: scrambled input differs at $(cmp "$TMP/$1/in.264" "$TMP/expect.264" | sed 's/.*char //')"
+  [ $FAILED -ne 0 ] && tail -5 "$TMP/$1/log"
+  echo "$1: $n key units, $(wc -c < "$TMP/$1/in.264.key.txt") key file bytes"
+}
+
+run plain
+check plain
+cp "$TMP/plain/in.264.key.txt" "$TMP/plain.key"
+rm -rf "$TMP/plain"
+
+# resume: stop the run once the .ckpt file points past 2 GiB (its picture offset is at byte 22)
+RUN_BG=1 run resume -p CheckpointInterval=1
+pos=0
+while kill -0 $PID 2>/dev/null; do
+  [ -f "$TMP/resume/in.264.key.txt.ckpt" ] && pos=$(od -An -t u8 -j 22 -N 8 "$TMP/resume/in.264.key.txt.ckpt" | tr -d ' ')
+  [ "${pos:-0}" -gt 2147483648 ] && { kill -9 $PID; break; }
+  sleep 0.05
+done
+wait $PID 2>/dev/null
+if [ "${pos:-0}" -gt 2147483648 ]; then
+  echo "resume: stopped with a checkpoint at byte $pos"
+  run resume -p CheckpointInterval=1
+  grep -q '^resuming at byte' "$TMP/resume/log" || fail "resume: the second run did not resume"
+  check resume
+  cmp -s "$TMP/resume/in.264.key.txt" "$TMP/plain.key" || fail "resume: key file differs from the plain run"
+else
+  fail "resume: the run ended before a checkpoint past 2 GiB"
+  tail -5 "$TMP/resume/log"
+fi
+rm -rf "$TMP/resume"
+
+# follow: append large.264 to the copy in steps while it is scrambled
+mkdir -p "$TMP/follow"
+have=$((SIZE / 4))
+head -c $have "$TMP/large.264" > "$TMP/follow/in.264"
+RUN_BG=1 run follow -p Follow=1 -p FollowPoll=50 -p FollowIdle=5
+for end in $((SIZE / 2)) $((L1 + MB * 1048576 + L2 / 2)) $SIZE; do
+  [ $end -gt $have ] || continue
+  sleep 1
+  tail -c +$((have + 1)) "$TMP/large.264" | head -c $((end - have)) >> "$TMP/follow/in.264"
+  have=$end
+done
+wait $PID
+check follow
+cmp -s "$TMP/follow/in.264.key.txt" "$TMP/plain.key" || fail "follow: key file differs from the plain run"
+rm -rf "$TMP/follow"
+
+[ $FAILED -eq 0 ] && echo "largefile: OK"
+exit $FAILED
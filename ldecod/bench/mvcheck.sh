@@ -0,0 +1,120 @@
+#!/bin/sh
+###
+###     mvcheck.sh
+###
+###     Motion vector field (MvFieldFile) against the motion vectors that
+###     ffmpeg exports, on h264gen streams of both entropy modes.
+###
+###     usage: mvcheck.sh [-d dir] [-n frames]
+###
+###     Streams: CAVLC and CABAC, P only and with two B pictures between
+###     the P pictures (30% direct), two slices per picture, <frames>
+###     (default 30) frames each. Every block of every extracted picture
+###     must have the reference list use and the motion vector ffmpeg
+###     reports for it; pictures without planes are counted, not compared.
+###     Needs python3 with the av (PyAV) and numpy modules. The streams go
+###     to <dir> (default $TMPDIR or /tmp) and are removed at the end.
+###
+
+FRAMES=30
+DIR=${TMPDIR:-/tmp}
+
+while getopts "d:n:" opt; do
+  case $opt in
+    d) DIR=$OPTARG ;;
+    n) FRAMES=$OPTARG ;;
+    *) sed -n 's/^###     usage: /usage: /p' "$0"; exit 1 ;;
+  esac
+done
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+BIN=$HERE/../../bin/ldecod.exe
+GEN=$HERE/../../bin/h264gen.exe
+CFG=$HERE/../../bin/decoder.cfg
+
+[ -x "$BIN" ] && [ -x "$GEN" ] || { echo "missing $BIN or $GEN, run make and make bench first"; exit 1; }
+python3 -c 'import av, numpy' 2>/dev/null || { echo "mvcheck needs python3 with the av (PyAV) and numpy modules"; exit 1; }
+
+TMP=$(mktemp -d "$DIR/mvcheck.XXXXXX")
+trap 'rm -rf "$TMP"' EXIT
+
+# compare <stream> <field>: one line per stream, exit status 1 on a mismatch
+compare() {
+  python3 - "$1" "$2" <<'EOF'
+import sys, struct, av, numpy as np
+
+stream, field = sys.argv[1], sys.argv[2]
+MV_FIELD_EXTRACTED, MV_FIELD_IDR, MV_FIELD_INEXACT, MV_FIELD_TRUNCATED = 0x01, 0x04, 0x08, 0x10
+
+# the records, in decoding order (see mvfield.h)
+d = open(field, 'rb').read()
+if d[:4] != b'JMMV':
+    sys.exit('%s: not a motion vector field file' % field)
+o, recs = 8, []
+while o < len(d):
+    poc, frame_num, w, h, slice_type, flags, lists, _ = struct.unpack_from('<iiHHBBBB', d, o)
+    o += 16
+    planes = []
+    for l in range(lists):
+        n = w * h
+        ref = np.frombuffer(d, np.int8, n, o).reshape(h, w); o += n
+        mv = np.frombuffer(d, np.int16, 2 * n, o).reshape(h, w, 2); o += 4 * n
+        planes.append((ref, mv))
+    recs.append((poc, flags, planes))
+
+# ffmpeg returns the pictures in output order: by POC between two IDR pictures
+groups = []
+for r in recs:
+    if r[1] & MV_FIELD_IDR or not groups:
+        groups.append([])
+    groups[-1].append(r)
+shown = [r for g in groups for r in sorted(g, key=lambda r: r[0])]
+
+c = av.open(stream)
+s = c.streams.video[0]
+s.codec_context.options = {'flags2': '+export_mvs'}
+exported = []
+for f in c.decode(s):
+    sd = f.side_data.get('MOTION_VECTORS')
+    exported.append(sd.to_ndarray() if sd is not None else None)
+if len(exported) != len(shown):
+    sys.exit('%s: ffmpeg has %d pictures, the field file %d' % (stream, len(exported), len(shown)))
+
+blocks = bad = 0
+for (poc, flags, planes), mvs in zip(shown, exported):
+    if not planes or mvs is None:
+        continue
+    for m in mvs:
+        ref, mv = planes[0 if m['source'] < 0 else 1]
+        x = (m['dst_x'] - m['w'] // 2) // 4
+        y = (m['dst_y'] - m['h'] // 2) // 4
+        # ffmpeg exports the list a B block does not use as 0,0
+        if ref[y, x] < 0 and m['motion_x'] == 0 and m['motion_y'] == 0:
+            continue
+        blocks += 1
+        if ref[y, x] < 0 or mv[y, x, 0] != m['motion_x'] or mv[y, x, 1] != m['motion_y']:
+            bad += 1
+
+count = lambda flag: sum(1 for r in recs if r[1] & flag)
+print('%s: %d pictures, %d extracted, %d inexact, %d truncated, %d blocks, %d mismatching'
+      % (stream.split('/')[-1], len(recs), count(MV_FIELD_EXTRACTED), count(MV_FIELD_INEXACT),
+         count(MV_FIELD_TRUNCATED), blocks, bad))
+sys.exit(1 if bad else 0)
+EOF
+}
+
+FAILED=0
+for c in 0 1; do
+  for b in 0 2; do
+    f=$TMP/mv_c${c}_b$b
+    "$GEN" -c $c -b $b -d 30 -S 2 -n "$FRAMES" -x $((c * 2 + b + 1)) -o "$f.264" > /dev/null || exit 1
+    # OutputFile keeps the stream ffmpeg decodes unscrambled
+    if ! "$BIN" -d "$CFG" -p InputFile="$f.264" -p KeyFileDir="$TMP/" -p OutputFile="$f.scr" -p MvFieldFile="$f.mv" > "$f.log" 2>&1; then
+      echo "FAIL: decoder failed on $f.264"; tail -5 "$f.log"; FAILED=1; continue
+    fi
+    compare "$f.264" "$f.mv" || FAILED=1
+  done
+done
+
+[ $FAILED -eq 0 ] && echo "mvcheck: OK"
+exit $FAILED
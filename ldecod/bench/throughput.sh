@@ -0,0 +1,104 @@
+#!/bin/sh
+###
+###     throughput.sh
+###
+###     End-to-end throughput of the parse + encrypt pipeline over a corpus.
+###
+###     usage: throughput.sh [-r repeats] [-c cpu] [-k keyformat] [-o results] file.264 ...
+###
+###     Every file is decoded <repeats> times (default 5) from a fresh copy,
+###     pinned to <cpu> (default 0) when taskset is available. Each run appends
+###     the decoder's StatsFile JSON line plus the repeat number to <results>
+###     (default throughput.jsonl); the median run of every file is appended to
+###     <results>.summary and printed as a table. The matrix columns
+###     (entropy mode, resolution, slices per picture, MBAFF/field, bitrate)
+###     are taken from the stream itself.
+###
+
+REPEATS=5
+CPU=0
+KEYFORMAT=0
+OUT=throughput.jsonl
+
+while getopts "r:c:k:o:" opt; do
+  case $opt in
+    r) REPEATS=$OPTARG ;;
+    c) CPU=$OPTARG ;;
+    k) KEYFORMAT=$OPTARG ;;
+    o) OUT=$OPTARG ;;
+    *) sed -n 's/^###     usage: /usage: /p' "$0"; exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -eq 0 ]; then
+  sed -n 's/^###     usage: /usage: /p' "$0"
+  exit 1
+fi
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+BIN=$HERE/../../bin/ldecod.exe
+CFG=$HERE/../../bin/decoder.cfg
+TMP=$(mktemp -d "${TMPDIR:-/tmp}/throughput.XXXXXX")
+trap 'rm -rf "$TMP"' EXIT
+
+PIN=
+if command -v taskset >/dev/null 2>&1; then
+  PIN="taskset -c $CPU"
+fi
+
+[ -x "$BIN" ] || { echo "missing $BIN, run make first"; exit 1; }
+
+for f in "$@"; do
+  name=$(basename "$f")
+  : > "$TMP/runs"
+  r=1
+  while [ $r -le "$REPEATS" ]; do
+    rm -rf "$TMP/run"
+    mkdir -p "$TMP/run"
+    # the copy has a plain name, the decoder's -p parser cannot take every file name
+    cp "$f" "$TMP/run/input.264"
+    $PIN "$BIN" -d "$CFG" -p InputFile="$TMP/run/input.264" -p KeyFileDir="$TMP/run/" \
+      -p KeyFormat="$KEYFORMAT" -p StatsFile="$TMP/run/stats.jsonl" > "$TMP/run/log" 2>&1
+    if [ ! -s "$TMP/run/stats.jsonl" ]; then
+      echo "$name: decoder failed (repeat $r), see output below"
+      tail -5 "$TMP/run/log"
+      break
+    fi
+    # the decoder's input field names the copy, put in the corpus path as a JSON string
+    INPUT=$(printf '%s' "$f" | sed 's/[\\"]/\\&/g') REPEAT=$r PINNED=${PIN:+$CPU} awk '
+      { i = index($0, ", \"bytes\": ")
+        printf "{\"input\": \"%s\", \"repeat\": %s, \"cpu\": \"%s\"%s\n", ENVIRON["INPUT"], ENVIRON["REPEAT"], ENVIRON["PINNED"], substr($0, i) }' \
+      "$TMP/run/stats.jsonl" >> "$TMP/runs"
+    r=$((r + 1))
+  done
+  cat "$TMP/runs" >> "$OUT"
+  [ -s "$TMP/runs" ] || continue
+
+  # median run by total time
+  awk '
+    function field(k,   m) { if (match($0, "\"" k "\": [^,}]*")) { m = substr($0, RSTART + length(k) + 4, RLENGTH - length(k) - 4); gsub(/"/, "", m); return m } return "" }
+    { print field("total_us"), $0 }' "$TMP/runs" | sort -n | awk -v n="$(wc -l < "$TMP/runs")" 'NR == int((n + 1) / 2) { sub(/^[0-9]+ /, ""); print }' > "$TMP/median"
+
+  awk -v out="$OUT.summary" -v repeats="$(wc -l < "$TMP/runs")" '
+    function field(k,   m) { if (match($0, "\"" k "\": [^,}]*")) { m = substr($0, RSTART + length(k) + 4, RLENGTH - length(k) - 4); gsub(/"/, "", m); return m } return "" }
+    # the input path as escaped in the JSON line, and as plain text for the table
+    function input_json() { match($0, /"input": "([^"\\]|\\.)*"/); return substr($0, RSTART + 10, RLENGTH - 11) }
+    function input_text(   s) { s = input_json(); gsub(/\\\\/, "\001", s); gsub(/\\"/, "\"", s); gsub(/\001/, "\\", s); return s }
+    {
+      us = field("total_us"); if (us <= 0) us = 1
+      pics = field("pictures"); fr = field("frames")
+      st = field("mbaff_pictures") > 0 ? "mbaff" : (field("field_pictures") > 0 ? "field" : "frame")
+      mbs = field("bytes") / us
+      fps = fr * 1e6 / us
+      kus = field("key_units") * 1e6 / us
+      mbps = field("macroblocks") * 1e6 / us
+      kbpf = fr > 0 ? field("bytes") * 8 / 1000 / fr : 0
+      printf "{\"input\": \"%s\", \"repeats\": %d, \"entropy\": \"%s\", \"resolution\": \"%sx%s\", \"max_slices_per_picture\": %s, \"structure\": \"%s\", \"kbit_per_frame\": %.1f, \"total_us\": %s, \"parse_us\": %s, \"encrypt_us\": %s, \"MB_per_s\": %.2f, \"frames_per_s\": %.1f, \"macroblocks_per_s\": %.0f, \"key_units_per_s\": %.0f, \"peak_rss\": %s}\n", \
+        input_json(), repeats, field("entropy"), field("width"), field("height"), field("max_slices_per_picture"), st, kbpf, \
+        field("total_us"), field("parse_us"), field("encrypt_us"), mbs, fps, mbps, kus, field("peak_rss") >> out
+      printf "%-24s %5s %9s %3s %5s %8.1f | %8.2f MB/s %9.1f fps %11.0f ku/s %8s KiB\n", \
+        substr(input_text(), length(input_text()) > 24 ? length(input_text()) - 23 : 1), field("entropy"), \
+        field("width") "x" field("height"), field("max_slices_per_picture"), st, kbpf, mbs, fps, kus, field("peak_rss")
+    }' "$TMP/median"
+done
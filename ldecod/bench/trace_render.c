@@ -0,0 +1,211 @@
+/*!
+ ***********************************************************************
+ *  \file
+ *     trace_render.c
+ *  \brief
+ *     Trace renderer: writes the binary trace of a TRACE build
+ *     (vfile/trace_dec.bin, see tracering.h) in the text format of
+ *     the former fprintf trace.
+ *
+ *     usage: trace_render.exe [-t thread] <trace_dec.bin> > trace_dec.txt
+ *
+ *       -t  only the records of one tracing thread (0 = the first
+ *           thread that traced, the parser unless Pipeline = 1)
+ *
+ *     The file is read twice: the names are defined in the ring of
+ *     the thread that used them first, so all definitions are
+ *     collected before anything is rendered.
+ ***********************************************************************
+ */
+
+#include "global.h"
+#include "tracering.h"
+
+#define RENDER_BATCH  4096
+
+static char *names[TRACE_MAX_SYMBOLS];
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: trace_render.exe [-t thread] <trace_dec.bin>\n");
+  exit(1);
+}
+
+//! reads the records of f after the header, calls handle for each, passes the name records that follow a TRACE_SYMDEF
+static void for_each_record(FILE *f, void (*handle)(const TraceRecord *r, const char *name))
+{
+  static TraceRecord buf[RENDER_BATCH];
+  char name[256 + TRACE_NAME_CHARS];
+  int n, i, pending = 0, got = 0;
+  TraceRecord def;
+
+  memset(&def, 0, sizeof(def));
+  fseek(f, 8, SEEK_SET);
+  while ((n = (int) fread(buf, sizeof(TraceRecord), RENDER_BATCH, f)) > 0)
+  {
+    for (i = 0; i < n; ++i)
+    {
+      if (pending > 0)
+      {
+        memcpy(name + got, &buf[i], TRACE_NAME_CHARS);
+        got += TRACE_NAME_CHARS;
+        if (--pending == 0)
+        {
+          name[def.len] = '\0';
+          handle(&def, name);
+        }
+      }
+      else if (TRACE_KIND(buf[i].kind) == TRACE_SYMDEF)
+      {
+        def = buf[i];
+        got = 0;
+        pending = (def.len + TRACE_NAME_CHARS - 1) / TRACE_NAME_CHARS;
+        if (pending == 0)
+          handle(&def, "");
+      }
+      else
+        handle(&buf[i], NULL);
+    }
+  }
+}
+
+static void define_name(const TraceRecord *r, const char *name)
+{
+  if (name != NULL && names[r->sym] == NULL)
+    names[r->sym] = strdup(name);
+}
+
+//! the formats of TRACE_BITS_FORMAT and TRACE_VALUES may only hold up to max %d
+static int safe_format(const char *format, int max)
+{
+  int n = 0;
+
+  for (; *format; ++format)
+  {
+    if (*format != '%')
+      continue;
+    if (format[1] == '%')
+      ++format;
+    else if (format[1] == 'd' && ++n <= max)
+      ++format;
+    else
+      return FALSE;
+  }
+  return TRUE;
+}
+
+static int thread_filter = -1;
+
+static void render(const TraceRecord *r, const char *def)
+{
+  const char *name = names[r->sym] != NULL ? names[r->sym] : "<unknown>";
+  char formatted[256];
+  int i, chars, len = r->len;
+
+  if (def != NULL || (thread_filter >= 0 && TRACE_THREAD(r->kind) != thread_filter))
+    return;
+
+  switch (TRACE_KIND(r->kind))
+  {
+  case TRACE_VLC:
+  case TRACE_BITS:
+  case TRACE_BITS_FORMAT:
+    if (TRACE_KIND(r->kind) == TRACE_BITS_FORMAT && safe_format(name, 4))
+    {
+      snprintf(formatted, sizeof(formatted), name, r->value & 0xFF, (r->value >> 8) & 0xFF, (r->value >> 16) & 0xFF, (r->value >> 24) & 0xFF);
+      name = formatted;
+    }
+    putchar('@');
+    chars = printf("%i", r->pos);
+    while(chars++ < 5)
+      putchar(' ');
+    chars += printf(" %s", name);
+    while(chars++ < 55)
+      putchar(' ');
+    // Align bitpattern
+    if (len < 15)
+    {
+      for (i = 0; i < 15 - len; i++)
+        putchar(' ');
+    }
+    if (TRACE_KIND(r->kind) == TRACE_VLC)
+    {
+      // 0 Xn...0 X2 0 X1 0 X0 1
+      for (i = 0; i < len / 2; i++)
+        putchar('0');
+      putchar('1');
+      for (i = 0; i < len / 2; i++)
+        putchar((0x01 & (r->info >> ((len / 2 - i) - 1))) ? '1' : '0');
+    }
+    else
+    {
+      while (len >= 32)
+      {
+        for (i = 0; i < 8; i++)
+          putchar('0');
+        len -= 8;
+      }
+      for (i = 0; i < len; i++)
+        putchar((0x01 & (r->info >> (len - i - 1))) ? '1' : '0');
+    }
+    printf(" (%3d) \n", TRACE_KIND(r->kind) == TRACE_VLC ? r->value : r->info);
+    break;
+  case TRACE_CABAC:
+    printf("@%-6d %-63s (%3d)\n", (int) r->pos, name, r->value);
+    break;
+  case TRACE_LEVEL_RUN:
+    printf("@%-6d %-53s %3d  %3d\n", (int) r->pos, name, r->value, r->info);
+    break;
+  case TRACE_NALU:
+    if (r->len)
+      printf("\n\nLast NALU in File\n\nAnnex B NALU w/ ");
+    else
+      printf("\n\nAnnex B NALU w/ ");
+    printf("%s startcode, len %d, forbidden_bit %d, nal_reference_idc %d, nal_unit_type %d\n\n",
+      (r->info & 0xFF) == 4 ? "long" : "short", r->value, (r->info >> 8) & 0xFF, (r->info >> 16) & 0xFF, (r->info >> 24) & 0xFF);
+    break;
+  case TRACE_VALUES:
+    if (safe_format(name, 3))
+      printf(name, r->value, r->info, (int) r->pos);
+    else
+      printf("%s %d %d %d\n", name, r->value, r->info, (int) r->pos);
+    break;
+  default:
+    printf("<record kind %d>\n", TRACE_KIND(r->kind));
+    break;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  static char out[1 << 20];
+  char magic[4];
+  int32 version;
+  FILE *f;
+  int i = 1;
+
+  if (argc == 4 && !strcmp(argv[1], "-t"))
+  {
+    thread_filter = atoi(argv[2]);
+    i = 3;
+  }
+  else if (argc != 2)
+    usage();
+
+  if ((f = fopen(argv[i], "rb")) == NULL)
+  {
+    fprintf(stderr, "trace_render: cannot open %s\n", argv[i]);
+    return 1;
+  }
+  if (fread(magic, 1, 4, f) != 4 || memcmp(magic, TRACE_MAGIC, 4) || fread(&version, sizeof(version), 1, f) != 1 || version != TRACE_VERSION)
+  {
+    fprintf(stderr, "trace_render: %s is not a version %d trace\n", argv[i], TRACE_VERSION);
+    return 1;
+  }
+
+  setvbuf(stdout, out, _IOFBF, sizeof(out));
+  for_each_record(f, define_name);
+  for_each_record(f, render);
+  fclose(f);
+  return 0;
+}
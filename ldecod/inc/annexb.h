@@ -13,15 +13,19 @@
 #define _ANNEXB_H_
 
 #include "nalucommon.h"
+#include "iobackend.h"
 
 typedef struct annex_b_struct 
 {
   int  BitStreamFile;                //!< the bit stream file
+  IoBackend *io;                     //!< read-ahead of BitStreamFile, owns iobuffer
   byte *iobuffer;
   byte *iobufferread;
   int bytesinbuffer;
   int is_eof;
   int iIOBufferSize;
+  int64 read_off;                    //!< file offset after the last chunk read
+  int follow;                        //!< Follow = 1: wait at the end of the file for appended data
 
   int IsFirstByteStreamNALU;
   int nextstartcodebytes;
@@ -36,5 +40,6 @@ extern void malloc_annex_b   (VideoParameters *p_Vid, ANNEXB_t **p_annex_b);
 extern void free_annex_b     (ANNEXB_t **p_annex_b);
 extern void init_annex_b     (ANNEXB_t *annex_b);
 extern void reset_annex_b    (ANNEXB_t *annex_b);
+extern void seek_annex_b     (ANNEXB_t *annex_b, int64 offset);
 #endif
 
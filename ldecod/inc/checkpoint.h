@@ -0,0 +1,50 @@
+
+/*!
+ ************************************************************************
+ * \file checkpoint.h
+ *
+ * \brief
+ *    Checkpoint and resume for long Annex B files (CheckpointInterval).
+ *
+ *    Every CheckpointInterval MB of input the parser notes the next IDR
+ *    picture together with the SPS/PPS seen so far. When decoding
+ *    reaches that picture, everything before it is made final on disk,
+ *    the key file first and then the scrambled bit stream, and
+ *    <key file>.ckpt is replaced atomically with the picture's offset,
+ *    where the key file continues and the base of the next key unit.
+ *
+ *    A run that finds the .ckpt file restores the original bits of the
+ *    key units written after it, truncates the key file there and
+ *    continues at the IDR picture. Once the key file is complete the
+ *    .ckpt file is marked so, a later run refuses to scramble the file a
+ *    second time.
+ *
+ *    Only rice key files (KeyFormat = 1) are checkpointed: the fixed
+ *    format cuts key units of 32 bits and more, they could not be undone.
+ ************************************************************************
+ */
+
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include "global.h"
+#include "nalucommon.h"
+
+#define CHECKPOINT_MAGIC        "JMCKPT"
+#define CHECKPOINT_VERSION      1
+#define CHECKPOINT_CANDIDATES   2         //!< IDR pictures noted ahead of decoding
+
+typedef struct checkpoint Checkpoint;
+
+extern Checkpoint *open_checkpoint      (VideoParameters *p_Vid, const char *key_file);
+extern int         checkpoint_resumes   (Checkpoint *cp);
+extern void        resume_checkpoint    (Checkpoint *cp);
+extern void        close_checkpoint     (Checkpoint *cp, int done);
+
+//! parser side: parameter sets as they are read, the first slice of an IDR picture
+extern void        checkpoint_note_ps   (Checkpoint *cp, NALU_t *nalu);
+extern void        checkpoint_candidate (Checkpoint *cp, int64 nalu_pos);
+//! decoder side: before the first slice of every picture
+extern void        checkpoint_picture   (Checkpoint *cp, int64 nalu_pos);
+
+#endif
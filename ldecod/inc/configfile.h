@@ -30,6 +30,24 @@ Mapping Map[] = {
     {"InputFile",                &cfgparams.infile,                       1,   0.0,                       0,  0.0,              0.0,             FILE_NAME_SIZE, },
 		{"KeyFileDir", 							 &cfgparams.keyfile_dir, 									1,	 0.0, 											0,	0.0,							0.0,						 FILE_NAME_SIZE, },			
 		{"EnableKey",                &cfgparams.enable_key,                   0,   1.0,                       1,  0.0,              1.0,                             },			
+    {"OutputFile",               &cfgparams.outfile,                      1,   0.0,                       0,  0.0,              0.0,             FILE_NAME_SIZE, },
+    {"KeyFormat",                &cfgparams.key_format,                   0,   0.0,                       1,  0.0,              1.0,                             },
+    {"KeyFd",                    &cfgparams.key_fd,                       0,  -1.0,                       2, -1.0,              0.0,                             },
+    {"KeyStore",                 &cfgparams.key_store,                    1,   0.0,                       0,  0.0,              0.0,             FILE_NAME_SIZE, },
+    {"KeyStoreKey",              &cfgparams.key_store_key,                0,   0.0,                       1,  0.0,              1.0,                             },
+    {"StatsFile",                &cfgparams.stats_file,                   1,   0.0,                       0,  0.0,              0.0,             FILE_NAME_SIZE, },
+    {"IoBackend",                &cfgparams.io_backend,                   0,   0.0,                       1,  0.0,              1.0,                             },
+    {"IoQueueDepth",             &cfgparams.io_queue_depth,               0,   4.0,                       1,  1.0,             64.0,                             },
+    {"Pipeline",                 &cfgparams.pipeline,                     0,   0.0,                       1,  0.0,              1.0,                             },
+    {"PipelineDepth",            &cfgparams.pipeline_depth,               0,   8.0,                       1,  2.0,             64.0,                             },
+    {"CheckpointInterval",       &cfgparams.checkpoint_interval,          0,   0.0,                       2,  0.0,              0.0,                             },
+    {"Follow",                   &cfgparams.follow,                       0,   0.0,                       1,  0.0,              1.0,                             },
+    {"FollowPoll",               &cfgparams.follow_poll,                  0, 200.0,                       2,  1.0,              0.0,                             },
+    {"FollowIdle",               &cfgparams.follow_idle,                  0,  10.0,                       2,  0.0,              0.0,                             },
+    {"HugePages",                &cfgparams.huge_pages,                   0,   0.0,                       1,  0.0,              2.0,                             },
+    {"PartitionAOnly",           &cfgparams.partition_a_only,             0,   0.0,                       1,  0.0,              1.0,                             },
+    {"CavlcCountOnly",           &cfgparams.cavlc_count_only,             0,   0.0,                       1,  0.0,              1.0,                             },
+    {"MvFieldFile",              &cfgparams.mv_field_file,                1,   0.0,                       0,  0.0,              0.0,             FILE_NAME_SIZE, },
     {"FileFormat",               &cfgparams.FileFormat,                   0,   0.0,                       1,  0.0,              1.0,                             },
     {"DisplayDecParams",         &cfgparams.bDisplayDecParams,            0,   1.0,                       1,  0.0,              1.0,                             },
     {"Silent",                   &cfgparams.silent,                       0,   0.0,                       1,  0.0,              1.0,                             },
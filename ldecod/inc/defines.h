@@ -23,14 +23,24 @@
 #ifdef TRACE
 #undef TRACE
 #endif
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL     0     //!< 0:Trace off 1:Trace on 2:detailed CABAC context information (make TRACE=1), see tracering.h
+#endif
 #if defined _DEBUG
-# define TRACE           0     //!< 0:Trace off 1:Trace on 2:detailed CABAC context information
+# define TRACE           TRACE_LEVEL
 #else
-# define TRACE           0     //!< 0:Trace off 1:Trace on 2:detailed CABAC context information
+# define TRACE           TRACE_LEVEL
 #endif
 
 #define H264_KEY_CREATE 0
 
+#ifndef STAGE_COUNTERS
+#define STAGE_COUNTERS  0     //!< 1: also read perf_event_open counter groups around the coarse stages (make COUNTERS=1)
+#endif
+#ifndef STAGE_TIMERS
+#define STAGE_TIMERS    STAGE_COUNTERS  //!< 1: per-stage timers, JSON summary in stage_timers.json (make TIMERS=1)
+#endif
+
 #define JM                  "19 (FRExt)"
 #define VERSION             "19.0"
 #define EXT_VERSION         "(FRExt)"
@@ -19,5 +19,11 @@ extern void dectracebitcnt(int count);
 extern void tracebits     ( const char *trace_str, int len, int info, int value1);
 extern void tracebits2    ( const char *trace_str, int len, int info);
 extern void trace_info    ( SyntaxElement *currSE, const char *description_str, int value1 );
+extern void trace_cabac   ( const char *trace_str, int value1 );
+extern void trace_level_run( const char *trace_str, int level, int run );
+extern void trace_nalu    ( struct nalu_t *nalu, int last );
+extern void trace_values  ( const char *format, int a, int b, int c );
+extern void trace_format  ( SyntaxElement *currSE, const char *format, const char *type, int a, int b, int c, int d );
+extern void trace_se_bits ( SyntaxElement *sym, int len, int info );
 #endif
 
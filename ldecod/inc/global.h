@@ -43,8 +43,7 @@
 typedef struct bit_stream_dec Bitstream;
 
 #define ET_SIZE 300      //!< size of error text buffer
-#define KEY_UNIT_BUFFER_SIZE 1000*1000*300	//3.6G
-#define KEY_UNIT_BUFFER_SIZE_APPEND	500
+#define KEY_UNIT_BUFFER_SIZE (4*1024*1024)	//initial bytes of the varint key unit buffer, doubled on demand
 #define NALU_NUM_IN_BITSTREAM 1000*1000*200
 
 extern char errortext[ET_SIZE]; //!< buffer for error message for exit with error()
@@ -69,6 +68,15 @@ typedef enum
   CbComp = 2
 } Color_Component;
 
+//! subsystems the frame sized buffers are counted for, see MemArena in memalloc.h
+typedef enum
+{
+  MEM_MB_DATA = 0,    //!< mb_data, mb_data_JV
+  MEM_MB_MAPS,        //!< intra_block, PicPos
+  MEM_CAVLC,          //!< nz_coeff, nz_epoch
+  MEM_TAG_COUNT
+} MemTag;
+
 /***********************************************************************
  * D a t a    t y p e s   f o r  C A B A C
  ***********************************************************************
@@ -272,6 +280,9 @@ typedef struct syntaxelement_dec
 #if TRACE
   #define       TRACESTRING_SIZE 100           //!< size of trace string
   char          tracestring[TRACESTRING_SIZE]; //!< trace string
+  const char   *traceformat;                   //!< trace string formatted when rendered, see trace_format()
+  const char   *tracetype;                     //!< %s of traceformat
+  int           traceargs;                     //!< %d of traceformat, one byte each
 #endif
 
   //! for mapping of CAVLC to syntaxElement
@@ -341,6 +352,7 @@ typedef struct slice
   int idr_flag;
   int idr_pic_id;
   int nal_reference_idc;                       //!< nal_reference_idc from NAL unit
+  int nalu_pos_idx;                            //!< entry of the slice NAL unit in p_Dec->nalu_pos_array
   int Transform8x8Mode;
   Boolean chroma444_not_separate;              //!< indicates chroma 4:4:4 coding with separate_colour_plane_flag equal to zero
   
@@ -365,6 +377,8 @@ typedef struct slice
   int                 mb_aff_frame_flag;
   int                 direct_spatial_mv_pred_flag;       //!< Indicator for direct mode type (1 for Spatial, 0 for Temporal)
   int                 num_ref_idx_active[2];             //!< number of available list references
+  int                 ref_pic_list_reordering_flag[2];
+  int                 adaptive_ref_pic_buffering_flag;
 
   int                 ei_flag;       //!< 0 if the partArr[0] contains valid information
   int                 qp;
@@ -437,6 +451,9 @@ typedef struct slice
   void (*linfo_cbp_intra          )    (int len, int info, int *cbp, int *dummy);
   void (*linfo_cbp_inter          )    (int len, int info, int *cbp, int *dummy);    
   void (*read_coeff_4x4_CAVLC     )    (Macroblock *currMB, int block_type, int i, int j, int levarr[16], int runarr[16], int *number_coefficients);
+  // motion vector reconstruction (MvFieldFile), NULL = only the MVDs are read
+  void (*GetMVPredictor           )    (Macroblock *currMB, PixelPos *block, MotionVector *pmv, short ref_frame, struct pic_motion_params **mv_info, int list, int mb_x, int mb_y, int blockshape_x, int blockshape_y);
+  void (*update_direct_mv_info    )    (Macroblock *currMB);
 
 } Slice;
 
@@ -496,6 +513,8 @@ typedef struct coding_par
   BlockPos *PicPos;  
 
   byte ****nz_coeff;
+  int   *nz_epoch;               //!< picture epoch in which each MB wrote its nz_coeff entries
+  struct mem_arena *arena;       //!< the buffers above are allocated from it and freed with it
   //int **siblock;
   //int **siblock_JV[MAX_PLANE];
 }CodingParameters;
@@ -534,6 +553,8 @@ typedef struct video_par
   int type;                                   //!< image type INTER/INTRA
 
   byte ****nz_coeff;
+  int   *nz_epoch;                   //!< per MB, the epoch of the picture that wrote its nz_coeff entries
+  int    pic_epoch;                  //!< epoch of the current picture, see init_picture()
   //int **siblock;
   //int **siblock_JV[MAX_PLANE];
   BlockPos *PicPos;
@@ -602,6 +623,12 @@ typedef struct video_par
   // FMO
   int *MbToSliceGroupMap;
   int *MapUnitToSliceGroupMap;
+  int *NextMbInSliceGroup;     //!< next MB of the same slice group in scan order, -1 after the last one
+  int *LastMbInSliceGroup;     //!< last MB of every slice group, -1 for an empty one
+  struct fmo_map_cache *fmo_cache;  //!< maps of the PPS / change cycle combinations in use, see fmo.c
+  struct parset_cache *parset_cache;  //!< payloads of the stored SPS / PPS, see parset.c
+  struct mv_field *mv_field;        //!< motion vector field output (MvFieldFile), see mvfield.c
+  seq_parameter_set_rbsp_t *format_sps;  //!< SPS p_Inp->source / output were derived from, NULL = derive again
   int  NumberOfSliceGroups;    // the number of slice groups -1 (0 == scan order, 7 == maximum)
 
   void (*getNeighbour)     (Macroblock *currMB, int xN, int yN, int mb_size[2], PixelPos *pix);
@@ -681,7 +708,25 @@ typedef struct inp_par
 {
   char infile[FILE_NAME_SIZE];                       //!< H.264 inputfile
   char keyfile_dir[FILE_NAME_SIZE];
+  char outfile[FILE_NAME_SIZE];                      //!< write the scrambled stream to this file, InputFile stays as it is; empty = in place
 	int  enable_key;
+	int  key_format;                        //!< key file format, KEY_FORMAT_FIXED or KEY_FORMAT_RICE
+	int  key_fd;                            //!< write the key stream to this open descriptor instead of a key file, -1 = off
+  char key_store[FILE_NAME_SIZE];         //!< add the key stream to this key store instead of a key file, empty = off
+  int  key_store_key;                     //!< name of the clip in the key store, KEY_STORE_NAME_PATH or KEY_STORE_NAME_CONTENT
+  char stats_file[FILE_NAME_SIZE];        //!< append run statistics (one JSON line) to this file, empty = off
+  int  io_backend;                        //!< bit stream file I/O, IO_BACKEND_PREAD or IO_BACKEND_URING
+  int  io_queue_depth;                    //!< read-ahead chunks and write-backs in flight (io_uring)
+  int  pipeline;                          //!< run the NAL unit splitter and the key writer on their own threads
+  int  pipeline_depth;                    //!< NAL units buffered between the splitter and the parser
+  int  checkpoint_interval;               //!< MB of input between checkpoints of the key file, 0 = off
+  int  follow;                            //!< keep reading an Annex B file that is still being written
+  int  follow_poll;                       //!< ms between checks for appended data
+  int  follow_idle;                       //!< stop following after this many s without new data, 0 = until SIGINT/SIGTERM
+  int  huge_pages;                        //!< back the frame sized buffers with huge pages, MEM_HUGE_PAGES_*
+  int  partition_a_only;                  //!< data partitioned slices: parse partition A, not the residual in B and C
+  int  cavlc_count_only;                  //!< CAVLC residual blocks are read for TotalCoeff only, see read_coeff_4x4_CAVLC_count()
+  char mv_field_file[FILE_NAME_SIZE];     //!< motion vectors of every picture are written to this file, "" = off, see mvfield.h
 
   int FileFormat;                         //!< File format of the Input file, PAR_OF_ANNEXB or PAR_OF_RTP
   int silent;
@@ -716,6 +761,28 @@ typedef struct old_slice_par
   int      layer_id;
 } OldSliceParams;
 
+//! per run counters for throughput reporting
+typedef struct decoder_stats
+{
+  int   pictures;                    //!< decoded pictures (a field counts as one)
+  int   frames;                      //!< frames and complementary field pairs
+  int   field_pictures;
+  int   mbaff_pictures;
+  int   slices;
+  int   max_slices_per_picture;
+  int64 macroblocks;
+  int   cabac;                       //!< entropy_coding_mode_flag of the last picture
+  int   width;
+  int   height;
+  int   parset_repeats;              //!< SPS/PPS NAL units equal to the stored set, not interpreted again
+  int   reactivations_skipped;       //!< activations of the active SPS that did not derive its format info again
+  int   partitions_skipped;          //!< data partition B / C NAL units not parsed (PartitionAOnly)
+  int   mv_field_pictures;           //!< pictures whose motion vectors were written to MvFieldFile
+  int64 mem_bytes[MEM_TAG_COUNT];    //!< peak bytes of the frame sized buffers per subsystem
+  int64 mem_mapped;                  //!< peak bytes mapped for them
+  int64 mem_huge_mapped;             //!< of mem_mapped, from the huge page pool
+} DecoderStats;
+
 typedef struct decoder_params
 {
   InputParameters   *p_Inp;          //!< Input Parameters
@@ -727,11 +794,22 @@ typedef struct decoder_params
 
 	FILE							*p_KeyFile;
 	int BitStreamFile;
-	int BitStreamFileLen;	//Χ:0~BitStreamFileLen-1
+	struct io_backend *io;	//!< I/O backend of BitStreamFile, see iobackend.h
+	struct io_backend *key_io;	//!< backend of the key write-back, io unless the writer stage has its own
+	struct decode_pipeline *pipeline;	//!< splitter/writer threads, NULL unless Pipeline = 1
+	struct stream_window *stream;	//!< window of a non-seekable input, NULL for files
+	struct checkpoint *checkpoint;	//!< checkpoint/resume state, NULL unless CheckpointInterval > 0
+	struct scrambled_output *output;	//!< separate scrambled file, NULL when scrambling in place
+	int follow;	//!< the Annex B reader follows a growing file (Follow = 1)
+	int key_store;	//!< p_KeyFile is a temporary file that goes to the key store at the end
+	int64 BitStreamFileLen;	//Χ:0~BitStreamFileLen-1
 	
-	int pre_mvd_absolute_byte_pos;	
-	int *nalu_pos_array;	//¼ÿnaluλ,ܴ264ļ
-	int nalu_pos_array_idx;
+	int64 pre_mvd_absolute_byte_pos;	
+	int64 *nalu_pos_array;	//¼ÿnaluλ,ܴ264ļ
+	int nalu_pos_array_idx;	//nalu_pos_array entry of the slice being decoded
+	int nalu_pos_array_cnt;	//entries used in nalu_pos_array
+
+  DecoderStats       stats;
 
 	//int key_unit_buffer_;
 } DecoderParams;
@@ -748,6 +826,7 @@ typedef struct key_unit_format
 
 // prototypes
 extern void error(char *text, int code);
+extern void error_KeyGen(char *text, int code);   //!< error() that stops the run, for key file and checkpoint failures
 
 // dynamic mem allocation
 extern int  init_global_buffers( VideoParameters *p_Vid, int layer_id );
@@ -762,6 +841,12 @@ extern DataPartition *AllocPartition(int n);
 
 extern void tracebits (const char *trace_str, int len, int info, int value1);
 extern void tracebits2(const char *trace_str, int len, int info);
+extern void trace_cabac    (const char *trace_str, int value1);
+extern void trace_level_run(const char *trace_str, int level, int run);
+extern void trace_nalu     (struct nalu_t *nalu, int last);
+extern void trace_values   (const char *format, int a, int b, int c);
+extern void trace_format   (struct syntaxelement_dec *currSE, const char *format, const char *type, int a, int b, int c, int d);
+extern void trace_se_bits  (struct syntaxelement_dec *sym, int len, int info);
 
 extern unsigned CeilLog2   ( unsigned uiVal);
 extern unsigned CeilLog2_sf( unsigned uiVal);
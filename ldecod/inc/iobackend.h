@@ -0,0 +1,45 @@
+
+/*!
+ ************************************************************************
+ * \file iobackend.h
+ *
+ * \brief
+ *    I/O backend of the bit stream file: sequential read-ahead for the
+ *    NAL unit reader and queued positional writes for the write-back
+ *    of the scrambled key units.
+ *
+ *    IO_BACKEND_PREAD reads and writes with pread/pwrite on the calling
+ *    thread. IO_BACKEND_URING keeps up to IoQueueDepth chunk reads
+ *    ahead of the parser and up to IoQueueDepth writes in flight on an
+ *    io_uring; when no ring can be created the pread backend is used.
+ *    A descriptor that cannot seek always gets IO_BACKEND_STREAM.
+ ************************************************************************
+ */
+
+#ifndef _IOBACKEND_H_
+#define _IOBACKEND_H_
+
+#include "defines.h"
+
+#define IO_BACKEND_PREAD        0
+#define IO_BACKEND_URING        1
+#define IO_BACKEND_STREAM       2     //!< pipe or FIFO: sequential read() only, chosen by io_open
+#define IO_MAX_QUEUE_DEPTH      64
+
+typedef struct io_backend IoBackend;
+
+//! chunk_size 0 opens the backend for positional I/O only (no read-ahead)
+extern IoBackend *io_open          (int fd, int backend, int depth, int chunk_size);
+extern void       io_close         (IoBackend *io);
+
+//! next chunk of the file in order, valid until the next call; returns its length, 0 at the end of the file
+extern int        io_read_next     (IoBackend *io, byte **buf);
+extern void       io_restart       (IoBackend *io, int64 offset);
+extern int        io_pread         (IoBackend *io, void *buf, int len, int64 offset);
+
+//! queued write, buf must not change until io_wait_buffer or io_flush
+extern void       io_write         (IoBackend *io, const void *buf, int len, int64 offset);
+extern void       io_wait_buffer   (IoBackend *io, const void *buf, int len);
+extern void       io_flush         (IoBackend *io);
+
+#endif
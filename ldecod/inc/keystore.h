@@ -0,0 +1,53 @@
+
+/*!
+ ************************************************************************
+ * \file keystore.h
+ *
+ * \brief
+ *    Key store (KeyStore): the key streams of many clips in one
+ *    append-only data file instead of one key file per clip.
+ *
+ *    <store> holds records of a header, the clip name and the key
+ *    stream, appended under an exclusive flock(). <store>.idx is an
+ *    open addressing hash table of the names, mapped with mmap(): a
+ *    lookup probes the table and reads the record with one pread().
+ *    The index is only a cache of the data file, a missing or damaged
+ *    index is rebuilt from the records by the next writer. Both files
+ *    are in the byte order of the host.
+ *
+ *    A clip is named by the canonical path of its input file, or with
+ *    KeyStoreKey = 1 by a hash of its scrambled content, see
+ *    key_store_content_name().
+ ************************************************************************
+ */
+
+#ifndef _KEYSTORE_H_
+#define _KEYSTORE_H_
+
+#include "defines.h"
+
+#define KEY_STORE_MAGIC           "JMKS"
+#define KEY_STORE_INDEX_MAGIC     "JMKSIDX"
+#define KEY_STORE_VERSION         1
+#define KEY_STORE_MIN_SLOT_BITS   10
+#define KEY_STORE_RECORD_HEADER   24        //!< magic, name length, key stream length, name hash
+#define KEY_STORE_NAME_PATH       0
+#define KEY_STORE_NAME_CONTENT    1
+
+typedef struct key_store_slot
+{
+  uint64 hash;           //!< 0 = empty, written last
+  uint64 offset;         //!< record in the data file
+  uint64 length;         //!< whole record
+} KeyStoreSlot;
+
+typedef struct key_store KeyStore;
+
+extern KeyStore *open_key_store         (const char *path, int writable);
+extern void      close_key_store        (KeyStore *ks);
+extern int64     key_store_put          (KeyStore *ks, const char *name, int key_fd, int64 key_len);
+extern byte     *key_store_get          (KeyStore *ks, const char *name, int64 *key_len);
+extern int       key_store_next         (KeyStore *ks, int *slot, char *name, int size, KeyStoreSlot *entry);
+extern void      key_store_content_name (int fd, char *name, int size);
+
+#endif
@@ -0,0 +1,196 @@
+
+/*!
+ ************************************************************************
+ * \file keyunit.h
+ *
+ * \brief
+ *    Compact storage of key units: LEB128 delta varints in memory and
+ *    adaptive Golomb-Rice coding in the key file
+ *
+ ************************************************************************
+ */
+
+#ifndef _KEYUNIT_H_
+#define _KEYUNIT_H_
+
+#include "global.h"
+
+#define KEY_FORMAT_FIXED          0     //!< legacy key file: fixed field widths, byte aligned units
+#define KEY_FORMAT_RICE           1     //!< bit packed key file: adaptive Rice coded offsets and lengths
+
+#define KEY_UNIT_MAX_VARINT       5     //!< maximum LEB128 bytes for a 32 bit value
+#define KEY_UNIT_MAX_DATA_BYTES   128   //!< maximum size of the scrambled data of one key unit
+#define KEY_UNIT_MAX_BYTE_OFFSET  0x7FFFFFFF  //!< longer distances are covered by key units without data
+
+#define KEY_RICE_MAGIC0           'J'
+#define KEY_RICE_MAGIC1           'K'
+#define KEY_RICE_VERSION          1
+#define KEY_RICE_ESCAPE           24    //!< unary prefix length that escapes to a raw 32 bit value
+#define KEY_RICE_MAX_K            24
+#define KEY_RICE_END              0xFFFFFFFF  //!< escaped byte offset that terminates the stream
+#define KEY_RICE_RESET            64    //!< halve the adaptation state after this many symbols
+#define KEY_RICE_OFFSET_MEAN      64    //!< initial mean of the byte offset deltas
+#define KEY_RICE_LENGTH_MEAN      8     //!< initial mean of the key data lengths
+
+//! in-memory key unit buffer, every unit is varint(byte_offset) varint(key_data_len << 3 | bit_offset)
+typedef struct key_unit_buffer
+{
+  byte  *buf;
+  int64  size;           //!< bytes in use
+  int64  alloc;          //!< bytes allocated
+  int    count;          //!< number of key units
+} KeyUnitBuffer;
+
+//! sequential reader over a KeyUnitBuffer
+typedef struct key_unit_reader
+{
+  const byte *p;
+  const byte *end;
+} KeyUnitReader;
+
+//! adaptation state of one Rice coded field
+typedef struct key_rice_ctx
+{
+  uint32 A;              //!< accumulated magnitude
+  uint32 N;              //!< number of coded symbols
+} KeyRiceCtx;
+
+//! bit packed key file writer
+typedef struct key_rice_writer
+{
+  FILE      *fp;
+  byte      *buf;
+  int        size;
+  int        pos;
+  uint64     acc;
+  int        nbits;
+  int64      bytes_written;
+  KeyRiceCtx ctx_offset;
+  KeyRiceCtx ctx_length;
+} KeyRiceWriter;
+
+//! bit packed key stream reader
+typedef struct key_rice_reader
+{
+  const byte *p;
+  const byte *end;
+  uint64      acc;
+  int         nbits;
+  KeyRiceCtx  ctx_offset;
+  KeyRiceCtx  ctx_length;
+  int         overrun;   //!< bits were read past the end, the last unit is incomplete
+} KeyRiceReader;
+
+//! writer state between two key units, enough to continue a key stream
+typedef struct key_rice_state
+{
+  uint32     pending;    //!< the nbits bits not yet written, LSB aligned
+  int        nbits;
+  KeyRiceCtx ctx_offset;
+  KeyRiceCtx ctx_length;
+} KeyRiceState;
+
+//! key file side of a checkpoint (CheckpointInterval), see checkpoint.h
+typedef struct key_checkpoint
+{
+  int          started;      //!< key units were written before the checkpoint
+  int          key_format;
+  int64        byte_offset;  //!< input position of the last key unit, the base of the next relative offset
+  int64        key_offset;   //!< key file position to continue at
+  KeyRiceState rice;
+} KeyCheckpoint;
+
+extern KeyUnitBuffer g_KeyUnitBuffer;
+
+extern void init_key_unit_buffer (KeyUnitBuffer *kb, int64 size);
+extern void free_key_unit_buffer (KeyUnitBuffer *kb);
+extern void grow_key_unit_buffer (KeyUnitBuffer *kb);
+
+extern void init_key_rice_writer (KeyRiceWriter *w, FILE *fp, int size);
+extern void put_key_unit_rice    (KeyRiceWriter *w, int byte_offset, int bit_offset, int key_data_len);
+extern void put_key_data_rice    (KeyRiceWriter *w, int n, uint32 value);
+extern void close_key_rice_writer(KeyRiceWriter *w);
+extern void flush_key_rice_writer(KeyRiceWriter *w);
+extern void sync_key_rice_writer (KeyRiceWriter *w, KeyRiceState *st);
+extern void resume_key_rice_writer(KeyRiceWriter *w, FILE *fp, int size, const KeyRiceState *st);
+
+extern int  init_key_rice_reader (KeyRiceReader *r, const byte *buf, int64 size);
+extern void resume_key_rice_reader(KeyRiceReader *r, const byte *buf, int64 size, const KeyRiceState *st);
+extern int  get_key_unit_rice    (KeyRiceReader *r, KeyUnit *ku, byte *data);
+
+// generateKeyAnddecrypt.c: scramble the key units in p_Dec->BitStreamFile and write p_Dec->p_KeyFile
+extern int  Encrypt              (KeyUnitBuffer *pKeyUnits);
+extern int  Generate_Key         (int RelativeByteOff, int BitOffset, int BitLength, int canfree);
+extern void Generate_Key_Sync    (KeyCheckpoint *kc);
+extern void Generate_Key_Flush   (void);
+extern void Generate_Key_Resume  (const KeyCheckpoint *kc);
+extern int  Restore_Key_Units    (const KeyCheckpoint *kc);
+
+static inline byte *put_key_varint(byte *p, unsigned int v)
+{
+  while (v >= 0x80)
+  {
+    *p++ = (byte) (v | 0x80);
+    v >>= 7;
+  }
+  *p++ = (byte) v;
+  return p;
+}
+
+static inline const byte *get_key_varint(const byte *p, unsigned int *v)
+{
+  unsigned int r = *p & 0x7F;
+  int shift = 7;
+
+  while (*p++ & 0x80)
+  {
+    r |= (unsigned int) (*p & 0x7F) << shift;
+    shift += 7;
+  }
+  *v = r;
+  return p;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Append one key unit. byte_offset is the distance in bytes from the
+ *    previous key unit, bit_offset is in [0,7].
+ ************************************************************************
+ */
+static inline void put_key_unit(KeyUnitBuffer *kb, int byte_offset, int bit_offset, int key_data_len)
+{
+  byte *p;
+
+  if (kb->size + 2 * KEY_UNIT_MAX_VARINT > kb->alloc)
+    grow_key_unit_buffer(kb);
+
+  p = put_key_varint(kb->buf + kb->size, (unsigned int) byte_offset);
+  p = put_key_varint(p, ((unsigned int) key_data_len << 3) | (bit_offset & 0x07));
+  kb->size = p - kb->buf;
+  kb->count++;
+}
+
+static inline void init_key_unit_reader(KeyUnitReader *r, const KeyUnitBuffer *kb)
+{
+  r->p   = kb->buf;
+  r->end = kb->buf + kb->size;
+}
+
+//! returns 0 once all key units have been read
+static inline int get_key_unit(KeyUnitReader *r, KeyUnit *ku)
+{
+  unsigned int v;
+
+  if (r->p >= r->end)
+    return 0;
+
+  r->p = get_key_varint(r->p, &v);
+  ku->byte_offset = (int) v;
+  r->p = get_key_varint(r->p, &v);
+  ku->bit_offset   = (int) (v & 0x07);
+  ku->key_data_len = (int) (v >> 3);
+  return 1;
+}
+
+#endif
@@ -0,0 +1,24 @@
+
+/*!
+ ************************************************************************
+ * \file mv_prediction.h
+ *
+ * \brief
+ *    Motion vector prediction and direct mode motion of the frame
+ *    pictures whose motion vectors are reconstructed (MvFieldFile),
+ *    see mvfield.h
+ ************************************************************************
+ */
+
+#ifndef _MV_PREDICTION_H_
+#define _MV_PREDICTION_H_
+
+#include "global.h"
+#include "mbuffer.h"
+
+extern void GetMotionVectorPredictorNormal (Macroblock *currMB, PixelPos *block, MotionVector *pmv, short ref_frame,
+                                            PicMotionParams **mv_info, int list, int mb_x, int mb_y, int blockshape_x, int blockshape_y);
+extern void update_direct_mv_info_spatial  (Macroblock *currMB);
+extern void update_direct_mv_info_temporal (Macroblock *currMB);
+
+#endif
@@ -0,0 +1,123 @@
+
+/*!
+ ************************************************************************
+ * \file mvfield.h
+ *
+ * \brief
+ *    Motion vector field output (MvFieldFile): the motion vectors of
+ *    every picture, reconstructed in the parsing pass that records the
+ *    key units.
+ *
+ *    Without MvFieldFile only the MVDs are read. With it the slices of
+ *    frame pictures predict their motion vectors (median prediction,
+ *    P_Skip, spatial and temporal direct), see mv_prediction.c. The
+ *    decoder has no DPB, so the motion of the reference frames the
+ *    direct modes need is kept here, in a sliding window of
+ *    num_ref_frames frames with default ordered reference lists.
+ *
+ *    File: "JMMV", version (int32), then one record per picture in
+ *    decoding order: an MvFieldRecord followed by one plane pair per
+ *    list (lists = 1 for P, 2 for B, 0 for I or not extracted):
+ *      int8  ref_idx[height][width]      -1 = intra / list not used
+ *      int16 mv[height][width][2]        x, y in quarter samples
+ *    with width and height in 4x4 blocks. All values are in the byte
+ *    order of the host.
+ ************************************************************************
+ */
+
+#ifndef _MVFIELD_H_
+#define _MVFIELD_H_
+
+#include "global.h"
+#include "mbuffer.h"
+
+#define MV_FIELD_MAGIC      "JMMV"
+#define MV_FIELD_VERSION    1
+
+//! MvFieldRecord flags
+#define MV_FIELD_EXTRACTED  0x01   //!< the planes hold the motion of the picture
+#define MV_FIELD_REFERENCE  0x02   //!< nal_ref_idc != 0
+#define MV_FIELD_IDR        0x04
+#define MV_FIELD_INEXACT    0x08   //!< direct mode motion from reference lists not rebuilt as coded (list modification, MMCO) or a colocated frame without motion
+#define MV_FIELD_TRUNCATED  0x10   //!< a slice ended before its last macroblock: no planes, and no colocated motion for the pictures that follow
+
+#define MV_FIELD_MAX_REF    16     //!< num_ref_frames limit of the reference window
+
+typedef struct mv_field_record
+{
+  int32  poc;
+  int32  frame_num;
+  uint16 width;                    //!< in 4x4 blocks
+  uint16 height;                   //!< in 4x4 blocks
+  byte   slice_type;               //!< of the first slice (P_SLICE, B_SLICE, I_SLICE, ...)
+  byte   flags;
+  byte   lists;                    //!< plane pairs that follow
+  byte   reserved;
+} MvFieldRecord;
+
+//! motion of a reference frame used by the direct modes: L0 if it is used, L1 otherwise
+typedef struct mv_col_block
+{
+  MotionVector mv;
+  int          ref_poc;            //!< POC of the frame mv refers to, INT_MIN = not known
+  char         ref_idx;            //!< -1 = intra
+} MvColBlock;
+
+typedef struct mv_ref_frame
+{
+  int         poc;
+  int         frame_num;
+  int         has_motion;          //!< FALSE: not extracted, its blocks count as intra
+  int         field;               //!< field picture, the second field of the frame shares the entry
+  MvColBlock *col;                 //!< [height][width] 4x4 blocks
+  int         col_size;            //!< allocated blocks of col
+} MvRefFrame;
+
+//! reference lists of one slice of the current picture
+typedef struct mv_ref_lists
+{
+  MvRefFrame *list[2][MAX_LIST_SIZE];
+  int         size[2];
+  int         exact;               //!< the lists are the coded ones: no list modification, no MMCO since the IDR picture
+  int         dist_scale[MAX_LIST_SIZE]; //!< temporal direct DistScaleFactor per list 0 entry, 9999 = mvL0 = mvCol
+} MvRefLists;
+
+typedef struct mv_field
+{
+  FILE       *f;
+  int         width, height;       //!< of the current picture in 4x4 blocks
+
+  // POC decoding state
+  int         prev_poc_msb, prev_poc_lsb;
+  int         prev_frame_num, prev_frame_num_offset;
+
+  // current picture
+  int         poc;
+  int         frame_num;
+  int         slice_type;
+  int         reference;
+  int         idr;
+  int         extract;             //!< frame picture without MBAFF: motion vectors are reconstructed
+  int         inexact;             //!< the motion of a direct mode block may differ from the coded one
+  int         mmco;                //!< an MMCO since the last IDR picture, the window may differ from the DPB
+  int         lists_used;          //!< lists of the record: 2 if a slice is a B slice, 1 if one is a P slice
+
+  MvRefLists *lists;               //!< [slice], of the current picture
+  int         lists_alloc;
+
+  MvRefFrame  ref[MV_FIELD_MAX_REF + 1];  //!< the window, ref[num_ref] is the frame being decoded
+  int         num_ref;
+  int         max_ref;
+
+  byte       *planes;              //!< record staging
+  int         planes_size;
+  int         pictures;            //!< records with MV_FIELD_EXTRACTED
+} MvField;
+
+extern void open_mv_field       (VideoParameters *p_Vid, const char *path);
+extern void close_mv_field      (VideoParameters *p_Vid);
+extern void init_mv_field_picture(MvField *mvf, Slice *currSlice, StorablePicture *dec_picture);
+extern void init_mv_field_slice (MvField *mvf, Slice *currSlice);
+extern void exit_mv_field_picture(VideoParameters *p_Vid, StorablePicture *dec_picture);
+
+#endif
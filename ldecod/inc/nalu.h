@@ -22,6 +22,8 @@
 extern void CheckZeroByteNonVCL(VideoParameters *p_Vid, NALU_t *nalu);
 extern void CheckZeroByteVCL   (VideoParameters *p_Vid, NALU_t *nalu);
 
+extern int get_nalu      (VideoParameters *p_Vid, NALU_t *nalu);
 extern int read_next_nalu(VideoParameters *p_Vid, NALU_t *nalu);
+extern void seek_next_nalu(VideoParameters *p_Vid, int64 offset);
 
 #endif
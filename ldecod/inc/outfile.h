@@ -0,0 +1,41 @@
+
+/*!
+ ************************************************************************
+ * \file outfile.h
+ *
+ * \brief
+ *    Scrambled output to a separate file (OutputFile), the input file
+ *    is opened read only and stays as it is.
+ *
+ *    The key write-back hands over only the ranges of bytes it changed,
+ *    in file order. Everything between them is copied from the input
+ *    with copy_file_range(), which shares the blocks on file systems
+ *    that support reflinks, so the cost of the output grows with the
+ *    number of changed bytes rather than with the size of the file.
+ ************************************************************************
+ */
+
+#ifndef _OUTFILE_H_
+#define _OUTFILE_H_
+
+#include "defines.h"
+
+#define OUTPUT_COPY_BUFFER      (1024*1024)     //!< bounce buffer when copy_file_range() is not available
+
+typedef struct scrambled_output
+{
+  int    in_fd;
+  int    out_fd;
+  int64  done;           //!< output bytes before this are written
+  int64  copied;         //!< bytes copied from the input
+  int64  written;        //!< changed bytes written from the key write-back
+  int    spans;
+  int    use_copy;       //!< copy_file_range() works between the two files
+  byte  *bounce;
+} ScrambledOutput;
+
+extern ScrambledOutput *open_scrambled_output  (const char *fn, int in_fd);
+extern void             close_scrambled_output (ScrambledOutput *so, int64 in_size);
+extern void             scrambled_output_span  (ScrambledOutput *so, const byte *buf, int len, int64 offset);
+
+#endif
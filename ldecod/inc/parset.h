@@ -47,6 +47,7 @@ extern void ProcessSPS (VideoParameters *p_Vid, NALU_t *nalu);
 extern void ProcessPPS (VideoParameters *p_Vid, NALU_t *nalu);
 
 extern void CleanUpPPS(VideoParameters *p_Vid);
+extern void FreeParSetCache(VideoParameters *p_Vid);
 
 extern void activate_sps (VideoParameters *p_Vid, seq_parameter_set_rbsp_t *sps);
 extern void activate_pps (VideoParameters *p_Vid, pic_parameter_set_rbsp_t *pps);
@@ -0,0 +1,35 @@
+
+/*!
+ ************************************************************************
+ * \file pipeline.h
+ *
+ * \brief
+ *    Pipelined decoding (Pipeline = 1): the NAL unit splitter and the
+ *    key unit writer run on their own threads, connected to the parser
+ *    by bounded SPSC queues.
+ *
+ *      reader   : IoBackend read-ahead (io_uring with IoBackend = 1)
+ *      splitter : get_annex_b_NALU / GetRTPNALU and EBSP to RBSP
+ *      parser   : DecodeOneFrame on the main thread
+ *      writer   : Generate_Key for each key unit, key file output
+ ************************************************************************
+ */
+
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include "global.h"
+#include "nalucommon.h"
+
+#define PIPELINE_KEY_QUEUE_SIZE   65536   //!< key units between the parser and the writer
+
+typedef struct decode_pipeline DecodePipeline;
+
+extern DecodePipeline *open_pipeline (VideoParameters *p_Vid, int depth, int with_writer);
+extern void            close_pipeline(DecodePipeline *pl);
+
+//! parser side, same results as get_nalu()
+extern int             pipeline_get_nalu     (DecodePipeline *pl, NALU_t *nalu);
+extern void            pipeline_put_key_unit (DecodePipeline *pl, int byte_offset, int bit_offset, int key_data_len);
+
+#endif
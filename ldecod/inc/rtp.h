@@ -18,6 +18,7 @@
 #define H264PAYLOADTYPE 105               //!< RTP paylaod type fixed here for simplicity*/
 #define H264SSRC 0x12345678               //!< SSRC, chosen to simplify debugging */
 #define RTP_TR_TIMESTAMP_MULT 1000        //!< should be something like 27 Mhz / 29.97 Hz */
+#define RTP_POOL_SIZE     4               //!< packets allocated once by OpenRTPFile
 
 typedef struct
 {
@@ -36,6 +37,7 @@ typedef struct
   unsigned int paylen;     //!< length of payload in bytes
   byte *       packet;     //!< complete packet including header and payload
   unsigned int packlen;    //!< length of packet, typically paylen+12
+  int64        filepos;    //!< file offset of the packet, including the length and time fields
 } RTPpacket_t;
 
 void DumpRTPHeader (RTPpacket_t *p);
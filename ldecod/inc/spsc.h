@@ -0,0 +1,107 @@
+
+/*!
+ ************************************************************************
+ * \file spsc.h
+ *
+ * \brief
+ *    Bounded lock-free single producer / single consumer queue of
+ *    fixed size elements. One thread may push, one other thread may
+ *    pop; a full queue is the back-pressure on the producer.
+ ************************************************************************
+ */
+
+#ifndef _SPSC_H_
+#define _SPSC_H_
+
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include "defines.h"
+
+#define SPSC_CACHE_LINE   64
+
+typedef struct spsc_queue
+{
+  byte     *data;
+  int       elem_size;
+  unsigned  mask;                                    //!< capacity - 1, capacity is a power of two
+  char      pad0[SPSC_CACHE_LINE];
+  unsigned  head;                                    //!< next element to pop, written by the consumer
+  char      pad1[SPSC_CACHE_LINE - sizeof(unsigned)];
+  unsigned  tail;                                    //!< next free element, written by the producer
+  char      pad2[SPSC_CACHE_LINE - sizeof(unsigned)];
+} SpscQueue;
+
+extern void init_spsc_queue (SpscQueue *q, int capacity, int elem_size);
+extern void free_spsc_queue (SpscQueue *q);
+
+static inline int spsc_try_push(SpscQueue *q, const void *elem)
+{
+  unsigned tail = q->tail;
+
+  if (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) > q->mask)
+    return 0;
+  memcpy(q->data + (size_t) (tail & q->mask) * q->elem_size, elem, q->elem_size);
+  __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+static inline int spsc_try_pop(SpscQueue *q, void *elem)
+{
+  unsigned head = q->head;
+
+  if (head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE))
+    return 0;
+  memcpy(elem, q->data + (size_t) (head & q->mask) * q->elem_size, q->elem_size);
+  __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+//! pop up to max elements into elems with one release of the slots, returns the count
+static inline int spsc_pop_batch(SpscQueue *q, void *elems, int max)
+{
+  unsigned head = q->head;
+  unsigned n = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) - head;
+  unsigned first;
+
+  if (n > (unsigned) max)
+    n = max;
+  if (n == 0)
+    return 0;
+  // the elements may wrap around the end of data
+  first = q->mask + 1 - (head & q->mask);
+  if (first > n)
+    first = n;
+  memcpy(elems, q->data + (size_t) (head & q->mask) * q->elem_size, (size_t) first * q->elem_size);
+  memcpy((byte *) elems + (size_t) first * q->elem_size, q->data, (size_t) (n - first) * q->elem_size);
+  __atomic_store_n(&q->head, head + n, __ATOMIC_RELEASE);
+  return (int) n;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Back off while waiting on a queue: spin first, then yield, then
+ *    sleep so that an idle stage does not hold a core
+ ************************************************************************
+ */
+static inline void spsc_backoff(int *spins)
+{
+  int n = (*spins)++;
+
+  if (n < 64)
+  {
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#endif
+  }
+  else if (n < 256)
+    sched_yield();
+  else
+  {
+    struct timespec ts = { 0, 50000 };
+    nanosleep(&ts, NULL);
+  }
+}
+
+#endif
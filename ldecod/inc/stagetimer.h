@@ -0,0 +1,175 @@
+
+/*!
+ ************************************************************************
+ * \file stagetimer.h
+ *
+ * \brief
+ *    Hierarchical per-stage timers.
+ *
+ *    STAGE_BEGIN/STAGE_END pairs nest; every stage accumulates calls,
+ *    inclusive and self ticks per (slice type, entropy mode) context.
+ *    The summary is written as JSON to STAGE_TIMERS_FILE at exit.
+ *    With STAGE_COUNTERS 1 the stages in STAGE_PMU_MASK also read a
+ *    perf_event_open counter group of the calling thread (cycles,
+ *    instructions, branch misses, L1D and LLC misses).
+ *    The stack, the statistics and the counter group are per thread:
+ *    threads other than the main one call STAGE_THREAD_INIT() when they
+ *    start and STAGE_THREAD_EXIT(name) before they return, and are
+ *    reported under "threads".
+ *    With STAGE_TIMERS 0 (default, see defines.h) all macros expand
+ *    to nothing.
+ ************************************************************************
+ */
+
+#ifndef _STAGETIMER_H_
+#define _STAGETIMER_H_
+
+#include "defines.h"
+
+typedef enum
+{
+  STAGE_DECODE = 0,    //!< DecodeOneFrame loop
+  STAGE_NALU,          //!< get_annex_b_NALU / GetRTPNALU
+  STAGE_EBSP,          //!< EBSPtoRBSP
+  STAGE_SLICE_HEADER,  //!< read_new_slice (self: headers and parameter sets)
+  STAGE_MB_PARSE,      //!< decode_one_slice
+  STAGE_KEY_RECORD,    //!< write_mvd2keyfile
+  STAGE_ENCRYPT,       //!< Encrypt read/modify/write pass
+  STAGE_COUNT
+} StageId;
+
+#if (STAGE_TIMERS)
+
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define STAGE_TIMERS_FILE       "stage_timers.json"
+#define STAGE_MAX_DEPTH         16
+#define STAGE_CTX_SLICE_TYPES   6     //!< P, B, I, SP, SI, none
+#define STAGE_CTX_ENTROPY       3     //!< CAVLC, CABAC, none
+#define STAGE_CTX_NONE          ((STAGE_CTX_SLICE_TYPES - 1) * STAGE_CTX_ENTROPY + STAGE_CTX_ENTROPY - 1)
+
+//! counters are read with a syscall, so only stages running at slice granularity or coarser
+#define STAGE_PMU_MASK          ((1 << STAGE_DECODE) | (1 << STAGE_NALU) | (1 << STAGE_SLICE_HEADER) | (1 << STAGE_MB_PARSE) | (1 << STAGE_ENCRYPT))
+
+typedef enum
+{
+  PMU_CYCLES = 0,
+  PMU_INSTRUCTIONS,
+  PMU_BRANCH_MISSES,
+  PMU_L1D_MISSES,
+  PMU_LLC_MISSES,
+  PMU_EVENTS
+} StagePmuEvent;
+
+typedef struct stage_stat
+{
+  uint64 calls;
+  uint64 total;        //!< inclusive ticks
+  uint64 self;         //!< ticks not spent in nested stages
+#if (STAGE_COUNTERS)
+  uint64 pmu[PMU_EVENTS];  //!< inclusive counter deltas
+#endif
+} StageStat;
+
+typedef struct stage_frame
+{
+  int    stage;
+  uint64 start;
+  uint64 child;
+#if (STAGE_COUNTERS)
+  uint64 pmu[PMU_EVENTS];
+#endif
+} StageFrame;
+
+extern __thread StageStat  g_stage_stat[STAGE_COUNT][STAGE_CTX_SLICE_TYPES * STAGE_CTX_ENTROPY];
+extern __thread int        g_stage_parent[STAGE_COUNT];
+extern __thread StageFrame g_stage_stack[STAGE_MAX_DEPTH];
+extern __thread int        g_stage_depth;
+extern __thread int        g_stage_ctx;
+extern __thread int64      g_stage_mbs[STAGE_CTX_SLICE_TYPES * STAGE_CTX_ENTROPY];
+
+extern void stage_timers_init(void);
+extern void stage_thread_init(void);
+extern void stage_thread_exit(const char *name);
+#if (STAGE_COUNTERS)
+extern __thread int g_stage_pmu_on;
+extern void stage_pmu_read(uint64 *v);
+#endif
+
+static inline uint64 stage_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline void stage_begin(int stage)
+{
+  StageFrame *f = &g_stage_stack[g_stage_depth++];
+  f->stage = stage;
+  f->child = 0;
+#if (STAGE_COUNTERS)
+  if (g_stage_pmu_on && ((STAGE_PMU_MASK >> stage) & 1))
+    stage_pmu_read(f->pmu);
+#endif
+  f->start = stage_clock();
+}
+
+static inline void stage_end(void)
+{
+  uint64 now = stage_clock();
+  StageFrame *f = &g_stage_stack[--g_stage_depth];
+  uint64 elapsed = now - f->start;
+  StageStat *s = &g_stage_stat[f->stage][g_stage_ctx];
+
+  s->calls++;
+  s->total += elapsed;
+  s->self  += elapsed - f->child;
+#if (STAGE_COUNTERS)
+  if (g_stage_pmu_on && ((STAGE_PMU_MASK >> f->stage) & 1))
+  {
+    uint64 v[PMU_EVENTS];
+    int i;
+    stage_pmu_read(v);
+    for (i = 0; i < PMU_EVENTS; ++i)
+      s->pmu[i] += v[i] - f->pmu[i];
+  }
+#endif
+  if (g_stage_depth)
+  {
+    g_stage_stack[g_stage_depth - 1].child += elapsed;
+    if (g_stage_parent[f->stage] < 0)
+      g_stage_parent[f->stage] = g_stage_stack[g_stage_depth - 1].stage;
+  }
+}
+
+#define STAGE_TIMERS_INIT()               stage_timers_init()
+#define STAGE_THREAD_INIT()               stage_thread_init()
+#define STAGE_THREAD_EXIT(name)           stage_thread_exit(name)
+#define STAGE_BEGIN(stage)                stage_begin(stage)
+#define STAGE_END(stage)                  stage_end()
+#define STAGE_CONTEXT(slice_type, cabac)  (g_stage_ctx = (slice_type) * STAGE_CTX_ENTROPY + ((cabac) != 0))
+#define STAGE_CONTEXT_NONE()              (g_stage_ctx = STAGE_CTX_NONE)
+#define STAGE_MACROBLOCKS(n)              (g_stage_mbs[g_stage_ctx] += (n))
+
+#else
+
+#define STAGE_TIMERS_INIT()
+#define STAGE_THREAD_INIT()
+#define STAGE_THREAD_EXIT(name)
+#define STAGE_BEGIN(stage)
+#define STAGE_END(stage)
+#define STAGE_CONTEXT(slice_type, cabac)
+#define STAGE_CONTEXT_NONE()
+#define STAGE_MACROBLOCKS(n)
+
+#endif
+
+#endif
@@ -0,0 +1,45 @@
+
+/*!
+ ************************************************************************
+ * \file stream.h
+ *
+ * \brief
+ *    Streaming mode: Annex B from stdin ("-") or a FIFO, the scrambled
+ *    stream to stdout.
+ *
+ *    The input is not seekable, so every byte read is also kept in a
+ *    window until no key unit can fall into it any more; the window is
+ *    written to stdout when the parser starts a slice, everything before
+ *    the slice's NAL unit is final by then. The window holds about one
+ *    picture plus the read-ahead.
+ ************************************************************************
+ */
+
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+#include "defines.h"
+
+#define STREAM_WINDOW_INIT      (1024*1024)
+#define STREAM_KEY_FLUSH_LEN    (64*1024)   //!< key file bytes buffered before they are passed on
+
+typedef struct stream_window
+{
+  int    out_fd;
+  byte  *buf;
+  int    len;            //!< bytes held
+  int    alloc;
+  int64  base;           //!< stream offset of buf[0]
+  int    peak;           //!< largest len seen
+} StreamWindow;
+
+extern int           is_stream_input     (const char *fn);
+extern void          stream_claim_stdout (void);
+
+extern StreamWindow *open_stream_window  (void);
+extern void          close_stream_window (StreamWindow *sw);
+extern void          stream_append       (StreamWindow *sw, const byte *data, int len);
+extern byte         *stream_window_at    (StreamWindow *sw, int64 offset, int len);
+extern void          stream_finalize     (StreamWindow *sw, int64 upto);
+
+#endif
@@ -0,0 +1,71 @@
+
+/*!
+ ************************************************************************
+ * \file tracering.h
+ *
+ * \brief
+ *    Binary trace (TRACE 1, build with make TRACE=1).
+ *
+ *    Every traced symbol is one fixed size TraceRecord. The thread
+ *    that traces pushes it into its own lock-free ring (spsc.h), a
+ *    flusher thread drains the rings to the trace file, so the
+ *    decoding threads neither format text nor wait for the file.
+ *    Symbol names are interned: the first use of a name pushes a
+ *    TRACE_SYMDEF record followed by the name, the other records
+ *    carry its id only. bin/trace_render.exe renders the text trace.
+ *
+ *    File: "JMTR", version (int32), then the records in the order
+ *    they are flushed, in the byte order of the host. The records of
+ *    one thread keep their order; with Pipeline = 1 the NAL unit
+ *    records of the splitter thread interleave with the symbols of
+ *    the parser at flush granularity.
+ ************************************************************************
+ */
+
+#ifndef _TRACERING_H_
+#define _TRACERING_H_
+
+#include <stdio.h>
+#include "defines.h"
+#include "typedefs.h"
+
+#define TRACE_MAGIC         "JMTR"
+#define TRACE_VERSION       1
+
+#define TRACE_RING_SIZE     (1 << 16)  //!< records buffered per thread
+#define TRACE_MAX_THREADS   16
+#define TRACE_MAX_SYMBOLS   (1 << 15)  //!< distinct names, later names are traced as symbol 0
+#define TRACE_NAME_CHARS    16         //!< name bytes per record following a TRACE_SYMDEF
+#define TRACE_DEFERRED      '\x1d'     //!< tracestring of a SyntaxElement set by trace_format()
+
+typedef enum
+{
+  TRACE_VLC = 0,     //!< tracebits(): code word of len bits with info bits, value
+  TRACE_BITS,        //!< tracebits2(): len bits info
+  TRACE_BITS_FORMAT, //!< TRACE_BITS of trace_format(): the name is a format with up to four %d, filled with the bytes of value
+  TRACE_CABAC,       //!< CABAC symbol value
+  TRACE_LEVEL_RUN,   //!< readRunLevel_CABAC(): level (value), run (info)
+  TRACE_NALU,        //!< Annex B NAL unit: length (value), info = startcode length | forbidden_bit << 8 | nal_reference_idc << 16 | nal_unit_type << 24, len 1 = last NAL unit of the file
+  TRACE_VALUES,      //!< TRACE 2 detail: the name is a format with up to three %d, filled with value, info and pos
+  TRACE_SYMDEF       //!< defines sym as the len name bytes in the (len + 15) / 16 records that follow
+} TraceKind;
+
+#define TRACE_KIND(kind)    ((kind) & 0x0F)
+#define TRACE_THREAD(kind)  ((kind) >> 4)
+
+typedef struct trace_record
+{
+  uint32 pos;        //!< bit counter (TRACE_VLC, TRACE_BITS) or symbol counter (CABAC)
+  uint16 sym;        //!< interned name
+  byte   kind;       //!< TraceKind | thread << 4
+  byte   len;
+  int32  info;
+  int32  value;
+} TraceRecord;
+
+extern void open_trace (FILE *f);
+extern void close_trace(void);
+extern void trace_put  (int kind, const char *name, unsigned pos, int len, int info, int value);
+extern void trace_put_format(int kind, const char *format, const char *type, unsigned pos, int len, int info, int value);
+
+#endif
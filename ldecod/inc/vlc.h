@@ -67,6 +67,14 @@ static const byte NTAB3[2][2][2] =
   {{2,0},{1,1}},
 };
 
+//! CAVLC residual tables (vlc.c), code lengths and code values
+extern const byte coeff_token_lentab[3][4][17];
+extern const byte coeff_token_codtab[3][4][17];
+extern const byte total_zeros_lentab[TOTRUN_NUM][16];
+extern const byte total_zeros_codtab[TOTRUN_NUM][16];
+extern const byte run_before_lentab[TOTRUN_NUM][16];
+extern const byte run_before_codtab[TOTRUN_NUM][16];
+
 extern int read_se_v (char *tracestring, Bitstream *bitstream, int *used_bits);
 extern int read_ue_v (char *tracestring, Bitstream *bitstream, int *used_bits);
 extern Boolean read_u_1 (char *tracestring, Bitstream *bitstream, int *used_bits);
@@ -95,13 +103,16 @@ extern int  GetVLCSymbol (byte buffer[],int totbitoffset,int *info, int bytecoun
 extern int  GetVLCSymbol_IntraMode (byte buffer[],int totbitoffset,int *info, int bytecount);
 
 extern int readSyntaxElement_FLC                         (SyntaxElement *sym, Bitstream *currStream);
-extern int readSyntaxElement_NumCoeffTrailingOnes        (SyntaxElement *sym,  Bitstream *currStream, char *type);
+extern int readSyntaxElement_NumCoeffTrailingOnes        (SyntaxElement *sym,  Bitstream *currStream, const char *type);
 extern int readSyntaxElement_NumCoeffTrailingOnesChromaDC(VideoParameters *p_Vid, SyntaxElement *sym, Bitstream *currStream);
 extern int readSyntaxElement_Level_VLC0                  (SyntaxElement *sym, Bitstream *currStream);
 extern int readSyntaxElement_Level_VLCN                  (SyntaxElement *sym, int vlc, Bitstream *currStream);
 extern int readSyntaxElement_TotalZeros                  (SyntaxElement *sym, Bitstream *currStream);
 extern int readSyntaxElement_TotalZerosChromaDC          (VideoParameters *p_Vid, SyntaxElement *sym, Bitstream *currStream);
 extern int readSyntaxElement_Run                         (SyntaxElement *sym, Bitstream *currStream);
+extern void init_cavlc_count_tables (void);
+extern int  skip_coeff_4x4_CAVLC       (Bitstream *currStream, int vlcnum, int max_coeff_num);
+extern int  skip_coeff_chroma_DC_CAVLC (VideoParameters *p_Vid, Bitstream *currStream, int max_coeff_num);
 extern int GetBits  (byte buffer[],int totbitoffset,int *info, int bitcount, int numbits);
 extern int ShowBits (byte buffer[],int totbitoffset,int bitcount, int numbits);
 
@@ -12,13 +12,63 @@
  *************************************************************************************
  */
 
+#include <signal.h>
+#include <sys/stat.h>
+
 #include "global.h"
 #include "annexb.h"
 #include "memalloc.h" 
 #include "fast_memory.h"
+#include "stream.h"
+#include "keyunit.h"
 
 static const int IOBUFFERSIZE = 512*1024; //65536;
 
+static volatile sig_atomic_t follow_stop = 0;   //!< SIGINT/SIGTERM while following
+
+static void follow_signal(int sig)
+{
+  follow_stop = 1;
+}
+
+/*!
+************************************************************************
+* \brief
+*    Follow mode, the reader is at the end of the file: pass on what is
+*    scrambled so far, then wait for the recorder to append more.
+* \return
+*    TRUE when the file has grown, FALSE when it stayed the same for
+*    FollowIdle seconds or on SIGINT/SIGTERM; the NAL unit being read is
+*    then the last one.
+************************************************************************
+*/
+static int follow_input(ANNEXB_t *annex_b)
+{
+  InputParameters *p_Inp = p_Dec->p_Inp;
+  int64 idle_ms = 0;
+  struct stat st;
+
+  Generate_Key_Flush();
+  while (!follow_stop)
+  {
+    if (fstat(annex_b->BitStreamFile, &st) == 0 && (int64) st.st_size > annex_b->read_off)
+    {
+      p_Dec->BitStreamFileLen = st.st_size;
+      io_restart(annex_b->io, annex_b->read_off);
+      return TRUE;
+    }
+    if (p_Inp->follow_idle > 0 && idle_ms >= (int64) p_Inp->follow_idle * 1000)
+    {
+      printf("follow: no new data for %d s, stopping\n", p_Inp->follow_idle);
+      return FALSE;
+    }
+    usleep(p_Inp->follow_poll * 1000);
+    idle_ms += p_Inp->follow_poll;
+  }
+  printf("follow: stopped by a signal\n");
+  return FALSE;
+}
+
 void malloc_annex_b(VideoParameters *p_Vid, ANNEXB_t **p_annex_b)
 {
   if ( ((*p_annex_b) = (ANNEXB_t *) calloc(1, sizeof(ANNEXB_t))) == NULL)
@@ -36,6 +86,7 @@ void malloc_annex_b(VideoParameters *p_Vid, ANNEXB_t **p_annex_b)
 void init_annex_b(ANNEXB_t *annex_b)
 {
   annex_b->BitStreamFile = -1;
+  annex_b->io = NULL;
   annex_b->iobuffer = NULL;
   annex_b->iobufferread = NULL;
   annex_b->bytesinbuffer = 0;
@@ -60,12 +111,18 @@ void free_annex_b(ANNEXB_t **p_annex_b)
 */
 static inline int getChunk(ANNEXB_t *annex_b)
 {
-  unsigned int readbytes = read (annex_b->BitStreamFile, annex_b->iobuffer, annex_b->iIOBufferSize); 
+  unsigned int readbytes = io_read_next (annex_b->io, &annex_b->iobuffer);
+  while (0==readbytes && annex_b->follow && follow_input(annex_b))
+    readbytes = io_read_next (annex_b->io, &annex_b->iobuffer);
   if (0==readbytes)
   {
     annex_b->is_eof = TRUE;
     return 0;
   }
+  annex_b->read_off += readbytes;
+  // no way back to these bytes later, keep them for the scrambled output
+  if (p_Dec->stream)
+    stream_append(p_Dec->stream, annex_b->iobuffer, readbytes);
 
   annex_b->bytesinbuffer = readbytes;
   annex_b->iobufferread = annex_b->iobuffer;
@@ -232,10 +289,7 @@ int get_annex_b_NALU (VideoParameters *p_Vid, NALU_t *nalu, ANNEXB_t *annex_b)
       // printf ("get_annex_b_NALU, eof case: pos %d nalu->len %d, nalu->reference_idc %d, nal_unit_type %d \n", pos, nalu->len, nalu->nal_reference_idc, nalu->nal_unit_type);
 
 #if TRACE
-      fprintf (p_Dec->p_trace, "\n\nLast NALU in File\n\n");
-      fprintf (p_Dec->p_trace, "Annex B NALU w/ %s startcode, len %d, forbidden_bit %d, nal_reference_idc %d, nal_unit_type %d\n\n",
-        nalu->startcodeprefix_len == 4?"long":"short", nalu->len, nalu->forbidden_bit, nalu->nal_reference_idc, nalu->nal_unit_type);
-      fflush (p_Dec->p_trace);
+      trace_nalu(nalu, TRUE);
 #endif
       return (pos - 1);
     }
@@ -287,9 +341,7 @@ int get_annex_b_NALU (VideoParameters *p_Vid, NALU_t *nalu, ANNEXB_t *annex_b)
   
   //printf ("get_annex_b_NALU, regular case: pos %d nalu->len %d, nalu->reference_idc %d, nal_unit_type %d \n", pos, nalu->len, nalu->nal_reference_idc, nalu->nal_unit_type);
 #if TRACE
-  fprintf (p_Dec->p_trace, "\n\nAnnex B NALU w/ %s startcode, len %d, forbidden_bit %d, nal_reference_idc %d, nal_unit_type %d\n\n",
-    nalu->startcodeprefix_len == 4?"long":"short", nalu->len, nalu->forbidden_bit, nalu->nal_reference_idc, nalu->nal_unit_type);
-  fflush (p_Dec->p_trace);
+  trace_nalu(nalu, FALSE);
 #endif
 
   return (pos);
@@ -308,11 +360,19 @@ int get_annex_b_NALU (VideoParameters *p_Vid, NALU_t *nalu, ANNEXB_t *annex_b)
  */
 void open_annex_b (char *fn, ANNEXB_t *annex_b)
 {
-  if (NULL != annex_b->iobuffer)
+  if (NULL != annex_b->io)
   {
     error ("open_annex_b: tried to open Annex B file twice",500);
   }
-  if ((annex_b->BitStreamFile = open(fn, O_RDWR)) == -1)
+  if (is_stream_input(fn))
+  {
+    // stdin or a FIFO: read once, the scrambled stream goes to stdout
+    annex_b->BitStreamFile = strcmp(fn, "-") ? open(fn, O_RDONLY) : dup(STDIN_FILENO);
+    p_Dec->stream = open_stream_window();
+  }
+  else
+    annex_b->BitStreamFile = open(fn, p_Dec->p_Inp->outfile[0] ? O_RDONLY : O_RDWR);
+  if (annex_b->BitStreamFile == -1)
   {
     snprintf (errortext, ET_SIZE, "Cannot open Annex B ByteStream file '%s'", fn);
     error(errortext,500);
@@ -320,17 +380,29 @@ void open_annex_b (char *fn, ANNEXB_t *annex_b)
   }
 
   annex_b->iIOBufferSize = IOBUFFERSIZE * sizeof (byte);
-  annex_b->iobuffer = malloc (annex_b->iIOBufferSize);
-  if (NULL == annex_b->iobuffer)
+
+	p_Dec->BitStreamFile = annex_b->BitStreamFile;
+	if (p_Dec->stream == NULL)
+	{
+		p_Dec->BitStreamFileLen = lseek(annex_b->BitStreamFile, 0, 2);
+		lseek(annex_b->BitStreamFile,0,0);
+	}
+
+  // a growing recording: the end of the file is only the end of what is there so far
+  annex_b->follow = p_Dec->p_Inp->follow && p_Dec->stream == NULL;
+  p_Dec->follow = annex_b->follow;
+  if (annex_b->follow)
   {
-    error ("open_annex_b: cannot allocate IO buffer",500);
+    signal(SIGINT, follow_signal);
+    signal(SIGTERM, follow_signal);
   }
 
-	p_Dec->BitStreamFile = annex_b->BitStreamFile;
-	p_Dec->BitStreamFileLen = lseek(annex_b->BitStreamFile, 0, 2);
-	lseek(annex_b->BitStreamFile,0,0);
+  // iobuffer points into the read-ahead chunks of the backend, the key write-back shares it
+  annex_b->io = io_open(annex_b->BitStreamFile, p_Dec->p_Inp->io_backend, p_Dec->p_Inp->io_queue_depth, annex_b->iIOBufferSize);
+  p_Dec->io = p_Dec->key_io = annex_b->io;
 	
   annex_b->is_eof = FALSE;
+  annex_b->read_off = 0;
   getChunk(annex_b);
 }
 
@@ -343,12 +415,14 @@ void open_annex_b (char *fn, ANNEXB_t *annex_b)
  */
 void close_annex_b(ANNEXB_t *annex_b)
 {
+  io_close(annex_b->io);
+  annex_b->io = NULL;
+  p_Dec->io = p_Dec->key_io = NULL;
   if (annex_b->BitStreamFile != -1)
   {
     close(annex_b->BitStreamFile);
     annex_b->BitStreamFile = - 1;
   }
-  free (annex_b->iobuffer);
   annex_b->iobuffer = NULL;
 }
 
@@ -359,3 +433,20 @@ void reset_annex_b(ANNEXB_t *annex_b)
   annex_b->bytesinbuffer = 0;
   annex_b->iobufferread = annex_b->iobuffer;
 }
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Continue reading at offset, which must be the start of a start
+ *    code (leading zero bytes are fine)
+ ************************************************************************
+ */
+void seek_annex_b(ANNEXB_t *annex_b, int64 offset)
+{
+  io_restart(annex_b->io, offset);
+  reset_annex_b(annex_b);
+  annex_b->read_off = offset;
+  annex_b->IsFirstByteStreamNALU = 1;
+  annex_b->nextstartcodebytes = 0;
+  getChunk(annex_b);
+}
@@ -72,7 +72,7 @@ void arideco_done_decoding(DecodingEnvironmentPtr dep)
 {
   (*dep->Dcodestrm_len)++;
 #if(TRACE==2)
-  fprintf(p_Dec->p_trace, "done_decoding: %d\n", *dep->Dcodestrm_len);
+  trace_values("done_decoding: %d\n", *dep->Dcodestrm_len, 0, 0);
 #endif
 }
 
@@ -85,7 +85,7 @@ void arideco_done_decoding(DecodingEnvironmentPtr dep)
 static inline unsigned int getbyte(DecodingEnvironmentPtr dep)
 {     
 #if(TRACE==2)
-  fprintf(p_Dec->p_trace, "get_byte: %d\n", (*dep->Dcodestrm_len));
+  trace_values("get_byte: %d\n", (*dep->Dcodestrm_len), 0, 0);
 #endif
   return dep->Dcodestrm[(*dep->Dcodestrm_len)++];
 }
@@ -101,8 +101,8 @@ static inline unsigned int getword(DecodingEnvironmentPtr dep)
   int *len = dep->Dcodestrm_len;
   byte *p_code_strm = &dep->Dcodestrm[*len];
 #if(TRACE==2)
-  fprintf(p_Dec->p_trace, "get_byte: %d\n", *len);
-  fprintf(p_Dec->p_trace, "get_byte: %d\n", *len + 1);
+  trace_values("get_byte: %d\n", *len, 0, 0);
+  trace_values("get_byte: %d\n", *len + 1, 0, 0);
 #endif
   *len += 2;
   return ((*p_code_strm<<8) | *(p_code_strm + 1));
@@ -128,7 +128,7 @@ void arideco_start_decoding(DecodingEnvironmentPtr dep, unsigned char *code_buff
   dep->Drange = HALF;
 
 #if (2==TRACE)
-  fprintf(p_Dec->p_trace, "value: %d firstbyte: %d code_len: %d\n", dep->Dvalue >> dep->DbitsLeft, firstbyte, *code_len);
+  trace_values("value: %d firstbyte: %d code_len: %d\n", dep->Dvalue >> dep->DbitsLeft, firstbyte, *code_len);
 #endif
 }
 
@@ -153,36 +153,54 @@ void readFieldModeInfo_CABAC(Macroblock *currMB,
   se->value1 = biari_decode_symbol (dep_dp, &ctx->mb_aff_contexts[act_ctx]);
 
 #if TRACE
-  fprintf(p_Dec->p_trace, "@%-6d %-63s (%3d)\n",symbolCount++, se->tracestring, se->value1);
-  fflush(p_Dec->p_trace);
+  trace_cabac(se->tracestring, se->value1);
 #endif
 }
 
 
-int check_next_mb_and_get_field_mode_CABAC_p_slice( Slice *currSlice,
-                                           SyntaxElement *se,                                           
-                                           DataPartition  *act_dp)
+/*!
+ ************************************************************************
+ * \brief
+ *    State the lookahead at the bottom MB of an MBAFF pair can change:
+ *    the arithmetic decoder, the row of mb_type contexts holding the
+ *    skip flag contexts of the slice type and the field mode contexts.
+ *    It is kept on the stack of the caller, the lookahead runs once
+ *    per MB pair and must not allocate.
+ ************************************************************************
+ */
+typedef struct mbaff_lookahead
 {
-  VideoParameters *p_Vid = currSlice->p_Vid;
-  BiContextTypePtr          mb_type_ctx_copy[3];
-  BiContextTypePtr          mb_aff_ctx_copy;
-  DecodingEnvironmentPtr    dep_dp_copy;
-  MotionInfoContexts *mot_ctx  = currSlice->mot_ctx;  
+  DecodingEnvironment dep;
+  int                 length;
+  BiContextType       mb_type_ctx[NUM_MB_TYPE_CTX];
+  BiContextType       mb_aff_ctx [NUM_MB_AFF_CTX];
+} MbaffLookahead;
 
-  int length;
-  DecodingEnvironmentPtr    dep_dp = &(act_dp->de_cabac);
+static inline void save_mbaff_lookahead(MbaffLookahead *la, DecodingEnvironmentPtr dep_dp, MotionInfoContexts *mot_ctx, int row)
+{
+  la->dep    = *dep_dp;
+  la->length = *(dep_dp->Dcodestrm_len);
+  memcpy(la->mb_type_ctx, mot_ctx->mb_type_contexts[row], NUM_MB_TYPE_CTX * sizeof(BiContextType));
+  memcpy(la->mb_aff_ctx,  mot_ctx->mb_aff_contexts,       NUM_MB_AFF_CTX  * sizeof(BiContextType));
+}
 
-  int skip   = 0;
-  int field  = 0;
-  int i;
+static inline void restore_mbaff_lookahead(const MbaffLookahead *la, DecodingEnvironmentPtr dep_dp, MotionInfoContexts *mot_ctx, int row)
+{
+  *dep_dp = la->dep;
+  *(dep_dp->Dcodestrm_len) = la->length;
+  memcpy(mot_ctx->mb_type_contexts[row], la->mb_type_ctx, NUM_MB_TYPE_CTX * sizeof(BiContextType));
+  memcpy(mot_ctx->mb_aff_contexts,       la->mb_aff_ctx,  NUM_MB_AFF_CTX  * sizeof(BiContextType));
+}
 
+//! set up the bottom MB of the current pair for the lookahead
+static inline Macroblock *next_mbaff_bottom(Slice *currSlice)
+{
   Macroblock *currMB;
 
-  //get next MB
   ++currSlice->current_mb_nr; // ++p_Vid->current_mb_nr;
-  
+
   currMB = &currSlice->mb_data[currSlice->current_mb_nr];
-  currMB->p_Vid    = p_Vid;
+  currMB->p_Vid    = currSlice->p_Vid;
   currMB->p_Slice  = currSlice; 
   currMB->slice_nr = currSlice->current_slice_nr;
   currMB->mb_field = currSlice->mb_data[currSlice->current_mb_nr-1].mb_field;
@@ -191,19 +209,24 @@ int check_next_mb_and_get_field_mode_CABAC_p_slice( Slice *currSlice,
 
   CheckAvailabilityOfNeighborsMBAFF(currMB);
   CheckAvailabilityOfNeighborsCABAC(currMB);
+  return currMB;
+}
+
+int check_next_mb_and_get_field_mode_CABAC_p_slice( Slice *currSlice,
+                                           SyntaxElement *se,                                           
+                                           DataPartition  *act_dp)
+{
+  MotionInfoContexts *mot_ctx  = currSlice->mot_ctx;  
+  DecodingEnvironmentPtr    dep_dp = &(act_dp->de_cabac);
+  MbaffLookahead la;
+
+  int skip   = 0;
+  int field  = 0;
 
-  //create
-  dep_dp_copy = (DecodingEnvironmentPtr) calloc(1, sizeof(DecodingEnvironment) );
-  for (i=0;i<3;++i)
-    mb_type_ctx_copy[i] = (BiContextTypePtr) calloc(NUM_MB_TYPE_CTX, sizeof(BiContextType) );
-  mb_aff_ctx_copy = (BiContextTypePtr) calloc(NUM_MB_AFF_CTX, sizeof(BiContextType) );
+  Macroblock *currMB = next_mbaff_bottom(currSlice);
 
-  //copy
-  memcpy(dep_dp_copy,dep_dp,sizeof(DecodingEnvironment));
-  length = *(dep_dp_copy->Dcodestrm_len) = *(dep_dp->Dcodestrm_len);
-  for (i=0;i<3;++i)
-    memcpy(mb_type_ctx_copy[i], mot_ctx->mb_type_contexts[i],NUM_MB_TYPE_CTX*sizeof(BiContextType) );
-  memcpy(mb_aff_ctx_copy, mot_ctx->mb_aff_contexts,NUM_MB_AFF_CTX*sizeof(BiContextType) );
+  // the skip flag of a P slice reads mb_type_contexts[1]
+  save_mbaff_lookahead(&la, dep_dp, mot_ctx, 1);
 
   //check_next_mb
 #if TRACE
@@ -226,21 +249,10 @@ int check_next_mb_and_get_field_mode_CABAC_p_slice( Slice *currSlice,
 
   //reset
   currSlice->current_mb_nr--;
-
-  memcpy(dep_dp,dep_dp_copy,sizeof(DecodingEnvironment));
-  *(dep_dp->Dcodestrm_len) = length;
-  for (i=0;i<3;++i)
-    memcpy(mot_ctx->mb_type_contexts[i],mb_type_ctx_copy[i], NUM_MB_TYPE_CTX*sizeof(BiContextType) );
-  memcpy( mot_ctx->mb_aff_contexts,mb_aff_ctx_copy,NUM_MB_AFF_CTX*sizeof(BiContextType) );
+  restore_mbaff_lookahead(&la, dep_dp, mot_ctx, 1);
 
   CheckAvailabilityOfNeighborsCABAC(currMB);
 
-  //delete
-  free(dep_dp_copy);
-  for (i=0;i<3;++i)
-    free(mb_type_ctx_copy[i]);
-  free(mb_aff_ctx_copy);
-
   return skip;
 }
 
@@ -248,49 +260,17 @@ int check_next_mb_and_get_field_mode_CABAC_b_slice( Slice *currSlice,
                                            SyntaxElement *se,                                           
                                            DataPartition  *act_dp)
 {
-  VideoParameters *p_Vid = currSlice->p_Vid;
-  BiContextTypePtr          mb_type_ctx_copy[3];
-  BiContextTypePtr          mb_aff_ctx_copy;
-  DecodingEnvironmentPtr    dep_dp_copy;
-
-  int length;
   DecodingEnvironmentPtr    dep_dp = &(act_dp->de_cabac);
   MotionInfoContexts  *mot_ctx = currSlice->mot_ctx;
+  MbaffLookahead la;
 
   int skip   = 0;
   int field  = 0;
-  int i;
 
-  Macroblock *currMB;
+  Macroblock *currMB = next_mbaff_bottom(currSlice);
 
-  //get next MB
-  ++currSlice->current_mb_nr; // ++p_Vid->current_mb_nr;
-  
-  currMB = &currSlice->mb_data[currSlice->current_mb_nr];
-  currMB->p_Vid    = p_Vid;
-  currMB->p_Slice  = currSlice; 
-  currMB->slice_nr = currSlice->current_slice_nr;
-  currMB->mb_field = currSlice->mb_data[currSlice->current_mb_nr-1].mb_field;
-  currMB->mbAddrX  = currSlice->current_mb_nr;
-  currMB->list_offset = ((currSlice->mb_aff_frame_flag)&&(currMB->mb_field))? (currMB->mbAddrX & 0x01) ? 4 : 2 : 0;
-
-  CheckAvailabilityOfNeighborsMBAFF(currMB);
-  CheckAvailabilityOfNeighborsCABAC(currMB);
-
-  //create
-  dep_dp_copy = (DecodingEnvironmentPtr) calloc(1, sizeof(DecodingEnvironment) );
-  for (i=0;i<3;++i)
-    mb_type_ctx_copy[i] = (BiContextTypePtr) calloc(NUM_MB_TYPE_CTX, sizeof(BiContextType) );
-  mb_aff_ctx_copy = (BiContextTypePtr) calloc(NUM_MB_AFF_CTX, sizeof(BiContextType) );
-
-  //copy
-  memcpy(dep_dp_copy,dep_dp,sizeof(DecodingEnvironment));
-  length = *(dep_dp_copy->Dcodestrm_len) = *(dep_dp->Dcodestrm_len);
-
-  for (i=0;i<3;++i)
-    memcpy(mb_type_ctx_copy[i], mot_ctx->mb_type_contexts[i],NUM_MB_TYPE_CTX*sizeof(BiContextType) );
-
-  memcpy(mb_aff_ctx_copy, mot_ctx->mb_aff_contexts,NUM_MB_AFF_CTX*sizeof(BiContextType) );
+  // the skip flag of a B slice reads mb_type_contexts[2]
+  save_mbaff_lookahead(&la, dep_dp, mot_ctx, 2);
 
   //check_next_mb
 #if TRACE
@@ -312,23 +292,10 @@ int check_next_mb_and_get_field_mode_CABAC_b_slice( Slice *currSlice,
 
   //reset
   currSlice->current_mb_nr--;
-
-  memcpy(dep_dp,dep_dp_copy,sizeof(DecodingEnvironment));
-  *(dep_dp->Dcodestrm_len) = length;
-  
-  for (i=0;i<3;++i)
-    memcpy(mot_ctx->mb_type_contexts[i],mb_type_ctx_copy[i], NUM_MB_TYPE_CTX * sizeof(BiContextType) );
-
-  memcpy( mot_ctx->mb_aff_contexts, mb_aff_ctx_copy, NUM_MB_AFF_CTX * sizeof(BiContextType) );
+  restore_mbaff_lookahead(&la, dep_dp, mot_ctx, 2);
 
   CheckAvailabilityOfNeighborsCABAC(currMB);
 
-  //delete
-  free(dep_dp_copy);
-  for (i=0;i<3;++i)
-    free(mb_type_ctx_copy[i]);
-  free(mb_aff_ctx_copy);
-
   return skip;
 }
 
@@ -391,8 +358,7 @@ void read_MVD_CABAC( Macroblock *currMB,
   se->value1 = act_sym;
 
 #if TRACE
-  fprintf(p_Dec->p_trace, "@%-6d %-63s (%3d)\n",symbolCount++, se->tracestring, se->value1);
-  fflush(p_Dec->p_trace);
+  trace_cabac(se->tracestring, se->value1);
 #endif
 }
 
@@ -470,8 +436,7 @@ void read_mvd_CABAC_mbaff( Macroblock *currMB,
   se->value1 = act_sym;
 
 #if TRACE
-  fprintf(p_Dec->p_trace, "@%-6d %-63s (%3d)\n",symbolCount++, se->tracestring, se->value1);
-  fflush(p_Dec->p_trace);
+  trace_cabac(se->tracestring, se->value1);
 #endif
 }
 
@@ -509,8 +474,7 @@ void readB8_typeInfo_CABAC_p_slice (Macroblock *currMB,
   se->value1 = act_sym;
 
 #if TRACE
-  fprintf(p_Dec->p_trace, "@%-6d %-63s (%3d)\n",symbolCount++, se->tracestring, se->value1);
-  fflush(p_Dec->p_trace);
+  trace_cabac(se->tracestring, se->value1);
 #endif
 }
 
@@ -575,8 +539,7 @@ void readB8_typeInfo_CABAC_b_slice (Macroblock *currMB,
   se->value1 = act_sym;
 
 #if TRACE
-  fprintf(p_Dec->p_trace, "@%-6d %-63s (%3d)\n",symbolCount++, se->tracestring, se->value1);
-  fflush(p_Dec->p_trace);
+  trace_cabac(se->tracestring, se->value1);
 #endif
 }
 
@@ -598,8 +561,7 @@ void read_skip_flag_CABAC_p_slice( Macroblock *currMB,
   se->value1 = (biari_decode_symbol(dep_dp, mb_type_contexts) != 1);
 
 #if TRACE
-  fprintf(p_Dec->p_trace, "@%-6d %-63s (%3d)\n",symbolCount++, se->tracestring, se->value1);
-  fflush(p_Dec->p_trace);
+  trace_cabac(se->tracestring, se->value1);
 #endif
   if (!se->value1)
   {
@@ -625,8 +587,7 @@ void read_skip_flag_CABAC_b_slice( Macroblock *currMB,
   se->value1 = se->value2 = (biari_decode_symbol (dep_dp, mb_type_contexts) != 1);
 
 #if TRACE
-  fprintf(p_Dec->p_trace, "@%-6d %-63s (%3d)\n", symbolCount++, se->tracestring, se->value1);
-  fflush(p_Dec->p_trace);
+  trace_cabac(se->tracestring, se->value1);
 #endif
   if (!se->value1)
   {
@@ -657,8 +618,7 @@ void readMB_transform_size_flag_CABAC( Macroblock *currMB,
   se->value1 = act_sym;
 
 #if TRACE
-  fprintf(p_Dec->p_trace, "@%-6d %-63s (%3d)\n",symbolCount++, se->tracestring, se->value1);
-  fflush(p_Dec->p_trace);
+  trace_cabac(se->tracestring, se->value1);
 #endif
 
 }
@@ -807,8 +767,7 @@ void readMB_typeInfo_CABAC_i_slice(Macroblock *currMB,
   se->value1 = curr_mb_type;
 
 #if TRACE
-  fprintf(p_Dec->p_trace, "@%-6d %-63s (%3d)\n",symbolCount++, se->tracestring, se->value1);
-  fflush(p_Dec->p_trace);
+  trace_cabac(se->tracestring, se->value1);
 #endif
 }
 
@@ -899,8 +858,7 @@ void readMB_typeInfo_CABAC_p_slice(Macroblock *currMB,
   se->value1 = curr_mb_type;
 
 #if TRACE
-  fprintf(p_Dec->p_trace, "@%-6d %-63s (%3d)\n",symbolCount++, se->tracestring, se->value1);
-  fflush(p_Dec->p_trace);
+  trace_cabac(se->tracestring, se->value1);
 #endif
 }
 
@@ -1027,8 +985,7 @@ void readMB_typeInfo_CABAC_b_slice(Macroblock *currMB,
   se->value1 = curr_mb_type;
 
 #if TRACE
-  fprintf(p_Dec->p_trace, "@%-6d %-63s (%3d)\n",symbolCount++, se->tracestring, se->value1);
-  fflush(p_Dec->p_trace);
+  trace_cabac(se->tracestring, se->value1);
 #endif
 }
 
@@ -1059,8 +1016,7 @@ void readIntraPredMode_CABAC( Macroblock *currMB,
   }
 
 #if TRACE
-  fprintf(p_Dec->p_trace, "@%-6d %-63s (%3d)\n",symbolCount++, se->tracestring, se->value1);
-  fflush(p_Dec->p_trace);
+  trace_cabac(se->tracestring, se->value1);
 #endif
 }
 /*!
@@ -1131,9 +1087,7 @@ void readRefFrame_CABAC(Macroblock *currMB,
   se->value1 = act_sym;
 
 #if TRACE
-  fprintf(p_Dec->p_trace, "@%-6d %-63s (%3d)\n",symbolCount++, se->tracestring, se->value1);
-//  fprintf(p_Dec->p_trace," c: %d :%d \n",ctx->ref_no_contexts[addctx][act_ctx].cum_freq[0],ctx->ref_no_contexts[addctx][act_ctx].cum_freq[1]);
-  fflush(p_Dec->p_trace);
+  trace_cabac(se->tracestring, se->value1);
 #endif
 }
 
@@ -1170,8 +1124,7 @@ void read_dQuant_CABAC( Macroblock *currMB,
   currSlice->last_dquant = *dquant;
 
 #if TRACE
-  fprintf(p_Dec->p_trace, "@%-6d %-63s (%3d)\n",symbolCount++, se->tracestring, se->value1);
-  fflush(p_Dec->p_trace);
+  trace_cabac(se->tracestring, se->value1);
 #endif
 }
 /*!
@@ -1303,8 +1256,7 @@ void read_CBP_CABAC(Macroblock *currMB,
   }
 
 #if TRACE
-  fprintf(p_Dec->p_trace, "@%-6d %-63s (%3d)\n",symbolCount++, se->tracestring, se->value1);
-  fflush(p_Dec->p_trace);
+  trace_cabac(se->tracestring, se->value1);
 #endif
 }
 
@@ -1336,8 +1288,7 @@ void readCIPredMode_CABAC(Macroblock *currMB,
     *act_sym = unary_bin_max_decode(dep_dp, ctx->cipr_contexts + 3, 0, 1) + 1;
 
 #if TRACE
-  fprintf(p_Dec->p_trace, "@%-6d %-63s (%3d)\n",symbolCount++, se->tracestring, se->value1);
-  fflush(p_Dec->p_trace);
+  trace_cabac(se->tracestring, se->value1);
 #endif
 
 }
@@ -2139,8 +2090,7 @@ void readRunLevel_CABAC (Macroblock *currMB,
     currSlice->pos = 0;
 
 #if TRACE
-  fprintf(p_Dec->p_trace, "@%-6d %-53s %3d  %3d\n",symbolCount++, se->tracestring, se->value1,se->value2);
-  fflush(p_Dec->p_trace);
+  trace_level_run(se->tracestring, se->value1, se->value2);
 #endif
 }
 
@@ -2162,8 +2112,8 @@ int readSyntaxElement_CABAC(Macroblock *currMB, SyntaxElement *se, DataPartition
   se->len = (arideco_bits_read(dep_dp) - curr_len);
 
 #if (TRACE==2)
-  fprintf(p_Dec->p_trace, "curr_len: %d\n",curr_len);		//ǰ﷨ڵλ
-  fprintf(p_Dec->p_trace, "se_len: %d\n",se->len);
+  trace_values("curr_len: %d\n", curr_len, 0, 0);		//ǰ﷨ڵλ
+  trace_values("se_len: %d\n", se->len, 0, 0);
 #endif
 
   return (se->len); 
@@ -2261,8 +2211,7 @@ int cabac_startcode_follows(Slice *currSlice, int eos_bit)
     bit = biari_decode_final (dep_dp); //GB
 
 #if TRACE
-    fprintf(p_Dec->p_trace, "@%-6d %-63s (%3d)\n",symbolCount++, "end_of_slice_flag", bit);
-    fflush(p_Dec->p_trace);
+    trace_cabac("end_of_slice_flag", bit);
 #endif
   }
   else
@@ -0,0 +1,541 @@
+
+/*!
+ ************************************************************************
+ * \file checkpoint.c
+ *
+ * \brief
+ *    Checkpoint and resume, see checkpoint.h.
+ *
+ *    The .ckpt file is little endian: magic, version, the complete flag,
+ *    the input size, the IDR NAL unit position, the key unit count, the
+ *    KeyCheckpoint, the parameter set RBSPs and an FNV-1a checksum of
+ *    all of it.
+ ************************************************************************
+ */
+
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+
+#include "global.h"
+#include "checkpoint.h"
+#include "keyunit.h"
+#include "memalloc.h"
+#include "nalu.h"
+#include "parset.h"
+
+#define CHECKPOINT_MAX_PS   (2 * MAXSPS + MAXPPS)   //!< SPS, subset SPS and PPS
+
+//! one parameter set NAL unit, header byte and RBSP
+typedef struct ps_record
+{
+  int   type;
+  int   id;
+  int   len;
+  int   alloc;
+  byte *rbsp;
+} PsRecord;
+
+typedef struct ps_set
+{
+  int      n;
+  PsRecord ps[CHECKPOINT_MAX_PS];
+} PsSet;
+
+typedef struct candidate
+{
+  int64 pos;                          //!< file position of the IDR NAL unit, 0 if unused
+  PsSet ps;
+} Candidate;
+
+struct checkpoint
+{
+  VideoParameters *p_Vid;
+  char          path[FILE_NAME_SIZE + 8];
+  char          tmp[FILE_NAME_SIZE + 16];
+  int64         interval;             //!< bytes of input between checkpoints
+  int64         last_pos;             //!< NAL unit position of the last checkpoint
+  int64         input_size;
+  PsSet         ps;                   //!< as read so far
+  Candidate     cand[CHECKPOINT_CANDIDATES];
+  int           next_cand;
+
+  int           resuming;             //!< a .ckpt file was found
+  int           complete;             //!< ... and it was written after the last key unit
+  int64         resume_pos;
+  int           resume_units;
+  KeyCheckpoint resume_kc;
+};
+
+//! error_KeyGen() with room for two paths, errortext[ET_SIZE] is too short for the checkpoint paths
+static void checkpoint_error(const char *format, ...)
+{
+  char text[2 * FILE_NAME_SIZE + 128];
+  va_list ap;
+
+  va_start(ap, format);
+  vsnprintf(text, sizeof(text), format, ap);
+  va_end(ap);
+  error_KeyGen(text, 500);
+}
+
+static void ps_record_set(PsRecord *r, int type, int id, const byte *rbsp, int len)
+{
+  if (len > r->alloc)
+  {
+    if ((r->rbsp = (byte *) realloc(r->rbsp, len)) == NULL)
+      no_mem_exit("ps_record_set: rbsp");
+    r->alloc = len;
+  }
+  memcpy(r->rbsp, rbsp, len);
+  r->type = type;
+  r->id   = id;
+  r->len  = len;
+}
+
+static void ps_set_copy(PsSet *dst, const PsSet *src)
+{
+  int i;
+
+  for (i = 0; i < src->n; ++i)
+    ps_record_set(&dst->ps[i], src->ps[i].type, src->ps[i].id, src->ps[i].rbsp, src->ps[i].len);
+  dst->n = src->n;
+}
+
+static void ps_set_free(PsSet *s)
+{
+  int i;
+
+  for (i = 0; i < CHECKPOINT_MAX_PS; ++i)
+    free(s->ps[i].rbsp);
+  memset(s, 0, sizeof(PsSet));
+}
+
+//! ue(v) at byte offset pos of an RBSP, -1 if it does not fit
+static int rbsp_ue(const byte *rbsp, int len, int pos)
+{
+  int bit = pos * 8, end = len * 8, zeros = 0, n;
+  unsigned int v = 0;
+
+  while (bit < end && !((rbsp[bit >> 3] >> (7 - (bit & 7))) & 1))
+  {
+    ++zeros;
+    ++bit;
+  }
+  if (++bit + zeros > end || zeros > 16)
+    return -1;
+  for (n = 0; n < zeros; ++n, ++bit)
+    v = (v << 1) | ((rbsp[bit >> 3] >> (7 - (bit & 7))) & 1);
+  return (int) ((1u << zeros) - 1 + v);
+}
+
+static uint64 fnv1a(const byte *p, size_t n)
+{
+  uint64 h = 0xcbf29ce484222325ULL;
+
+  while (n--)
+    h = (h ^ *p++) * 0x100000001b3ULL;
+  return h;
+}
+
+static byte *put_u32(byte *p, uint32 v)
+{
+  int i;
+
+  for (i = 0; i < 4; ++i)
+    *p++ = (byte) (v >> (8 * i));
+  return p;
+}
+
+static byte *put_u64(byte *p, uint64 v)
+{
+  p = put_u32(p, (uint32) v);
+  return put_u32(p, (uint32) (v >> 32));
+}
+
+static const byte *get_u32(const byte *p, uint32 *v)
+{
+  *v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32) p[3] << 24);
+  return p + 4;
+}
+
+static const byte *get_u64(const byte *p, uint64 *v)
+{
+  uint32 lo, hi;
+
+  p = get_u32(p, &lo);
+  p = get_u32(p, &hi);
+  *v = ((uint64) hi << 32) | lo;
+  return p;
+}
+
+static int64 file_size(int fd)
+{
+  struct stat st;
+
+  return fstat(fd, &st) ? -1 : (int64) st.st_size;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Read the .ckpt file into cp, FALSE if there is none
+ ************************************************************************
+ */
+static int load_checkpoint(Checkpoint *cp)
+{
+  FILE *f = fopen(cp->path, "rb");
+  const byte *p, *end;
+  byte *buf;
+  long size;
+  uint32 v32, i;
+  uint64 v64;
+
+  if (f == NULL)
+    return FALSE;
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  if ((buf = (byte *) malloc(size > 0 ? size : 1)) == NULL)
+    no_mem_exit("load_checkpoint: buf");
+  if (size < 16 || fread(buf, 1, size, f) != (size_t) size || memcmp(buf, CHECKPOINT_MAGIC, 6)
+    || (get_u64(buf + size - 8, &v64), v64 != fnv1a(buf, size - 8)))
+  {
+    checkpoint_error("load_checkpoint: %s is damaged, remove it and start over from the original stream", cp->path);
+  }
+  fclose(f);
+
+  p   = buf + 6;
+  end = buf + size - 8;
+  p = get_u32(p, &v32);
+  if (v32 != CHECKPOINT_VERSION)
+  {
+    checkpoint_error("load_checkpoint: %s has version %u, expected %d", cp->path, v32, CHECKPOINT_VERSION);
+  }
+  p = get_u32(p, &v32);  cp->complete = (int) v32;
+  p = get_u64(p, &v64);
+  if ((int64) v64 != cp->input_size)
+  {
+    checkpoint_error("load_checkpoint: %s belongs to an input of %lld bytes, this one has %lld",
+      cp->path, (long long) v64, (long long) cp->input_size);
+  }
+  p = get_u64(p, &v64);  cp->resume_pos = (int64) v64;
+  p = get_u32(p, &v32);  cp->resume_units = (int) v32;
+  p = get_u32(p, &v32);  cp->resume_kc.started = (int) v32;
+  p = get_u32(p, &v32);  cp->resume_kc.key_format = (int) v32;
+  p = get_u64(p, &v64);  cp->resume_kc.byte_offset = (int64) v64;
+  p = get_u64(p, &v64);  cp->resume_kc.key_offset = (int64) v64;
+  p = get_u32(p, &cp->resume_kc.rice.pending);
+  p = get_u32(p, &v32);  cp->resume_kc.rice.nbits = (int) v32;
+  p = get_u32(p, &cp->resume_kc.rice.ctx_offset.A);
+  p = get_u32(p, &cp->resume_kc.rice.ctx_offset.N);
+  p = get_u32(p, &cp->resume_kc.rice.ctx_length.A);
+  p = get_u32(p, &cp->resume_kc.rice.ctx_length.N);
+  p = get_u32(p, &v32);
+  for (i = 0; i < v32 && i < CHECKPOINT_MAX_PS && p + 12 <= end; ++i)
+  {
+    uint32 type, id, len;
+
+    p = get_u32(p, &type);
+    p = get_u32(p, &id);
+    p = get_u32(p, &len);
+    if (p + len > end)
+      break;
+    ps_record_set(&cp->ps.ps[i], (int) type, (int) id, p, (int) len);
+    p += len;
+  }
+  cp->ps.n = (int) i;
+  if (i != v32 || p != end)
+    error_KeyGen("load_checkpoint: parameter sets do not match the file size", 500);
+
+  free(buf);
+  return TRUE;
+}
+
+static void fsync_dir(const char *path)
+{
+  char dir[FILE_NAME_SIZE + 16];
+  int fd;
+
+  strncpy(dir, path, sizeof(dir) - 1);
+  dir[sizeof(dir) - 1] = '\0';
+  if ((fd = open(dirname(dir), O_RDONLY)) >= 0)
+  {
+    fsync(fd);
+    close(fd);
+  }
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Write a .ckpt file for the IDR picture c, through a temporary file
+ *    and rename() so that a crash leaves either the old or the new one
+ ************************************************************************
+ */
+static void save_checkpoint(Checkpoint *cp, const Candidate *c, const KeyCheckpoint *kc, int complete)
+{
+  size_t size = 6 + 4 + 4 + 8 + 8 + 4 + 4 + 4 + 8 + 8 + 6 * 4 + 4 + 8;
+  byte *buf, *p;
+  FILE *f;
+  int i;
+
+  for (i = 0; i < c->ps.n; ++i)
+    size += 12 + c->ps.ps[i].len;
+  if ((buf = (byte *) malloc(size)) == NULL)
+    no_mem_exit("save_checkpoint: buf");
+
+  memcpy(buf, CHECKPOINT_MAGIC, 6);
+  p = put_u32(buf + 6, CHECKPOINT_VERSION);
+  p = put_u32(p, (uint32) complete);
+  p = put_u64(p, (uint64) cp->input_size);
+  p = put_u64(p, (uint64) c->pos);
+  p = put_u32(p, (uint32) g_KeyUnitBuffer.count);
+  p = put_u32(p, (uint32) kc->started);
+  p = put_u32(p, (uint32) kc->key_format);
+  p = put_u64(p, (uint64) kc->byte_offset);
+  p = put_u64(p, (uint64) kc->key_offset);
+  p = put_u32(p, kc->rice.pending);
+  p = put_u32(p, (uint32) kc->rice.nbits);
+  p = put_u32(p, kc->rice.ctx_offset.A);
+  p = put_u32(p, kc->rice.ctx_offset.N);
+  p = put_u32(p, kc->rice.ctx_length.A);
+  p = put_u32(p, kc->rice.ctx_length.N);
+  p = put_u32(p, (uint32) c->ps.n);
+  for (i = 0; i < c->ps.n; ++i)
+  {
+    p = put_u32(p, (uint32) c->ps.ps[i].type);
+    p = put_u32(p, (uint32) c->ps.ps[i].id);
+    p = put_u32(p, (uint32) c->ps.ps[i].len);
+    memcpy(p, c->ps.ps[i].rbsp, c->ps.ps[i].len);
+    p += c->ps.ps[i].len;
+  }
+  p = put_u64(p, fnv1a(buf, p - buf));
+
+  if ((f = fopen(cp->tmp, "wb")) == NULL || fwrite(buf, 1, size, f) != size || fflush(f) || fsync(fileno(f)))
+  {
+    checkpoint_error("save_checkpoint: cannot write %s", cp->tmp);
+  }
+  fclose(f);
+  if (rename(cp->tmp, cp->path))
+  {
+    checkpoint_error("save_checkpoint: cannot rename %s", cp->tmp);
+  }
+  fsync_dir(cp->path);
+  free(buf);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Checkpoints for the key file key_file, an existing .ckpt file
+ *    makes the run a resume (see resume_checkpoint())
+ ************************************************************************
+ */
+Checkpoint *open_checkpoint(VideoParameters *p_Vid, const char *key_file)
+{
+  Checkpoint *cp = (Checkpoint *) calloc(1, sizeof(Checkpoint));
+
+  if (cp == NULL)
+    no_mem_exit("open_checkpoint: cp");
+  cp->p_Vid      = p_Vid;
+  cp->interval   = (int64) p_Vid->p_Inp->checkpoint_interval << 20;
+  cp->input_size = file_size(p_Dec->BitStreamFile);
+  snprintf(cp->path, sizeof(cp->path), "%s.ckpt", key_file);
+  snprintf(cp->tmp, sizeof(cp->tmp), "%s.ckpt.tmp", key_file);
+  cp->resuming = load_checkpoint(cp);
+  if (cp->complete)
+  {
+    checkpoint_error("%s is already scrambled, its key file is complete (remove %s to run again)",
+      p_Vid->p_Inp->infile, cp->path);
+  }
+  if (!cp->resuming)
+  {
+    // a run that stops before the first checkpoint must still find one to undo from
+    Candidate start;
+    KeyCheckpoint kc;
+
+    memset(&start, 0, sizeof(Candidate));
+    memset(&kc, 0, sizeof(KeyCheckpoint));
+    kc.key_format = p_Vid->p_Inp->key_format;
+    save_checkpoint(cp, &start, &kc, FALSE);
+  }
+  return cp;
+}
+
+int checkpoint_resumes(Checkpoint *cp)
+{
+  return cp != NULL && cp->resuming;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Continue the run of the .ckpt file: undo what came after it, then
+ *    set up the key file, the reader and the parameter sets. Call after
+ *    the key file is open and before the first NAL unit is read.
+ ************************************************************************
+ */
+void resume_checkpoint(Checkpoint *cp)
+{
+  VideoParameters *p_Vid = cp->p_Vid;
+  KeyCheckpoint *kc = &cp->resume_kc;
+  static const int order[3] = { NALU_TYPE_SPS, NALU_TYPE_SUB_SPS, NALU_TYPE_PPS };
+  NALU_t nalu;
+  int restored, i, k;
+
+  if (!cp->resuming)
+    return;
+  if (kc->key_format != p_Vid->p_Inp->key_format)
+  {
+    checkpoint_error("resume_checkpoint: %s was written with KeyFormat = %d", cp->path, kc->key_format);
+  }
+
+  restored = Restore_Key_Units(kc);
+  fflush(p_Dec->p_KeyFile);
+  if (ftruncate(fileno(p_Dec->p_KeyFile), (off_t) kc->key_offset))
+    error_KeyGen("resume_checkpoint: cannot truncate the key file", 500);
+  Generate_Key_Resume(kc);
+  p_Dec->pre_mvd_absolute_byte_pos = kc->started ? kc->byte_offset : 0;
+  g_KeyUnitBuffer.count = cp->resume_units;
+
+  // the reader has read ahead before the undo, so it starts again even at 0; the IDR
+  // NAL unit is always preceded by a three byte start code, 0 is the start of the stream
+  seek_next_nalu(p_Vid, cp->resume_pos > 0 ? cp->resume_pos - 3 : 0);
+
+  memset(&nalu, 0, sizeof(NALU_t));
+  for (k = 0; k < 3; ++k)
+  {
+    for (i = 0; i < cp->ps.n; ++i)
+    {
+      PsRecord *r = &cp->ps.ps[i];
+
+      if (r->type != order[k])
+        continue;
+      nalu.buf               = r->rbsp;
+      nalu.len               = r->len;
+      nalu.max_size          = r->len;
+      nalu.nal_unit_type     = (NaluType) (r->rbsp[0] & 0x1f);
+      nalu.nal_reference_idc = (NalRefIdc) ((r->rbsp[0] >> 5) & 3);
+      if (r->type == NALU_TYPE_SPS)
+        ProcessSPS(p_Vid, &nalu);
+      else if (r->type == NALU_TYPE_PPS)
+        ProcessPPS(p_Vid, &nalu);
+#if (MVC_EXTENSION_ENABLE)
+      else if (p_Vid->p_Inp->DecodeAllLayers == 1)
+        ProcessSubsetSPS(p_Vid, &nalu);
+#endif
+    }
+  }
+
+  cp->last_pos = cp->resume_pos;
+  printf("resuming at byte %lld from checkpoint [%s], %d key units done, %d restored\n",
+    (long long) (cp->resume_pos > 0 ? cp->resume_pos - 3 : 0), cp->path, cp->resume_units, restored);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    done: the key file is complete and on disk. The .ckpt file stays as
+ *    a marker, a second run on the scrambled file would scramble it again.
+ ************************************************************************
+ */
+void close_checkpoint(Checkpoint *cp, int done)
+{
+  int i;
+
+  if (cp == NULL)
+    return;
+  if (done)
+  {
+    Candidate end;
+    KeyCheckpoint kc;
+
+    memset(&end, 0, sizeof(Candidate));
+    memset(&kc, 0, sizeof(KeyCheckpoint));
+    kc.key_format = cp->p_Vid->p_Inp->key_format;
+    save_checkpoint(cp, &end, &kc, TRUE);
+  }
+  ps_set_free(&cp->ps);
+  for (i = 0; i < CHECKPOINT_CANDIDATES; ++i)
+    ps_set_free(&cp->cand[i].ps);
+  free(cp);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Keep the latest SPS, subset SPS or PPS of each id, a resume feeds
+ *    them to the decoder again
+ ************************************************************************
+ */
+void checkpoint_note_ps(Checkpoint *cp, NALU_t *nalu)
+{
+  int type = nalu->nal_unit_type;
+  int id = rbsp_ue(nalu->buf, nalu->len, type == NALU_TYPE_PPS ? 1 : 4);
+  int i;
+
+  if (id < 0)
+    return;
+  for (i = 0; i < cp->ps.n; ++i)
+    if (cp->ps.ps[i].type == type && cp->ps.ps[i].id == id)
+      break;
+  if (i == CHECKPOINT_MAX_PS)
+    return;
+  if (i == cp->ps.n)
+    cp->ps.n++;
+  ps_record_set(&cp->ps.ps[i], type, id, nalu->buf, nalu->len);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    The parser has read the first slice of an IDR picture at nalu_pos,
+ *    note it if a checkpoint is due
+ ************************************************************************
+ */
+void checkpoint_candidate(Checkpoint *cp, int64 nalu_pos)
+{
+  Candidate *c;
+  int i;
+
+  if (nalu_pos - cp->last_pos < cp->interval)
+    return;
+  for (i = 0; i < CHECKPOINT_CANDIDATES; ++i)
+    if (cp->cand[i].pos == nalu_pos)
+      return;
+  c = &cp->cand[cp->next_cand];
+  cp->next_cand = (cp->next_cand + 1) % CHECKPOINT_CANDIDATES;
+  c->pos = nalu_pos;
+  ps_set_copy(&c->ps, &cp->ps);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Decoding is about to start the picture at nalu_pos, all key units
+ *    before it are applied. Write the checkpoint if it is a candidate.
+ ************************************************************************
+ */
+void checkpoint_picture(Checkpoint *cp, int64 nalu_pos)
+{
+  KeyCheckpoint kc;
+  int i;
+
+  for (i = 0; i < CHECKPOINT_CANDIDATES; ++i)
+  {
+    Candidate *c = &cp->cand[i];
+
+    if (c->pos != nalu_pos)
+      continue;
+    Generate_Key_Sync(&kc);
+    save_checkpoint(cp, c, &kc, FALSE);
+    cp->last_pos = nalu_pos;
+    c->pos = 0;
+  }
+  // candidates behind the decoder will not come up again
+  for (i = 0; i < CHECKPOINT_CANDIDATES; ++i)
+    if (cp->cand[i].pos < nalu_pos)
+      cp->cand[i].pos = 0;
+}
@@ -94,7 +94,7 @@ void JMDecHelpExit (void)
     "   ldecod  -h\n"
     "   ldecod  -d default.cfg\n"
     "   ldecod  -f curenc1.cfg\n"
-    "   ldecod  -f curenc1.cfg -p InputFile=\"e:\\data\\container_qcif_30.264\" -p OutputFile=\"dec.yuv\" -p RefFile=\"Rec.yuv\"\n");
+    "   ldecod  -f curenc1.cfg -p InputFile=\"e:\\data\\container_qcif_30.264\" -p OutputFile=\"scrambled.264\"\n");
 
   exit(-1);
 }
@@ -13,12 +13,22 @@
 
 #include "contributors.h"
 
+#include <fcntl.h>
+#include <limits.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 
 //#include "global.h"
 #include "win32.h"
 #include "h264decoder.h"
 #include "configfile.h"
+#include "keyunit.h"
+#include "stagetimer.h"
+#include "pipeline.h"
+#include "stream.h"
+#include "checkpoint.h"
+#include "outfile.h"
+#include "keystore.h"
 
 #define PRINT_OUTPUT_POC    0
 #define BITSTREAM_FILENAME  "test.264"
@@ -39,6 +49,8 @@ static void Configure(InputParameters *p_Inp, int ac, char *av[])
   //strcpy(p_Inp->reffile, ENCRECON_FILENAME); //! set default reference file name
   
   ParseCommand(p_Inp, ac, av);
+  if (is_stream_input(p_Inp->infile))
+    stream_claim_stdout();
 
   fprintf(stdout,"----------------------------- JM %s %s -----------------------------\n", VERSION, EXT_VERSION);
   //fprintf(stdout," Decoder config file                    : %s \n",config_filename);
@@ -68,26 +80,79 @@ void get_KeyFileName(char* path, char* filename)
 	{
 		filename[j++] = path[i];
 	}
-
+	filename[j] = '\0';
 }
 
+static void get_KeyStoreName(char* name, int size);
+
 void open_KeyFile()
 {
 	if(!p_Dec->p_Inp->enable_key)
 		return;
 	
 	char key_file[FILE_NAME_SIZE];
-	char filename[100];
+	char filename[FILE_NAME_SIZE];
+	const char *prefix;
 	
+	if(p_Dec->p_Inp->key_fd >= 0)
+	{
+		p_Dec->p_KeyFile = fdopen(p_Dec->p_Inp->key_fd, "wb");
+		if(!p_Dec->p_KeyFile)
+		{
+			printf("\033[1;31m open key fd %d error!\033[0m \n",p_Dec->p_Inp->key_fd);
+			exit(0);
+		}
+		return;
+	}
+
+	//the key store gets the whole key stream at the end, keep it in a temporary file until then
+	if(p_Dec->p_Inp->key_store[0] && p_Dec->stream)
+		printf("KeyStore is not used for stream input, writing a key file\n");
+	else if(p_Dec->p_Inp->key_store[0])
+	{
+		char name[FILE_NAME_SIZE];
+
+		if(p_Dec->p_Inp->checkpoint_interval > 0)
+			printf("CheckpointInterval is not supported with KeyStore, no checkpoints\n");
+		//fail on a path name before the input is scrambled, not when the keys are stored
+		if(p_Dec->p_Inp->key_store_key == KEY_STORE_NAME_PATH)
+			get_KeyStoreName(name, FILE_NAME_SIZE);
+		p_Dec->p_KeyFile = tmpfile();
+		if(!p_Dec->p_KeyFile)
+		{
+			printf("\033[1;31m open a temporary key file error!\033[0m \n");
+			exit(0);
+		}
+		p_Dec->key_store = 1;
+		return;
+	}
+
 	get_KeyFileName(p_Dec->p_Inp->infile, filename);
+	//stdin has no name, and a key file name starting with a dash reads like an option
+	if(strcmp(p_Dec->p_Inp->infile, "-") == 0)
+		strcpy(filename, "stdin");
+	prefix = filename[0] == '-' ? "_" : "";
 
-	strncpy(key_file, p_Dec->p_Inp->keyfile_dir, strlen(p_Dec->p_Inp->keyfile_dir));
-	strncat(key_file, filename, strlen(filename));
-	strcat(key_file, ".key");
-	strcat(key_file, ".txt");
+	if(snprintf(key_file, FILE_NAME_SIZE, "%s%s%s.key.txt", p_Dec->p_Inp->keyfile_dir, prefix, filename) >= FILE_NAME_SIZE)
+	{
+		fprintf(stderr, "key file name [%s%s%s.key.txt] is longer than %d bytes\n", p_Dec->p_Inp->keyfile_dir, prefix, filename, FILE_NAME_SIZE - 1);
+		exit(500);
+	}
 	//printf("key_file: %s\n",key_file);	
 
-	p_Dec->p_KeyFile = fopen(key_file, "w+");
+	//a checkpoint of an interrupted run keeps the key file written so far
+	if(p_Dec->p_Inp->checkpoint_interval > 0 && (p_Dec->stream || p_Dec->p_Inp->FileFormat != PAR_OF_ANNEXB))
+		printf("CheckpointInterval is only supported for Annex B files, no checkpoints\n");
+	else if(p_Dec->p_Inp->checkpoint_interval > 0 && p_Dec->follow)
+		printf("CheckpointInterval is not supported with Follow = 1, no checkpoints\n");
+	else if(p_Dec->p_Inp->checkpoint_interval > 0 && p_Dec->output)
+		printf("CheckpointInterval is not needed with OutputFile, the input is not changed, no checkpoints\n");
+	else if(p_Dec->p_Inp->checkpoint_interval > 0 && p_Dec->p_Inp->key_format != KEY_FORMAT_RICE)
+		printf("CheckpointInterval needs KeyFormat = %d, the fixed format cannot hold every key unit, no checkpoints\n", KEY_FORMAT_RICE);
+	else if(p_Dec->p_Inp->checkpoint_interval > 0)
+		p_Dec->checkpoint = open_checkpoint(p_Dec->p_Vid, key_file);
+
+	p_Dec->p_KeyFile = fopen(key_file, checkpoint_resumes(p_Dec->checkpoint) ? "r+" : "w+");
 	if(!p_Dec->p_KeyFile)
 	{
 		printf("\033[1;31m open key file [%s] error!\033[0m \n",key_file);
@@ -99,15 +164,65 @@ void open_KeyFile()
 	}
 }
 
-void close_KeyFile()
+/*!
+ ***********************************************************************
+ * \brief
+ *    Name of the clip in the key store: the canonical path of the
+ *    input, or a hash of the scrambled bytes (the output file when
+ *    there is one, the input scrambled in place otherwise). A path
+ *    that does not fit size is an error.
+ ***********************************************************************
+ */
+static void get_KeyStoreName(char* name, int size)
 {
-	if(p_Dec->p_Inp->enable_key && p_Dec->p_KeyFile)
-		fclose(p_Dec->p_KeyFile);
+	InputParameters *p_Inp = p_Dec->p_Inp;
+	const char *clip = p_Inp->outfile[0] ? p_Inp->outfile : p_Inp->infile;
+	char path[PATH_MAX];
+	int fd;
+
+	if(p_Inp->key_store_key == KEY_STORE_NAME_PATH)
+	{
+		if(!realpath(p_Inp->infile, path))
+			strncpy(path, p_Inp->infile, PATH_MAX - 1);
+		//a cut name would replace the keys of another clip with the same prefix
+		if(snprintf(name, size, "%s", path) >= size)
+		{
+			fprintf(stderr, "The path '%s' is longer than %d bytes and cannot name the clip in the key store, use KeyStoreKey = %d\n",
+				path, size - 1, KEY_STORE_NAME_CONTENT);
+			exit(500);
+		}
+		return;
+	}
+	if((fd = open(clip, O_RDONLY)) < 0)
+	{
+		fprintf(stderr, "Cannot open '%s' to name the clip in the key store\n", clip);
+		exit(500);
+	}
+	key_store_content_name(fd, name, size);
+	close(fd);
 }
 
-KeyUnit* g_pKeyUnitBuffer;
-int g_KeyUnitIdx = 0;
-int g_KeyUnitBufferSize = 0;
+void close_KeyFile()
+{
+	if(!p_Dec->p_Inp->enable_key || !p_Dec->p_KeyFile)
+		return;
+	if(p_Dec->key_store)
+	{
+		KeyStore *ks = open_key_store(p_Dec->p_Inp->key_store, TRUE);
+		char name[FILE_NAME_SIZE];
+		struct stat st;
+		int64 offset;
+
+		fflush(p_Dec->p_KeyFile);
+		if(fstat(fileno(p_Dec->p_KeyFile), &st))
+			error_KeyGen("close_KeyFile: cannot stat the temporary key file", 500);
+		get_KeyStoreName(name, FILE_NAME_SIZE);
+		offset = key_store_put(ks, name, fileno(p_Dec->p_KeyFile), (int64) st.st_size);
+		printf("key store [%s]: %s at byte %lld\n", p_Dec->p_Inp->key_store, name, (long long) offset);
+		close_key_store(ks);
+	}
+	fclose(p_Dec->p_KeyFile);
+}
 
 void print_KeyUnit()
 {
@@ -117,19 +232,20 @@ void print_KeyUnit()
 		printf("open key_unit_log error!\n");
 		exit(1);
 	}
-	KeyUnit* p_tmp = g_pKeyUnitBuffer;
+	KeyUnitReader reader;
+	KeyUnit ku;
 	int i = 0;
 	char s[100];
-	int pre_off = 0;
-	
-	for(; i < g_KeyUnitIdx; ++i)
+
+	init_key_unit_reader(&reader, &g_KeyUnitBuffer);
+	for(; get_key_unit(&reader, &ku); ++i)
 	{		
-		//pre_off += p_tmp[i].byte_offset;
 		snprintf(s,100,"ByteOffset: %5d, BitOffset: %2d, DataLen: %4d\n",
-						p_tmp[i].byte_offset,p_tmp[i].bit_offset,p_tmp[i].key_data_len);
+						ku.byte_offset,ku.bit_offset,ku.key_data_len);
 		fwrite(s,strlen(s),1,log);		
 	}
-	printf("KeyUnitIdx: %d\n",i,g_KeyUnitIdx);
+	fclose(log);
+	printf("KeyUnitIdx: %d\n",i);
 }
 
 void init_GenKeyPar()
@@ -137,37 +253,92 @@ void init_GenKeyPar()
 	if(!p_Dec->p_Inp->enable_key)
 		return;
 	
-	p_Dec->nalu_pos_array = calloc(NALU_NUM_IN_BITSTREAM,sizeof(int));
+	p_Dec->nalu_pos_array = calloc(NALU_NUM_IN_BITSTREAM,sizeof(int64));
 	if(!p_Dec->nalu_pos_array)
 	{
 		printf("\033[1;31m p_Dec->nalu_pos_array malloc failed!\033[0m \n");
 		exit(1);
 	}
 		
-	g_pKeyUnitBuffer = (KeyUnit*)malloc(KEY_UNIT_BUFFER_SIZE*sizeof(KeyUnit));
-	if(!g_pKeyUnitBuffer)
+	init_key_unit_buffer(&g_KeyUnitBuffer, KEY_UNIT_BUFFER_SIZE);
+}
+
+//a JSON string: quote, backslash and control characters escaped
+static void put_json_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for(; *s; ++s)
 	{
-		printf("\033[1;31m key unit buffer malloc failed!\033[0m \n");
-		exit(1);
+		if(*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if((unsigned char) *s < 0x20)
+			fprintf(f, "\\u%04x", (unsigned char) *s);
+		else
+			fputc(*s, f);
 	}
-	g_KeyUnitBufferSize = KEY_UNIT_BUFFER_SIZE;
+	fputc('"', f);
 }
+
+/*!
+ ***********************************************************************
+ * \brief
+ *    Append the statistics of this run as one JSON line to StatsFile
+ *    (times in us, peak_rss in KiB)
+ ***********************************************************************
+ */
+static void write_stats(InputParameters *p_Inp, DecoderStats *stats, int key_units, long parse_us, long encrypt_us, long total_us)
+{
+	FILE *f;
+	struct stat st;
+	struct rusage ru;
+
+	if(p_Inp->stats_file[0] == '\0')
+		return;
+	if((f = fopen(p_Inp->stats_file, "a")) == NULL)
+	{
+		printf("open stats file [%s] error!\n", p_Inp->stats_file);
+		return;
+	}
+	if(stat(p_Inp->infile, &st))
+		st.st_size = 0;
+	getrusage(RUSAGE_SELF, &ru);
+
+	fprintf(f, "{\"input\": ");
+	put_json_string(f, p_Inp->infile);
+	fprintf(f, ", \"bytes\": %lld, \"entropy\": \"%s\", \"width\": %d, \"height\": %d, "
+		"\"pictures\": %d, \"frames\": %d, \"field_pictures\": %d, \"mbaff_pictures\": %d, "
+		"\"slices\": %d, \"max_slices_per_picture\": %d, \"macroblocks\": %lld, \"key_units\": %d, "
+		"\"parset_repeats\": %d, \"reactivations_skipped\": %d, \"partitions_skipped\": %d, \"mv_field_pictures\": %d, "
+		"\"mem\": {\"mb_data\": %lld, \"mb_maps\": %lld, \"cavlc\": %lld}, \"mem_mapped\": %lld, \"mem_huge_mapped\": %lld, "
+		"\"parse_us\": %ld, \"encrypt_us\": %ld, \"total_us\": %ld, \"peak_rss\": %ld}\n",
+		(long long) st.st_size, stats->cabac ? "cabac" : "cavlc", stats->width, stats->height,
+		stats->pictures, stats->frames, stats->field_pictures, stats->mbaff_pictures,
+		stats->slices, stats->max_slices_per_picture, (long long) stats->macroblocks, key_units,
+		stats->parset_repeats, stats->reactivations_skipped, stats->partitions_skipped, stats->mv_field_pictures,
+		(long long) stats->mem_bytes[MEM_MB_DATA], (long long) stats->mem_bytes[MEM_MB_MAPS], (long long) stats->mem_bytes[MEM_CAVLC],
+		(long long) stats->mem_mapped, (long long) stats->mem_huge_mapped,
+		parse_us, encrypt_us, total_us, ru.ru_maxrss);
+	fclose(f);
+}
+
 /*!
  ***********************************************************************
  * \brief
  *    main function for JM decoder
  ***********************************************************************
  */
-extern int Encrypt(KeyUnit *pKeyUnit,int UnitNum); 
 int main(int argc, char **argv)
 {
-	struct timeval start, end1, end2;
-	long int time_us1,time_us2;
+	struct timeval start, end1, end2, end3;
+	long int time_us1,time_us2,time_us3;
+	int key_units;
+	DecoderStats stats;
 	gettimeofday( &start, NULL );
 	
   int iRet;
   InputParameters InputParams;
   init_time();
+  STAGE_TIMERS_INIT();
 
   //get input parameters;
   Configure(&InputParams, argc, argv);
@@ -179,10 +350,32 @@ int main(int argc, char **argv)
     return -1; //failed;
   }
 
+	if(p_Dec->p_Inp->follow && !p_Dec->follow && !p_Dec->stream)
+		printf("Follow = 1 is only supported for Annex B files, reading to the end once\n");
+
+	//a separate scrambled file leaves the input as it is
+	if(p_Dec->p_Inp->outfile[0] && p_Dec->stream)
+		printf("OutputFile is not used for stream input, the scrambled stream goes to stdout\n");
+	else if(p_Dec->p_Inp->outfile[0])
+		p_Dec->output = open_scrambled_output(p_Dec->p_Inp->outfile, p_Dec->BitStreamFile);
+
 	open_KeyFile();	
 	init_GenKeyPar();
+	if(p_Dec->checkpoint)
+		resume_checkpoint(p_Dec->checkpoint);
+
+	//the writer stage scrambles the key units while decoding goes on
+	if(p_Dec->p_Inp->pipeline && p_Dec->stream)
+		printf("Pipeline = 1 is not supported for stream input, decoding on one thread\n");
+	else if(p_Dec->p_Inp->pipeline && p_Dec->checkpoint)
+		printf("Pipeline = 1 is not supported with checkpoints, decoding on one thread\n");
+	else if(p_Dec->p_Inp->pipeline && p_Dec->follow)
+		printf("Pipeline = 1 is not supported with Follow = 1, decoding on one thread\n");
+	else if(p_Dec->p_Inp->pipeline)
+		p_Dec->pipeline = open_pipeline(p_Dec->p_Vid, p_Dec->p_Inp->pipeline_depth, p_Dec->p_Inp->enable_key);
 	
   //decoding;
+  STAGE_BEGIN(STAGE_DECODE);
   do
   {
     iRet = DecodeOneFrame();
@@ -196,26 +389,77 @@ int main(int argc, char **argv)
       fprintf(stderr, "Error in decoding process: 0x%x\n", iRet);
     }
   }while((iRet == DEC_SUCCEED) /*&& ((p_Dec->p_Inp->iDecFrmNum==0) || (iFramesDecoded<p_Dec->p_Inp->iDecFrmNum))*/);
+  STAGE_CONTEXT_NONE();
+  STAGE_END(STAGE_DECODE);
 
 	gettimeofday( &end1, NULL );
 	time_us1 = 1000000 * ( end1.tv_sec - start.tv_sec ) + end1.tv_usec - start.tv_usec;
 	printf("run time0: %ld us\n",time_us1);
 
 	//encrypt the H.264 file
-	printf("key unit count: %d\n",g_KeyUnitIdx);
-	if(p_Dec->p_Inp->enable_key && g_pKeyUnitBuffer && g_KeyUnitIdx > 0)
-		Encrypt(g_pKeyUnitBuffer, g_KeyUnitIdx);
+	key_units = g_KeyUnitBuffer.count;
+	printf("key unit count: %d\n",key_units);
+	if(p_Dec->pipeline)
+	{
+		STAGE_CONTEXT_NONE();
+		STAGE_BEGIN(STAGE_ENCRYPT);
+		close_pipeline(p_Dec->pipeline);
+		p_Dec->pipeline = NULL;
+		STAGE_END(STAGE_ENCRYPT);
+	}
+	else if(p_Dec->stream)
+	{
+		//the key units were scrambled while decoding, pass on the rest of the stream
+		if(p_Dec->p_Inp->enable_key && g_KeyUnitBuffer.count > 0)
+			Generate_Key(0,0,0,1);
+		close_stream_window(p_Dec->stream);
+		p_Dec->stream = NULL;
+	}
+	else if(p_Dec->follow)
+	{
+		//the key units were scrambled while following, complete the key file
+		if(p_Dec->p_Inp->enable_key && g_KeyUnitBuffer.count > 0)
+			Generate_Key(0,0,0,1);
+	}
+	else if(p_Dec->checkpoint)
+	{
+		//the key units were scrambled while decoding, complete the key file
+		if(g_KeyUnitBuffer.count > 0)
+			Generate_Key(0,0,0,1);
+		fflush(p_Dec->p_KeyFile);
+		fsync(fileno(p_Dec->p_KeyFile));
+		close_checkpoint(p_Dec->checkpoint, TRUE);
+		p_Dec->checkpoint = NULL;
+	}
+	else if(p_Dec->p_Inp->enable_key && g_KeyUnitBuffer.buf && g_KeyUnitBuffer.count > 0)
+	{
+		STAGE_CONTEXT_NONE();
+		STAGE_BEGIN(STAGE_ENCRYPT);
+		Encrypt(&g_KeyUnitBuffer);
+		STAGE_END(STAGE_ENCRYPT);
+	}
+	if(p_Dec->output)
+	{
+		close_scrambled_output(p_Dec->output, p_Dec->BitStreamFileLen);
+		p_Dec->output = NULL;
+	}
 
 	close_KeyFile();
+	gettimeofday( &end3, NULL );
+	time_us3 = 1000000 * ( end3.tv_sec - end1.tv_sec ) + end3.tv_usec - end1.tv_usec;
+
+	stats = p_Dec->stats;		// p_Dec is released by CloseDecoder()
   iRet = FinitDecoder();
   iRet = CloseDecoder();
 
 	//print_KeyUnit();
+	free_key_unit_buffer(&g_KeyUnitBuffer);
 	
 	gettimeofday( &end2, NULL );
 	time_us2 = 1000000 * ( end2.tv_sec - end1.tv_sec ) + end2.tv_usec - end1.tv_usec;
 	printf("run time1: %ld us\n",time_us2);
 	printf("run time(all): %ld us\n", time_us1+time_us2);
+	write_stats(&InputParams, &stats, key_units, time_us1, time_us3, time_us1+time_us2);
   return 0;
 }
 
@@ -14,10 +14,14 @@
 #include "contributors.h"
 #include "global.h"
 #include "mbuffer.h"
+#include "nalucommon.h"
+#include "tracering.h"
 
 
 #if TRACE
 
+extern int symbolCount;
+
 /*!
 ************************************************************************
 * \brief
@@ -42,52 +46,14 @@ void tracebits(
     int info,               //!< infoword of syntax element
     int value1)
 {
-  int i, chars;
-  // int outint = 1;
-
   if(len>=64)
   {
     snprintf(errortext, ET_SIZE, "Length argument to put too long for trace to work");
     error (errortext, 600);
   }
 
-  putc('@', p_Dec->p_trace);
-  chars = fprintf(p_Dec->p_trace, "%i", p_Dec->bitcounter);
-  while(chars++ < 5)
-    putc(' ',p_Dec->p_trace);
-
-  chars += fprintf(p_Dec->p_trace, " %s", trace_str);
-  while(chars++ < 55)
-    putc(' ',p_Dec->p_trace);
-
-  // Align bitpattern
-  if(len<15)
-  {
-    for(i=0 ; i<15-len ; i++)
-      fputc(' ', p_Dec->p_trace);
-  }
-
-  // Print bitpattern
-  for(i=0 ; i<len/2 ; i++)
-  {
-    fputc('0', p_Dec->p_trace);
-  }
-  // put 1
-  fprintf(p_Dec->p_trace, "1");
-
-  // Print bitpattern
-  for(i=0 ; i<len/2 ; i++)
-  {
-      if (0x01 & ( info >> ((len/2-i)-1)))
-        fputc('1', p_Dec->p_trace);
-      else
-        fputc('0', p_Dec->p_trace);
-  }
-
-  fprintf(p_Dec->p_trace, " (%3d) \n", value1);
+  trace_put(TRACE_VLC, trace_str, p_Dec->bitcounter, len, info, value1);
   p_Dec->bitcounter += len;
-
-  fflush (p_Dec->p_trace);
 }
 
 /*!
@@ -101,56 +67,93 @@ void tracebits2(
     int len,                //!< length of syntax element in bits
     int info)
 {
-
-  int i, chars;
-  // int outint = 1;
-
   if(len>=64)
   {
     snprintf(errortext, ET_SIZE, "Length argument to put too long for trace to work");
     error (errortext, 600);
   }
 
-  putc('@', p_Dec->p_trace);
-  chars = fprintf(p_Dec->p_trace, "%i", p_Dec->bitcounter);
-
-  while(chars++ < 5)
-    putc(' ',p_Dec->p_trace);
-
-  chars += fprintf(p_Dec->p_trace, " %s", trace_str);
+  trace_put(TRACE_BITS, trace_str, p_Dec->bitcounter, len, info, info);
+  p_Dec->bitcounter += len;
+}
 
-  while(chars++ < 55)
-    putc(' ',p_Dec->p_trace);
+/*!
+ ************************************************************************
+ * \brief
+ *    Set the trace string of currSE to format with its %s replaced by
+ *    type and its %d by a, b, c and d (0..255). Only the pointers are
+ *    kept, trace_se_bits() traces the format and the renderer prints
+ *    the string, so the per coefficient strings cost no formatting.
+ ************************************************************************
+ */
+void trace_format(SyntaxElement *currSE, const char *format, const char *type, int a, int b, int c, int d)
+{
+  currSE->tracestring[0] = TRACE_DEFERRED;
+  currSE->tracestring[1] = '\0';
+  currSE->traceformat    = format;
+  currSE->tracetype      = type;
+  currSE->traceargs      = (a & 0xFF) | ((b & 0xFF) << 8) | ((c & 0xFF) << 16) | ((unsigned) (d & 0xFF) << 24);
+}
 
-  // Align bitpattern
-  if(len < 15)
+/*!
+ ************************************************************************
+ * \brief
+ *    tracebits2() of the trace string of sym
+ ************************************************************************
+ */
+void trace_se_bits(SyntaxElement *sym, int len, int info)
+{
+  if (sym->tracestring[0] != TRACE_DEFERRED || sym->tracestring[1] != '\0')
   {
-    for(i = 0; i < 15 - len; i++)
-      fputc(' ', p_Dec->p_trace);
+    tracebits2(sym->tracestring, len, info);
+    return;
   }
-
-  p_Dec->bitcounter += len;
-  while (len >= 32)
+  if(len>=64)
   {
-    for(i = 0; i < 8; i++)
-    {
-      fputc('0', p_Dec->p_trace);
-    }
-    len -= 8;
+    snprintf(errortext, ET_SIZE, "Length argument to put too long for trace to work");
+    error (errortext, 600);
   }
 
-  // Print bitpattern
-  for(i=0 ; i<len ; i++)
-  {
-    if (0x01 & ( info >> (len-i-1)))
-      fputc('1', p_Dec->p_trace);
-    else
-      fputc('0', p_Dec->p_trace);
-  }
+  trace_put_format(TRACE_BITS_FORMAT, sym->traceformat, sym->tracetype, p_Dec->bitcounter, len, info, sym->traceargs);
+  p_Dec->bitcounter += len;
+}
 
-  fprintf(p_Dec->p_trace, " (%3d) \n", info);
+/*!
+ ************************************************************************
+ * \brief
+ *    Tracing CABAC symbols, numbered by symbolCount
+ ************************************************************************
+ */
+void trace_cabac(const char *trace_str, int value1)
+{
+  trace_put(TRACE_CABAC, trace_str, symbolCount++, 0, 0, value1);
+}
 
-  fflush (p_Dec->p_trace);
+void trace_level_run(const char *trace_str, int level, int run)
+{
+  trace_put(TRACE_LEVEL_RUN, trace_str, symbolCount++, 0, run, level);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Tracing an Annex B NAL unit header
+ ************************************************************************
+ */
+void trace_nalu(NALU_t *nalu, int last)
+{
+  trace_put(TRACE_NALU, "", 0, last, nalu->startcodeprefix_len | (nalu->forbidden_bit << 8) | (nalu->nal_reference_idc << 16) | (nalu->nal_unit_type << 24), nalu->len);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Tracing detail values (TRACE 2), format holds up to three %d
+ ************************************************************************
+ */
+void trace_values(const char *format, int a, int b, int c)
+{
+  trace_put(TRACE_VALUES, format, c, 0, b, a);
 }
 
 /*!
@@ -20,9 +20,58 @@
 #include "header.h"
 #include "fmo.h"
 #include "fast_memory.h"
+#include "memalloc.h"
 
 //#define PRINT_FMO_MAPS
 
+#define FMO_MAP_CACHE_SIZE  4     //!< slice group maps kept for PPS / change cycle combinations in use
+
+/*!
+ ************************************************************************
+ * \brief
+ *    What the slice group maps of a picture depend on. Only the fields
+ *    the map type reads are set, the rest stay 0, so two PPS that
+ *    differ elsewhere share the maps. The explicit map of type 6 is
+ *    compared with the cached map units themselves.
+ ************************************************************************
+ */
+typedef struct fmo_map_key
+{
+  unsigned num_slice_groups_minus1;
+  unsigned slice_group_map_type;
+  unsigned run_length_minus1[MAXnum_slice_groups_minus1];
+  unsigned top_left[MAXnum_slice_groups_minus1];
+  unsigned bottom_right[MAXnum_slice_groups_minus1];
+  unsigned slice_group_change_direction_flag;
+  unsigned slice_group_change_rate_minus1;
+  unsigned slice_group_change_cycle;
+  unsigned map_units;
+  unsigned PicWidthInMbs;
+  unsigned PicHeightInMapUnits;
+  unsigned PicSizeInMbs;
+  int      frame_mbs_only_flag;
+  int      mb_adaptive_frame_field_flag;
+  int      field_pic_flag;
+} FmoMapKey;
+
+typedef struct fmo_map_entry
+{
+  FmoMapKey key;
+  int       used;                         //!< clock of the last use, 0 = empty
+  unsigned  map_units_size;               //!< allocated entries of map_units
+  unsigned  mbs_size;                     //!< allocated entries of mbs and next_mb
+  int      *map_units;                    //!< MapUnitToSliceGroupMap
+  int      *mbs;                          //!< MbToSliceGroupMap
+  int      *next_mb;                      //!< next MB of the same slice group, -1 after the last one
+  int       last_mb[MAXnum_slice_groups_minus1];
+} FmoMapEntry;
+
+typedef struct fmo_map_cache
+{
+  FmoMapEntry entry[FMO_MAP_CACHE_SIZE];
+  int         clock;
+} FmoMapCache;
+
 static void FmoGenerateType0MapUnitMap (VideoParameters *p_Vid, unsigned PicSizeInMapUnits );
 static void FmoGenerateType1MapUnitMap (VideoParameters *p_Vid, unsigned PicSizeInMapUnits );
 static void FmoGenerateType2MapUnitMap (VideoParameters *p_Vid, unsigned PicSizeInMapUnits );
@@ -35,7 +84,7 @@ static void FmoGenerateType6MapUnitMap (VideoParameters *p_Vid, unsigned PicSize
 /*!
  ************************************************************************
  * \brief
- *    Generates p_Vid->MapUnitToSliceGroupMap
+ *    Generates p_Vid->MapUnitToSliceGroupMap (allocated by the caller)
  *    Has to be called every time a new Picture Parameter Set is used
  *
  * \param p_Vid
@@ -60,15 +109,6 @@ static int FmoGenerateMapUnitToSliceGroupMap (VideoParameters *p_Vid, Slice *cur
     }
   }
 
-  // allocate memory for p_Vid->MapUnitToSliceGroupMap
-  if (p_Vid->MapUnitToSliceGroupMap)
-    free (p_Vid->MapUnitToSliceGroupMap);
-  if ((p_Vid->MapUnitToSliceGroupMap = malloc ((NumSliceGroupMapUnits) * sizeof (int))) == NULL)
-  {
-    printf ("cannot allocated %d bytes for p_Vid->MapUnitToSliceGroupMap, exit\n", (int) ( (pps->pic_size_in_map_units_minus1+1) * sizeof (int)));
-    exit (-1);
-  }
-
   if (pps->num_slice_groups_minus1 == 0)    // only one slice group
   {
     fast_memset (p_Vid->MapUnitToSliceGroupMap, 0, NumSliceGroupMapUnits * sizeof (int));
@@ -109,7 +149,8 @@ static int FmoGenerateMapUnitToSliceGroupMap (VideoParameters *p_Vid, Slice *cur
 /*!
  ************************************************************************
  * \brief
- *    Generates p_Vid->MbToSliceGroupMap from p_Vid->MapUnitToSliceGroupMap
+ *    Generates p_Vid->MbToSliceGroupMap (allocated by the caller) from
+ *    p_Vid->MapUnitToSliceGroupMap
  *
  * \param p_Vid
  *      video encoding parameters for current picture
@@ -122,17 +163,6 @@ static int FmoGenerateMbToSliceGroupMap (VideoParameters *p_Vid, Slice *pSlice)
 
   unsigned i;
 
-  // allocate memory for p_Vid->MbToSliceGroupMap
-  if (p_Vid->MbToSliceGroupMap)
-    free (p_Vid->MbToSliceGroupMap);
-
-  if ((p_Vid->MbToSliceGroupMap = malloc ((p_Vid->PicSizeInMbs) * sizeof (int))) == NULL)
-  {
-    printf ("cannot allocate %d bytes for p_Vid->MbToSliceGroupMap, exit\n", (int) ((p_Vid->PicSizeInMbs) * sizeof (int)));
-    exit (-1);
-  }
-
-
   if ((sps->frame_mbs_only_flag)|| pSlice->field_pic_flag)
   {
     int *MbToSliceGroupMap = p_Vid->MbToSliceGroupMap;
@@ -164,7 +194,157 @@ static int FmoGenerateMbToSliceGroupMap (VideoParameters *p_Vid, Slice *pSlice)
 /*!
  ************************************************************************
  * \brief
- *    FMO initialization: Generates p_Vid->MapUnitToSliceGroupMap and p_Vid->MbToSliceGroupMap.
+ *    Fills the cache key of the current picture
+ ************************************************************************
+ */
+static void FmoGetMapKey (VideoParameters *p_Vid, Slice *pSlice, FmoMapKey *key)
+{
+  seq_parameter_set_rbsp_t* sps = p_Vid->active_sps;
+  pic_parameter_set_rbsp_t* pps = p_Vid->active_pps;
+  unsigned i;
+
+  memset(key, 0, sizeof(FmoMapKey));
+  key->num_slice_groups_minus1      = pps->num_slice_groups_minus1;
+  key->map_units                    = (sps->pic_height_in_map_units_minus1+1)* (sps->pic_width_in_mbs_minus1+1);
+  key->PicWidthInMbs                = p_Vid->PicWidthInMbs;
+  key->PicHeightInMapUnits          = p_Vid->PicHeightInMapUnits;
+  key->PicSizeInMbs                 = p_Vid->PicSizeInMbs;
+  key->frame_mbs_only_flag          = sps->frame_mbs_only_flag;
+  key->mb_adaptive_frame_field_flag = sps->mb_adaptive_frame_field_flag;
+  key->field_pic_flag               = pSlice->field_pic_flag;
+  if (pps->num_slice_groups_minus1 == 0)
+    return;
+
+  key->slice_group_map_type = pps->slice_group_map_type;
+  switch (pps->slice_group_map_type)
+  {
+  case 0:
+    for (i = 0; i <= pps->num_slice_groups_minus1; i++)
+      key->run_length_minus1[i] = pps->run_length_minus1[i];
+    break;
+  case 2:
+    for (i = 0; i < pps->num_slice_groups_minus1; i++)
+    {
+      key->top_left[i]     = pps->top_left[i];
+      key->bottom_right[i] = pps->bottom_right[i];
+    }
+    break;
+  case 3:
+  case 4:
+  case 5:
+    key->slice_group_change_direction_flag = pps->slice_group_change_direction_flag;
+    key->slice_group_change_rate_minus1    = pps->slice_group_change_rate_minus1;
+    key->slice_group_change_cycle          = pSlice->slice_group_change_cycle;
+    break;
+  default:
+    break;
+  }
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Precomputes the next MB of the same slice group for every MB and
+ *    the last MB of every slice group from the MB map of e
+ ************************************************************************
+ */
+static void FmoGenerateNextMbMap (FmoMapEntry *e, unsigned PicSizeInMbs)
+{
+  int next[MAXnum_slice_groups_minus1];
+  int i, g;
+
+  for (g = 0; g < MAXnum_slice_groups_minus1; g++)
+  {
+    next[g] = -1;
+    e->last_mb[g] = -1;
+  }
+  for (i = (int) PicSizeInMbs - 1; i >= 0; i--)
+  {
+    g = e->mbs[i];
+    if (e->last_mb[g] < 0)
+      e->last_mb[g] = i;
+    e->next_mb[i] = next[g];
+    next[g] = i;
+  }
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    The cache entry holding the maps for key, the least recently used
+ *    entry (re)generated when none does
+ ************************************************************************
+ */
+static FmoMapEntry *FmoGetMapEntry (VideoParameters *p_Vid, Slice *pSlice, FmoMapKey *key)
+{
+  pic_parameter_set_rbsp_t* pps = p_Vid->active_pps;
+  FmoMapCache *cache = p_Vid->fmo_cache;
+  FmoMapEntry *e, *victim;
+  int i;
+
+  if (cache == NULL && (cache = p_Vid->fmo_cache = (FmoMapCache *) calloc(1, sizeof(FmoMapCache))) == NULL)
+    no_mem_exit("FmoGetMapEntry: fmo_cache");
+
+  victim = &cache->entry[0];
+  for (i = 0; i < FMO_MAP_CACHE_SIZE; i++)
+  {
+    e = &cache->entry[i];
+    if (e->used && !memcmp(&e->key, key, sizeof(FmoMapKey)))
+    {
+      unsigned u;
+
+      if (key->num_slice_groups_minus1 == 0 || key->slice_group_map_type != 6)
+        break;
+      // the explicit map is not part of the key
+      for (u = 0; u < key->map_units && e->map_units[u] == pps->slice_group_id[u]; u++)
+        ;
+      if (u == key->map_units)
+        break;
+    }
+    if (e->used < victim->used)
+      victim = e;
+  }
+  if (i < FMO_MAP_CACHE_SIZE)
+  {
+    e->used = ++cache->clock;
+    return e;
+  }
+
+  e = victim;
+  if (e->map_units_size < key->map_units)
+  {
+    free(e->map_units);
+    if ((e->map_units = (int *) malloc(key->map_units * sizeof(int))) == NULL)
+      no_mem_exit("FmoGetMapEntry: map_units");
+    e->map_units_size = key->map_units;
+  }
+  if (e->mbs_size < key->PicSizeInMbs)
+  {
+    free(e->mbs);
+    free(e->next_mb);
+    if ((e->mbs = (int *) malloc(key->PicSizeInMbs * sizeof(int))) == NULL
+      || (e->next_mb = (int *) malloc(key->PicSizeInMbs * sizeof(int))) == NULL)
+      no_mem_exit("FmoGetMapEntry: mbs");
+    e->mbs_size = key->PicSizeInMbs;
+  }
+  e->key  = *key;
+  e->used = ++cache->clock;
+
+  p_Vid->MapUnitToSliceGroupMap = e->map_units;
+  p_Vid->MbToSliceGroupMap      = e->mbs;
+  FmoGenerateMapUnitToSliceGroupMap(p_Vid, pSlice);
+  FmoGenerateMbToSliceGroupMap(p_Vid, pSlice);
+  FmoGenerateNextMbMap(e, key->PicSizeInMbs);
+  return e;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    FMO initialization: Sets p_Vid->MapUnitToSliceGroupMap and p_Vid->MbToSliceGroupMap.
+ *    The maps only change with the PPS, the picture structure and the
+ *    slice_group_change_cycle, they are generated once per combination
+ *    and kept in a small cache.
  *
  * \param p_Vid
  *      video encoding parameters for current picture
@@ -173,14 +353,20 @@ static int FmoGenerateMbToSliceGroupMap (VideoParameters *p_Vid, Slice *pSlice)
 int fmo_init(VideoParameters *p_Vid, Slice *pSlice)
 {
   pic_parameter_set_rbsp_t* pps = p_Vid->active_pps;
+  FmoMapKey key;
+  FmoMapEntry *e;
 
 #ifdef PRINT_FMO_MAPS
   unsigned i,j;
 #endif
 
-  FmoGenerateMapUnitToSliceGroupMap(p_Vid, pSlice);
-  FmoGenerateMbToSliceGroupMap(p_Vid, pSlice);
+  FmoGetMapKey(p_Vid, pSlice, &key);
+  e = FmoGetMapEntry(p_Vid, pSlice, &key);
 
+  p_Vid->MapUnitToSliceGroupMap = e->map_units;
+  p_Vid->MbToSliceGroupMap      = e->mbs;
+  p_Vid->NextMbInSliceGroup     = e->next_mb;
+  p_Vid->LastMbInSliceGroup     = e->last_mb;
   p_Vid->NumberOfSliceGroups = pps->num_slice_groups_minus1 + 1;
 
 #ifdef PRINT_FMO_MAPS
@@ -222,16 +408,23 @@ int fmo_init(VideoParameters *p_Vid, Slice *pSlice)
  */
 int FmoFinit(VideoParameters *p_Vid)
 {
-  if (p_Vid->MbToSliceGroupMap)
-  {
-    free (p_Vid->MbToSliceGroupMap);
-    p_Vid->MbToSliceGroupMap = NULL;
-  }
-  if (p_Vid->MapUnitToSliceGroupMap)
+  if (p_Vid->fmo_cache)
   {
-    free (p_Vid->MapUnitToSliceGroupMap);
-    p_Vid->MapUnitToSliceGroupMap = NULL;
+    int i;
+
+    for (i = 0; i < FMO_MAP_CACHE_SIZE; i++)
+    {
+      free (p_Vid->fmo_cache->entry[i].map_units);
+      free (p_Vid->fmo_cache->entry[i].mbs);
+      free (p_Vid->fmo_cache->entry[i].next_mb);
+    }
+    free (p_Vid->fmo_cache);
+    p_Vid->fmo_cache = NULL;
   }
+  p_Vid->MbToSliceGroupMap = NULL;
+  p_Vid->MapUnitToSliceGroupMap = NULL;
+  p_Vid->NextMbInSliceGroup = NULL;
+  p_Vid->LastMbInSliceGroup = NULL;
   return 0;
 }
 
@@ -281,13 +474,9 @@ int FmoGetLastMBOfPicture(VideoParameters *p_Vid)
 
 int FmoGetLastMBInSliceGroup (VideoParameters *p_Vid, int SliceGroup)
 {
-  int i;
-
-  for (i=p_Vid->PicSizeInMbs-1; i>=0; i--)
-    if (FmoGetSliceGroupId (p_Vid, i) == SliceGroup)
-      return i;
-  return -1;
-
+  assert (SliceGroup >= 0 && SliceGroup < MAXnum_slice_groups_minus1);
+  assert (p_Vid->LastMbInSliceGroup != NULL);
+  return p_Vid->LastMbInSliceGroup[SliceGroup];
 }
 
 
@@ -324,15 +513,9 @@ int FmoGetSliceGroupId (VideoParameters *p_Vid, int mb)
  */
 int FmoGetNextMBNr (VideoParameters *p_Vid, int CurrentMbNr)
 {
-  int SliceGroup = FmoGetSliceGroupId (p_Vid, CurrentMbNr);
-
-  while (++CurrentMbNr<(int)p_Vid->PicSizeInMbs && p_Vid->MbToSliceGroupMap [CurrentMbNr] != SliceGroup)
-    ;
-
-  if (CurrentMbNr >= (int)p_Vid->PicSizeInMbs)
-    return -1;    // No further MB in this slice (could be end of picture)
-  else
-    return CurrentMbNr;
+  assert (CurrentMbNr < (int) p_Vid->PicSizeInMbs);
+  assert (p_Vid->NextMbInSliceGroup != NULL);
+  return p_Vid->NextMbInSliceGroup[CurrentMbNr];    // -1: no further MB in this slice (could be end of picture)
 }
 
 
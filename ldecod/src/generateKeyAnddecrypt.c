@@ -7,8 +7,14 @@
 #include <time.h>
 
 #include "global.h"
+#include "memalloc.h"
+#include "keyunit.h"
+#include "iobackend.h"
+#include "stream.h"
+#include "outfile.h"
 
 #define MAX_BUFFER_LEN 1024*1024*120	//20MB
+#define DIRTY_MERGE_GAP 4096	//changed ranges closer than this are written as one, about a page
 
 #define KEY_BIT_LEN_1 8
 #define KEY_BIT_LEN_3 3
@@ -16,6 +22,9 @@
 
 #define KEY_MAX_BYTE_LEN 100
 
+#define KEY_RICE_BUFFER_LEN 1024*1024
+#define KEY_RICE_DATA_CHUNK 24
+
 typedef struct
 {
 	uint8_t* start;
@@ -212,16 +221,110 @@ int Generate_Key_Get_Changed_ByteNum(int BitLength,int BitOffset,int *ChangedByt
 	return 0;
 }
 
-int Encrypt(KeyUnit *pKeyUnit,int UnitNum)
+int Encrypt(KeyUnitBuffer *pKeyUnits)
 {
-	int i=0;
+	KeyUnitReader reader;
+	KeyUnit ku;
+
+	init_key_unit_reader(&reader, pKeyUnits);
+	while(get_key_unit(&reader, &ku))
+	{
+		Generate_Key(ku.byte_offset,ku.bit_offset,ku.key_data_len,0);	
+	}
+	Generate_Key(0,0,0,1);
+	return 0;
+}
+
+//Generate_Key state, file scope for the checkpoint functions below
+static bs_t *b_read,*b_write;
+static int KeyByteLen;
+static int64 RelativeByteOff_Sum=0;
+static int64 BufferStart=0;
+static int read_count=0;
+static int KeyByteLenSum=0;
+
+static char *keyBuffer=NULL;
+static char *h264Buffer=NULL;
+static char *h264Spare=NULL;	//next window, filled while h264Buffer is still being written back
+
+static int64 LastByteOffset=0;
+static int64 ByteOffset=0;
+
+static KeyRiceWriter rice_writer;
+
+static KeyCheckpoint key_resume;	//continue from this, until the first key unit after a resume
+static int key_resume_pending=0;
+
+//window bytes changed by the key units and not yet written, in file order
+typedef struct
+{
+	int64 start;
+	int64 end;
+} DirtyRange;
+
+static DirtyRange *Dirty=NULL;
+static int DirtyCount=0;
+static int DirtyAlloc=0;
+
+//the key unit changes the window bytes start..start+len, close ranges are merged into one
+static void mark_dirty(int64 start,int len)
+{
+	DirtyRange *last=DirtyCount ? &Dirty[DirtyCount-1] : NULL;
 
-	for(i=0;i<UnitNum;i++)
+	if(len<=0)
+		return;	//a key unit without data, write_dirty() stops at an empty range
+	if(last && start<=last->end+DIRTY_MERGE_GAP)
+	{
+		last->end=i64max(last->end,start+len);
+		return;
+	}
+	if(DirtyCount==DirtyAlloc)
 	{
-		Generate_Key(pKeyUnit[i].byte_offset,pKeyUnit[i].bit_offset,pKeyUnit[i].key_data_len,0);	
+		DirtyAlloc=DirtyAlloc ? 2*DirtyAlloc : 1024;
+		if((Dirty=(DirtyRange *)realloc(Dirty,DirtyAlloc*sizeof(DirtyRange)))==NULL)
+			no_mem_exit("mark_dirty: Dirty");
 	}
-	if(i == UnitNum)
-		Generate_Key(0,0,0,1);
+	Dirty[DirtyCount].start=start;
+	Dirty[DirtyCount].end=start+len;
+	DirtyCount++;
+}
+
+/*
+*	Write the changed window bytes before upto back to the bit stream, or pass
+*	them on to the scrambled output. Bytes from upto on move to the next window
+*	and are written from there, so queued writes never overlap.
+*/
+static void write_dirty(int64 upto)
+{
+	int i;
+
+	for(i=0;i<DirtyCount;++i)
+	{
+		int64 start=Dirty[i].start;
+		int64 end=i64min(Dirty[i].end,upto);
+
+		if(start>=end)
+			break;
+		if(p_Dec->output)
+			scrambled_output_span(p_Dec->output,(byte *)h264Buffer+start,(int)(end-start),BufferStart+start);
+		else
+			io_write(p_Dec->key_io,h264Buffer+start,(int)(end-start),BufferStart+start);
+	}
+	DirtyCount=0;
+}
+
+/*
+*	Put the key data written so far into the key file on disk. With checkpoints
+*	this comes before any write-back: a scrambled byte may only reach the bit
+*	stream once the key unit that restores it is durable. Checkpoints always
+*	use the rice format, see open_KeyFile().
+*/
+static void sync_key_file(KeyRiceState *st)
+{
+	sync_key_rice_writer(&rice_writer,st);
+	fflush(p_Dec->p_KeyFile);
+	if(fsync(fileno(p_Dec->p_KeyFile)))
+		error_KeyGen("sync_key_file: fsync of the key file failed",500);
 }
 
 /*
@@ -243,19 +346,9 @@ int Generate_Key(int RelativeByteOff,int BitOffset,int BitLength, int canfree)
 {
 	int keydata;
 	int ChangedByteNum=0;
-	static bs_t *b_read,*b_write;
 	char *key=NULL;
-	static int KeyByteLen;
-	static int RelativeByteOff_Sum=0;
-	static int BufferStart=0;
-	static int read_count=0;
-	static int KeyByteLenSum=0;
-
-	static char *keyBuffer=NULL;
-	static char *h264Buffer=NULL;
-
-	static int LastByteOffset=0;
-	static int ByteOffset=0;
+	int rice = (p_Dec->p_Inp->key_format == KEY_FORMAT_RICE);
+	int key_flush_len = p_Dec->stream ? STREAM_KEY_FLUSH_LEN : MAX_BUFFER_LEN;	//a stream consumer should not wait for 120MB of keys
 	
 	LastByteOffset=ByteOffset;
 	ByteOffset+=RelativeByteOff;
@@ -263,15 +356,30 @@ int Generate_Key(int RelativeByteOff,int BitOffset,int BitLength, int canfree)
 	Generate_Key_Get_Changed_ByteNum(BitLength,BitOffset,&ChangedByteNum);
 	
 	
-	if(LastByteOffset==0)
+	if(b_read==NULL && p_Dec->stream)
+	{
+		//the bytes are in the stream window, b_read/b_write are pointed at them below
+		b_read=bs_new(NULL,0);
+		b_write=bs_new(NULL,0);
+
+		if(rice)
+		{
+			init_key_rice_writer(&rice_writer,p_Dec->p_KeyFile,KEY_RICE_BUFFER_LEN);
+		}
+		else
+		{
+			keyBuffer=(char *)malloc(key_flush_len*sizeof(char));
+			memset(keyBuffer,0x00,key_flush_len);
+		}
+	}
+	else if(b_read==NULL)
 	{
-		lseek(p_Dec->BitStreamFile,ByteOffset,SEEK_SET);
 		BufferStart=ByteOffset;
 
 		h264Buffer=(char *)malloc(MAX_BUFFER_LEN*sizeof(char));
 		memset(h264Buffer,0x00,MAX_BUFFER_LEN);
 	
-		read_count=read(p_Dec->BitStreamFile,h264Buffer,MAX_BUFFER_LEN);
+		read_count=io_pread(p_Dec->key_io,h264Buffer,MAX_BUFFER_LEN,BufferStart);
 
 		if(0==read_count)
 		{
@@ -281,55 +389,158 @@ int Generate_Key(int RelativeByteOff,int BitOffset,int BitLength, int canfree)
 		b_read=bs_new(h264Buffer,MAX_BUFFER_LEN);
 		b_write=bs_new(h264Buffer,MAX_BUFFER_LEN);
 
-		keyBuffer=(char *)malloc(MAX_BUFFER_LEN*sizeof(char));
-		memset(keyBuffer,0x00,MAX_BUFFER_LEN);
+		if(rice && key_resume_pending)
+		{
+			resume_key_rice_writer(&rice_writer,p_Dec->p_KeyFile,KEY_RICE_BUFFER_LEN,&key_resume.rice);
+		}
+		else if(rice)
+		{
+			init_key_rice_writer(&rice_writer,p_Dec->p_KeyFile,KEY_RICE_BUFFER_LEN);
+		}
+		else
+		{
+			keyBuffer=(char *)malloc(MAX_BUFFER_LEN*sizeof(char));
+			memset(keyBuffer,0x00,MAX_BUFFER_LEN);
+		}
+		key_resume_pending=0;
+		DirtyCount=0;
 	}
-	else if(LastByteOffset>0)
+	else if(!p_Dec->stream)
 	{	
 		RelativeByteOff_Sum+=RelativeByteOff;
 
-		if(RelativeByteOff_Sum+ChangedByteNum<=MAX_BUFFER_LEN)
+		//read_count is short of MAX_BUFFER_LEN only at the end of the file, which can grow (Follow)
+		if(RelativeByteOff_Sum+ChangedByteNum<=read_count)
 		{	
-			bs_skip_u(b_read,(RelativeByteOff-ChangedByteNum)*8);
-			bs_skip_u(b_write,(RelativeByteOff-ChangedByteNum)*8);
+			//seek to the byte of this key unit, the previous one may end before or inside it
+			b_read->p=b_write->p=(uint8_t *)h264Buffer+RelativeByteOff_Sum;
+			b_read->bits_left=b_write->bits_left=8;
 		}		
 		else
 		{
-			lseek(p_Dec->BitStreamFile,BufferStart,SEEK_SET);
-			write(p_Dec->BitStreamFile,h264Buffer,MAX_BUFFER_LEN);
+			//queue the write-back of the changed bytes before the new window, the bytes
+			//from ByteOffset on move over to the new window and are written back with it
+			int keep=(int)i64min(RelativeByteOff_Sum,read_count);
+			int overlap=read_count-keep;
+			char *old=h264Buffer;
+
+			if(p_Dec->checkpoint)
+			{
+				KeyRiceState st;
+				sync_key_file(&st);
+			}
+			write_dirty(keep);
+
+			if(h264Spare==NULL)
+			{
+				h264Spare=(char *)malloc(MAX_BUFFER_LEN*sizeof(char));
+				if(h264Spare==NULL)
+					no_mem_exit("Generate_Key: h264Spare");
+			}
+			io_wait_buffer(p_Dec->key_io,h264Spare,MAX_BUFFER_LEN);
+			h264Buffer=h264Spare;
+			h264Spare=old;
 
-			lseek(p_Dec->BitStreamFile,ByteOffset,SEEK_SET);
 			BufferStart=ByteOffset;
-			read_count=read(p_Dec->BitStreamFile,h264Buffer,MAX_BUFFER_LEN);
+			if(overlap>0)
+			{
+				memcpy(h264Buffer,old+keep,overlap);
+				read_count=overlap+io_pread(p_Dec->key_io,h264Buffer+overlap,MAX_BUFFER_LEN-overlap,BufferStart+overlap);
+			}
+			else
+			{
+				read_count=io_pread(p_Dec->key_io,h264Buffer,MAX_BUFFER_LEN,BufferStart);
+			}
 
 			if(0==read_count)
 			{
 				return -1;
 			}
 			
+			free(b_read);
+			free(b_write);
 			b_read=bs_new(h264Buffer,MAX_BUFFER_LEN);
 			b_write=bs_new(h264Buffer,MAX_BUFFER_LEN);
 			RelativeByteOff_Sum=0;
 		}
 	}
 
+	if(p_Dec->stream && !canfree && ChangedByteNum)
+	{
+		uint8_t *p=(uint8_t *)stream_window_at(p_Dec->stream,ByteOffset,ChangedByteNum);
+
+		bs_init(b_read,p,ChangedByteNum);
+		bs_init(b_write,p,ChangedByteNum);
+	}
+
 	#if 1
 	if(canfree)
 	{
-		lseek(p_Dec->BitStreamFile,BufferStart,SEEK_SET);
-		write(p_Dec->BitStreamFile,h264Buffer,read_count);
-		fwrite(keyBuffer,sizeof(char),KeyByteLenSum,p_Dec->p_KeyFile);
+		if(p_Dec->checkpoint)
+		{
+			KeyRiceState st;
+			sync_key_file(&st);
+		}
+		if(!p_Dec->stream)
+		{
+			write_dirty(read_count);
+			io_flush(p_Dec->key_io);
+		}
+		if(rice)
+		{
+			close_key_rice_writer(&rice_writer);
+		}
+		else
+		{
+			fwrite(keyBuffer,sizeof(char),KeyByteLenSum,p_Dec->p_KeyFile);
 
-		fputc(0x08,p_Dec->p_KeyFile);		
-		fputc(0x00,p_Dec->p_KeyFile);		
+			fputc(0x08,p_Dec->p_KeyFile);		
+			fputc(0x00,p_Dec->p_KeyFile);		
+		}
 		free(key);
 		free(keyBuffer);
 		free(h264Buffer);
+		free(h264Spare);
+		free(Dirty);
 		free(b_read);
 		free(b_write);
+		b_read=NULL;
+		b_write=NULL;
+		keyBuffer=NULL;
+		h264Buffer=NULL;
+		h264Spare=NULL;
+		Dirty=NULL;
+		DirtyAlloc=0;
+
+		//ready for the next Encrypt() pass
+		LastByteOffset=0;
+		ByteOffset=0;
+		RelativeByteOff_Sum=0;
+		KeyByteLenSum=0;
 		return 0;
 	}
 	#endif
+
+	if(!p_Dec->stream)
+		mark_dirty(RelativeByteOff_Sum,ChangedByteNum);
+
+	if(rice)
+	{
+		//the key data is copied in chunks, so key units longer than 32 bits are kept intact
+		int n;
+
+		put_key_unit_rice(&rice_writer,RelativeByteOff,BitOffset,BitLength);
+		bs_skip_u(b_read,BitOffset);
+		for(n=BitLength;n>0;n-=KEY_RICE_DATA_CHUNK)
+		{
+			int chunk=imin(n,KEY_RICE_DATA_CHUNK);
+			put_key_data_rice(&rice_writer,chunk,bs_read_u(b_read,chunk));
+		}
+
+		bs_skip_u(b_write,BitOffset);
+		bs_write_u(b_write,BitLength,0x00);
+		return 0;
+	}
 	
 	bs_skip_u(b_read,BitOffset);
 	keydata=bs_read_u(b_read,BitLength);
@@ -343,14 +554,16 @@ int Generate_Key(int RelativeByteOff,int BitOffset,int BitLength, int canfree)
 	KeyByteLen=Get_Key(RelativeByteOff,BitOffset,BitLength,keydata,&key);
 	KeyByteLenSum+=KeyByteLen;
 
-	if(KeyByteLenSum<=MAX_BUFFER_LEN)
+	if(KeyByteLenSum<=key_flush_len)
 	{
 		memcpy(keyBuffer+KeyByteLenSum-KeyByteLen,key,KeyByteLen);
 	}
 	else
 	{
 		fwrite(keyBuffer,sizeof(char),KeyByteLenSum-KeyByteLen,p_Dec->p_KeyFile);
-		memset(keyBuffer,0x00,MAX_BUFFER_LEN);
+		if(p_Dec->stream)
+			fflush(p_Dec->p_KeyFile);
+		memset(keyBuffer,0x00,key_flush_len);
 
 		memcpy(keyBuffer,key,KeyByteLen);
 		KeyByteLenSum=KeyByteLen;
@@ -359,3 +572,187 @@ int Generate_Key(int RelativeByteOff,int BitOffset,int BitLength, int canfree)
 	return 0;
 		
 }
+
+/*
+*	Follow mode, the reader waits for more data: pass on the key units so far,
+*	to the key file and to the bit stream or the scrambled output. Nothing is
+*	forced to disk. Of a rice key stream only the complete bytes are written,
+*	the key file may be a pipe (KeyFd) and cannot take a byte back.
+*/
+void Generate_Key_Flush(void)
+{
+	if(b_read==NULL || p_Dec->stream)
+		return;
+	if(p_Dec->p_Inp->key_format == KEY_FORMAT_RICE)
+		flush_key_rice_writer(&rice_writer);
+	else if(KeyByteLenSum>0)
+	{
+		fwrite(keyBuffer,sizeof(char),KeyByteLenSum,p_Dec->p_KeyFile);
+		KeyByteLenSum=0;
+	}
+	fflush(p_Dec->p_KeyFile);
+	write_dirty(read_count);
+	io_flush(p_Dec->key_io);
+}
+
+/*
+*	Checkpoint: make everything scrambled so far final on disk, the key file
+*	first, and return where the key file continues.
+*/
+void Generate_Key_Sync(KeyCheckpoint *kc)
+{
+	if(b_read==NULL)
+	{
+		//no key unit since the start or the resume, nothing was scrambled
+		if(key_resume_pending)
+		{
+			*kc=key_resume;
+		}
+		else
+		{
+			memset(kc,0,sizeof(KeyCheckpoint));
+			kc->key_format=p_Dec->p_Inp->key_format;
+			kc->key_offset=ftello(p_Dec->p_KeyFile);
+		}
+		return;
+	}
+
+	memset(kc,0,sizeof(KeyCheckpoint));
+	sync_key_file(&kc->rice);
+	kc->started=1;
+	kc->key_format=p_Dec->p_Inp->key_format;
+	kc->byte_offset=ByteOffset;
+	kc->key_offset=ftello(p_Dec->p_KeyFile);
+
+	//every key unit so far lies before the picture of the checkpoint
+	write_dirty(read_count);
+	io_flush(p_Dec->key_io);
+	if(fdatasync(p_Dec->BitStreamFile))
+		error_KeyGen("Generate_Key_Sync: fdatasync of the bit stream failed",500);
+}
+
+/*
+*	Continue after a checkpoint: the next key unit is relative to kc->byte_offset
+*	and goes to kc->key_offset of the key file.
+*/
+void Generate_Key_Resume(const KeyCheckpoint *kc)
+{
+	if(fseeko(p_Dec->p_KeyFile,kc->key_offset,SEEK_SET))
+		error_KeyGen("Generate_Key_Resume: cannot seek in the key file",500);
+	if(!kc->started)
+		return;
+	key_resume=*kc;
+	key_resume_pending=1;
+	ByteOffset=kc->byte_offset;
+}
+
+/*
+*	One key unit behind the checkpoint, its data bits MSB first in the pool
+*/
+typedef struct
+{
+	int64 offset;
+	int BitOffset;
+	int BitLength;
+	int64 data;
+} RestoreUnit;
+
+static void restore_add(RestoreUnit **units,int *count,int *alloc,byte **pool,int64 *pool_len,int64 *pool_alloc,
+	int64 offset,int BitOffset,int BitLength,const byte *data)
+{
+	int len=(BitLength+7)/8;
+
+	if(*count==*alloc)
+	{
+		*alloc=*alloc ? 2*(*alloc) : 4096;
+		if((*units=(RestoreUnit *)realloc(*units,*alloc*sizeof(RestoreUnit)))==NULL)
+			no_mem_exit("Restore_Key_Units: units");
+	}
+	if(*pool_len+len>*pool_alloc)
+	{
+		*pool_alloc=*pool_alloc ? 2*(*pool_alloc)+len : 65536;
+		if((*pool=(byte *)realloc(*pool,*pool_alloc))==NULL)
+			no_mem_exit("Restore_Key_Units: pool");
+	}
+	(*units)[*count].offset=offset;
+	(*units)[*count].BitOffset=BitOffset;
+	(*units)[*count].BitLength=BitLength;
+	(*units)[*count].data=*pool_len;
+	memcpy(*pool+*pool_len,data,len);
+	*pool_len+=len;
+	(*count)++;
+}
+
+/*
+*	Undo a run that stopped after the checkpoint kc: write the original bits of
+*	every complete key unit behind kc->key_offset back into the bit stream.
+*	Neighbouring key units can share a bit and each one holds the bits as it
+*	found them, so they are restored last to first. Every unit overwrites all
+*	of its bits, which makes the result the same whichever of the write-backs
+*	reached the disk.
+*	Retval: the number of key units restored
+*/
+int Restore_Key_Units(const KeyCheckpoint *kc)
+{
+	int64 size;
+	byte *keys;
+	KeyRiceReader r;
+	KeyUnit ku;
+	byte kd[KEY_UNIT_MAX_DATA_BYTES];
+	int64 offset=kc->started ? kc->byte_offset : 0;
+	RestoreUnit *units=NULL;
+	int count=0,alloc=0,i;
+	byte *pool=NULL;
+	int64 pool_len=0,pool_alloc=0;
+	uint8_t bytes[KEY_UNIT_MAX_DATA_BYTES+2];
+	bs_t b;
+
+	fseeko(p_Dec->p_KeyFile,0,SEEK_END);
+	size=ftello(p_Dec->p_KeyFile)-kc->key_offset;
+	if(size<=0)
+		return 0;
+	if((keys=(byte *)malloc(size))==NULL)
+		no_mem_exit("Restore_Key_Units: keys");
+	fseeko(p_Dec->p_KeyFile,kc->key_offset,SEEK_SET);
+	if(fread(keys,1,size,p_Dec->p_KeyFile)!=(size_t)size)
+		error_KeyGen("Restore_Key_Units: cannot read the key file",500);
+
+	//a unit cut short by the crash is dropped, its bits never reached the bit stream
+	if(kc->started)
+		resume_key_rice_reader(&r,keys,size,&kc->rice);
+	else if(init_key_rice_reader(&r,keys,size))
+		size=0;	//the header did not make it
+	while(size && get_key_unit_rice(&r,&ku,kd) && !r.overrun)
+	{
+		if(ku.key_data_len>KEY_UNIT_MAX_DATA_BYTES*8)
+			error_KeyGen("Restore_Key_Units: key unit too long",500);
+		offset+=ku.byte_offset;
+		restore_add(&units,&count,&alloc,&pool,&pool_len,&pool_alloc,offset,ku.bit_offset,ku.key_data_len,kd);
+	}
+	free(keys);
+
+	for(i=count-1;i>=0;--i)
+	{
+		RestoreUnit *u=&units[i];
+		const byte *data=pool+u->data;
+		int n,len,k=0;
+
+		Generate_Key_Get_Changed_ByteNum(u->BitLength,u->BitOffset,&len);
+		if(pread(p_Dec->BitStreamFile,bytes,len,u->offset)!=len)
+			error_KeyGen("Restore_Key_Units: cannot read the bit stream",500);
+		bs_init(&b,bytes,len);
+		bs_skip_u(&b,u->BitOffset);
+		for(n=u->BitLength;n>=8;n-=8)
+			bs_write_u(&b,8,data[k++]);
+		if(n)
+			bs_write_u(&b,n,data[k]>>(8-n));
+		if(pwrite(p_Dec->BitStreamFile,bytes,len,u->offset)!=len)
+			error_KeyGen("Restore_Key_Units: cannot write the bit stream",500);
+	}
+	free(units);
+	free(pool);
+
+	if(count && fdatasync(p_Dec->BitStreamFile))
+		error_KeyGen("Restore_Key_Units: fdatasync of the bit stream failed",500);
+	return count;
+}
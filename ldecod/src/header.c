@@ -327,10 +327,11 @@ static void ref_pic_list_reordering(Slice *currSlice)
   int i, val;
 
   //alloc_ref_pic_list_reordering_buffer(currSlice);
+  currSlice->ref_pic_list_reordering_flag[LIST_0] = currSlice->ref_pic_list_reordering_flag[LIST_1] = 0;
 
   if (currSlice->slice_type != I_SLICE && currSlice->slice_type != SI_SLICE)
   {
-    val = read_u_1 ("SH: ref_pic_list_reordering_flag_l0", currStream, &p_Dec->UsedBits);
+    val = currSlice->ref_pic_list_reordering_flag[LIST_0] = read_u_1 ("SH: ref_pic_list_reordering_flag_l0", currStream, &p_Dec->UsedBits);
 
     if (val)
     {
@@ -357,7 +358,7 @@ static void ref_pic_list_reordering(Slice *currSlice)
 
   if (currSlice->slice_type == B_SLICE)
   {
-    val = read_u_1 ("SH: ref_pic_list_reordering_flag_l1", currStream, &p_Dec->UsedBits);
+    val = currSlice->ref_pic_list_reordering_flag[LIST_1] = read_u_1 ("SH: ref_pic_list_reordering_flag_l1", currStream, &p_Dec->UsedBits);
 
     if (val)
     {
@@ -641,11 +642,11 @@ void dec_ref_pic_marking(VideoParameters *p_Vid, Bitstream *currStream, Slice *p
     //p_Vid->no_output_of_prior_pics_flag = pSlice->no_output_of_prior_pics_flag;
     //pSlice->long_term_reference_flag = 
     read_u_1("SH: long_term_reference_flag", currStream, &p_Dec->UsedBits);
+    pSlice->adaptive_ref_pic_buffering_flag = 0;
   }
   else
   {
-    //pSlice->adaptive_ref_pic_buffering_flag = 
-    if (read_u_1("SH: adaptive_ref_pic_buffering_flag", currStream, &p_Dec->UsedBits))
+    if ((pSlice->adaptive_ref_pic_buffering_flag = read_u_1("SH: adaptive_ref_pic_buffering_flag", currStream, &p_Dec->UsedBits)) != 0)
     {
       // read Memory Management Control Operation
       do
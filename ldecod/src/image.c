@@ -49,6 +49,10 @@
 #include "cabac.h"
 #include "vlc.h"
 #include "fast_memory.h"
+#include "stagetimer.h"
+#include "stream.h"
+#include "checkpoint.h"
+#include "mvfield.h"
 
 extern int testEndian(void);
 void reorder_lists(Slice *currSlice);
@@ -85,6 +89,7 @@ static void setup_buffers(VideoParameters *p_Vid, int layer_id)
     }
     p_Vid->PicPos = cps->PicPos;
     p_Vid->nz_coeff = cps->nz_coeff;
+    p_Vid->nz_epoch = cps->nz_epoch;
     //p_Vid->qp_per_matrix = cps->qp_per_matrix;
     //p_Vid->qp_rem_matrix = cps->qp_rem_matrix;
     p_Vid->oldFrameSizeInMbs = cps->oldFrameSizeInMbs;
@@ -102,7 +107,6 @@ static void setup_buffers(VideoParameters *p_Vid, int layer_id)
  */
 static void init_picture(VideoParameters *p_Vid, Slice *currSlice, InputParameters *p_Inp)
 {
-  int i;
   int nplane;
   StorablePicture *dec_picture = NULL;
   seq_parameter_set_rbsp_t *active_sps = p_Vid->active_sps;
@@ -155,11 +159,14 @@ static void init_picture(VideoParameters *p_Vid, Slice *currSlice, InputParamete
     p_Vid->type = P_SLICE;  // concealed element
   }
 
-  // CAVLC init
-  if (p_Vid->active_pps->entropy_coding_mode_flag == (Boolean) CAVLC)
+  // CAVLC init: instead of setting all nz_coeff entries to -1 a new epoch is
+  // started, the entries of the MBs not yet decoded in it are not available
+  if (p_Vid->pic_epoch == INT_MAX)
   {
-    memset(p_Vid->nz_coeff[0][0][0], -1, p_Vid->PicSizeInMbs * 48 *sizeof(byte)); // 3 * 4 * 4
+    memset(p_Vid->nz_epoch, 0, p_Vid->FrameSizeInMbs * sizeof(int));
+    p_Vid->pic_epoch = 0;
   }
+  ++p_Vid->pic_epoch;
 
   // Set the slice_nr member of each MB to -1, to ensure correct when packet loss occurs
   // TO set Macroblock Map (mark all MBs as 'have to be concealed')
@@ -168,30 +175,17 @@ static void init_picture(VideoParameters *p_Vid, Slice *currSlice, InputParamete
     for( nplane=0; nplane<MAX_PLANE; ++nplane )
     {      
       Macroblock *currMB = p_Vid->mb_data_JV[nplane];
-      char *intra_block = p_Vid->intra_block_JV[nplane];
       //for(i=0; i<(int)p_Vid->PicSizeInMbs; ++i)
       {
         //reset_mbs(currMB++);
       }
       //fast_memset(p_Vid->ipredmode_JV[nplane][0], DC_PRED, 16 * p_Vid->FrameHeightInMbs * p_Vid->PicWidthInMbs * sizeof(char));
-      if(p_Vid->active_pps->constrained_intra_pred_flag)
-      {
-        for (i=0; i<(int)p_Vid->PicSizeInMbs; ++i)
-        {
-          intra_block[i] = 1;
-        }
-      }
+      // intra_block is set as each MB is started, see start_macroblock()
     }
   }
   else
   {
-    if(p_Vid->active_pps->constrained_intra_pred_flag)
-    {
-      for (i=0; i<(int)p_Vid->PicSizeInMbs; ++i)
-      {
-        p_Vid->intra_block[i] = 1;
-      }
-    }
+    // intra_block is set as each MB is started, see start_macroblock()
     //fast_memset(p_Vid->ipredmode[0], DC_PRED, 16 * p_Vid->FrameHeightInMbs * p_Vid->PicWidthInMbs * sizeof(char));
   }  
 
@@ -230,6 +224,9 @@ static void init_picture(VideoParameters *p_Vid, Slice *currSlice, InputParamete
     dec_picture->frame_crop_top_offset    = active_sps->frame_crop_top_offset;
     dec_picture->frame_crop_bottom_offset = active_sps->frame_crop_bottom_offset;
   }
+
+  if (p_Vid->mv_field)
+    init_mv_field_picture(p_Vid->mv_field, currSlice, dec_picture);
 }
 
 static void update_mbaff_macroblock_data(imgpel **cur_img, imgpel (*temp)[16], int x0, int width, int height)
@@ -314,6 +311,8 @@ void init_slice(VideoParameters *p_Vid, Slice *currSlice)
   p_Vid->active_pps = currSlice->active_pps;
 
   //currSlice->init_lists (currSlice);
+  if (p_Vid->mv_field)
+    init_mv_field_slice(p_Vid->mv_field, currSlice);
 
 #if (MVC_EXTENSION_ENABLE)
   //if (currSlice->svc_extension_flag == 0 || currSlice->svc_extension_flag == 1)
@@ -382,7 +381,13 @@ void decode_slice(Slice *currSlice, int current_header)
 
   // decode main slice information
   if ((current_header == SOP || current_header == SOS) && currSlice->ei_flag == 0)
+  {
+    STAGE_CONTEXT(currSlice->slice_type, currSlice->active_pps->entropy_coding_mode_flag);
+    STAGE_BEGIN(STAGE_MB_PARSE);
     decode_one_slice(currSlice);
+    STAGE_END(STAGE_MB_PARSE);
+    STAGE_MACROBLOCKS(currSlice->num_dec_mb);
+  }
 
   // setMB-Nr in case this slice was lost
   // if(currSlice->ei_flag)
@@ -400,6 +405,32 @@ static void CopyPOC(Slice *pSlice0, Slice *currSlice)
 
 
 
+/*!
+ ***********************************************************************
+ * \brief
+ *    count the picture just read for the run statistics
+ ***********************************************************************
+ */
+static void update_decoder_stats(DecoderStats *stats, VideoParameters *p_Vid, Slice *currSlice)
+{
+  if (p_Vid->iSliceNumOfCurrPic == 0)
+    return;
+
+  stats->pictures++;
+  if (currSlice->structure != TOP_FIELD)
+    stats->frames++;
+  if (currSlice->field_pic_flag)
+    stats->field_pictures++;
+  if (currSlice->mb_aff_frame_flag)
+    stats->mbaff_pictures++;
+  stats->slices += p_Vid->iSliceNumOfCurrPic;
+  stats->max_slices_per_picture = imax(stats->max_slices_per_picture, p_Vid->iSliceNumOfCurrPic);
+  stats->macroblocks += p_Vid->PicSizeInMbs;
+  stats->cabac  = currSlice->active_pps->entropy_coding_mode_flag;
+  stats->width  = p_Vid->width;
+  stats->height = p_Vid->height;
+}
+
 /*!
  ***********************************************************************
  * \brief
@@ -467,7 +498,9 @@ int decode_one_frame(DecoderParams *pDecoder)
     //currSlice->is_reset_coeff = FALSE;
     //currSlice->is_reset_coeff_cr = FALSE;
 
+    STAGE_BEGIN(STAGE_SLICE_HEADER);
     current_header = read_new_slice(currSlice);
+    STAGE_END(STAGE_SLICE_HEADER);
     //init;
     currSlice->current_header = current_header;
 
@@ -511,7 +544,6 @@ int decode_one_frame(DecoderParams *pDecoder)
          p_Vid->iNumOfSlicesAllocated += MAX_NUM_DECSLICES;
        }
 
-			 p_Dec->nalu_pos_array_idx--;
        current_header = SOS;       
     }
     else
@@ -529,7 +561,6 @@ int decode_one_frame(DecoderParams *pDecoder)
        ppSliceList[p_Vid->iSliceNumOfCurrPic] = p_Vid->pNextSlice;
        p_Vid->pNextSlice = currSlice;
 
-			 p_Dec->nalu_pos_array_idx++;
     }
 
     copy_slice_info(currSlice, p_Vid->old_slice);
@@ -547,6 +578,12 @@ int decode_one_frame(DecoderParams *pDecoder)
     assert(currSlice->current_slice_nr == iSliceNo);
 
     init_slice(p_Vid, currSlice);
+    p_Dec->nalu_pos_array_idx = currSlice->nalu_pos_idx;
+    // nothing before this slice can get a key unit any more
+    if (p_Dec->stream)
+      stream_finalize(p_Dec->stream, p_Dec->p_Inp->enable_key ? p_Dec->nalu_pos_array[currSlice->nalu_pos_idx] : p_Dec->stream->base + p_Dec->stream->len);
+    if (p_Dec->checkpoint && iSliceNo == 0)
+      checkpoint_picture(p_Dec->checkpoint, p_Dec->nalu_pos_array[currSlice->nalu_pos_idx]);
     decode_slice(currSlice, current_header);
 
     p_Vid->iNumOfSlicesDecoded++;
@@ -554,6 +591,8 @@ int decode_one_frame(DecoderParams *pDecoder)
     //p_Vid->erc_mvperMB += currSlice->erc_mvperMB;
   }
 
+  update_decoder_stats(&pDecoder->stats, p_Vid, ppSliceList[0]);
+
 #if MVC_EXTENSION_ENABLE
   //p_Vid->last_dec_view_id = p_Vid->dec_picture->view_id;
 #endif
@@ -563,6 +602,8 @@ int decode_one_frame(DecoderParams *pDecoder)
     //p_Vid->last_dec_poc = p_Vid->dec_picture->top_poc;
   //else if(p_Vid->dec_picture->structure == BOTTOM_FIELD)
     //p_Vid->last_dec_poc = p_Vid->dec_picture->bottom_poc;
+  if (p_Vid->mv_field && p_Vid->dec_picture && p_Vid->iSliceNumOfCurrPic > 0)
+    exit_mv_field_picture(p_Vid, p_Vid->dec_picture);
   exit_picture(p_Vid, &p_Vid->dec_picture);
   p_Vid->previous_frame_num = ppSliceList[0]->frame_num;
   return (iRet);
@@ -691,6 +732,7 @@ process_nalu:
 
       currSlice->idr_flag = (nalu->nal_unit_type == NALU_TYPE_IDR);
       currSlice->nal_reference_idc = nalu->nal_reference_idc;
+      currSlice->nalu_pos_idx = p_Dec->nalu_pos_array_cnt - 1;
       currSlice->dp_mode = PAR_DP_1;
       currSlice->max_part_nr = 1;
 #if (MVC_EXTENSION_ENABLE)
@@ -770,6 +812,7 @@ process_nalu:
       currSlice->chroma444_not_separate = (p_Vid->active_sps->chroma_format_idc==YUV444)&&((p_Vid->separate_colour_plane_flag == 0));
 
       BitsUsedByHeader += RestOfSliceHeader (currSlice);
+      STAGE_CONTEXT(currSlice->slice_type, currSlice->active_pps->entropy_coding_mode_flag);
 #if (MVC_EXTENSION_ENABLE)
       //if(currSlice->view_id >=0)
       {
@@ -793,6 +836,8 @@ process_nalu:
         current_header = SOP;
         //check zero_byte if it is also the first NAL unit in the access unit
         CheckZeroByteVCL(p_Vid, nalu);
+        if (p_Dec->checkpoint && currSlice->idr_flag)
+          checkpoint_candidate(p_Dec->checkpoint, p_Dec->nalu_pos_array[currSlice->nalu_pos_idx]);
       }
       else
         current_header = SOS;
@@ -829,6 +874,7 @@ process_nalu:
 
       currSlice->idr_flag          = FALSE;
       currSlice->nal_reference_idc = nalu->nal_reference_idc;
+      currSlice->nalu_pos_idx      = p_Dec->nalu_pos_array_cnt - 1;
       currSlice->dp_mode     = PAR_DP_3;
       currSlice->max_part_nr = 3;
       currSlice->ei_flag     = 0;
@@ -890,6 +936,24 @@ process_nalu:
       if (p_Vid->active_pps->entropy_coding_mode_flag)
         error ("received data partition with CABAC, this is not allowed", 500);
 
+      if (p_Inp->partition_a_only)
+      {
+        // B and C hold residual only: read past them, the slice is parsed as one with B and C missing
+        if (0 == read_next_nalu(p_Vid, nalu))
+          return current_header;
+        if (NALU_TYPE_DPB == nalu->nal_unit_type)
+        {
+          p_Dec->stats.partitions_skipped++;
+          if (0 == read_next_nalu(p_Vid, nalu))
+            return current_header;
+        }
+        if (NALU_TYPE_DPC == nalu->nal_unit_type)
+          p_Dec->stats.partitions_skipped++;
+        else
+          pending_nalu = nalu;
+        return current_header;
+      }
+
       // continue with reading next DP
       if (0 == read_next_nalu(p_Vid, nalu))
         return current_header;
@@ -983,19 +1047,20 @@ process_nalu:
       }
       break;
     case NALU_TYPE_SEI:
-			p_Dec->nalu_pos_array_idx++;
       //printf ("read_new_slice: Found NALU_TYPE_SEI, len %d\n", nalu->len);
       InterpretSEIMessage(nalu->buf,nalu->len,p_Vid, currSlice);
       break;
     case NALU_TYPE_PPS:
-			p_Dec->nalu_pos_array_idx++;
       //printf ("Found NALU_TYPE_PPS\n");
       ProcessPPS(p_Vid, nalu);
+      if (p_Dec->checkpoint)
+        checkpoint_note_ps(p_Dec->checkpoint, nalu);
       break;
     case NALU_TYPE_SPS:
-			p_Dec->nalu_pos_array_idx++;
       //printf ("Found NALU_TYPE_SPS\n");
       ProcessSPS(p_Vid, nalu);
+      if (p_Dec->checkpoint)
+        checkpoint_note_ps(p_Dec->checkpoint, nalu);
       break;
     case NALU_TYPE_AUD:
       //printf ("Found NALU_TYPE_AUD\n");
@@ -1028,8 +1093,9 @@ process_nalu:
       //printf ("Found NALU_TYPE_SUB_SPS\n");
       if (p_Inp->DecodeAllLayers== 1)
       {
-				p_Dec->nalu_pos_array_idx++;
         ProcessSubsetSPS(p_Vid, nalu);
+        if (p_Dec->checkpoint)
+          checkpoint_note_ps(p_Dec->checkpoint, nalu);
       }
       else
       {
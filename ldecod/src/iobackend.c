@@ -0,0 +1,494 @@
+
+/*!
+ ************************************************************************
+ * \file iobackend.c
+ *
+ * \brief
+ *    I/O backends of the bit stream file, see iobackend.h.
+ *
+ *    The io_uring backend talks to the kernel through the raw system
+ *    calls (no liburing). Read-ahead chunks form a ring of depth
+ *    buffers in file order: the chunk handed to the caller is submitted
+ *    again for the next free file offset when the caller asks for the
+ *    following one. Writes use a separate set of depth slots; a short
+ *    read or write is completed synchronously.
+ ************************************************************************
+ */
+
+#include <errno.h>
+
+#include "global.h"
+#include "memalloc.h"
+#include "iobackend.h"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#define IO_HAVE_URING 1
+#else
+#define IO_HAVE_URING 0
+#endif
+
+#define IO_PENDING  (-0x7FFFFFFF)
+
+typedef struct io_request
+{
+  byte  *buf;
+  int    len;
+  int64  offset;
+  int    res;              //!< bytes transferred, -errno or IO_PENDING
+} IoRequest;
+
+struct io_backend
+{
+  int        fd;
+  int        kind;
+  int        depth;
+  int        chunk_size;
+
+  byte      *rd_mem;
+  IoRequest  rd[IO_MAX_QUEUE_DEPTH];
+  int        rd_slots;
+  int        rd_head;      //!< slot of the next chunk in file order
+  int        rd_held;      //!< the slot before rd_head is held by the caller
+  int64      rd_next_off;  //!< file offset of the next read to submit
+  int        rd_eof;
+
+  IoRequest  wr[IO_MAX_QUEUE_DEPTH];
+  int        wr_pending;
+
+#if IO_HAVE_URING
+  int        ring_fd;
+  void      *sq_ring;
+  void      *cq_ring;
+  size_t     sq_ring_size;
+  size_t     cq_ring_size;
+  struct io_uring_sqe *sqes;
+  size_t     sqes_size;
+  unsigned  *sq_head;
+  unsigned  *sq_tail;
+  unsigned  *sq_mask;
+  unsigned  *sq_array;
+  unsigned  *cq_head;
+  unsigned  *cq_tail;
+  unsigned  *cq_mask;
+  struct io_uring_cqe *cqes;
+#endif
+};
+
+static int pread_full(int fd, byte *buf, int len, int64 offset)
+{
+  int done = 0;
+
+  while (done < len)
+  {
+    ssize_t n = pread(fd, buf + done, len - done, (off_t) (offset + done));
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    if (n == 0)
+      break;
+    done += (int) n;
+  }
+  return done;
+}
+
+static void pwrite_full(int fd, const byte *buf, int len, int64 offset)
+{
+  int done = 0;
+
+  while (done < len)
+  {
+    ssize_t n = pwrite(fd, buf + done, len - done, (off_t) (offset + done));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+    {
+      snprintf(errortext, ET_SIZE, "io_write: cannot write %d bytes at offset %lld", len - done, (long long) (offset + done));
+      error(errortext, 500);
+    }
+    done += (int) n;
+  }
+}
+
+#if IO_HAVE_URING
+
+#define IO_TAG_WRITE  0x10000
+
+static int uring_setup(IoBackend *io)
+{
+  struct io_uring_params p;
+
+  memset(&p, 0, sizeof(p));
+  io->ring_fd = (int) syscall(__NR_io_uring_setup, 2 * io->depth, &p);
+  if (io->ring_fd < 0)
+    return 0;
+
+  io->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  io->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    io->sq_ring_size = io->cq_ring_size = imax((int) io->sq_ring_size, (int) io->cq_ring_size);
+
+  io->sq_ring = mmap(NULL, io->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring_fd, IORING_OFF_SQ_RING);
+  if (io->sq_ring == MAP_FAILED)
+  {
+    close(io->ring_fd);
+    return 0;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    io->cq_ring = io->sq_ring;
+  else
+  {
+    io->cq_ring = mmap(NULL, io->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring_fd, IORING_OFF_CQ_RING);
+    if (io->cq_ring == MAP_FAILED)
+    {
+      munmap(io->sq_ring, io->sq_ring_size);
+      close(io->ring_fd);
+      return 0;
+    }
+  }
+  io->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  io->sqes = (struct io_uring_sqe *) mmap(NULL, io->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring_fd, IORING_OFF_SQES);
+  if (io->sqes == MAP_FAILED)
+  {
+    if (io->cq_ring != io->sq_ring)
+      munmap(io->cq_ring, io->cq_ring_size);
+    munmap(io->sq_ring, io->sq_ring_size);
+    close(io->ring_fd);
+    return 0;
+  }
+
+  io->sq_head  = (unsigned *) ((byte *) io->sq_ring + p.sq_off.head);
+  io->sq_tail  = (unsigned *) ((byte *) io->sq_ring + p.sq_off.tail);
+  io->sq_mask  = (unsigned *) ((byte *) io->sq_ring + p.sq_off.ring_mask);
+  io->sq_array = (unsigned *) ((byte *) io->sq_ring + p.sq_off.array);
+  io->cq_head  = (unsigned *) ((byte *) io->cq_ring + p.cq_off.head);
+  io->cq_tail  = (unsigned *) ((byte *) io->cq_ring + p.cq_off.tail);
+  io->cq_mask  = (unsigned *) ((byte *) io->cq_ring + p.cq_off.ring_mask);
+  io->cqes     = (struct io_uring_cqe *) ((byte *) io->cq_ring + p.cq_off.cqes);
+  return 1;
+}
+
+static void uring_teardown(IoBackend *io)
+{
+  munmap(io->sqes, io->sqes_size);
+  if (io->cq_ring != io->sq_ring)
+    munmap(io->cq_ring, io->cq_ring_size);
+  munmap(io->sq_ring, io->sq_ring_size);
+  close(io->ring_fd);
+}
+
+static int uring_enter(IoBackend *io, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+  int ret;
+
+  do
+    ret = (int) syscall(__NR_io_uring_enter, io->ring_fd, to_submit, min_complete, flags, NULL, 0);
+  while (ret < 0 && errno == EINTR);
+  return ret;
+}
+
+static void uring_submit(IoBackend *io, int opcode, IoRequest *r, unsigned tag)
+{
+  unsigned tail = *io->sq_tail;
+  unsigned idx  = tail & *io->sq_mask;
+  struct io_uring_sqe *sqe = &io->sqes[idx];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode    = (byte) opcode;
+  sqe->fd        = io->fd;
+  sqe->addr      = (unsigned long long) (size_t) r->buf;
+  sqe->len       = r->len;
+  sqe->off       = r->offset;
+  sqe->user_data = tag;
+  io->sq_array[idx] = idx;
+  r->res = IO_PENDING;
+  __atomic_store_n(io->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  if (uring_enter(io, 1, 0, 0) < 0)
+    error("io_uring_enter: submission failed", 500);
+}
+
+static void uring_complete(IoBackend *io, unsigned tag, int res)
+{
+  if (tag & IO_TAG_WRITE)
+  {
+    IoRequest *r = &io->wr[tag & (IO_TAG_WRITE - 1)];
+
+    if (res < 0)
+    {
+      snprintf(errortext, ET_SIZE, "io_write: write at offset %lld failed (%d)", (long long) r->offset, res);
+      error(errortext, 500);
+    }
+    if (res < r->len)
+      pwrite_full(io->fd, r->buf + res, r->len - res, r->offset + res);
+    r->res = r->len;
+    io->wr_pending--;
+  }
+  else
+  {
+    IoRequest *r = &io->rd[tag];
+
+    if (res > 0 && res < r->len)
+    {
+      int rest = pread_full(io->fd, r->buf + res, r->len - res, r->offset + res);
+      res = rest < 0 ? rest : res + rest;
+    }
+    r->res = res;
+  }
+}
+
+//! handle all completions, waiting for at least one if wait is set and none is ready
+static void uring_reap(IoBackend *io, int wait)
+{
+  unsigned head = *io->cq_head;
+
+  if (head == __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE))
+  {
+    if (!wait)
+      return;
+    if (uring_enter(io, 0, 1, IORING_ENTER_GETEVENTS) < 0)
+      error("io_uring_enter: wait failed", 500);
+  }
+  while (head != __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE))
+  {
+    struct io_uring_cqe *cqe = &io->cqes[head & *io->cq_mask];
+    uring_complete(io, (unsigned) cqe->user_data, cqe->res);
+    head++;
+  }
+  __atomic_store_n(io->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void submit_read_ahead(IoBackend *io, int slot)
+{
+  IoRequest *r = &io->rd[slot];
+
+  r->offset = io->rd_next_off;
+  r->len    = io->chunk_size;
+  io->rd_next_off += io->chunk_size;
+  uring_submit(io, IORING_OP_READ, r, slot);
+}
+
+#endif
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Open a backend on fd. With IO_BACKEND_URING the first depth chunks
+ *    are requested right away.
+ ************************************************************************
+ */
+IoBackend *io_open(int fd, int backend, int depth, int chunk_size)
+{
+  IoBackend *io = (IoBackend *) calloc(1, sizeof(IoBackend));
+  int i;
+
+  if (io == NULL)
+    no_mem_exit("io_open: io");
+  io->fd         = fd;
+  io->kind       = IO_BACKEND_PREAD;
+  io->depth      = iClip3(1, IO_MAX_QUEUE_DEPTH, depth);
+  io->chunk_size = chunk_size;
+
+  if (lseek(fd, 0, SEEK_CUR) < 0)
+    io->kind = IO_BACKEND_STREAM;
+#if IO_HAVE_URING
+  else if (backend == IO_BACKEND_URING)
+  {
+    if (uring_setup(io))
+      io->kind = IO_BACKEND_URING;
+    else
+      fprintf(stderr, "io_uring not available (%s), using pread/pwrite\n", strerror(errno));
+  }
+#endif
+
+  io->rd_slots = chunk_size > 0 ? (io->kind == IO_BACKEND_URING ? io->depth : 1) : 0;
+  if (io->rd_slots)
+  {
+    if ((io->rd_mem = (byte *) malloc((size_t) io->rd_slots * chunk_size)) == NULL)
+      no_mem_exit("io_open: read-ahead buffers");
+    for (i = 0; i < io->rd_slots; ++i)
+      io->rd[i].buf = io->rd_mem + (size_t) i * chunk_size;
+  }
+
+#if IO_HAVE_URING
+  if (io->kind == IO_BACKEND_URING)
+  {
+    for (i = 0; i < io->rd_slots; ++i)
+      submit_read_ahead(io, i);
+  }
+#endif
+  return io;
+}
+
+void io_close(IoBackend *io)
+{
+  if (io == NULL)
+    return;
+  io_flush(io);
+#if IO_HAVE_URING
+  if (io->kind == IO_BACKEND_URING)
+  {
+    int i;
+    // outstanding read-ahead still targets rd_mem
+    for (i = 0; i < io->rd_slots; ++i)
+      while (io->rd[i].res == IO_PENDING)
+        uring_reap(io, 1);
+    uring_teardown(io);
+  }
+#endif
+  free(io->rd_mem);
+  free(io);
+}
+
+int io_read_next(IoBackend *io, byte **buf)
+{
+  IoRequest *r;
+
+  if (io->rd_eof)
+    return 0;
+
+#if IO_HAVE_URING
+  if (io->kind == IO_BACKEND_URING)
+  {
+    if (io->rd_held)
+      submit_read_ahead(io, (io->rd_head + io->rd_slots - 1) % io->rd_slots);
+    r = &io->rd[io->rd_head];
+    while (r->res == IO_PENDING)
+      uring_reap(io, 1);
+    io->rd_head = (io->rd_head + 1) % io->rd_slots;
+    io->rd_held = 1;
+  }
+  else
+#endif
+  if (io->kind == IO_BACKEND_STREAM)
+  {
+    // hand out what has arrived, a live source may not fill the chunk for a while
+    r = &io->rd[0];
+    r->offset = io->rd_next_off;
+    do
+      r->res = (int) read(io->fd, r->buf, io->chunk_size);
+    while (r->res < 0 && errno == EINTR);
+    if (r->res <= 0)
+      io->rd_eof = 1;
+    else
+      io->rd_next_off += r->res;
+    r->len = r->res;
+  }
+  else
+  {
+    r = &io->rd[0];
+    r->offset = io->rd_next_off;
+    r->len    = io->chunk_size;
+    r->res    = pread_full(io->fd, r->buf, r->len, r->offset);
+    io->rd_next_off += io->chunk_size;
+  }
+
+  if (r->res < 0)
+  {
+    snprintf(errortext, ET_SIZE, "io_read_next: read at offset %lld failed", (long long) r->offset);
+    error(errortext, 500);
+  }
+  if (r->res < r->len)
+    io->rd_eof = 1;
+  *buf = r->buf;
+  return r->res;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Continue the chunk sequence of io_read_next at offset, read-ahead
+ *    still in flight is waited for and dropped
+ ************************************************************************
+ */
+void io_restart(IoBackend *io, int64 offset)
+{
+  if (io->kind == IO_BACKEND_STREAM)
+    error_KeyGen("io_restart: the input cannot seek", 500);
+  io->rd_next_off = offset;
+  io->rd_eof      = 0;
+#if IO_HAVE_URING
+  if (io->kind == IO_BACKEND_URING)
+  {
+    int i;
+
+    for (i = 0; i < io->rd_slots; ++i)
+      while (io->rd[i].res == IO_PENDING)
+        uring_reap(io, 1);
+    io->rd_head = 0;
+    io->rd_held = 0;
+    for (i = 0; i < io->rd_slots; ++i)
+      submit_read_ahead(io, i);
+  }
+#endif
+}
+
+int io_pread(IoBackend *io, void *buf, int len, int64 offset)
+{
+  int n = pread_full(io->fd, (byte *) buf, len, offset);
+
+  if (n < 0)
+  {
+    snprintf(errortext, ET_SIZE, "io_pread: read at offset %lld failed", (long long) offset);
+    error(errortext, 500);
+  }
+  return n;
+}
+
+void io_write(IoBackend *io, const void *buf, int len, int64 offset)
+{
+  if (len <= 0)
+    return;
+#if IO_HAVE_URING
+  if (io->kind == IO_BACKEND_URING)
+  {
+    int slot;
+
+    while (io->wr_pending == io->depth)
+      uring_reap(io, 1);
+    for (slot = 0; io->wr[slot].res == IO_PENDING; ++slot)
+      ;
+    io->wr[slot].buf    = (byte *) buf;
+    io->wr[slot].len    = len;
+    io->wr[slot].offset = offset;
+    io->wr_pending++;
+    uring_submit(io, IORING_OP_WRITE, &io->wr[slot], IO_TAG_WRITE | slot);
+    return;
+  }
+#endif
+  pwrite_full(io->fd, (const byte *) buf, len, offset);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Wait until no queued write reads from [buf, buf + len)
+ ************************************************************************
+ */
+void io_wait_buffer(IoBackend *io, const void *buf, int len)
+{
+#if IO_HAVE_URING
+  const byte *lo = (const byte *) buf, *hi = lo + len;
+  int i;
+
+  for (i = 0; i < io->depth && io->wr_pending; ++i)
+  {
+    IoRequest *r = &io->wr[i];
+    while (r->res == IO_PENDING && r->buf < hi && r->buf + r->len > lo)
+      uring_reap(io, 1);
+  }
+#endif
+}
+
+void io_flush(IoBackend *io)
+{
+#if IO_HAVE_URING
+  while (io->wr_pending)
+    uring_reap(io, 1);
+#endif
+}
@@ -0,0 +1,534 @@
+
+/*!
+ ************************************************************************
+ * \file keystore.c
+ *
+ * \brief
+ *    Key store, see keystore.h.
+ *
+ *    A writer holds the lock on the data file for one put: it maps the
+ *    index afresh (another writer may have replaced it), cuts off a
+ *    record that a crashed writer left behind the last indexed one,
+ *    appends the record and syncs it, then fills the slot and syncs the
+ *    index. A bigger table is written to a temporary file and renamed
+ *    over the index, readers that mapped the old one keep a consistent
+ *    (if slightly older) table. A slot replaced in place is checked
+ *    against its record header, see read_slot().
+ ************************************************************************
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "global.h"
+#include "memalloc.h"
+#include "keystore.h"
+
+typedef struct key_store_index_header
+{
+  char   magic[8];
+  uint32 version;
+  uint32 slot_bits;
+  uint64 count;          //!< slots in use
+  uint64 data_len;       //!< bytes of the data file covered by the index
+  uint64 reserved[4];
+} KeyStoreIndexHeader;
+
+struct key_store
+{
+  char   data_path[FILE_NAME_SIZE];
+  char   idx_path[FILE_NAME_SIZE + 8];
+  int    data_fd;
+  int    writable;
+  byte  *map;
+  size_t map_len;
+  KeyStoreIndexHeader *hdr;
+  KeyStoreSlot        *slots;
+};
+
+static uint64 name_hash(const char *name)
+{
+  uint64 h = 0xcbf29ce484222325ULL;
+
+  while (*name)
+  {
+    h ^= (byte) *name++;
+    h *= 0x100000001b3ULL;
+  }
+  return h ? h : 1;      // 0 marks an empty slot
+}
+
+static void ks_pread(KeyStore *ks, void *buf, int64 len, int64 offset)
+{
+  byte *p = (byte *) buf;
+
+  while (len > 0)
+  {
+    ssize_t n = pread(ks->data_fd, p, (size_t) len, (off_t) offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+    {
+      snprintf(errortext, ET_SIZE, "key store %s: cannot read byte %lld", ks->data_path, (long long) offset);
+      error_KeyGen(errortext, 500);
+    }
+    p += n;
+    len -= n;
+    offset += n;
+  }
+}
+
+static void ks_pwrite(int fd, const void *buf, int64 len, int64 offset, const char *path)
+{
+  const byte *p = (const byte *) buf;
+
+  while (len > 0)
+  {
+    ssize_t n = pwrite(fd, p, (size_t) len, (off_t) offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+    {
+      snprintf(errortext, ET_SIZE, "key store %s: cannot write byte %lld (%s)", path, (long long) offset, strerror(errno));
+      error_KeyGen(errortext, 500);
+    }
+    p += n;
+    len -= n;
+    offset += n;
+  }
+}
+
+static void unmap_index(KeyStore *ks)
+{
+  if (ks->map)
+    munmap(ks->map, ks->map_len);
+  ks->map   = NULL;
+  ks->hdr   = NULL;
+  ks->slots = NULL;
+}
+
+//! TRUE if the index file is there and sound
+static int map_index(KeyStore *ks)
+{
+  int fd = open(ks->idx_path, ks->writable ? O_RDWR : O_RDONLY);
+  KeyStoreIndexHeader *hdr;
+  struct stat st;
+  void *map;
+
+  unmap_index(ks);
+  if (fd < 0)
+    return FALSE;
+  if (fstat(fd, &st) || st.st_size < (off_t) sizeof(KeyStoreIndexHeader))
+  {
+    close(fd);
+    return FALSE;
+  }
+  map = mmap(NULL, (size_t) st.st_size, ks->writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return FALSE;
+
+  hdr = (KeyStoreIndexHeader *) map;
+  if (memcmp(hdr->magic, KEY_STORE_INDEX_MAGIC, 8) || hdr->version != KEY_STORE_VERSION || hdr->slot_bits > 40
+    || (uint64) st.st_size != sizeof(KeyStoreIndexHeader) + (sizeof(KeyStoreSlot) << hdr->slot_bits))
+  {
+    munmap(map, (size_t) st.st_size);
+    return FALSE;
+  }
+  ks->map     = (byte *) map;
+  ks->map_len = (size_t) st.st_size;
+  ks->hdr     = hdr;
+  ks->slots   = (KeyStoreSlot *) (ks->map + sizeof(KeyStoreIndexHeader));
+  return TRUE;
+}
+
+//! the slot of hash in a table of 1 << bits slots, linear probing
+static KeyStoreSlot *probe_free(KeyStoreSlot *slots, int bits, uint64 hash)
+{
+  uint64 mask = ((uint64) 1 << bits) - 1;
+  uint64 i = hash & mask;
+
+  while (slots[i].hash)
+    i = (i + 1) & mask;
+  return &slots[i];
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Write a new index of 1 << bits slots through a temporary file and
+ *    rename(). Its entries are the slots of the current index, or with
+ *    rescan the records found in the data file.
+ ************************************************************************
+ */
+static void write_index(KeyStore *ks, int bits, int rescan)
+{
+  char tmp[FILE_NAME_SIZE + 16];
+  size_t len = sizeof(KeyStoreIndexHeader) + (sizeof(KeyStoreSlot) << bits);
+  byte *buf = (byte *) calloc(1, len);
+  KeyStoreIndexHeader *hdr = (KeyStoreIndexHeader *) buf;
+  KeyStoreSlot *slots = (KeyStoreSlot *) (buf + sizeof(KeyStoreIndexHeader));
+  int fd;
+
+  if (buf == NULL)
+    no_mem_exit("write_index: buf");
+  memcpy(hdr->magic, KEY_STORE_INDEX_MAGIC, 8);
+  hdr->version   = KEY_STORE_VERSION;
+  hdr->slot_bits = bits;
+
+  if (rescan)
+  {
+    // a record that does not check out ends the store, a crashed writer left it
+    struct stat st;
+    int64 pos = 0;
+
+    fstat(ks->data_fd, &st);
+    while (pos + KEY_STORE_RECORD_HEADER <= (int64) st.st_size)
+    {
+      byte head[KEY_STORE_RECORD_HEADER];
+      char name[FILE_NAME_SIZE];
+      uint32 name_len;
+      uint64 key_len, hash, rec_len;
+      KeyStoreSlot *s;
+      uint64 mask = ((uint64) 1 << bits) - 1;
+      uint64 i;
+
+      ks_pread(ks, head, KEY_STORE_RECORD_HEADER, pos);
+      memcpy(&name_len, head + 4, 4);
+      memcpy(&key_len, head + 8, 8);
+      memcpy(&hash, head + 16, 8);
+      rec_len = KEY_STORE_RECORD_HEADER + name_len + key_len;
+      if (memcmp(head, KEY_STORE_MAGIC, 4) || name_len == 0 || name_len >= FILE_NAME_SIZE || pos + rec_len > (uint64) st.st_size)
+        break;
+      ks_pread(ks, name, name_len, pos + KEY_STORE_RECORD_HEADER);
+      name[name_len] = '\0';
+      if (name_hash(name) != hash)
+        break;
+      if (hdr->count * 10 >= (uint64) 7 << bits)
+      {
+        // more records than the table takes, start over with twice the slots
+        free(buf);
+        write_index(ks, bits + 1, TRUE);
+        return;
+      }
+
+      // a later record of the same name replaces the earlier one
+      for (i = hash & mask, s = NULL; slots[i].hash; i = (i + 1) & mask)
+      {
+        char other[FILE_NAME_SIZE];
+
+        if (slots[i].hash != hash)
+          continue;
+        ks_pread(ks, other, name_len, slots[i].offset + KEY_STORE_RECORD_HEADER);
+        if (memcmp(other, name, name_len) == 0)
+        {
+          s = &slots[i];
+          break;
+        }
+      }
+      if (s == NULL)
+      {
+        s = &slots[i];
+        hdr->count++;
+      }
+      s->hash   = hash;
+      s->offset = (uint64) pos;
+      s->length = rec_len;
+      pos += rec_len;
+    }
+    hdr->data_len = (uint64) pos;
+  }
+  else
+  {
+    uint64 i, n = (uint64) 1 << ks->hdr->slot_bits;
+
+    for (i = 0; i < n; ++i)
+      if (ks->slots[i].hash)
+        *probe_free(slots, bits, ks->slots[i].hash) = ks->slots[i];
+    hdr->count    = ks->hdr->count;
+    hdr->data_len = ks->hdr->data_len;
+  }
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", ks->idx_path);
+  if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+  {
+    snprintf(errortext, ET_SIZE, "key store: cannot create %s (%s)", tmp, strerror(errno));
+    error_KeyGen(errortext, 500);
+  }
+  ks_pwrite(fd, buf, (int64) len, 0, tmp);
+  if (fsync(fd) || close(fd) || rename(tmp, ks->idx_path))
+  {
+    snprintf(errortext, ET_SIZE, "key store: cannot replace %s (%s)", ks->idx_path, strerror(errno));
+    error_KeyGen(errortext, 500);
+  }
+  free(buf);
+  if (!map_index(ks))
+  {
+    snprintf(errortext, ET_SIZE, "key store: cannot map %s", ks->idx_path);
+    error_KeyGen(errortext, 500);
+  }
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Open the key store path (created when writable). A reader needs
+ *    the index, a writer builds it when it is missing.
+ ************************************************************************
+ */
+KeyStore *open_key_store(const char *path, int writable)
+{
+  KeyStore *ks = (KeyStore *) calloc(1, sizeof(KeyStore));
+
+  if (ks == NULL)
+    no_mem_exit("open_key_store: ks");
+  strncpy(ks->data_path, path, FILE_NAME_SIZE - 1);
+  snprintf(ks->idx_path, sizeof(ks->idx_path), "%s.idx", path);
+  ks->writable = writable;
+  if ((ks->data_fd = open(path, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644)) < 0)
+  {
+    snprintf(errortext, ET_SIZE, "Cannot open the key store '%s' (%s)", path, strerror(errno));
+    error_KeyGen(errortext, 500);
+  }
+  if (!writable && !map_index(ks))
+  {
+    snprintf(errortext, ET_SIZE, "The key store index '%.*s' is missing or damaged, the next writer rebuilds it", ET_SIZE - 80, ks->idx_path);
+    error_KeyGen(errortext, 500);
+  }
+  return ks;
+}
+
+void close_key_store(KeyStore *ks)
+{
+  if (ks == NULL)
+    return;
+  unmap_index(ks);
+  close(ks->data_fd);
+  free(ks);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Append the key_len bytes of key_fd (from its start) as the key
+ *    stream of name, a former entry of the same name is replaced.
+ * \return
+ *    the offset of the record in the data file
+ ************************************************************************
+ */
+int64 key_store_put(KeyStore *ks, const char *name, int key_fd, int64 key_len)
+{
+  int name_len = (int) strlen(name);
+  uint64 hash = name_hash(name);
+  byte head[KEY_STORE_RECORD_HEADER];
+  byte buf[65536];
+  KeyStoreSlot *s = NULL;
+  uint64 mask, i;
+  int64 pos, done;
+  struct stat st;
+
+  if (name_len == 0 || name_len >= FILE_NAME_SIZE)
+    error_KeyGen("key_store_put: bad clip name", 500);
+  while (flock(ks->data_fd, LOCK_EX) && errno == EINTR)
+    ;
+
+  if (!map_index(ks) || fstat(ks->data_fd, &st) || (uint64) st.st_size < ks->hdr->data_len)
+    write_index(ks, KEY_STORE_MIN_SLOT_BITS, TRUE);
+  if (fstat(ks->data_fd, &st) == 0 && (uint64) st.st_size != ks->hdr->data_len && ftruncate(ks->data_fd, (off_t) ks->hdr->data_len))
+    error_KeyGen("key_store_put: cannot cut off an unfinished record", 500);
+  if ((ks->hdr->count + 1) * 10 > (uint64) 7 << ks->hdr->slot_bits)
+    write_index(ks, ks->hdr->slot_bits + 1, FALSE);
+
+  // the record first, then the slot that points to it
+  pos = (int64) ks->hdr->data_len;
+  memcpy(head, KEY_STORE_MAGIC, 4);
+  memcpy(head + 4, &name_len, 4);
+  memcpy(head + 8, &key_len, 8);
+  memcpy(head + 16, &hash, 8);
+  ks_pwrite(ks->data_fd, head, KEY_STORE_RECORD_HEADER, pos, ks->data_path);
+  ks_pwrite(ks->data_fd, name, name_len, pos + KEY_STORE_RECORD_HEADER, ks->data_path);
+  for (done = 0; done < key_len; )
+  {
+    ssize_t n = pread(key_fd, buf, (size_t) (key_len - done < (int64) sizeof(buf) ? key_len - done : (int64) sizeof(buf)), (off_t) done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      error_KeyGen("key_store_put: cannot read the key stream", 500);
+    ks_pwrite(ks->data_fd, buf, n, pos + KEY_STORE_RECORD_HEADER + name_len + done, ks->data_path);
+    done += n;
+  }
+  if (fdatasync(ks->data_fd))
+    error_KeyGen("key_store_put: fdatasync of the data file failed", 500);
+
+  mask = ((uint64) 1 << ks->hdr->slot_bits) - 1;
+  for (i = hash & mask; ks->slots[i].hash; i = (i + 1) & mask)
+  {
+    char other[FILE_NAME_SIZE];
+
+    if (ks->slots[i].hash != hash)
+      continue;
+    ks_pread(ks, other, name_len, (int64) ks->slots[i].offset + KEY_STORE_RECORD_HEADER);
+    if (memcmp(other, name, name_len) == 0)
+    {
+      s = &ks->slots[i];
+      break;
+    }
+  }
+  if (s == NULL)
+  {
+    s = &ks->slots[i];
+    ks->hdr->count++;
+  }
+  s->offset = (uint64) pos;
+  s->length = KEY_STORE_RECORD_HEADER + name_len + key_len;
+  __atomic_store_n(&s->hash, hash, __ATOMIC_RELEASE);
+  ks->hdr->data_len = s->offset + s->length;
+  if (msync(ks->map, ks->map_len, MS_SYNC))
+    error_KeyGen("key_store_put: msync of the index failed", 500);
+
+  unmap_index(ks);
+  flock(ks->data_fd, LOCK_UN);
+  return pos;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Copy slot i of a mapped index into s. A writer that replaces an
+ *    entry stores offset and length one after the other, a copy taken
+ *    in between points to a record of another length: the slot is read
+ *    again until the record header agrees with it.
+ * \return
+ *    FALSE when the slot stays the same and still does not match its
+ *    record
+ ************************************************************************
+ */
+static int read_slot(KeyStore *ks, uint64 i, uint64 hash, KeyStoreSlot *s)
+{
+  byte head[KEY_STORE_RECORD_HEADER];
+  uint32 name_len;
+  uint64 key_len, rec_hash;
+  KeyStoreSlot again;
+
+  *s = ks->slots[i];
+  for (;;)
+  {
+    if (s->length >= KEY_STORE_RECORD_HEADER)
+    {
+      ks_pread(ks, head, KEY_STORE_RECORD_HEADER, (int64) s->offset);
+      memcpy(&name_len, head + 4, 4);
+      memcpy(&key_len, head + 8, 8);
+      memcpy(&rec_hash, head + 16, 8);
+      if (memcmp(head, KEY_STORE_MAGIC, 4) == 0 && rec_hash == hash && KEY_STORE_RECORD_HEADER + name_len + key_len == s->length)
+        return TRUE;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    again = ks->slots[i];
+    if (again.offset == s->offset && again.length == s->length)
+      return FALSE;
+    *s = again;
+  }
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    The key stream of name (malloc'ed, the caller frees it) and its
+ *    length, NULL when the store has no such clip
+ ************************************************************************
+ */
+byte *key_store_get(KeyStore *ks, const char *name, int64 *key_len)
+{
+  int name_len = (int) strlen(name);
+  uint64 hash = name_hash(name);
+  uint64 mask = ((uint64) 1 << ks->hdr->slot_bits) - 1;
+  uint64 i, h;
+
+  for (i = hash & mask; (h = __atomic_load_n(&ks->slots[i].hash, __ATOMIC_ACQUIRE)) != 0; i = (i + 1) & mask)
+  {
+    KeyStoreSlot s;
+    byte *rec;
+    uint32 rec_name_len;
+
+    if (h != hash || !read_slot(ks, i, hash, &s) || s.length < KEY_STORE_RECORD_HEADER + (uint64) name_len)
+      continue;
+    if ((rec = (byte *) malloc((size_t) s.length)) == NULL)
+      no_mem_exit("key_store_get: rec");
+    ks_pread(ks, rec, (int64) s.length, (int64) s.offset);
+    memcpy(&rec_name_len, rec + 4, 4);
+    if ((int) rec_name_len == name_len && memcmp(rec + KEY_STORE_RECORD_HEADER, name, name_len) == 0)
+    {
+      *key_len = (int64) s.length - KEY_STORE_RECORD_HEADER - name_len;
+      memmove(rec, rec + KEY_STORE_RECORD_HEADER + name_len, (size_t) *key_len);
+      return rec;
+    }
+    free(rec);
+  }
+  return NULL;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Walk the index: the entry at or after *slot, its name in name.
+ *    FALSE when there is none; *slot is moved past the entry.
+ ************************************************************************
+ */
+int key_store_next(KeyStore *ks, int *slot, char *name, int size, KeyStoreSlot *entry)
+{
+  uint64 n = (uint64) 1 << ks->hdr->slot_bits;
+  uint32 name_len;
+
+  for (; (uint64) *slot < n; ++*slot)
+  {
+    if (!__atomic_load_n(&ks->slots[*slot].hash, __ATOMIC_ACQUIRE))
+      continue;
+    *entry = ks->slots[(*slot)++];
+    ks_pread(ks, &name_len, 4, (int64) entry->offset + 4);
+    if ((int) name_len >= size)
+      name_len = size - 1;
+    ks_pread(ks, name, name_len, (int64) entry->offset + KEY_STORE_RECORD_HEADER);
+    name[name_len] = '\0';
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Content name of the file fd: its size and a 64 bit FNV-1a hash of
+ *    its bytes, so a restore job can find the keys of a scrambled clip
+ *    it only has the bytes of
+ ************************************************************************
+ */
+void key_store_content_name(int fd, char *name, int size)
+{
+  uint64 h = 0xcbf29ce484222325ULL;
+  int64 pos = 0;
+  byte *buf = (byte *) malloc(1 << 20);
+  ssize_t n;
+
+  if (buf == NULL)
+    no_mem_exit("key_store_content_name: buf");
+  while ((n = pread(fd, buf, 1 << 20, (off_t) pos)) != 0)
+  {
+    ssize_t k;
+
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      error_KeyGen("key_store_content_name: cannot read the clip", 500);
+    for (k = 0; k < n; ++k)
+    {
+      h ^= buf[k];
+      h *= 0x100000001b3ULL;
+    }
+    pos += n;
+  }
+  free(buf);
+  snprintf(name, size, "fnv64:%016llx:%lld", (unsigned long long) h, (long long) pos);
+}
@@ -0,0 +1,373 @@
+
+/*!
+ ************************************************************************
+ * \file keyunit.c
+ *
+ * \brief
+ *    Key unit storage.
+ *
+ *    Key units are kept in memory as two LEB128 varints each (delta byte
+ *    offset, data length and bit offset), which usually needs 2-3 bytes
+ *    instead of the 12 bytes of a KeyUnit.
+ *
+ *    With KeyFormat = 1 the key file is a single bit packed stream:
+ *      'J' 'K' version
+ *      { rice(byte_offset) u(3) bit_offset rice(key_data_len) u(key_data_len) data }
+ *      escape u(32) 0xFFFFFFFF                    -- terminator
+ *    The Rice parameter of each field adapts to the running mean of the
+ *    values already coded, so the decoder mirrors the encoder exactly.
+ ************************************************************************
+ */
+
+#include "global.h"
+#include "keyunit.h"
+#include "memalloc.h"
+
+KeyUnitBuffer g_KeyUnitBuffer;
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Allocate a key unit buffer of size bytes (grows on demand)
+ ************************************************************************
+ */
+void init_key_unit_buffer(KeyUnitBuffer *kb, int64 size)
+{
+  kb->size  = 0;
+  kb->count = 0;
+  kb->alloc = i64max(size, 4 * KEY_UNIT_MAX_VARINT);
+  if ((kb->buf = (byte *) malloc((size_t) kb->alloc)) == NULL)
+    no_mem_exit("init_key_unit_buffer: kb->buf");
+}
+
+void free_key_unit_buffer(KeyUnitBuffer *kb)
+{
+  free(kb->buf);
+  kb->buf   = NULL;
+  kb->size  = 0;
+  kb->alloc = 0;
+  kb->count = 0;
+}
+
+void grow_key_unit_buffer(KeyUnitBuffer *kb)
+{
+  int64 alloc = kb->alloc << 1;
+  byte *buf = (byte *) realloc(kb->buf, (size_t) alloc);
+
+  if (buf == NULL)
+    no_mem_exit("grow_key_unit_buffer: kb->buf");
+  kb->buf   = buf;
+  kb->alloc = alloc;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Rice parameter for the current state: smallest k with N * 2^k >= A
+ ************************************************************************
+ */
+static inline int rice_k(const KeyRiceCtx *ctx)
+{
+  int k = 0;
+  while ((ctx->N << k) < ctx->A && k < KEY_RICE_MAX_K)
+    ++k;
+  return k;
+}
+
+static inline void rice_update(KeyRiceCtx *ctx, uint32 v)
+{
+  ctx->A += (v < (1u << KEY_RICE_MAX_K)) ? v : (1u << KEY_RICE_MAX_K);
+  if (++ctx->N >= KEY_RICE_RESET)
+  {
+    ctx->A >>= 1;
+    ctx->N >>= 1;
+  }
+}
+
+static inline void rice_init(KeyRiceCtx *ctx, uint32 mean)
+{
+  ctx->A = mean;
+  ctx->N = 1;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Writer
+ ************************************************************************
+ */
+static inline void flush_key_rice_buffer(KeyRiceWriter *w)
+{
+  if (w->pos)
+  {
+    fwrite(w->buf, sizeof(byte), w->pos, w->fp);
+    w->bytes_written += w->pos;
+    w->pos = 0;
+  }
+}
+
+// n in [1,32]
+static inline void put_bits(KeyRiceWriter *w, int n, uint32 v)
+{
+  w->acc = (w->acc << n) | (v & (((uint64) 1 << n) - 1));
+  w->nbits += n;
+  while (w->nbits >= 8)
+  {
+    w->nbits -= 8;
+    w->buf[w->pos++] = (byte) (w->acc >> w->nbits);
+    if (w->pos == w->size)
+      flush_key_rice_buffer(w);
+  }
+}
+
+static inline void put_rice(KeyRiceWriter *w, KeyRiceCtx *ctx, uint32 v)
+{
+  int k = rice_k(ctx);
+  uint32 q = v >> k;
+
+  if (q < KEY_RICE_ESCAPE)
+  {
+    put_bits(w, q + 1, 1);          // q zeros terminated by a one
+    if (k)
+      put_bits(w, k, v);
+  }
+  else
+  {
+    put_bits(w, KEY_RICE_ESCAPE + 1, 1);
+    put_bits(w, 32, v);
+  }
+  rice_update(ctx, v);
+}
+
+void init_key_rice_writer(KeyRiceWriter *w, FILE *fp, int size)
+{
+  memset(w, 0, sizeof(KeyRiceWriter));
+  w->fp   = fp;
+  w->size = imax(size, 16);
+  if ((w->buf = (byte *) malloc(w->size)) == NULL)
+    no_mem_exit("init_key_rice_writer: w->buf");
+
+  rice_init(&w->ctx_offset, KEY_RICE_OFFSET_MEAN);
+  rice_init(&w->ctx_length, KEY_RICE_LENGTH_MEAN);
+
+  put_bits(w, 8, KEY_RICE_MAGIC0);
+  put_bits(w, 8, KEY_RICE_MAGIC1);
+  put_bits(w, 8, KEY_RICE_VERSION);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Write the header of one key unit; its key_data_len data bits must
+ *    follow through put_key_data_rice()
+ ************************************************************************
+ */
+void put_key_unit_rice(KeyRiceWriter *w, int byte_offset, int bit_offset, int key_data_len)
+{
+  put_rice(w, &w->ctx_offset, (uint32) byte_offset);
+  put_bits(w, 3, (uint32) bit_offset);
+  put_rice(w, &w->ctx_length, (uint32) key_data_len);
+}
+
+void put_key_data_rice(KeyRiceWriter *w, int n, uint32 value)
+{
+  put_bits(w, n, value);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Write the terminator, pad to a byte boundary and flush the stream.
+ *    The FILE is left open.
+ ************************************************************************
+ */
+void close_key_rice_writer(KeyRiceWriter *w)
+{
+  if (w->buf == NULL)
+    return;
+
+  // offsets are non-negative ints, so the escaped all-ones value cannot occur in a key unit
+  put_bits(w, KEY_RICE_ESCAPE + 1, 1);
+  put_bits(w, 32, KEY_RICE_END);
+  if (w->nbits)
+    put_bits(w, 8 - w->nbits, 0);
+  flush_key_rice_buffer(w);
+
+  free(w->buf);
+  w->buf = NULL;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Put the complete bytes written so far into the FILE, the pending
+ *    bits of the incomplete last byte stay in the writer. Unlike
+ *    sync_key_rice_writer() this does not seek, the FILE may be a pipe.
+ ************************************************************************
+ */
+void flush_key_rice_writer(KeyRiceWriter *w)
+{
+  flush_key_rice_buffer(w);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Put everything written so far into the FILE, the incomplete last
+ *    byte zero padded, and return the state to continue from. The FILE
+ *    is left at the incomplete byte, the next flush writes it again.
+ ************************************************************************
+ */
+void sync_key_rice_writer(KeyRiceWriter *w, KeyRiceState *st)
+{
+  flush_key_rice_buffer(w);
+  st->nbits      = w->nbits;
+  st->pending    = (uint32) (w->acc & ((1u << w->nbits) - 1));
+  st->ctx_offset = w->ctx_offset;
+  st->ctx_length = w->ctx_length;
+  if (w->nbits)
+  {
+    fputc((int) (byte) (st->pending << (8 - w->nbits)), w->fp);
+    fseek(w->fp, -1, SEEK_CUR);
+  }
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Continue a key stream at the FILE position of a sync, no header
+ ************************************************************************
+ */
+void resume_key_rice_writer(KeyRiceWriter *w, FILE *fp, int size, const KeyRiceState *st)
+{
+  memset(w, 0, sizeof(KeyRiceWriter));
+  w->fp   = fp;
+  w->size = imax(size, 16);
+  if ((w->buf = (byte *) malloc(w->size)) == NULL)
+    no_mem_exit("resume_key_rice_writer: w->buf");
+  w->acc        = st->pending;
+  w->nbits      = st->nbits;
+  w->ctx_offset = st->ctx_offset;
+  w->ctx_length = st->ctx_length;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Reader
+ ************************************************************************
+ */
+// n in [1,32], reads zeros past the end of the stream
+static inline uint32 get_bits(KeyRiceReader *r, int n)
+{
+  while (r->nbits < n)
+  {
+    if (r->p < r->end)
+      r->acc = (r->acc << 8) | *r->p++;
+    else
+    {
+      r->acc <<= 8;
+      r->overrun = 1;
+    }
+    r->nbits += 8;
+  }
+  r->nbits -= n;
+  return (uint32) ((r->acc >> r->nbits) & (((uint64) 1 << n) - 1));
+}
+
+static inline uint32 get_rice(KeyRiceReader *r, KeyRiceCtx *ctx)
+{
+  int k = rice_k(ctx);
+  uint32 q = 0, v;
+
+  while (q < KEY_RICE_ESCAPE && get_bits(r, 1) == 0)
+    ++q;
+
+  if (q < KEY_RICE_ESCAPE)
+    v = (q << k) | (k ? get_bits(r, k) : 0);
+  else
+  {
+    get_bits(r, 1);
+    v = get_bits(r, 32);
+  }
+  rice_update(ctx, v);
+  return v;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Check the stream header and prepare for get_key_unit_rice()
+ * \return
+ *    0 on success, -1 if buf is not a Rice key stream
+ ************************************************************************
+ */
+int init_key_rice_reader(KeyRiceReader *r, const byte *buf, int64 size)
+{
+  memset(r, 0, sizeof(KeyRiceReader));
+  if (size < 3 || buf[0] != KEY_RICE_MAGIC0 || buf[1] != KEY_RICE_MAGIC1 || buf[2] != KEY_RICE_VERSION)
+    return -1;
+
+  r->p   = buf + 3;
+  r->end = buf + size;
+  rice_init(&r->ctx_offset, KEY_RICE_OFFSET_MEAN);
+  rice_init(&r->ctx_length, KEY_RICE_LENGTH_MEAN);
+  return 0;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Read a key stream from the position of sync_key_rice_writer(), buf
+ *    starts with the byte that held the pending bits
+ ************************************************************************
+ */
+void resume_key_rice_reader(KeyRiceReader *r, const byte *buf, int64 size, const KeyRiceState *st)
+{
+  memset(r, 0, sizeof(KeyRiceReader));
+  r->p          = buf;
+  r->end        = buf + size;
+  r->ctx_offset = st->ctx_offset;
+  r->ctx_length = st->ctx_length;
+  if (st->nbits)
+    get_bits(r, st->nbits);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Read the next key unit. The data bits are returned MSB first in
+ *    data (KEY_UNIT_MAX_DATA_BYTES bytes), longer units are truncated.
+ * \return
+ *    1 if a key unit was read, 0 at the terminator or end of stream
+ ************************************************************************
+ */
+int get_key_unit_rice(KeyRiceReader *r, KeyUnit *ku, byte *data)
+{
+  int n, i = 0;
+  uint32 v;
+
+  if (r->p >= r->end && r->nbits < 8)
+    return 0;
+
+  v = get_rice(r, &r->ctx_offset);
+  if (v == KEY_RICE_END)
+    return 0;
+
+  ku->byte_offset  = (int) v;
+  ku->bit_offset   = (int) get_bits(r, 3);
+  ku->key_data_len = (int) get_rice(r, &r->ctx_length);
+
+  for (n = ku->key_data_len; n >= 8; n -= 8)
+  {
+    byte b = (byte) get_bits(r, 8);
+    if (i < KEY_UNIT_MAX_DATA_BYTES)
+      data[i++] = b;
+  }
+  if (n && i < KEY_UNIT_MAX_DATA_BYTES)
+    data[i] = (byte) (get_bits(r, n) << (8 - n));
+  else if (n)
+    get_bits(r, n);
+
+  return 1;
+}
@@ -58,10 +58,12 @@
 #include "nalu.h"
 #include "rtp.h"
 #include "h264decoder.h"
+#include "mvfield.h"
+#include "tracering.h"
 
 #define LOGFILE     "log.dec"
 #define DATADECFILE "dataDec.txt"
-#define TRACEFILE   "vfile/trace_dec.txt"
+#define TRACEFILE   "vfile/trace_dec.bin"  //!< binary, see tracering.h
 
 // Decoder definition. This should be the only global variable in the entire
 // software. Global variables should be avoided.
@@ -201,6 +203,11 @@ static void free_img( VideoParameters *p_Vid)
     {
       if(p_Vid->p_EncodePar[i])
       {
+        if (p_Vid->p_EncodePar[i]->arena)
+        {
+          free_mem_arena(p_Vid->p_EncodePar[i]->arena);
+          free(p_Vid->p_EncodePar[i]->arena);
+        }
         free(p_Vid->p_EncodePar[i]);
         p_Vid->p_EncodePar[i] = NULL;
       }
@@ -274,6 +281,9 @@ static void init(VideoParameters *p_Vid)  //!< video parameters
   p_Vid->dec_picture = NULL;
   p_Vid->MbToSliceGroupMap = NULL;
   p_Vid->MapUnitToSliceGroupMap = NULL;
+  p_Vid->NextMbInSliceGroup = NULL;
+  p_Vid->LastMbInSliceGroup = NULL;
+  p_Vid->fmo_cache = NULL;
 
   p_Vid->LastAccessUnitExists  = 0;
   p_Vid->NALUCount = 0;
@@ -554,7 +564,8 @@ DataPartition *AllocPartition(int n)
       snprintf(errortext, ET_SIZE, "AllocPartition: Memory allocation for Bitstream failed");
       error(errortext, 100);
     }
-    dataPart->bitstream->streamBuffer = (byte *) calloc(MAX_CODED_FRAME_SIZE, sizeof(byte));
+    // the count only CAVLC reader looks 5 bytes ahead, see peek_bits32()
+    dataPart->bitstream->streamBuffer = (byte *) calloc(MAX_CODED_FRAME_SIZE + 8, sizeof(byte));
     if (dataPart->bitstream->streamBuffer == NULL)
     {
       snprintf(errortext, ET_SIZE, "AllocPartition: Memory allocation for streamBuffer failed");
@@ -664,6 +675,35 @@ static void free_slice(Slice *currSlice)
   currSlice = NULL;
 }
 
+/*!
+ ************************************************************************
+ * \brief
+ *    Keep the peak of the bytes the arenas of the layers hold in the
+ *    decoder statistics
+ ************************************************************************
+ */
+static void update_mem_stats(VideoParameters *p_Vid)
+{
+  DecoderStats *stats = &p_Dec->stats;
+  int64 bytes[MEM_TAG_COUNT] = { 0 }, mapped = 0, huge_mapped = 0;
+  int i, tag;
+
+  for (i = 0; i < MAX_NUM_DPB_LAYERS; i++)
+  {
+    MemArena *arena = p_Vid->p_EncodePar[i] ? p_Vid->p_EncodePar[i]->arena : NULL;
+    if (arena == NULL)
+      continue;
+    for (tag = 0; tag < MEM_TAG_COUNT; tag++)
+      bytes[tag] += arena->tag_bytes[tag];
+    mapped      += arena->mapped;
+    huge_mapped += arena->huge_mapped;
+  }
+  for (tag = 0; tag < MEM_TAG_COUNT; tag++)
+    stats->mem_bytes[tag] = i64max(stats->mem_bytes[tag], bytes[tag]);
+  stats->mem_mapped      = i64max(stats->mem_mapped, mapped);
+  stats->mem_huge_mapped = i64max(stats->mem_huge_mapped, huge_mapped);
+}
+
 /*!
  ************************************************************************
  * \brief
@@ -690,38 +730,41 @@ int init_global_buffers(VideoParameters *p_Vid, int layer_id)
     free_layer_buffers(p_Vid, layer_id);
   }
 
+  // the buffers of a layer are allocated from its arena and freed with it on an SPS change
+  if (cps->arena == NULL)
+  {
+    if ((cps->arena = (MemArena *) calloc(1, sizeof(MemArena))) == NULL)
+      no_mem_exit("init_global_buffers: cps->arena");
+    init_mem_arena(cps->arena, p_Vid->p_Inp->huge_pages);
+  }
+
   // allocate memory in structure p_Vid
   if( (cps->separate_colour_plane_flag != 0) )
   {
     for( i=0; i<MAX_PLANE; ++i )
     {
-      if(((cps->mb_data_JV[i]) = (Macroblock *) calloc(cps->FrameSizeInMbs, sizeof(Macroblock))) == NULL)
-        no_mem_exit("init_global_buffers: cps->mb_data_JV");
+      cps->mb_data_JV[i] = (Macroblock *) arena_calloc(cps->arena, cps->FrameSizeInMbs, sizeof(Macroblock), MEM_MB_DATA);
     }
     cps->mb_data = NULL;
   }
   else
   {
-    if(((cps->mb_data) = (Macroblock *) calloc(cps->FrameSizeInMbs, sizeof(Macroblock))) == NULL)
-      no_mem_exit("init_global_buffers: cps->mb_data");
+    cps->mb_data = (Macroblock *) arena_calloc(cps->arena, cps->FrameSizeInMbs, sizeof(Macroblock), MEM_MB_DATA);
   }
   if( (cps->separate_colour_plane_flag != 0) )
   {
     for( i=0; i<MAX_PLANE; ++i )
     {
-      if(((cps->intra_block_JV[i]) = (char*) calloc(cps->FrameSizeInMbs, sizeof(char))) == NULL)
-        no_mem_exit("init_global_buffers: cps->intra_block_JV");
+      cps->intra_block_JV[i] = (char*) arena_calloc(cps->arena, cps->FrameSizeInMbs, sizeof(char), MEM_MB_MAPS);
     }
     cps->intra_block = NULL;
   }
   else
   {
-    if(((cps->intra_block) = (char*) calloc(cps->FrameSizeInMbs, sizeof(char))) == NULL)
-      no_mem_exit("init_global_buffers: cps->intra_block");
+    cps->intra_block = (char*) arena_calloc(cps->arena, cps->FrameSizeInMbs, sizeof(char), MEM_MB_MAPS);
   }
 
-  if(((cps->PicPos) = (BlockPos*) calloc(cps->FrameSizeInMbs + 1, sizeof(BlockPos))) == NULL)
-    no_mem_exit("init_global_buffers: PicPos");
+  cps->PicPos = (BlockPos*) arena_calloc(cps->arena, cps->FrameSizeInMbs + 1, sizeof(BlockPos), MEM_MB_MAPS);
 
   PicPos = cps->PicPos;
   for (i = 0; i < (int) cps->FrameSizeInMbs + 1;++i)
@@ -731,7 +774,9 @@ int init_global_buffers(VideoParameters *p_Vid, int layer_id)
   }
 
   // CAVLC mem
-  memory_size += get_mem4D(&(cps->nz_coeff), cps->FrameSizeInMbs, 3, BLOCK_SIZE, BLOCK_SIZE);
+  memory_size += get_mem4D_arena(cps->arena, &(cps->nz_coeff), cps->FrameSizeInMbs, 3, BLOCK_SIZE, BLOCK_SIZE, MEM_CAVLC);
+  cps->nz_epoch = (int*) arena_calloc(cps->arena, cps->FrameSizeInMbs, sizeof(int), MEM_CAVLC);
+  memory_size += cps->FrameSizeInMbs * sizeof(int);
   //if( (cps->separate_colour_plane_flag != 0) )
   {
     //for( i=0; i<MAX_PLANE; ++i )
@@ -750,6 +795,7 @@ int init_global_buffers(VideoParameters *p_Vid, int layer_id)
   cps->oldFrameSizeInMbs = cps->FrameSizeInMbs;
 
   p_Vid->global_init_done[layer_id] = 1;
+  update_mem_stats(p_Vid);
 
   return (memory_size);
 }
@@ -776,50 +822,33 @@ void free_layer_buffers(VideoParameters *p_Vid, int layer_id)
   if(!p_Vid->global_init_done[layer_id])
     return;
 
-  // CAVLC free mem
-  if (cps->nz_coeff)
-  {
-    free_mem4D(cps->nz_coeff);
-    cps->nz_coeff = NULL;
-  }
+  // all of them were allocated from the arena
+  free_mem_arena(cps->arena);
+  cps->nz_coeff = NULL;
+  cps->nz_epoch = NULL;
 
-  // free mem, allocated for structure p_Vid
   if( (cps->separate_colour_plane_flag != 0) )
   {
     int i;
     for(i=0; i<MAX_PLANE; i++)
     {
-      free(cps->mb_data_JV[i]);
       cps->mb_data_JV[i] = NULL;
       //free_mem2Dint(cps->siblock_JV[i]);
       //cps->siblock_JV[i] = NULL;
-      free (cps->intra_block_JV[i]);
       cps->intra_block_JV[i] = NULL;
     }   
   }
   else
   {
-    if (cps->mb_data != NULL)
-    {
-      free(cps->mb_data);
-      cps->mb_data = NULL;
-    }
+    cps->mb_data = NULL;
     //if(cps->siblock)
     {
       //free_mem2Dint(cps->siblock);
       //cps->siblock = NULL;
     }
-    if(cps->intra_block)
-    {
-      free (cps->intra_block);
-      cps->intra_block = NULL;
-    }
-  }
-  if(cps->PicPos)
-  {
-    free(cps->PicPos);
-    cps->PicPos = NULL;
+    cps->intra_block = NULL;
   }
+  cps->PicPos = NULL;
 
   p_Vid->global_init_done[layer_id] = 0;
 }
@@ -878,12 +907,13 @@ int OpenDecoder(InputParameters *p_Inp)
   pDecoder = p_Dec;
   memcpy(pDecoder->p_Inp, p_Inp, sizeof(InputParameters));
 #if TRACE
-  if ((pDecoder->p_trace = fopen(TRACEFILE,"w"))==0) 
+  if ((pDecoder->p_trace = fopen(TRACEFILE,"wb"))==0) 
   {
     snprintf(errortext, ET_SIZE, "Error open file %s!",TRACEFILE);
     //error(errortext,500);
     return -1;
   }
+  open_trace(pDecoder->p_trace);
 #endif
 
   switch( pDecoder->p_Inp->FileFormat )
@@ -901,6 +931,8 @@ int OpenDecoder(InputParameters *p_Inp)
   init_old_slice(pDecoder->p_Vid->old_slice);
 
   init(pDecoder->p_Vid);
+  if (pDecoder->p_Inp->mv_field_file[0])
+    open_mv_field(pDecoder->p_Vid, pDecoder->p_Inp->mv_field_file);
 
 #if (MVC_EXTENSION_ENABLE)
   pDecoder->p_Vid->active_sps = NULL;
@@ -967,6 +999,7 @@ int CloseDecoder()
     return DEC_CLOSE_NOERR;
   
   //Report  (pDecoder->p_Vid);
+  close_mv_field(pDecoder->p_Vid);
   FmoFinit(pDecoder->p_Vid);
   free_layer_buffers(pDecoder->p_Vid, 0);
   free_layer_buffers(pDecoder->p_Vid, 1);
@@ -983,10 +1016,12 @@ int CloseDecoder()
   }
 
 #if TRACE
+  close_trace();
   fclose(pDecoder->p_trace);
 #endif
 
   CleanUpPPS(pDecoder->p_Vid);
+  FreeParSetCache(pDecoder->p_Vid);
 #if (MVC_EXTENSION_ENABLE)
   for(i=0; i<MAXSPS; i++)
   {
@@ -37,6 +37,10 @@
 #include "biaridecod.h"
 #include "fast_memory.h"
 #include "filehandle.h"
+#include "keyunit.h"
+#include "stagetimer.h"
+#include "pipeline.h"
+#include "stream.h"
 
 
 #if TRACE
@@ -61,6 +65,7 @@ extern void set_read_CBP_and_coeffs_cabac      (Slice *currSlice);
 extern void set_read_CBP_and_coeffs_cavlc      (Slice *currSlice);
 extern void read_coeff_4x4_CAVLC               (Macroblock *currMB, int block_type, int i, int j, int levarr[16], int runarr[16], int *number_coefficients);
 extern void read_coeff_4x4_CAVLC_444           (Macroblock *currMB, int block_type, int i, int j, int levarr[16], int runarr[16], int *number_coefficients);
+extern void read_coeff_4x4_CAVLC_count         (Macroblock *currMB, int block_type, int i, int j, int levarr[16], int runarr[16], int *number_coefficients);
 
 static void read_motion_info_from_NAL_p_slice  (Macroblock *currMB);
 static void read_motion_info_from_NAL_b_slice  (Macroblock *currMB);
@@ -220,7 +225,7 @@ static void readMBRefPictureIdx (SyntaxElement *currSE, DataPartition *dP, Macro
       currMB->subblock_x = 0;
       currMB->subblock_y = 0;
       refframe = currMB->readRefPictureIdx(currMB, currSE, dP, 1, list);	//readRefPictureIdx_FLC readRefPictureIdx_VLC
-			#if	0      
+      // readRefFrame_CABAC selects its context from the ref_idx of the neighbours
       for (j = 0; j <  step_v0; ++j)
       {
         char *ref_idx = &mv_info[j][currMB->block_x].ref_idx[list];
@@ -232,7 +237,6 @@ static void readMBRefPictureIdx (SyntaxElement *currSE, DataPartition *dP, Macro
           ref_idx += sizeof(PicMotionParams);
         }
       }
-			#endif
     }
   }
   else if (currMB->mb_type == 2)	//P16x8
@@ -249,7 +253,6 @@ static void readMBRefPictureIdx (SyntaxElement *currSE, DataPartition *dP, Macro
         currMB->subblock_y = j0 << 2;
         currMB->subblock_x = 0;
         refframe = currMB->readRefPictureIdx(currMB, currSE, dP, currMB->b8mode[k], list);
-				#if 0
         for (j = j0; j < j0 + step_v0; ++j)
         {
           char *ref_idx = &mv_info[j][currMB->block_x].ref_idx[list];
@@ -261,7 +264,6 @@ static void readMBRefPictureIdx (SyntaxElement *currSE, DataPartition *dP, Macro
             ref_idx += sizeof(PicMotionParams);
           }
         }
-				#endif
       }
     }
   }  
@@ -279,7 +281,6 @@ static void readMBRefPictureIdx (SyntaxElement *currSE, DataPartition *dP, Macro
       {
         currMB->subblock_x = i0 << 2;
         refframe = currMB->readRefPictureIdx(currMB, currSE, dP, currMB->b8mode[k], list);
-				#if 0
         for (j = 0; j < step_v0; ++j)
         {
           char *ref_idx = &mv_info[j][currMB->block_x + i0].ref_idx[list];
@@ -291,7 +292,6 @@ static void readMBRefPictureIdx (SyntaxElement *currSE, DataPartition *dP, Macro
             ref_idx += sizeof(PicMotionParams);
           }
         }
-				#endif
       }
     }
   }
@@ -311,7 +311,6 @@ static void readMBRefPictureIdx (SyntaxElement *currSE, DataPartition *dP, Macro
         {
           currMB->subblock_x = i0 << 2;
           refframe = currMB->readRefPictureIdx(currMB, currSE, dP, currMB->b8mode[k], list);
-					#if 0
           for (j = j0; j < j0 + step_v0; ++j)
           {
             char *ref_idx = &mv_info[j][currMB->block_x + i0].ref_idx[list];
@@ -323,7 +322,6 @@ static void readMBRefPictureIdx (SyntaxElement *currSE, DataPartition *dP, Macro
               ref_idx += sizeof(PicMotionParams);
             }
           }
-					#endif
         }
       }
     }
@@ -355,9 +353,24 @@ void analysis_bitoffset(int* byteoffset, int* bitoffset)
 //extern int Generate_Key(int LastByteOffset,int ByteOffset,int BitOffset,int BitLength,FILE* KeyFile,int h264fd);
 
 //extern int Generate_Key(int LastByteOffset,int ByteOffset,int BitOffset,int BitLength,FILE* KeyFile,int h264fd);
-extern KeyUnit* g_pKeyUnitBuffer;
-extern int g_KeyUnitIdx;
-extern int g_KeyUnitBufferSize;
+
+//put one key unit into the key unit buffer, or apply it right away
+static void record_key_unit(int diff, int BitOffset, int KeyDataLen)
+{
+	if(p_Dec->stream || p_Dec->checkpoint || p_Dec->follow)
+	{
+		//the bytes are still in the stream window, or a checkpoint or a follow poll needs
+		//them applied: scramble them now and only count the unit
+		Generate_Key(diff, BitOffset, KeyDataLen, 0);
+		g_KeyUnitBuffer.count++;
+	}
+	else
+	{
+		put_key_unit(&g_KeyUnitBuffer, diff, BitOffset, KeyDataLen);
+		if(p_Dec->pipeline)
+			pipeline_put_key_unit(p_Dec->pipeline, diff, BitOffset, KeyDataLen);
+	}
+}
 
 //RBSP_offset:RBSP(NALU=header+RBSP)ʼλƫ
 void write_mvd2keyfile(int bit_offset_from_rbsp, int KeyDataLen, int mvd, int mvd_num)
@@ -367,31 +380,27 @@ void write_mvd2keyfile(int bit_offset_from_rbsp, int KeyDataLen, int mvd, int mv
 		FILE* p_KeyFile = p_Dec->p_KeyFile;
 		int ByteOffset = 0; 	
 		int BitOffset = bit_offset_from_rbsp;
-		int cur_rbsp_absolute_pos = p_Dec->nalu_pos_array[p_Dec->nalu_pos_array_idx] + 1;
+		int64 cur_rbsp_absolute_pos = p_Dec->nalu_pos_array[p_Dec->nalu_pos_array_idx] + 1;
 
 		analysis_bitoffset(&ByteOffset,&BitOffset);
-		int mvd_absolute_byte_pos = cur_rbsp_absolute_pos + ByteOffset;	//ǰRBSPλ+ֽƫ,λMVDֽڴ(ƫ)
+		int64 mvd_absolute_byte_pos = cur_rbsp_absolute_pos + ByteOffset;	//ǰRBSPλ+ֽƫ,λMVDֽڴ(ƫ)
 
-		int diff = mvd_absolute_byte_pos - p_Dec->pre_mvd_absolute_byte_pos;
+		int64 diff = mvd_absolute_byte_pos - p_Dec->pre_mvd_absolute_byte_pos;
 		p_Dec->pre_mvd_absolute_byte_pos = mvd_absolute_byte_pos; 
 		
 		if(diff < 0 || BitOffset < 0)
 		{
-			printf("diff: %d, BitOffset: %d\n",diff,BitOffset);
+			printf("diff: %lld, BitOffset: %d\n",(long long) diff,BitOffset);
 			error_KeyGen("[Byte offset diff] or [BitOffset] less-than 0, they should not less-than 0!",1);
 		}	
 
-		//put the key datas into the key unit buffer
-		if(g_KeyUnitIdx >= g_KeyUnitBufferSize - 1)
-		{
-			//printf("\033[1;31m tmp_test===============idx: %d======= \033[0m \n",g_KeyUnitIdx);
-			g_KeyUnitBufferSize += KEY_UNIT_BUFFER_SIZE_APPEND;
-			g_pKeyUnitBuffer = (KeyUnit*)realloc(g_pKeyUnitBuffer, g_KeyUnitBufferSize);			
-		}
-		g_pKeyUnitBuffer[g_KeyUnitIdx].byte_offset 		= diff;
-		g_pKeyUnitBuffer[g_KeyUnitIdx].bit_offset 		= BitOffset;
-		g_pKeyUnitBuffer[g_KeyUnitIdx].key_data_len 	= KeyDataLen;
-		g_KeyUnitIdx ++;		
+		//put the key datas into the key unit buffer, a distance the key formats cannot
+		//hold is covered by key units without data first
+		STAGE_BEGIN(STAGE_KEY_RECORD);
+		for(; diff > KEY_UNIT_MAX_BYTE_OFFSET; diff -= KEY_UNIT_MAX_BYTE_OFFSET)
+			record_key_unit(KEY_UNIT_MAX_BYTE_OFFSET, 0, 0);
+		record_key_unit((int) diff, BitOffset, KeyDataLen);
+		STAGE_END(STAGE_KEY_RECORD);
 #if 0
 #if H264_KEY_CREATE		
 		//Generate_Key(pre_MVD_BOffset,mvd_absolute_byte_pos,BitOffset,KeyDataLen,p_KeyFile,p_Dec->BitStreamFile);
@@ -429,10 +438,12 @@ static void readMBMotionVectors (SyntaxElement *currSE, DataPartition *dP, Macro
       j4  = currMB->block_y;
       mvd = &currMB->mvd [list][0];
 
-      //get_neighbors(currMB, block, 0, 0, step_h0 << 2);
-
-      // first get MV predictor
-      //currMB->GetMVPredictor (currMB, block, &pred_mv, mv_info[j4][i4].ref_idx[list], mv_info, list, 0, 0, step_h0 << 2, step_v0 << 2);
+      // first get MV predictor (MvFieldFile only, otherwise just the MVDs are read)
+      if (currMB->p_Slice->GetMVPredictor)
+      {
+        get_neighbors(currMB, block, 0, 0, step_h0 << 2);
+        currMB->p_Slice->GetMVPredictor (currMB, block, &pred_mv, mv_info[j4][i4].ref_idx[list], mv_info, list, 0, 0, step_h0 << 2, step_v0 << 2);
+      }
 
       // X component
 #if TRACE
@@ -470,19 +481,22 @@ static void readMBMotionVectors (SyntaxElement *currSE, DataPartition *dP, Macro
 			key_data_len += currSE->len;
 			write_mvd2keyfile(bit_offset_from_rbsp, key_data_len,curr_mvd[0]+curr_mvd[1],2);
 
-#if 0
-      curr_mv.mv_x = (short)(curr_mvd[0] + pred_mv.mv_x);  // compute motion vector x
-      curr_mv.mv_y = (short)(curr_mvd[1] + pred_mv.mv_y);  // compute motion vector y
-
-      for(jj = j4; jj < j4 + step_v0; ++jj)
+      if (currMB->p_Slice->GetMVPredictor)
       {
-        PicMotionParams *mvinfo = mv_info[jj] + i4;
-        for(ii = i4; ii < i4 + step_h0; ++ii)
+        curr_mv.mv_x = (short)(curr_mvd[0] + pred_mv.mv_x);  // compute motion vector x
+        curr_mv.mv_y = (short)(curr_mvd[1] + pred_mv.mv_y);  // compute motion vector y
+
+        for(jj = j4; jj < j4 + step_v0; ++jj)
         {
-          (mvinfo++)->mv[list] = curr_mv;
-        }            
+          PicMotionParams *mvinfo = mv_info[jj] + i4;
+          for(ii = i4; ii < i4 + step_h0; ++ii)
+          {
+            (mvinfo++)->mv[list] = curr_mv;
+          }            
+        }
       }
 
+      // mvd of the neighbours select the CABAC contexts of read_MVD_CABAC
       // Init first line (mvd)
       for(ii = 0; ii < step_h0; ++ii)
       {
@@ -496,7 +510,6 @@ static void readMBMotionVectors (SyntaxElement *currSE, DataPartition *dP, Macro
       {
         memcpy(mvd[jj][0], mvd[0][0],  2 * step_h0 * sizeof(short));
       }
-#endif			
     }
   }
   else
@@ -555,10 +568,12 @@ static void readMBMotionVectors (SyntaxElement *currSE, DataPartition *dP, Macro
               currMB->subblock_x = i << 2; // position used for context determination
               i4 = currMB->block_x + i;
 
-              //get_neighbors(currMB, block, BLOCK_SIZE * i, BLOCK_SIZE * j, step_h4);
-
-              // first get MV predictor
-              //currMB->GetMVPredictor (currMB, block, &pred_mv, cur_ref_idx, mv_info, list, BLOCK_SIZE * i, BLOCK_SIZE * j, step_h4, step_v4);
+              // first get MV predictor (MvFieldFile only)
+              if (currMB->p_Slice->GetMVPredictor)
+              {
+                get_neighbors(currMB, block, BLOCK_SIZE * i, BLOCK_SIZE * j, step_h4);
+                currMB->p_Slice->GetMVPredictor (currMB, block, &pred_mv, cur_ref_idx, mv_info, list, BLOCK_SIZE * i, BLOCK_SIZE * j, step_h4, step_v4);
+              }
 
               for (k=0; k < 2; ++k)
               {
@@ -586,17 +601,19 @@ static void readMBMotionVectors (SyntaxElement *currSE, DataPartition *dP, Macro
 								mvd_sum += curr_mvd[k];
 								key_data_len += currSE->len;								
               }
-#if 0
-              curr_mv.mv_x = (short)(curr_mvd[0] + pred_mv.mv_x);  // compute motion vector 
-              curr_mv.mv_y = (short)(curr_mvd[1] + pred_mv.mv_y);  // compute motion vector 
-
-              for(jj = j4; jj < j4 + step_v; ++jj)
+              if (currMB->p_Slice->GetMVPredictor)
               {
-                PicMotionParams *mvinfo = mv_info[jj] + i4;
-                for(ii = i4; ii < i4 + step_h; ++ii)
+                curr_mv.mv_x = (short)(curr_mvd[0] + pred_mv.mv_x);  // compute motion vector 
+                curr_mv.mv_y = (short)(curr_mvd[1] + pred_mv.mv_y);  // compute motion vector 
+
+                for(jj = j4; jj < j4 + step_v; ++jj)
                 {
-                  (mvinfo++)->mv[list] = curr_mv;
-                }            
+                  PicMotionParams *mvinfo = mv_info[jj] + i4;
+                  for(ii = i4; ii < i4 + step_h; ++ii)
+                  {
+                    (mvinfo++)->mv[list] = curr_mv;
+                  }            
+                }
               }
 
               // Init first line (mvd)
@@ -612,7 +629,6 @@ static void readMBMotionVectors (SyntaxElement *currSE, DataPartition *dP, Macro
               {
                 memcpy(&mvd[jj][i][0], &mvd[0][i][0],  2 * step_h * sizeof(short));
               }
-#endif							
             }
           }
         }
@@ -685,6 +701,13 @@ void start_macroblock(Slice *currSlice, Macroblock **currMB)
   // is coded it will use this to decide if prediction for above is possible
   (*currMB)->slice_nr = (short) currSlice->current_slice_nr;
 
+  // the per picture reset of the state the neighbours read, done as each MB
+  // is reached: its nz_coeff entries belong to this picture from now on and
+  // it counts as intra until its type is read
+  p_Vid->nz_epoch[mb_nr] = p_Vid->pic_epoch;
+  if (p_Vid->active_pps->constrained_intra_pred_flag)
+    currSlice->intra_block[mb_nr] = 1;
+
   CheckAvailabilityOfNeighbors(*currMB);
 
   set_read_and_store_CBP(currMB, currSlice->active_sps->chroma_format_idc);
@@ -1050,6 +1073,12 @@ void setup_slice_methods(Slice *currSlice)
 
   if ( currSlice->p_Vid->active_sps->chroma_format_idc==YUV444 && (currSlice->p_Vid->separate_colour_plane_flag == 0) )
     currSlice->read_coeff_4x4_CAVLC = read_coeff_4x4_CAVLC_444;
+  else if (currSlice->p_Vid->p_Inp->cavlc_count_only && !TRACE)
+  {
+    // levels and runs are not used, only TotalCoeff for the nC prediction
+    init_cavlc_count_tables();
+    currSlice->read_coeff_4x4_CAVLC = read_coeff_4x4_CAVLC_count;
+  }
   else
     currSlice->read_coeff_4x4_CAVLC = read_coeff_4x4_CAVLC;
 
@@ -1189,8 +1218,8 @@ static void read_motion_info_from_NAL_b_slice (Macroblock *currMB)
   //StorablePicture **list1 = currSlice->listX[LIST_1 + list_offset];
   PicMotionParams **p_mv_info = &dec_picture->mv_info[currMB->block_y];
 
-  //if (currMB->mb_type == P8x8)
-    //currSlice->update_direct_mv_info(currMB);   
+  if (currMB->mb_type == P8x8 && currSlice->update_direct_mv_info)
+    currSlice->update_direct_mv_info(currMB);   
 
   //=====  READ REFERENCE PICTURE INDICES =====
   currSE.type = SE_REFFRAME;
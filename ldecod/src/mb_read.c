@@ -52,6 +52,11 @@
 
 extern void set_read_comp_coeff_cabac     (Macroblock *currMB);
 extern void set_read_comp_coeff_cavlc     (Macroblock *currMB);
+extern void read_CBP_and_coeffs_from_NAL_CABAC_420(Macroblock *currMB);
+extern void read_CBP_and_coeffs_from_NAL_CAVLC_420(Macroblock *currMB);
+
+//! reads the CBP and the coefficients of an MB, a compile time constant in the specialized MB readers
+typedef void (*ReadCBPFn)(Macroblock *currMB);
 
 static inline void update_pixel_pos8(PixelPos *pos_block, const PixelPos *pos_mb, int pos)
 {
@@ -796,7 +801,10 @@ void skip_macroblock(Macroblock *currMB)
     PicMotionParams **dec_mv_info = &dec_picture->mv_info[img_block_y];
     PicMotionParams *mv_info = NULL;
     //StorablePicture *cur_pic = currSlice->listX[list_offset][0];
-    //currMB->GetMVPredictor (currMB, mb, &pred_mv, 0, dec_picture->mv_info, LIST_0, 0, 0, MB_BLOCK_SIZE, MB_BLOCK_SIZE);
+    if (currSlice->GetMVPredictor)
+      currSlice->GetMVPredictor (currMB, mb, &pred_mv, 0, dec_picture->mv_info, LIST_0, 0, 0, MB_BLOCK_SIZE, MB_BLOCK_SIZE);
+    else
+      pred_mv = zero_mv;
 
     // Set first block line (position img_block_y)
     for(j = 0; j < BLOCK_SIZE; ++j)
@@ -839,7 +847,7 @@ static void read_skip_macroblock(Macroblock *currMB)
  *   read and set intra (other than 4x4/8x8) mode macroblock information
  ************************************************************************
  */
-static void read_intra_macroblock(Macroblock *currMB)
+static forceinline void read_intra_macroblock(Macroblock *currMB, ReadCBPFn read_cbp)
 {
   //init NoMbPartLessThan8x8Flag
   currMB->NoMbPartLessThan8x8Flag = TRUE;
@@ -856,7 +864,7 @@ static void read_intra_macroblock(Macroblock *currMB)
   read_ipred_modes(currMB);
 
   // read CBP and Coeffs  ***************************************************************
-  currMB->p_Slice->read_CBP_and_coeffs_from_NAL (currMB);
+  read_cbp(currMB);
 }
 
 
@@ -866,7 +874,7 @@ static void read_intra_macroblock(Macroblock *currMB)
  *   read and set intra (4x4/8x8) mode macroblock information (CAVLC)
  ************************************************************************
  */
-static void read_intra4x4_macroblock_cavlc(Macroblock *currMB, const byte *partMap)
+static forceinline void read_intra4x4_macroblock_cavlc(Macroblock *currMB, const byte *partMap, ReadCBPFn read_cbp)
 {
   Slice *currSlice = currMB->p_Slice;
   //============= Transform Size Flag for INTRA MBs =============
@@ -904,7 +912,7 @@ static void read_intra4x4_macroblock_cavlc(Macroblock *currMB, const byte *partM
   read_ipred_modes(currMB);
 
   // read CBP and Coeffs  ***************************************************************
-  currSlice->read_CBP_and_coeffs_from_NAL (currMB);
+  read_cbp(currMB);
 }
 
 /*!
@@ -913,7 +921,7 @@ static void read_intra4x4_macroblock_cavlc(Macroblock *currMB, const byte *partM
  *   read and set intra (4x4/8x8) mode macroblock information (CAVLC)
  ************************************************************************
  */
-static void read_intra4x4_macroblock_cabac(Macroblock *currMB, const byte *partMap)
+static forceinline void read_intra4x4_macroblock_cabac(Macroblock *currMB, const byte *partMap, ReadCBPFn read_cbp)
 {
   Slice *currSlice = currMB->p_Slice;
   //============= Transform Size Flag for INTRA MBs =============
@@ -959,7 +967,7 @@ static void read_intra4x4_macroblock_cabac(Macroblock *currMB, const byte *partM
   read_ipred_modes(currMB);
 
   // read CBP and Coeffs  ***************************************************************
-  currSlice->read_CBP_and_coeffs_from_NAL (currMB);
+  read_cbp(currMB);
 }
 
 
@@ -970,7 +978,7 @@ static void read_intra4x4_macroblock_cabac(Macroblock *currMB, const byte *partM
  *   mode macroblock information
  ************************************************************************
  */
-static void read_inter_macroblock(Macroblock *currMB)
+static forceinline void read_inter_macroblock(Macroblock *currMB, ReadCBPFn read_cbp)
 {
   Slice *currSlice = currMB->p_Slice;
   //init NoMbPartLessThan8x8Flag
@@ -989,7 +997,7 @@ static void read_inter_macroblock(Macroblock *currMB)
   // read inter frame vector data *********************************************************
   currSlice->read_motion_info_from_NAL (currMB);
   // read CBP and Coeffs  ***************************************************************
-  currSlice->read_CBP_and_coeffs_from_NAL (currMB);
+  read_cbp(currMB);
 }
 
 /*!
@@ -1007,6 +1015,9 @@ static void read_i_pcm_macroblock(Macroblock *currMB, const byte *partMap)
   //--- init macroblock data ---
   init_macroblock(currMB);
 
+  // all coefficients are considered nonzero for the nC prediction of the neighbours
+  memset(currSlice->p_Vid->nz_coeff[currMB->mbAddrX][0][0], 16, 3 * BLOCK_PIXELS * sizeof(byte));
+
   //read pcm_alignment_zero_bit and pcm_byte[i]
 
   // here dP is assigned with the same dP as SE_MBTYPE, because IPCM syntax is in the
@@ -1028,7 +1039,7 @@ static void read_i_pcm_macroblock(Macroblock *currMB, const byte *partMap)
  *   read and set P8x8 mode macroblock information
  ************************************************************************
  */
-static void read_P8x8_macroblock(Macroblock *currMB, DataPartition *dP, SyntaxElement *currSE)
+static forceinline void read_P8x8_macroblock(Macroblock *currMB, DataPartition *dP, SyntaxElement *currSE, ReadCBPFn read_cbp)
 {
   int i;
   Slice *currSlice = currMB->p_Slice;
@@ -1058,7 +1069,7 @@ static void read_P8x8_macroblock(Macroblock *currMB, DataPartition *dP, SyntaxEl
   }
 
   // read CBP and Coeffs  ***************************************************************
-  currSlice->read_CBP_and_coeffs_from_NAL (currMB);
+  read_cbp(currMB);
 }
 
 /*!
@@ -1067,7 +1078,7 @@ static void read_P8x8_macroblock(Macroblock *currMB, DataPartition *dP, SyntaxEl
  *    Get the syntax elements from the NAL
  ************************************************************************
  */
-static void read_one_macroblock_i_slice_cavlc(Macroblock *currMB)
+static forceinline void read_one_macroblock_i_slice_cavlc(Macroblock *currMB, int mb_aff, ReadCBPFn read_cbp)
 {
   Slice *currSlice = currMB->p_Slice;
 
@@ -1090,7 +1101,7 @@ static void read_one_macroblock_i_slice_cavlc(Macroblock *currMB)
   currSE.mapping = linfo_ue;
 
   // read MB aff
-  if (currSlice->mb_aff_frame_flag && (mb_nr&0x01)==0)
+  if (mb_aff && (mb_nr&0x01)==0)
   {
     TRACE_STRING("mb_field_decoding_flag");
     currSE.len = (int64) 1;
@@ -1100,7 +1111,7 @@ static void read_one_macroblock_i_slice_cavlc(Macroblock *currMB)
 
   //  read MB type
   TRACE_STRING("mb_type");
-  dP->readSyntaxElement(currMB, &currSE, dP);
+  readSyntaxElement_UVLC(currMB, &currSE, dP);
 
   currMB->mb_type = (short) currSE.value1;
   if(!dP->bitstream->ei_flag)
@@ -1108,7 +1119,7 @@ static void read_one_macroblock_i_slice_cavlc(Macroblock *currMB)
 
   motion->mb_field[mb_nr] = (byte) currMB->mb_field;
 
-  currMB->block_y_aff = ((currSlice->mb_aff_frame_flag) && (currMB->mb_field)) ? (mb_nr&0x01) ? (currMB->block_y - 4)>>1 : currMB->block_y >> 1 : currMB->block_y;
+  currMB->block_y_aff = ((mb_aff) && (currMB->mb_field)) ? (mb_nr&0x01) ? (currMB->block_y - 4)>>1 : currMB->block_y >> 1 : currMB->block_y;
 
   //currSlice->siblock[currMB->mb.y][currMB->mb.x] = 0;
 
@@ -1123,11 +1134,11 @@ static void read_one_macroblock_i_slice_cavlc(Macroblock *currMB)
   }
   else if (currMB->mb_type == I4MB)
   {
-    read_intra4x4_macroblock_cavlc(currMB, partMap);
+    read_intra4x4_macroblock_cavlc(currMB, partMap, read_cbp);
   }
   else // all other modes
   {
-    read_intra_macroblock(currMB);
+    read_intra_macroblock(currMB, read_cbp);
   }
   return;
 }
@@ -1138,7 +1149,7 @@ static void read_one_macroblock_i_slice_cavlc(Macroblock *currMB)
  *    Get the syntax elements from the NAL
  ************************************************************************
  */
-static void read_one_macroblock_i_slice_cabac(Macroblock *currMB)
+static forceinline void read_one_macroblock_i_slice_cabac(Macroblock *currMB, int mb_aff, ReadCBPFn read_cbp)
 {
   Slice *currSlice = currMB->p_Slice;
 
@@ -1162,7 +1173,7 @@ static void read_one_macroblock_i_slice_cabac(Macroblock *currMB)
     currSE.mapping = linfo_ue;
 
   // read MB aff
-  if (currSlice->mb_aff_frame_flag && (mb_nr&0x01)==0)
+  if (mb_aff && (mb_nr&0x01)==0)
   {
     TRACE_STRING("mb_field_decoding_flag");
     if (dP->bitstream->ei_flag)
@@ -1173,7 +1184,7 @@ static void read_one_macroblock_i_slice_cabac(Macroblock *currMB)
     else
     {
       currSE.reading = readFieldModeInfo_CABAC;
-      dP->readSyntaxElement(currMB, &currSE, dP);
+      readSyntaxElement_CABAC(currMB, &currSE, dP);
     }
     currMB->mb_field = (Boolean) currSE.value1;
   }
@@ -1183,7 +1194,7 @@ static void read_one_macroblock_i_slice_cabac(Macroblock *currMB)
   //  read MB type
   TRACE_STRING("mb_type");
   currSE.reading = readMB_typeInfo_CABAC_i_slice;
-  dP->readSyntaxElement(currMB, &currSE, dP);		//readSyntaxElement_CABAC
+  readSyntaxElement_CABAC(currMB, &currSE, dP);		//readSyntaxElement_CABAC
 
   currMB->mb_type = (short) currSE.value1;
   if(!dP->bitstream->ei_flag)
@@ -1191,7 +1202,7 @@ static void read_one_macroblock_i_slice_cabac(Macroblock *currMB)
 
   motion->mb_field[mb_nr] = (byte) currMB->mb_field;
 
-  currMB->block_y_aff = ((currSlice->mb_aff_frame_flag) && (currMB->mb_field)) ? (mb_nr&0x01) ? (currMB->block_y - 4)>>1 : currMB->block_y >> 1 : currMB->block_y;
+  currMB->block_y_aff = ((mb_aff) && (currMB->mb_field)) ? (mb_nr&0x01) ? (currMB->block_y - 4)>>1 : currMB->block_y >> 1 : currMB->block_y;
 
   //currSlice->siblock[currMB->mb.y][currMB->mb.x] = 0;
 
@@ -1224,7 +1235,7 @@ static void read_one_macroblock_i_slice_cabac(Macroblock *currMB)
       }
       else
       {
-        dP->readSyntaxElement(currMB, &currSE, dP);		//readSyntaxElement_CABAC
+        readSyntaxElement_CABAC(currMB, &currSE, dP);		//readSyntaxElement_CABAC
       }
 
       currMB->luma_transform_size_8x8_flag = (Boolean) currSE.value1;
@@ -1248,11 +1259,11 @@ static void read_one_macroblock_i_slice_cabac(Macroblock *currMB)
     read_ipred_modes(currMB);
 
     // read CBP and Coeffs  ***************************************************************
-    currSlice->read_CBP_and_coeffs_from_NAL (currMB);		//read_CBP_and_coeffs_from_NAL_CABAC_420        
+    read_cbp(currMB);		//read_CBP_and_coeffs_from_NAL_CABAC_420        
   }
   else // all other modes I16x16
   {
-    read_intra_macroblock(currMB);
+    read_intra_macroblock(currMB, read_cbp);
   }
   return;
 }
@@ -1263,7 +1274,7 @@ static void read_one_macroblock_i_slice_cabac(Macroblock *currMB)
  *    Get the syntax elements from the NAL
  ************************************************************************
  */
-static void read_one_macroblock_p_slice_cavlc(Macroblock *currMB)
+static forceinline void read_one_macroblock_p_slice_cavlc(Macroblock *currMB, int mb_aff, ReadCBPFn read_cbp)
 {
   Slice *currSlice = currMB->p_Slice;
   SyntaxElement currSE;
@@ -1272,7 +1283,7 @@ static void read_one_macroblock_p_slice_cavlc(Macroblock *currMB)
   DataPartition *dP;
   const byte *partMap = assignSE2partition[currSlice->dp_mode];
 
-  if (currSlice->mb_aff_frame_flag == 0)
+  if (mb_aff == 0)
   {
     StorablePicture *dec_picture = currSlice->dec_picture;
     PicMotionParamsOld *motion = &dec_picture->motion;
@@ -1291,7 +1302,7 @@ static void read_one_macroblock_p_slice_cavlc(Macroblock *currMB)
     if(currSlice->cod_counter == -1)
     {
       TRACE_STRING("mb_skip_run");
-      dP->readSyntaxElement(currMB, &currSE, dP);
+      readSyntaxElement_UVLC(currMB, &currSE, dP);
       currSlice->cod_counter = currSE.value1;
     }
 
@@ -1299,7 +1310,7 @@ static void read_one_macroblock_p_slice_cavlc(Macroblock *currMB)
     {
       // read MB type
       TRACE_STRING("mb_type");
-      dP->readSyntaxElement(currMB, &currSE, dP);
+      readSyntaxElement_UVLC(currMB, &currSE, dP);
       ++(currSE.value1);
       currMB->mb_type = (short) currSE.value1;
       if(!dP->bitstream->ei_flag)
@@ -1356,7 +1367,7 @@ static void read_one_macroblock_p_slice_cavlc(Macroblock *currMB)
     if(currSlice->cod_counter == -1)
     {
       TRACE_STRING("mb_skip_run");
-      dP->readSyntaxElement(currMB, &currSE, dP);
+      readSyntaxElement_UVLC(currMB, &currSE, dP);
       currSlice->cod_counter = currSE.value1;
     }
 
@@ -1373,7 +1384,7 @@ static void read_one_macroblock_p_slice_cavlc(Macroblock *currMB)
 
       // read MB type
       TRACE_STRING("mb_type");
-      dP->readSyntaxElement(currMB, &currSE, dP);
+      readSyntaxElement_UVLC(currMB, &currSE, dP);
       ++(currSE.value1);
       currMB->mb_type = (short) currSE.value1;
       if(!dP->bitstream->ei_flag)
@@ -1443,7 +1454,7 @@ static void read_one_macroblock_p_slice_cavlc(Macroblock *currMB)
     }
     else if (currMB->mb_type == I4MB)
     {      
-      read_intra4x4_macroblock_cavlc(currMB, partMap);
+      read_intra4x4_macroblock_cavlc(currMB, partMap, read_cbp);
     }
     else if (currMB->mb_type == P8x8)
     {
@@ -1451,7 +1462,7 @@ static void read_one_macroblock_p_slice_cavlc(Macroblock *currMB)
       currSE.mapping = linfo_ue;
       dP = &(currSlice->partArr[partMap[SE_MBTYPE]]);
 
-      read_P8x8_macroblock(currMB, dP, &currSE);
+      read_P8x8_macroblock(currMB, dP, &currSE, read_cbp);
     }
     else if (currMB->mb_type == PSKIP)
     {
@@ -1459,11 +1470,11 @@ static void read_one_macroblock_p_slice_cavlc(Macroblock *currMB)
     }    
     else if (currMB->is_intra_block) // all other intra modes
     {
-      read_intra_macroblock(currMB);
+      read_intra_macroblock(currMB, read_cbp);
     }
     else // all other remaining modes
     {
-      read_inter_macroblock(currMB);
+      read_inter_macroblock(currMB, read_cbp);
     }
   
 
@@ -1476,7 +1487,7 @@ static void read_one_macroblock_p_slice_cavlc(Macroblock *currMB)
  *    Get the syntax elements from the NAL
  ************************************************************************
  */
-static void read_one_macroblock_p_slice_cabac(Macroblock *currMB)
+static forceinline void read_one_macroblock_p_slice_cabac(Macroblock *currMB, int mb_aff, ReadCBPFn read_cbp)
 {
   Slice *currSlice = currMB->p_Slice;  
   VideoParameters *p_Vid = currMB->p_Vid;
@@ -1485,7 +1496,7 @@ static void read_one_macroblock_p_slice_cabac(Macroblock *currMB)
   DataPartition *dP;
   const byte *partMap = assignSE2partition[currSlice->dp_mode];
 
-  if (currSlice->mb_aff_frame_flag == 0)
+  if (mb_aff == 0)
   {
     StorablePicture *dec_picture = currSlice->dec_picture;
     PicMotionParamsOld *motion = &dec_picture->motion;
@@ -1504,7 +1515,7 @@ static void read_one_macroblock_p_slice_cabac(Macroblock *currMB)
     CheckAvailabilityOfNeighborsCABAC(currMB);
     TRACE_STRING("mb_skip_flag");
     currSE.reading = read_skip_flag_CABAC_p_slice;
-    dP->readSyntaxElement(currMB, &currSE, dP);		//readSyntaxElement_CABAC
+    readSyntaxElement_CABAC(currMB, &currSE, dP);		//readSyntaxElement_CABAC
 
     currMB->mb_type   = (short) currSE.value1;
     currMB->skip_flag = (char) (!(currSE.value1));
@@ -1517,7 +1528,7 @@ static void read_one_macroblock_p_slice_cabac(Macroblock *currMB)
     {
       currSE.reading = readMB_typeInfo_CABAC_p_slice;
       TRACE_STRING("mb_type");
-      dP->readSyntaxElement(currMB, &currSE, dP);
+      readSyntaxElement_CABAC(currMB, &currSE, dP);
       currMB->mb_type = (short) currSE.value1;
       if(!dP->bitstream->ei_flag)
         currMB->ei_flag = 0;
@@ -1561,7 +1572,7 @@ static void read_one_macroblock_p_slice_cabac(Macroblock *currMB)
     CheckAvailabilityOfNeighborsCABAC(currMB);
     TRACE_STRING("mb_skip_flag");
     currSE.reading = read_skip_flag_CABAC_p_slice;
-    dP->readSyntaxElement(currMB, &currSE, dP);
+    readSyntaxElement_CABAC(currMB, &currSE, dP);
 
     currMB->mb_type   = (short) currSE.value1;
     currMB->skip_flag = (char) (!(currSE.value1));
@@ -1585,7 +1596,7 @@ static void read_one_macroblock_p_slice_cabac(Macroblock *currMB)
     {
       TRACE_STRING("mb_field_decoding_flag");
       currSE.reading = readFieldModeInfo_CABAC;
-      dP->readSyntaxElement(currMB, &currSE, dP);
+      readSyntaxElement_CABAC(currMB, &currSE, dP);
       currMB->mb_field = (Boolean) currSE.value1;
     }
 
@@ -1603,7 +1614,7 @@ static void read_one_macroblock_p_slice_cabac(Macroblock *currMB)
     {
       currSE.reading = readMB_typeInfo_CABAC_p_slice;
       TRACE_STRING("mb_type");
-      dP->readSyntaxElement(currMB, &currSE, dP);
+      readSyntaxElement_CABAC(currMB, &currSE, dP);
       currMB->mb_type = (short) currSE.value1;
       if(!dP->bitstream->ei_flag)
         currMB->ei_flag = 0;
@@ -1632,7 +1643,7 @@ static void read_one_macroblock_p_slice_cabac(Macroblock *currMB)
   }
   else if (currMB->mb_type == I4MB)
   {
-    read_intra4x4_macroblock_cabac(currMB, partMap);
+    read_intra4x4_macroblock_cabac(currMB, partMap, read_cbp);
   }
   else if (currMB->mb_type == P8x8)
   {
@@ -1644,7 +1655,7 @@ static void read_one_macroblock_p_slice_cabac(Macroblock *currMB)
     else
       currSE.reading = readB8_typeInfo_CABAC_p_slice;
 
-    read_P8x8_macroblock(currMB, dP, &currSE);
+    read_P8x8_macroblock(currMB, dP, &currSE, read_cbp);
   }
   else if (currMB->mb_type == PSKIP)
   {
@@ -1652,11 +1663,11 @@ static void read_one_macroblock_p_slice_cabac(Macroblock *currMB)
   }
   else if (currMB->is_intra_block == TRUE) // all other intra modes
   {
-    read_intra_macroblock(currMB);
+    read_intra_macroblock(currMB, read_cbp);
   }
   else // all other remaining modes
   {
-    read_inter_macroblock(currMB);
+    read_inter_macroblock(currMB, read_cbp);
   }
 
   return;
@@ -1668,7 +1679,7 @@ static void read_one_macroblock_p_slice_cabac(Macroblock *currMB)
  *    Get the syntax elements from the NAL
  ************************************************************************
  */
-static void read_one_macroblock_b_slice_cavlc(Macroblock *currMB)
+static forceinline void read_one_macroblock_b_slice_cavlc(Macroblock *currMB, int mb_aff, ReadCBPFn read_cbp)
 {
   VideoParameters *p_Vid = currMB->p_Vid;
   Slice *currSlice = currMB->p_Slice;
@@ -1677,7 +1688,7 @@ static void read_one_macroblock_b_slice_cavlc(Macroblock *currMB)
   SyntaxElement currSE;
   const byte *partMap = assignSE2partition[currSlice->dp_mode];
 
-  if (currSlice->mb_aff_frame_flag == 0)
+  if (mb_aff == 0)
   {
     StorablePicture *dec_picture = currSlice->dec_picture;
     PicMotionParamsOld *motion = &dec_picture->motion;
@@ -1695,14 +1706,14 @@ static void read_one_macroblock_b_slice_cavlc(Macroblock *currMB)
     if(currSlice->cod_counter == -1)
     {
       TRACE_STRING("mb_skip_run");
-      dP->readSyntaxElement(currMB, &currSE, dP);
+      readSyntaxElement_UVLC(currMB, &currSE, dP);
       currSlice->cod_counter = currSE.value1;
     }
     if (currSlice->cod_counter==0)
     {
       // read MB type
       TRACE_STRING("mb_type");
-      dP->readSyntaxElement(currMB, &currSE, dP);
+      readSyntaxElement_UVLC(currMB, &currSE, dP);
       currMB->mb_type = (short) currSE.value1;
       if(!dP->bitstream->ei_flag)
         currMB->ei_flag = 0;
@@ -1754,7 +1765,7 @@ static void read_one_macroblock_b_slice_cavlc(Macroblock *currMB)
     if(currSlice->cod_counter == -1)
     {
       TRACE_STRING("mb_skip_run");
-      dP->readSyntaxElement(currMB, &currSE, dP);
+      readSyntaxElement_UVLC(currMB, &currSE, dP);
       currSlice->cod_counter = currSE.value1;
     }
     if (currSlice->cod_counter==0)
@@ -1770,7 +1781,7 @@ static void read_one_macroblock_b_slice_cavlc(Macroblock *currMB)
 
       // read MB type
       TRACE_STRING("mb_type");
-      dP->readSyntaxElement(currMB, &currSE, dP);
+      readSyntaxElement_UVLC(currMB, &currSE, dP);
       currMB->mb_type = (short) currSE.value1;
       if(!dP->bitstream->ei_flag)
         currMB->ei_flag = 0;
@@ -1824,7 +1835,7 @@ static void read_one_macroblock_b_slice_cavlc(Macroblock *currMB)
 
     currSlice->interpret_mb_mode(currMB);
 
-    if(currSlice->mb_aff_frame_flag)
+    if(mb_aff)
     {
       if(currMB->mb_field)
       {
@@ -1840,7 +1851,7 @@ static void read_one_macroblock_b_slice_cavlc(Macroblock *currMB)
   }
   else if (currMB->mb_type == I4MB)
   {
-    read_intra4x4_macroblock_cavlc(currMB, partMap);
+    read_intra4x4_macroblock_cavlc(currMB, partMap, read_cbp);
   }
   else if (currMB->mb_type == P8x8)
   {
@@ -1848,7 +1859,7 @@ static void read_one_macroblock_b_slice_cavlc(Macroblock *currMB)
     currSE.type = SE_MBTYPE;
     currSE.mapping = linfo_ue;
 
-    read_P8x8_macroblock(currMB, dP, &currSE);
+    read_P8x8_macroblock(currMB, dP, &currSE, read_cbp);
   }
   else if (currMB->mb_type == BSKIP_DIRECT)
   {
@@ -1864,6 +1875,8 @@ static void read_one_macroblock_b_slice_cavlc(Macroblock *currMB)
 
     //--- init macroblock data ---
     //init_macroblock_direct(currMB);
+    if (currSlice->update_direct_mv_info)
+      currSlice->update_direct_mv_info(currMB);
 
     if (currSlice->cod_counter >= 0)
     {
@@ -1873,16 +1886,16 @@ static void read_one_macroblock_b_slice_cavlc(Macroblock *currMB)
     else
     {
       // read CBP and Coeffs  ***************************************************************
-      currSlice->read_CBP_and_coeffs_from_NAL (currMB);
+      read_cbp(currMB);
     }     
   }
   else if (currMB->is_intra_block == TRUE) // all other intra modes
   {
-    read_intra_macroblock(currMB);
+    read_intra_macroblock(currMB, read_cbp);
   }
   else // all other remaining modes
   {
-    read_inter_macroblock(currMB);
+    read_inter_macroblock(currMB, read_cbp);
   }
 
   return;
@@ -1894,7 +1907,7 @@ static void read_one_macroblock_b_slice_cavlc(Macroblock *currMB)
  *    Get the syntax elements from the NAL
  ************************************************************************
  */
-static void read_one_macroblock_b_slice_cabac(Macroblock *currMB)
+static forceinline void read_one_macroblock_b_slice_cabac(Macroblock *currMB, int mb_aff, ReadCBPFn read_cbp)
 {
   Slice *currSlice = currMB->p_Slice;
   VideoParameters *p_Vid = currMB->p_Vid;
@@ -1904,7 +1917,7 @@ static void read_one_macroblock_b_slice_cabac(Macroblock *currMB)
   DataPartition *dP;
   const byte *partMap = assignSE2partition[currSlice->dp_mode];
 
-  if (currSlice->mb_aff_frame_flag == 0)
+  if (mb_aff == 0)
   {
     StorablePicture *dec_picture = currSlice->dec_picture;
     PicMotionParamsOld *motion = &dec_picture->motion;
@@ -1923,7 +1936,7 @@ static void read_one_macroblock_b_slice_cabac(Macroblock *currMB)
     CheckAvailabilityOfNeighborsCABAC(currMB);
     TRACE_STRING("mb_skip_flag");
     currSE.reading = read_skip_flag_CABAC_b_slice;
-    dP->readSyntaxElement(currMB, &currSE, dP);
+    readSyntaxElement_CABAC(currMB, &currSE, dP);
 
     currMB->mb_type   = (short) currSE.value1;
     currMB->skip_flag = (char) (!(currSE.value1));
@@ -1941,7 +1954,7 @@ static void read_one_macroblock_b_slice_cabac(Macroblock *currMB)
     {
       currSE.reading = readMB_typeInfo_CABAC_b_slice;
       TRACE_STRING("mb_type");
-      dP->readSyntaxElement(currMB, &currSE, dP);
+      readSyntaxElement_CABAC(currMB, &currSE, dP);
       currMB->mb_type = (short) currSE.value1;
       if(!dP->bitstream->ei_flag)
         currMB->ei_flag = 0;
@@ -1986,7 +1999,7 @@ static void read_one_macroblock_b_slice_cabac(Macroblock *currMB)
     CheckAvailabilityOfNeighborsCABAC(currMB);
     TRACE_STRING("mb_skip_flag");
     currSE.reading = read_skip_flag_CABAC_b_slice;
-    dP->readSyntaxElement(currMB, &currSE, dP);
+    readSyntaxElement_CABAC(currMB, &currSE, dP);
 
     currMB->mb_type   = (short) currSE.value1;
     currMB->skip_flag = (char) (!(currSE.value1));
@@ -2015,7 +2028,7 @@ static void read_one_macroblock_b_slice_cabac(Macroblock *currMB)
     {
       TRACE_STRING("mb_field_decoding_flag");
       currSE.reading = readFieldModeInfo_CABAC;
-      dP->readSyntaxElement(currMB, &currSE, dP);
+      readSyntaxElement_CABAC(currMB, &currSE, dP);
       currMB->mb_field = (Boolean) currSE.value1;
     }
     if (check_bottom)
@@ -2031,7 +2044,7 @@ static void read_one_macroblock_b_slice_cabac(Macroblock *currMB)
     {
       currSE.reading = readMB_typeInfo_CABAC_b_slice;
       TRACE_STRING("mb_type");
-      dP->readSyntaxElement(currMB, &currSE, dP);
+      readSyntaxElement_CABAC(currMB, &currSE, dP);
       currMB->mb_type = (short) currSE.value1;
       if(!dP->bitstream->ei_flag)
         currMB->ei_flag = 0;
@@ -2059,7 +2072,7 @@ static void read_one_macroblock_b_slice_cabac(Macroblock *currMB)
   }
   else if (currMB->mb_type == I4MB)
   {
-    read_intra4x4_macroblock_cabac(currMB, partMap);
+    read_intra4x4_macroblock_cabac(currMB, partMap, read_cbp);
   }
   else if (currMB->mb_type == P8x8)
   {
@@ -2071,7 +2084,7 @@ static void read_one_macroblock_b_slice_cabac(Macroblock *currMB)
     else
       currSE.reading = readB8_typeInfo_CABAC_b_slice;
 
-    read_P8x8_macroblock(currMB, dP, &currSE);
+    read_P8x8_macroblock(currMB, dP, &currSE, read_cbp);
   }
   else if (currMB->mb_type == BSKIP_DIRECT)
   {
@@ -2090,6 +2103,8 @@ static void read_one_macroblock_b_slice_cabac(Macroblock *currMB)
 
     //--- init macroblock data ---
     //init_macroblock_direct(currMB);
+    if (currSlice->update_direct_mv_info)
+      currSlice->update_direct_mv_info(currMB);
 
     if (currSlice->cod_counter >= 0)
     {
@@ -2100,38 +2115,83 @@ static void read_one_macroblock_b_slice_cabac(Macroblock *currMB)
     else
     {
       // read CBP and Coeffs  ***************************************************************
-      currSlice->read_CBP_and_coeffs_from_NAL (currMB);
+      read_cbp(currMB);
     }      
   }
   else if (currMB->is_intra_block == TRUE) // all other intra modes
   {
-    read_intra_macroblock(currMB);
+    read_intra_macroblock(currMB, read_cbp);
   }
   else // all other remaining modes
   {
-    read_inter_macroblock(currMB);
+    read_inter_macroblock(currMB, read_cbp);
   }
 
   return;
 }
 
 
+/*!
+ ************************************************************************
+ * \brief
+ *    CBP and coefficient reader of the slice, for the specialized MB
+ *    readers of the chroma formats other than 4:2:0
+ ************************************************************************
+ */
+static void read_CBP_and_coeffs_of_slice(Macroblock *currMB)
+{
+  currMB->p_Slice->read_CBP_and_coeffs_from_NAL(currMB);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Specialized MB readers: the read_one_macroblock_* functions above
+ *    built for MBAFF off / on and for 4:2:0 / any chroma format. Within
+ *    one the MBAFF branches fold away and the syntax element and the
+ *    4:2:0 CBP and coefficient readers are direct calls instead of
+ *    calls through dP->readSyntaxElement and
+ *    currSlice->read_CBP_and_coeffs_from_NAL.
+ *    reader##_variants[yuv420][mb_aff]
+ ************************************************************************
+ */
+#define DEFINE_MB_READERS(reader, read_cbp_420) \
+  static void reader##_frame    (Macroblock *currMB) { reader(currMB, FALSE, read_CBP_and_coeffs_of_slice); } \
+  static void reader##_mbaff    (Macroblock *currMB) { reader(currMB, TRUE,  read_CBP_and_coeffs_of_slice); } \
+  static void reader##_frame_420(Macroblock *currMB) { reader(currMB, FALSE, read_cbp_420); } \
+  static void reader##_mbaff_420(Macroblock *currMB) { reader(currMB, TRUE,  read_cbp_420); } \
+  static void (* const reader##_variants[2][2])(Macroblock *currMB) = \
+    { { reader##_frame, reader##_mbaff }, { reader##_frame_420, reader##_mbaff_420 } };
+
+DEFINE_MB_READERS(read_one_macroblock_i_slice_cavlc, read_CBP_and_coeffs_from_NAL_CAVLC_420)
+DEFINE_MB_READERS(read_one_macroblock_p_slice_cavlc, read_CBP_and_coeffs_from_NAL_CAVLC_420)
+DEFINE_MB_READERS(read_one_macroblock_b_slice_cavlc, read_CBP_and_coeffs_from_NAL_CAVLC_420)
+DEFINE_MB_READERS(read_one_macroblock_i_slice_cabac, read_CBP_and_coeffs_from_NAL_CABAC_420)
+DEFINE_MB_READERS(read_one_macroblock_p_slice_cabac, read_CBP_and_coeffs_from_NAL_CABAC_420)
+DEFINE_MB_READERS(read_one_macroblock_b_slice_cabac, read_CBP_and_coeffs_from_NAL_CABAC_420)
+
 void setup_read_macroblock(Slice *currSlice)
 {
+  // read_CBP_and_coeffs_from_NAL is the _420 reader exactly when the format is 4:2:0 (and the
+  // residual is read, not so for data partitions with PartitionAOnly), see set_read_CBP_and_coeffs_cavlc/_cabac()
+  int yuv420 = (currSlice->p_Vid->active_sps->chroma_format_idc == YUV420)
+    && !(currSlice->dp_mode && currSlice->p_Vid->p_Inp->partition_a_only);
+  int mb_aff = (currSlice->mb_aff_frame_flag != 0);
+
   if (currSlice->p_Vid->active_pps->entropy_coding_mode_flag == (Boolean) CABAC)
   {
     switch (currSlice->slice_type)
     {
     case P_SLICE: 
     case SP_SLICE:
-      currSlice->read_one_macroblock = read_one_macroblock_p_slice_cabac;
+      currSlice->read_one_macroblock = read_one_macroblock_p_slice_cabac_variants[yuv420][mb_aff];
       break;
     case B_SLICE:
-      currSlice->read_one_macroblock = read_one_macroblock_b_slice_cabac;
+      currSlice->read_one_macroblock = read_one_macroblock_b_slice_cabac_variants[yuv420][mb_aff];
       break;
     case I_SLICE: 
     case SI_SLICE: 
-      currSlice->read_one_macroblock = read_one_macroblock_i_slice_cabac;
+      currSlice->read_one_macroblock = read_one_macroblock_i_slice_cabac_variants[yuv420][mb_aff];
       break;
     default:
       printf("Unsupported slice type\n");
@@ -2144,14 +2204,14 @@ void setup_read_macroblock(Slice *currSlice)
     {
     case P_SLICE: 
     case SP_SLICE:
-      currSlice->read_one_macroblock = read_one_macroblock_p_slice_cavlc;
+      currSlice->read_one_macroblock = read_one_macroblock_p_slice_cavlc_variants[yuv420][mb_aff];
       break;
     case B_SLICE:
-      currSlice->read_one_macroblock = read_one_macroblock_b_slice_cavlc;
+      currSlice->read_one_macroblock = read_one_macroblock_b_slice_cavlc_variants[yuv420][mb_aff];
       break;
     case I_SLICE: 
     case SI_SLICE:     
-      currSlice->read_one_macroblock = read_one_macroblock_i_slice_cavlc;
+      currSlice->read_one_macroblock = read_one_macroblock_i_slice_cavlc_variants[yuv420][mb_aff];
       break;
     default:
       printf("Unsupported slice type\n");
@@ -0,0 +1,315 @@
+
+/*!
+ ************************************************************************
+ * \file mv_prediction.c
+ *
+ * \brief
+ *    Motion vector prediction (8.4.1.3) and the motion of direct
+ *    predicted blocks in B slices (8.4.1.2) for frame pictures without
+ *    MBAFF. Only used with MvFieldFile: Slice::GetMVPredictor and
+ *    Slice::update_direct_mv_info are NULL otherwise and the parser
+ *    reads the MVDs alone.
+ *
+ *    The colocated motion comes from the reference window of mvfield.c
+ *    (MvColBlock, already reduced to the list the colocated block
+ *    uses), not from a DPB.
+ ************************************************************************
+ */
+
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "global.h"
+#include "mbuffer.h"
+#include "mb_access.h"
+#include "macroblock.h"
+#include "mv_prediction.h"
+#include "mvfield.h"
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Component wise median of three motion vectors. With SSE2 both
+ *    components go through one min / max network on the packed
+ *    (mv_x, mv_y) pairs instead of two branchy imedian() calls.
+ ************************************************************************
+ */
+static inline MotionVector mv_median(MotionVector a, MotionVector b, MotionVector c)
+{
+  MotionVector m;
+#if defined(__SSE2__)
+  int32 ia, ib, ic, im;
+  __m128i va, vb, vc;
+
+  memcpy(&ia, &a, sizeof(int32));
+  memcpy(&ib, &b, sizeof(int32));
+  memcpy(&ic, &c, sizeof(int32));
+  va = _mm_cvtsi32_si128(ia);
+  vb = _mm_cvtsi32_si128(ib);
+  vc = _mm_cvtsi32_si128(ic);
+  // max(min(a, b), min(max(a, b), c))
+  im = _mm_cvtsi128_si32(_mm_max_epi16(_mm_min_epi16(va, vb), _mm_min_epi16(_mm_max_epi16(va, vb), vc)));
+  memcpy(&m, &im, sizeof(MotionVector));
+#else
+  m.mv_x = (short) imedian(a.mv_x, b.mv_x, c.mv_x);
+  m.mv_y = (short) imedian(a.mv_y, b.mv_y, c.mv_y);
+#endif
+  return m;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Get motion vector predictor of a partition (non MBAFF)
+ *
+ * \param currMB
+ *    current macroblock
+ * \param block
+ *    neighbours A, B and C (D if C is not available), see get_neighbors()
+ * \param pmv
+ *    the predictor
+ * \param ref_frame
+ *    reference index of the partition
+ * \param mv_info
+ *    motion of the current picture
+ * \param list
+ *    LIST_0 or LIST_1
+ * \param mb_x, mb_y
+ *    position of the partition in the macroblock
+ * \param blockshape_x, blockshape_y
+ *    size of the partition
+ ************************************************************************
+ */
+void GetMotionVectorPredictorNormal (Macroblock *currMB, PixelPos *block, MotionVector *pmv, short ref_frame,
+                                     PicMotionParams **mv_info, int list, int mb_x, int mb_y, int blockshape_x, int blockshape_y)
+{
+  int mvPredType = MVPRED_MEDIAN;
+  int rFrameL  = block[0].available ? mv_info[block[0].pos_y][block[0].pos_x].ref_idx[list] : -1;
+  int rFrameU  = block[1].available ? mv_info[block[1].pos_y][block[1].pos_x].ref_idx[list] : -1;
+  int rFrameUR = block[2].available ? mv_info[block[2].pos_y][block[2].pos_x].ref_idx[list] : -1;
+  MotionVector mv_a = block[0].available ? mv_info[block[0].pos_y][block[0].pos_x].mv[list] : zero_mv;
+  MotionVector mv_b = block[1].available ? mv_info[block[1].pos_y][block[1].pos_x].mv[list] : zero_mv;
+  MotionVector mv_c = block[2].available ? mv_info[block[2].pos_y][block[2].pos_x].mv[list] : zero_mv;
+
+  /* Prediction if only one of the neighbors uses the reference frame
+   *  we are checking
+   */
+  if(rFrameL == ref_frame && rFrameU != ref_frame && rFrameUR != ref_frame)
+    mvPredType = MVPRED_L;
+  else if(rFrameL != ref_frame && rFrameU == ref_frame && rFrameUR != ref_frame)
+    mvPredType = MVPRED_U;
+  else if(rFrameL != ref_frame && rFrameU != ref_frame && rFrameUR == ref_frame)
+    mvPredType = MVPRED_UR;
+
+  // Directional predictions
+  if(blockshape_x == 8 && blockshape_y == 16)
+  {
+    if(mb_x == 0)
+    {
+      if(rFrameL == ref_frame)
+        mvPredType = MVPRED_L;
+    }
+    else
+    {
+      if(rFrameUR == ref_frame)
+        mvPredType = MVPRED_UR;
+    }
+  }
+  else if(blockshape_x == 16 && blockshape_y == 8)
+  {
+    if(mb_y == 0)
+    {
+      if(rFrameU == ref_frame)
+        mvPredType = MVPRED_U;
+    }
+    else
+    {
+      if(rFrameL == ref_frame)
+        mvPredType = MVPRED_L;
+    }
+  }
+
+  switch (mvPredType)
+  {
+  case MVPRED_MEDIAN:
+    // B and C not available: A alone (B and C take its motion)
+    if(!(block[1].available || block[2].available))
+      *pmv = mv_a;
+    else
+      *pmv = mv_median(mv_a, mv_b, mv_c);
+    break;
+  case MVPRED_L:
+    *pmv = mv_a;
+    break;
+  case MVPRED_U:
+    *pmv = mv_b;
+    break;
+  case MVPRED_UR:
+    *pmv = mv_c;
+    break;
+  default:
+    break;
+  }
+}
+
+//! colocated block of the 4x4 block (i, j) of the macroblock, NULL = intra
+static inline MvColBlock *get_colocated(Macroblock *currMB, MvRefFrame *col_frame, int i, int j)
+{
+  MvField *mvf = currMB->p_Vid->mv_field;
+
+  if (col_frame == NULL || !col_frame->has_motion)
+  {
+    mvf->inexact = TRUE;
+    return NULL;
+  }
+  // direct_8x8_inference_flag: the corner 4x4 block of the 8x8 block
+  if (currMB->p_Slice->active_sps->direct_8x8_inference_flag)
+  {
+    i = (i >> 1) * 3;
+    j = (j >> 1) * 3;
+  }
+  return &col_frame->col[(currMB->block_y + j) * mvf->width + currMB->block_x + i];
+}
+
+static inline char min_positive(int a, int b)
+{
+  return (char) ((a >= 0 && b >= 0) ? imin(a, b) : imax(a, b));
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Spatial direct: motion of the direct predicted 8x8 blocks of the
+ *    macroblock (all of them for B_Skip / B_Direct_16x16)
+ ************************************************************************
+ */
+void update_direct_mv_info_spatial(Macroblock *currMB)
+{
+  Slice *currSlice = currMB->p_Slice;
+  PicMotionParams **mv_info = currSlice->dec_picture->mv_info;
+  MvRefLists *lists = &currMB->p_Vid->mv_field->lists[currSlice->current_slice_nr];
+  MvRefFrame *col_frame = lists->size[LIST_1] > 0 ? lists->list[LIST_1][0] : NULL;
+  MotionVector pmvl0 = zero_mv, pmvl1 = zero_mv;
+  char l0_rFrame, l1_rFrame;
+  PixelPos mb[4];
+  int i, j, k;
+
+  get_neighbors(currMB, mb, 0, 0, MB_BLOCK_SIZE);
+
+  l0_rFrame = min_positive(mb[0].available ? mv_info[mb[0].pos_y][mb[0].pos_x].ref_idx[LIST_0] : -1,
+              min_positive(mb[1].available ? mv_info[mb[1].pos_y][mb[1].pos_x].ref_idx[LIST_0] : -1,
+                           mb[2].available ? mv_info[mb[2].pos_y][mb[2].pos_x].ref_idx[LIST_0] : -1));
+  l1_rFrame = min_positive(mb[0].available ? mv_info[mb[0].pos_y][mb[0].pos_x].ref_idx[LIST_1] : -1,
+              min_positive(mb[1].available ? mv_info[mb[1].pos_y][mb[1].pos_x].ref_idx[LIST_1] : -1,
+                           mb[2].available ? mv_info[mb[2].pos_y][mb[2].pos_x].ref_idx[LIST_1] : -1));
+
+  if (l0_rFrame >= 0)
+    currSlice->GetMVPredictor (currMB, mb, &pmvl0, l0_rFrame, mv_info, LIST_0, 0, 0, MB_BLOCK_SIZE, MB_BLOCK_SIZE);
+  if (l1_rFrame >= 0)
+    currSlice->GetMVPredictor (currMB, mb, &pmvl1, l1_rFrame, mv_info, LIST_1, 0, 0, MB_BLOCK_SIZE, MB_BLOCK_SIZE);
+
+  for (k = 0; k < 4; ++k)
+  {
+    int i0 = (k & 1) << 1;
+    int j0 = k & 2;
+
+    if (currMB->b8mode[k] != 0)
+      continue;
+
+    for (j = j0; j < j0 + 2; ++j)
+    {
+      PicMotionParams *mvi = &mv_info[currMB->block_y + j][currMB->block_x + i0];
+
+      for (i = i0; i < i0 + 2; ++i, ++mvi)
+      {
+        MvColBlock *col;
+        int col_zero;
+
+        // no neighbour uses either list: bi-predicted from index 0 with zero motion
+        if (l0_rFrame < 0 && l1_rFrame < 0)
+        {
+          mvi->ref_idx[LIST_0] = mvi->ref_idx[LIST_1] = 0;
+          mvi->mv[LIST_0] = mvi->mv[LIST_1] = zero_mv;
+          continue;
+        }
+
+        col = get_colocated(currMB, col_frame, i, j);
+        col_zero = col != NULL && col->ref_idx == 0 && iabs(col->mv.mv_x) <= 1 && iabs(col->mv.mv_y) <= 1;
+
+        mvi->ref_idx[LIST_0] = l0_rFrame;
+        mvi->mv[LIST_0] = (l0_rFrame < 0 || (l0_rFrame == 0 && col_zero)) ? zero_mv : pmvl0;
+        mvi->ref_idx[LIST_1] = l1_rFrame;
+        mvi->mv[LIST_1] = (l1_rFrame < 0 || (l1_rFrame == 0 && col_zero)) ? zero_mv : pmvl1;
+      }
+    }
+  }
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Temporal direct: motion of the direct predicted 8x8 blocks of the
+ *    macroblock, the colocated motion scaled by the POC distances
+ ************************************************************************
+ */
+void update_direct_mv_info_temporal(Macroblock *currMB)
+{
+  Slice *currSlice = currMB->p_Slice;
+  PicMotionParams **mv_info = currSlice->dec_picture->mv_info;
+  MvRefLists *lists = &currMB->p_Vid->mv_field->lists[currSlice->current_slice_nr];
+  MvRefFrame *col_frame = lists->size[LIST_1] > 0 ? lists->list[LIST_1][0] : NULL;
+  int i, j, k;
+
+  for (k = 0; k < 4; ++k)
+  {
+    int i0 = (k & 1) << 1;
+    int j0 = k & 2;
+
+    if (currMB->b8mode[k] != 0)
+      continue;
+
+    for (j = j0; j < j0 + 2; ++j)
+    {
+      PicMotionParams *mvi = &mv_info[currMB->block_y + j][currMB->block_x + i0];
+
+      for (i = i0; i < i0 + 2; ++i, ++mvi)
+      {
+        MvColBlock *col = get_colocated(currMB, col_frame, i, j);
+        MotionVector mv_col = zero_mv;
+        int ref = 0;
+        int scale;
+
+        if (col != NULL && col->ref_idx >= 0)
+        {
+          // lowest list 0 index of the frame the colocated block refers to
+          for (ref = 0; ref < lists->size[LIST_0] && lists->list[LIST_0][ref]->poc != col->ref_poc; ++ref)
+            ;
+          if (ref == lists->size[LIST_0])
+          {
+            currMB->p_Vid->mv_field->inexact = TRUE;
+            ref = 0;
+          }
+          mv_col = col->mv;
+        }
+
+        scale = lists->dist_scale[ref];
+        mvi->ref_idx[LIST_0] = (char) ref;
+        mvi->ref_idx[LIST_1] = 0;
+        if (scale == 9999)
+        {
+          mvi->mv[LIST_0] = mv_col;
+          mvi->mv[LIST_1] = zero_mv;
+        }
+        else
+        {
+          mvi->mv[LIST_0].mv_x = (short) ((scale * mv_col.mv_x + 128) >> 8);
+          mvi->mv[LIST_0].mv_y = (short) ((scale * mv_col.mv_y + 128) >> 8);
+          mvi->mv[LIST_1].mv_x = (short) (mvi->mv[LIST_0].mv_x - mv_col.mv_x);
+          mvi->mv[LIST_1].mv_y = (short) (mvi->mv[LIST_0].mv_y - mv_col.mv_y);
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,464 @@
+
+/*!
+ ************************************************************************
+ * \file mvfield.c
+ *
+ * \brief
+ *    Motion vector field output (MvFieldFile), see mvfield.h.
+ *
+ *    The decoder keeps no DPB, so the reference lists the motion
+ *    vectors refer to are rebuilt here from what the slice headers
+ *    give: the POC of every picture, a sliding window of the last
+ *    num_ref_frames reference frames and the default list order
+ *    (8.2.4.2). Streams that modify the lists or mark with MMCO get
+ *    their records flagged MV_FIELD_INEXACT: the motion vectors read
+ *    from the MVDs are right, the predicted ones (skip and direct) may
+ *    use other references than the coded stream.
+ ************************************************************************
+ */
+
+#include <errno.h>
+#include <limits.h>
+
+#include "global.h"
+#include "mbuffer.h"
+#include "memalloc.h"
+#include "mvfield.h"
+#include "mv_prediction.h"
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Open the MvFieldFile and write its header
+ ************************************************************************
+ */
+void open_mv_field(VideoParameters *p_Vid, const char *path)
+{
+  MvField *mvf;
+  int32 version = MV_FIELD_VERSION;
+
+  if ((mvf = (MvField *) calloc(1, sizeof(MvField))) == NULL)
+    no_mem_exit("open_mv_field: mvf");
+  if ((mvf->f = fopen(path, "wb")) == NULL)
+  {
+    snprintf(errortext, ET_SIZE, "Cannot open the motion vector field file '%s' (%s)", path, strerror(errno));
+    error_KeyGen(errortext, 500);
+  }
+  if (fwrite(MV_FIELD_MAGIC, 4, 1, mvf->f) != 1 || fwrite(&version, sizeof(version), 1, mvf->f) != 1)
+  {
+    snprintf(errortext, ET_SIZE, "Cannot write the motion vector field file '%s'", path);
+    error_KeyGen(errortext, 500);
+  }
+  p_Vid->mv_field = mvf;
+}
+
+void close_mv_field(VideoParameters *p_Vid)
+{
+  MvField *mvf = p_Vid->mv_field;
+  int i;
+
+  if (mvf == NULL)
+    return;
+  if (fclose(mvf->f))
+    error_KeyGen("close_mv_field: cannot write the motion vector field file", 500);
+  for (i = 0; i <= MV_FIELD_MAX_REF; ++i)
+    free(mvf->ref[i].col);
+  free(mvf->lists);
+  free(mvf->planes);
+  free(mvf);
+  p_Vid->mv_field = NULL;
+}
+
+//! POC of the picture (8.2.1), of the frame for field pictures: min(top, bottom)
+static int decode_poc(MvField *mvf, Slice *currSlice)
+{
+  seq_parameter_set_rbsp_t *sps = currSlice->active_sps;
+  int max_frame_num = 1 << (sps->log2_max_frame_num_minus4 + 4);
+  int frame_num = (int) currSlice->frame_num;
+  int frame_num_offset = 0;
+  int top, bottom;
+
+  if (!currSlice->idr_flag)
+    frame_num_offset = mvf->prev_frame_num_offset + (mvf->prev_frame_num > frame_num ? max_frame_num : 0);
+
+  switch (sps->pic_order_cnt_type)
+  {
+  case 0:
+    {
+      int max_lsb = 1 << (sps->log2_max_pic_order_cnt_lsb_minus4 + 4);
+      int lsb = (int) currSlice->pic_order_cnt_lsb;
+      int msb;
+
+      if (currSlice->idr_flag)
+        mvf->prev_poc_msb = mvf->prev_poc_lsb = 0;
+      if (lsb < mvf->prev_poc_lsb && (mvf->prev_poc_lsb - lsb) >= max_lsb / 2)
+        msb = mvf->prev_poc_msb + max_lsb;
+      else if (lsb > mvf->prev_poc_lsb && (lsb - mvf->prev_poc_lsb) > max_lsb / 2)
+        msb = mvf->prev_poc_msb - max_lsb;
+      else
+        msb = mvf->prev_poc_msb;
+
+      top = bottom = msb + lsb;
+      if (currSlice->structure == FRAME)
+        bottom = top + currSlice->delta_pic_order_cnt_bottom;
+      if (currSlice->nal_reference_idc)
+      {
+        mvf->prev_poc_msb = msb;
+        mvf->prev_poc_lsb = lsb;
+      }
+    }
+    break;
+  case 1:
+    {
+      int cycle = (int) sps->num_ref_frames_in_pic_order_cnt_cycle;
+      int abs_frame_num = cycle != 0 ? frame_num_offset + frame_num : 0;
+      int expected = 0;
+      int i;
+
+      if (currSlice->nal_reference_idc == 0 && abs_frame_num > 0)
+        --abs_frame_num;
+      if (abs_frame_num > 0)
+      {
+        int delta_per_cycle = 0;
+        int in_cycle = (abs_frame_num - 1) % cycle;
+
+        for (i = 0; i < cycle; ++i)
+          delta_per_cycle += sps->offset_for_ref_frame[i];
+        expected = ((abs_frame_num - 1) / cycle) * delta_per_cycle;
+        for (i = 0; i <= in_cycle; ++i)
+          expected += sps->offset_for_ref_frame[i];
+      }
+      if (currSlice->nal_reference_idc == 0)
+        expected += sps->offset_for_non_ref_pic;
+
+      top    = expected + currSlice->delta_pic_order_cnt[0];
+      bottom = top + sps->offset_for_top_to_bottom_field + (currSlice->structure == FRAME ? currSlice->delta_pic_order_cnt[1] : 0);
+    }
+    break;
+  default:
+    top = bottom = currSlice->idr_flag ? 0 : 2 * (frame_num_offset + frame_num) - (currSlice->nal_reference_idc == 0);
+    break;
+  }
+
+  mvf->prev_frame_num = frame_num;
+  mvf->prev_frame_num_offset = frame_num_offset;
+  return imin(top, bottom);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Start of a picture: its POC and whether its motion vectors are
+ *    reconstructed, called by init_picture() with the first slice
+ ************************************************************************
+ */
+void init_mv_field_picture(MvField *mvf, Slice *currSlice, StorablePicture *dec_picture)
+{
+  VideoParameters *p_Vid = currSlice->p_Vid;
+  int i;
+
+  if (currSlice->idr_flag)
+  {
+    mvf->num_ref = 0;
+    mvf->mmco = FALSE;
+  }
+  mvf->max_ref    = iClip3(1, MV_FIELD_MAX_REF, (int) currSlice->active_sps->num_ref_frames);
+  mvf->poc        = decode_poc(mvf, currSlice);
+  mvf->frame_num  = (int) currSlice->frame_num;
+  mvf->slice_type = currSlice->slice_type;
+  mvf->reference  = currSlice->nal_reference_idc != 0;
+  mvf->idr        = currSlice->idr_flag;
+  mvf->extract    = currSlice->structure == FRAME && !currSlice->mb_aff_frame_flag && !p_Vid->separate_colour_plane_flag;
+  mvf->inexact    = FALSE;
+  // the marking applies after this picture, the pictures that follow use the window
+  if (mvf->reference && !mvf->idr && currSlice->adaptive_ref_pic_buffering_flag)
+    mvf->mmco = TRUE;
+  mvf->lists_used = 0;
+  mvf->width      = dec_picture->size_x >> BLOCK_SHIFT;
+  mvf->height     = dec_picture->size_y >> BLOCK_SHIFT;
+
+  if (mvf->extract)
+  {
+    // blocks of intra MBs and lists a block does not use keep ref_idx -1
+    PicMotionParams *mv_info = dec_picture->mv_info[0];
+
+    for (i = 0; i < mvf->width * mvf->height; ++i)
+      mv_info[i].ref_idx[LIST_0] = mv_info[i].ref_idx[LIST_1] = -1;
+  }
+}
+
+//! FrameNumWrap up to a constant: frame_num values above the current one wrapped below all others
+static int frame_num_wrap(MvField *mvf, MvRefFrame *r)
+{
+  return r->frame_num > mvf->frame_num ? r->frame_num - (1 << 30) : r->frame_num;
+}
+
+//! DistScaleFactor of temporal direct (8.4.1.2.3)
+static int dist_scale_factor(int poc, int poc0, int poc1)
+{
+  int tb = iClip3(-128, 127, poc - poc0);
+  int td = iClip3(-128, 127, poc1 - poc0);
+  int tx;
+
+  if (td == 0)
+    return 9999;
+  tx = (16384 + iabs(td / 2)) / td;
+  return iClip3(-1024, 1023, (tb * tx + 32) >> 6);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Default reference lists of a slice (8.2.4.2.1, 8.2.4.2.3) and the
+ *    prediction functions, called by init_slice()
+ ************************************************************************
+ */
+void init_mv_field_slice(MvField *mvf, Slice *currSlice)
+{
+  MvRefLists *lists;
+  MvRefFrame *sorted[MV_FIELD_MAX_REF];
+  int n = mvf->num_ref;
+  int i, j, list;
+
+  currSlice->GetMVPredictor = NULL;
+  currSlice->update_direct_mv_info = NULL;
+
+  if (currSlice->current_slice_nr >= mvf->lists_alloc)
+  {
+    int alloc = imax(2 * mvf->lists_alloc, currSlice->current_slice_nr + 1);
+
+    if ((mvf->lists = (MvRefLists *) realloc(mvf->lists, alloc * sizeof(MvRefLists))) == NULL)
+      no_mem_exit("init_mv_field_slice: lists");
+    mvf->lists_alloc = alloc;
+  }
+  lists = &mvf->lists[currSlice->current_slice_nr];
+  lists->size[LIST_0] = lists->size[LIST_1] = 0;
+
+  if (currSlice->slice_type != P_SLICE && currSlice->slice_type != SP_SLICE && currSlice->slice_type != B_SLICE)
+    return;
+  mvf->lists_used = imax(mvf->lists_used, currSlice->slice_type == B_SLICE ? 2 : 1);
+
+  for (i = 0; i < n; ++i)
+    sorted[i] = &mvf->ref[i];
+
+  if (currSlice->slice_type != B_SLICE)
+  {
+    // descending FrameNumWrap
+    for (i = 1; i < n; ++i)
+      for (j = i; j > 0 && frame_num_wrap(mvf, sorted[j - 1]) < frame_num_wrap(mvf, sorted[j]); --j)
+      {
+        MvRefFrame *t = sorted[j]; sorted[j] = sorted[j - 1]; sorted[j - 1] = t;
+      }
+    for (i = 0; i < n; ++i)
+      lists->list[LIST_0][i] = sorted[i];
+    lists->size[LIST_0] = n;
+  }
+  else
+  {
+    int before = 0;
+
+    // ascending POC, then the past frames (descending) before the future ones (ascending)
+    for (i = 1; i < n; ++i)
+      for (j = i; j > 0 && sorted[j - 1]->poc > sorted[j]->poc; --j)
+      {
+        MvRefFrame *t = sorted[j]; sorted[j] = sorted[j - 1]; sorted[j - 1] = t;
+      }
+    while (before < n && sorted[before]->poc < mvf->poc)
+      ++before;
+    for (i = 0; i < before; ++i)
+    {
+      lists->list[LIST_0][i] = sorted[before - 1 - i];
+      lists->list[LIST_1][n - before + i] = sorted[before - 1 - i];
+    }
+    for (i = before; i < n; ++i)
+    {
+      lists->list[LIST_0][i] = sorted[i];
+      lists->list[LIST_1][i - before] = sorted[i];
+    }
+    lists->size[LIST_0] = lists->size[LIST_1] = n;
+    if (n > 1 && before == n)
+    {
+      MvRefFrame *t = lists->list[LIST_1][0];
+      lists->list[LIST_1][0] = lists->list[LIST_1][1];
+      lists->list[LIST_1][1] = t;
+    }
+  }
+
+  for (list = 0; list < 2; ++list)
+    lists->size[list] = imin(lists->size[list], currSlice->num_ref_idx_active[list]);
+  // P slices predict from the coded ref_idx, only the direct modes and the colocated ref_poc need the lists
+  lists->exact = !mvf->mmco && !currSlice->ref_pic_list_reordering_flag[LIST_0] && !currSlice->ref_pic_list_reordering_flag[LIST_1];
+  if (currSlice->slice_type == B_SLICE && !lists->exact)
+    mvf->inexact = TRUE;
+
+  if (!mvf->extract)
+    return;
+
+  currSlice->GetMVPredictor = GetMotionVectorPredictorNormal;
+  if (currSlice->slice_type == B_SLICE)
+  {
+    if (currSlice->direct_spatial_mv_pred_flag)
+      currSlice->update_direct_mv_info = update_direct_mv_info_spatial;
+    else
+    {
+      currSlice->update_direct_mv_info = update_direct_mv_info_temporal;
+      for (i = 0; i < lists->size[LIST_0]; ++i)
+        lists->dist_scale[i] = lists->size[LIST_1] > 0 ? dist_scale_factor(mvf->poc, lists->list[LIST_0][i]->poc, lists->list[LIST_1][0]->poc) : 9999;
+    }
+  }
+}
+
+static MvRefFrame *ref_frame(MvRefLists *lists, int list, int ref_idx)
+{
+  return ref_idx < lists->size[list] ? lists->list[list][ref_idx] : NULL;
+}
+
+//! keep the motion of a reference picture for the direct modes of the pictures that follow
+static void store_reference(VideoParameters *p_Vid, MvField *mvf, StorablePicture *dec_picture)
+{
+  MvRefFrame *r = &mvf->ref[mvf->num_ref];
+  int blocks = mvf->width * mvf->height;
+  int i, x, y;
+
+  // the second field of a frame whose first field is in the window
+  if (!mvf->extract && mvf->num_ref > 0 && mvf->ref[mvf->num_ref - 1].field && mvf->ref[mvf->num_ref - 1].frame_num == mvf->frame_num
+    && dec_picture->structure != FRAME)
+  {
+    mvf->ref[mvf->num_ref - 1].field = FALSE;
+    return;
+  }
+
+  r->poc        = mvf->poc;
+  r->frame_num  = mvf->frame_num;
+  r->has_motion = mvf->extract;
+  r->field      = dec_picture->structure != FRAME;
+  if (mvf->extract)
+  {
+    if (r->col_size < blocks)
+    {
+      free(r->col);
+      if ((r->col = (MvColBlock *) malloc(blocks * sizeof(MvColBlock))) == NULL)
+        no_mem_exit("store_reference: col");
+      r->col_size = blocks;
+    }
+    for (y = 0; y < mvf->height; ++y)
+    {
+      PicMotionParams *mvi = dec_picture->mv_info[y];
+      MvColBlock *col = &r->col[y * mvf->width];
+
+      for (x = 0; x < mvf->width; ++x, ++mvi, ++col)
+      {
+        int list = mvi->ref_idx[LIST_0] >= 0 ? LIST_0 : LIST_1;
+        MvRefFrame *ref;
+
+        col->ref_idx = mvi->ref_idx[list];
+        col->mv      = mvi->mv[list];
+        col->ref_poc = INT_MIN;
+        if (col->ref_idx >= 0)
+        {
+          short slice_nr = p_Vid->mb_data[(y >> 2) * (mvf->width >> 2) + (x >> 2)].slice_nr;
+
+          if (slice_nr >= 0 && slice_nr < mvf->lists_alloc && mvf->lists[slice_nr].exact && (ref = ref_frame(&mvf->lists[slice_nr], list, col->ref_idx)) != NULL)
+            col->ref_poc = ref->poc;
+        }
+      }
+    }
+  }
+
+  // sliding window (8.2.5.3): the frame with the smallest FrameNumWrap leaves
+  if (++mvf->num_ref > mvf->max_ref)
+  {
+    MvRefFrame t;
+    int oldest = 0;
+
+    for (i = 1; i < mvf->num_ref; ++i)
+      if (frame_num_wrap(mvf, &mvf->ref[i]) < frame_num_wrap(mvf, &mvf->ref[oldest]))
+        oldest = i;
+    --mvf->num_ref;
+    t = mvf->ref[oldest];
+    mvf->ref[oldest] = mvf->ref[mvf->num_ref];
+    mvf->ref[mvf->num_ref] = t;
+  }
+}
+
+//! a slice of the picture ended before its last macroblock
+static int truncated_picture(VideoParameters *p_Vid)
+{
+  unsigned int mbs = p_Vid->num_dec_mb;
+  int i;
+
+  // I slices are not parsed, they reach up to the next slice
+  for (i = 0; i < p_Vid->iSliceNumOfCurrPic; ++i)
+  {
+    Slice *s = p_Vid->ppSliceList[i];
+
+    if (s->slice_type != I_SLICE && s->slice_type != SI_SLICE)
+      continue;
+    if (s->active_pps->num_slice_groups_minus1 > 0)
+      return FALSE;   // the macroblocks of an I slice in a slice group are not known
+    mbs += imax(0, s->end_mb_nr_plus1 - s->start_mb_nr);
+  }
+  return mbs < p_Vid->PicSizeInMbs;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    End of a picture: write its record and keep it in the reference
+ *    window, called by decode_one_frame() before exit_picture()
+ ************************************************************************
+ */
+void exit_mv_field_picture(VideoParameters *p_Vid, StorablePicture *dec_picture)
+{
+  MvField *mvf = p_Vid->mv_field;
+  MvFieldRecord rec;
+  int blocks = mvf->width * mvf->height;
+  int truncated = mvf->extract && truncated_picture(p_Vid);
+  int list, i;
+
+  // the blocks of the missing macroblocks hold no motion, the picture is not extracted
+  if (truncated)
+    mvf->extract = FALSE;
+
+  memset(&rec, 0, sizeof(rec));
+  rec.poc        = mvf->poc;
+  rec.frame_num  = mvf->frame_num;
+  rec.width      = (uint16) mvf->width;
+  rec.height     = (uint16) mvf->height;
+  rec.slice_type = (byte) mvf->slice_type;
+  rec.lists      = (byte) (mvf->extract ? mvf->lists_used : 0);
+  rec.flags      = (byte) ((mvf->extract ? MV_FIELD_EXTRACTED : 0) | (mvf->reference ? MV_FIELD_REFERENCE : 0)
+                         | (mvf->idr ? MV_FIELD_IDR : 0) | (mvf->extract && mvf->inexact ? MV_FIELD_INEXACT : 0)
+                         | (truncated ? MV_FIELD_TRUNCATED : 0));
+
+  if (rec.lists > 0 && mvf->planes_size < blocks * 5)
+  {
+    free(mvf->planes);
+    if ((mvf->planes = (byte *) malloc(blocks * 5)) == NULL)
+      no_mem_exit("exit_mv_field_picture: planes");
+    mvf->planes_size = blocks * 5;
+  }
+
+  if (fwrite(&rec, sizeof(rec), 1, mvf->f) != 1)
+    error_KeyGen("exit_mv_field_picture: cannot write the motion vector field file", 500);
+  for (list = 0; list < rec.lists; ++list)
+  {
+    PicMotionParams *mv_info = dec_picture->mv_info[0];
+    char  *ref_idx = (char *) mvf->planes;
+    short *mv = (short *) (mvf->planes + blocks);
+
+    for (i = 0; i < blocks; ++i)
+    {
+      ref_idx[i]    = mv_info[i].ref_idx[list];
+      mv[2 * i]     = mv_info[i].mv[list].mv_x;
+      mv[2 * i + 1] = mv_info[i].mv[list].mv_y;
+    }
+    if (fwrite(mvf->planes, blocks * 5, 1, mvf->f) != 1)
+      error_KeyGen("exit_mv_field_picture: cannot write the motion vector field file", 500);
+  }
+  if (mvf->extract)
+    ++p_Dec->stats.mv_field_pictures;
+
+  if (mvf->reference)
+    store_reference(p_Vid, mvf, dec_picture);
+}
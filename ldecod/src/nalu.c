@@ -17,6 +17,8 @@
 #include "nalu.h"
 #include "memalloc.h"
 #include "rtp.h"
+#include "pipeline.h"
+#include "stagetimer.h"
 #if (MVC_EXTENSION_ENABLE)
 #include "vlc.h"
 #endif
@@ -43,57 +45,124 @@ static int NALUtoRBSP (NALU_t *nalu)
   return nalu->len ;
 }
 
+static off_t nalu_pos = 0;	//!< file position of the next Annex B start code
+
+//! TRUE for the data partitions B and C with PartitionAOnly, their payload is never read
+static inline int nalu_not_parsed(VideoParameters *p_Vid, NALU_t *nalu)
+{
+  return p_Vid->p_Inp->partition_a_only && (nalu->nal_unit_type == NALU_TYPE_DPB || nalu->nal_unit_type == NALU_TYPE_DPC);
+}
+
 /*!
 ************************************************************************
 * \brief
-*    Read the next NAL unit (with error handling)
+*    Read the next NAL unit and note its file position in nalu->file_pos
 ************************************************************************
 */
-int read_next_nalu(VideoParameters *p_Vid, NALU_t *nalu)
+static int read_nalu(VideoParameters *p_Vid, NALU_t *nalu)
 {
-  InputParameters *p_Inp = p_Vid->p_Inp;
   int ret;
-	static off_t nalu_pos = 0;
-	static int nalu_nums_in_bs = 0;
 
-  switch( p_Inp->FileFormat )
+  switch( p_Vid->p_Inp->FileFormat )
   {
   default:
   case PAR_OF_ANNEXB:
     ret = get_annex_b_NALU(p_Vid, nalu, p_Vid->annex_b);
 
-		if(p_Dec->p_Inp->enable_key)
-		{
-			nalu_pos += nalu->startcodeprefix_len;
-			p_Dec->nalu_pos_array[nalu_nums_in_bs++] = nalu_pos;
-			nalu_pos += nalu->len;		
-		}
+		nalu_pos += nalu->startcodeprefix_len;
+		nalu->file_pos = nalu_pos;
+		nalu_pos += nalu->len;		
     break;
   case PAR_OF_RTP:
     ret = GetRTPNALU(p_Vid, nalu, p_Vid->BitStreamFile);
     break;   
   }
+  return ret;
+}
 
-  if (ret < 0)
+/*!
+************************************************************************
+* \brief
+*    Read the next NAL unit and convert it to an RBSP, the splitter
+*    thread of a pipelined decoder runs this (its stages are reported
+*    under the "splitter" thread)
+* \return
+*    length of the RBSP, 0 at the end of the stream, -1 if the NAL unit
+*    could not be read, -2 for an invalid emulation prevention
+************************************************************************
+*/
+int get_nalu(VideoParameters *p_Vid, NALU_t *nalu)
+{
+  int ret;
+
+  STAGE_BEGIN(STAGE_NALU);
+  ret = read_nalu(p_Vid, nalu);
+  STAGE_END(STAGE_NALU);
+
+  if (ret <= 0)
+    return ret < 0 ? -1 : 0;
+  if (nalu_not_parsed(p_Vid, nalu))
+    return ret;
+
+  STAGE_BEGIN(STAGE_EBSP);
+  ret = NALUtoRBSP(nalu);
+  STAGE_END(STAGE_EBSP);
+  return ret < 0 ? -2 : ret;
+}
+
+/*!
+************************************************************************
+* \brief
+*    Read the next NAL unit (with error handling)
+************************************************************************
+*/
+int read_next_nalu(VideoParameters *p_Vid, NALU_t *nalu)
+{
+  InputParameters *p_Inp = p_Vid->p_Inp;
+  int ret;
+
+  STAGE_CONTEXT_NONE();
+  if (p_Dec->pipeline)
+  {
+    STAGE_BEGIN(STAGE_NALU);
+    ret = pipeline_get_nalu(p_Dec->pipeline, nalu);
+    STAGE_END(STAGE_NALU);
+  }
+  else
+  {
+    STAGE_BEGIN(STAGE_NALU);
+    ret = read_nalu(p_Vid, nalu);
+    STAGE_END(STAGE_NALU);
+    if (ret > 0 && !nalu_not_parsed(p_Vid, nalu))
+    {
+      STAGE_BEGIN(STAGE_EBSP);
+      ret = NALUtoRBSP(nalu) < 0 ? -2 : (int) nalu->len;
+      STAGE_END(STAGE_EBSP);
+    }
+    else if (ret < 0)
+      ret = -1;
+  }
+
+  if (ret == -1)
   {
     snprintf (errortext, ET_SIZE, "Error while getting the NALU in file format %s, exit\n", p_Inp->FileFormat==PAR_OF_ANNEXB?"Annex B":"RTP");
     error (errortext, 601);
   }
+  if (ret == -2)
+    error ("Invalid startcode emulation prevention found.", 602);
   if (ret == 0)
   {
     //FreeNALU(nalu);
     return 0;
   }
 
+	if(p_Dec->p_Inp->enable_key)
+		p_Dec->nalu_pos_array[p_Dec->nalu_pos_array_cnt++] = nalu->file_pos;
+
   //In some cases, zero_byte shall be present. If current NALU is a VCL NALU, we can't tell
   //whether it is the first VCL NALU at this point, so only non-VCL NAL unit is checked here.
   CheckZeroByteNonVCL(p_Vid, nalu);
 
-  ret = NALUtoRBSP(nalu);
-
-  if (ret < 0)
-    error ("Invalid startcode emulation prevention found.", 602);
-
   // Got a NALU
   if (nalu->forbidden_bit)
   {
@@ -103,6 +172,20 @@ int read_next_nalu(VideoParameters *p_Vid, NALU_t *nalu)
   return nalu->len;
 }
 
+/*!
+************************************************************************
+* \brief
+*    Continue with the Annex B start code at file offset offset
+************************************************************************
+*/
+void seek_next_nalu(VideoParameters *p_Vid, int64 offset)
+{
+  if (p_Vid->p_Inp->FileFormat != PAR_OF_ANNEXB)
+    error_KeyGen("seek_next_nalu: only Annex B input can seek", 500);
+  seek_annex_b(p_Vid->annex_b, offset);
+  nalu_pos = (off_t) offset;
+}
+
 void CheckZeroByteNonVCL(VideoParameters *p_Vid, NALU_t *nalu)
 {
   int CheckZeroByte=0;
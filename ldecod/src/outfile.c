@@ -0,0 +1,190 @@
+
+/*!
+ ************************************************************************
+ * \file outfile.c
+ *
+ * \brief
+ *    Scrambled output to a separate file, see outfile.h.
+ ************************************************************************
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "global.h"
+#include "memalloc.h"
+#include "outfile.h"
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__) && defined(__NR_copy_file_range)
+static int64 sys_copy_file_range(int in_fd, int64 *in_off, int out_fd, int64 *out_off, int64 len)
+{
+  loff_t in_pos = (loff_t) *in_off, out_pos = (loff_t) *out_off;
+  int64 n = syscall(__NR_copy_file_range, in_fd, &in_pos, out_fd, &out_pos, (size_t) len, 0);
+
+  if (n > 0)
+  {
+    *in_off  += n;
+    *out_off += n;
+  }
+  return n;
+}
+#else
+static int64 sys_copy_file_range(int in_fd, int64 *in_off, int out_fd, int64 *out_off, int64 len)
+{
+  errno = ENOSYS;
+  return -1;
+}
+#endif
+
+static void write_all(int fd, const byte *buf, int64 len, int64 offset)
+{
+  while (len > 0)
+  {
+    ssize_t w = pwrite(fd, buf, (size_t) len, (off_t) offset);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w <= 0)
+    {
+      snprintf(errortext, ET_SIZE, "scrambled output: cannot write at byte %lld (%s)", (long long) offset, strerror(errno));
+      error_KeyGen(errortext, 500);
+    }
+    buf    += w;
+    len    -= w;
+    offset += w;
+  }
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Copy the input bytes offset..offset+len to the same place in the
+ *    output. copy_file_range() is given up for the run on the first
+ *    error that says it cannot work between these files (old kernel,
+ *    different file systems), the bytes then go through a buffer.
+ ************************************************************************
+ */
+static void copy_span(ScrambledOutput *so, int64 offset, int64 len)
+{
+  int64 in_off = offset, out_off = offset;
+
+  so->copied += len;
+  while (len > 0 && so->use_copy)
+  {
+    int64 n = sys_copy_file_range(so->in_fd, &in_off, so->out_fd, &out_off, len);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP || errno == EBADF))
+    {
+      so->use_copy = 0;
+      break;
+    }
+    if (n <= 0)
+    {
+      snprintf(errortext, ET_SIZE, "scrambled output: cannot copy byte %lld of the input (%s)", (long long) in_off,
+        n < 0 ? strerror(errno) : "unexpected end of file");
+      error_KeyGen(errortext, 500);
+    }
+    len -= n;
+  }
+
+  while (len > 0)
+  {
+    int chunk = (int) (len < OUTPUT_COPY_BUFFER ? len : OUTPUT_COPY_BUFFER);
+    ssize_t r;
+
+    if (so->bounce == NULL && (so->bounce = (byte *) malloc(OUTPUT_COPY_BUFFER)) == NULL)
+      no_mem_exit("copy_span: bounce");
+    r = pread(so->in_fd, so->bounce, chunk, (off_t) in_off);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+    {
+      snprintf(errortext, ET_SIZE, "scrambled output: cannot read byte %lld of the input", (long long) in_off);
+      error_KeyGen(errortext, 500);
+    }
+    write_all(so->out_fd, so->bounce, r, out_off);
+    in_off  += r;
+    out_off += r;
+    len     -= r;
+  }
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Create (or truncate) the scrambled output fn for the input in_fd.
+ *    fn must be a regular file other than the input.
+ ************************************************************************
+ */
+ScrambledOutput *open_scrambled_output(const char *fn, int in_fd)
+{
+  ScrambledOutput *so = (ScrambledOutput *) calloc(1, sizeof(ScrambledOutput));
+  struct stat in_st, out_st;
+
+  if (so == NULL)
+    no_mem_exit("open_scrambled_output: so");
+  // not O_TRUNC before it is known not to be the input
+  if ((so->out_fd = open(fn, O_WRONLY | O_CREAT, 0644)) < 0)
+  {
+    snprintf(errortext, ET_SIZE, "Cannot open the scrambled output '%s' (%s)", fn, strerror(errno));
+    error_KeyGen(errortext, 500);
+  }
+  if (fstat(in_fd, &in_st) || fstat(so->out_fd, &out_st) || !S_ISREG(out_st.st_mode))
+  {
+    snprintf(errortext, ET_SIZE, "The scrambled output '%s' must be a regular file", fn);
+    error_KeyGen(errortext, 500);
+  }
+  if (in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino)
+  {
+    snprintf(errortext, ET_SIZE, "The scrambled output '%s' is the input file, leave OutputFile empty to scramble in place", fn);
+    error_KeyGen(errortext, 500);
+  }
+  if (ftruncate(so->out_fd, 0))
+  {
+    snprintf(errortext, ET_SIZE, "Cannot truncate the scrambled output '%s' (%s)", fn, strerror(errno));
+    error_KeyGen(errortext, 500);
+  }
+  so->in_fd    = in_fd;
+  so->use_copy = 1;
+  return so;
+}
+
+//! copy the rest of the input and close the output
+void close_scrambled_output(ScrambledOutput *so, int64 in_size)
+{
+  if (so == NULL)
+    return;
+  if (in_size > so->done)
+    copy_span(so, so->done, in_size - so->done);
+  if (close(so->out_fd))
+    error_KeyGen("close_scrambled_output: cannot close the scrambled output", 500);
+  printf("scrambled output: %lld bytes copied%s, %lld bytes written in %d spans\n", (long long) so->copied,
+    so->use_copy ? "" : " (no copy_file_range)", (long long) so->written, so->spans);
+  free(so->bounce);
+  free(so);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    The len changed bytes at input offset offset. Spans come in file
+ *    order; a span may start inside the previous one when two key
+ *    units share a byte, it is then written again.
+ ************************************************************************
+ */
+void scrambled_output_span(ScrambledOutput *so, const byte *buf, int len, int64 offset)
+{
+  if (offset > so->done)
+    copy_span(so, so->done, offset - so->done);
+  write_all(so->out_fd, buf, len, offset);
+  so->written += len;
+  so->spans++;
+  if (offset + len > so->done)
+    so->done = offset + len;
+}
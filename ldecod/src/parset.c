@@ -31,6 +31,103 @@
 
 extern void init_frext(VideoParameters *p_Vid);
 
+/*!
+ ************************************************************************
+ * \brief
+ *    The NAL unit payload each stored SPS / PPS was interpreted from.
+ *    Streams repeat their parameter sets before every IDR picture; a
+ *    repeat with the same bytes as the stored set is recognised by
+ *    hash and comparison and not interpreted again.
+ ************************************************************************
+ */
+typedef struct parset_raw
+{
+  uint64 hash;
+  int    len;                   //!< 0 = none stored
+  byte  *buf;
+} ParSetRaw;
+
+typedef struct parset_cache
+{
+  ParSetRaw sps[MAXSPS];
+  ParSetRaw pps[MAXPPS];
+} ParSetCache;
+
+static uint64 parset_hash(const byte *buf, int len)
+{
+  uint64 h = 0xcbf29ce484222325ULL;
+
+  while (len-- > 0)
+  {
+    h ^= *buf++;
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static ParSetCache *get_parset_cache(VideoParameters *p_Vid)
+{
+  if (p_Vid->parset_cache == NULL && (p_Vid->parset_cache = (ParSetCache *) calloc(1, sizeof(ParSetCache))) == NULL)
+    no_mem_exit("get_parset_cache: parset_cache");
+  return p_Vid->parset_cache;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Id of the stored set whose payload the NAL unit repeats byte for
+ *    byte, -1 if there is none
+ ************************************************************************
+ */
+static int find_parset_repeat(VideoParameters *p_Vid, ParSetRaw *raw, int n, const byte *buf, int len, uint64 hash, int (*valid)(VideoParameters *, int))
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+  {
+    if (raw[i].len == len && raw[i].hash == hash && !memcmp(raw[i].buf, buf, len) && valid(p_Vid, i))
+      return i;
+  }
+  return -1;
+}
+
+static void store_parset_raw(ParSetRaw *raw, const byte *buf, int len, uint64 hash)
+{
+  if (raw->buf == NULL || len > raw->len)
+  {
+    free(raw->buf);
+    if ((raw->buf = (byte *) malloc(len)) == NULL)
+      no_mem_exit("store_parset_raw: buf");
+  }
+  memcpy(raw->buf, buf, len);
+  raw->len  = len;
+  raw->hash = hash;
+}
+
+static int sps_valid(VideoParameters *p_Vid, int id)
+{
+  return p_Vid->SeqParSet[id].Valid == TRUE;
+}
+
+static int pps_valid(VideoParameters *p_Vid, int id)
+{
+  return p_Vid->PicParSet[id].Valid == TRUE;
+}
+
+void FreeParSetCache(VideoParameters *p_Vid)
+{
+  int i;
+
+  if (p_Vid->parset_cache == NULL)
+    return;
+  for (i = 0; i < MAXSPS; i++)
+    free(p_Vid->parset_cache->sps[i].buf);
+  for (i = 0; i < MAXPPS; i++)
+    free(p_Vid->parset_cache->pps[i].buf);
+  free(p_Vid->parset_cache);
+  p_Vid->parset_cache = NULL;
+}
+
 // syntax for scaling list matrix values
 void Scaling_List(int *scalingList, int sizeOfScalingList, Boolean *UseDefaultScalingMatrix, Bitstream *s)
 {
@@ -555,13 +652,52 @@ void MakeSPSavailable (VideoParameters *p_Vid, int id, seq_parameter_set_rbsp_t
 {
   assert (sps->Valid == TRUE);
   memcpy (&p_Vid->SeqParSet[id], sps, sizeof (seq_parameter_set_rbsp_t));
+  // the format info has to be derived again from the new contents
+  if (p_Vid->format_sps == &p_Vid->SeqParSet[id])
+    p_Vid->format_sps = NULL;
+}
+
+//! the decoder state an SPS sets when it is received
+static void set_sps_globals (VideoParameters *p_Vid, seq_parameter_set_rbsp_t *sps)
+{
+#if (MVC_EXTENSION_ENABLE)
+  if (p_Vid->profile_idc < (int) sps->profile_idc)
+  {
+    p_Vid->profile_idc = sps->profile_idc;
+  }
+#else
+  p_Vid->profile_idc = sps->profile_idc;
+#endif
+  p_Vid->separate_colour_plane_flag = sps->separate_colour_plane_flag;
+  if( p_Vid->separate_colour_plane_flag )
+  {
+    p_Vid->ChromaArrayType = 0;
+  }
+  else
+  {
+    p_Vid->ChromaArrayType = sps->chroma_format_idc;
+  }
 }
 
 
 void ProcessSPS (VideoParameters *p_Vid, NALU_t *nalu)
 {  
-  DataPartition *dp = AllocPartition(1);
-  seq_parameter_set_rbsp_t *sps = AllocSPS();
+  ParSetCache *cache = get_parset_cache(p_Vid);
+  uint64 hash = parset_hash(&nalu->buf[1], nalu->len-1);
+  int id = find_parset_repeat(p_Vid, cache->sps, MAXSPS, &nalu->buf[1], nalu->len-1, hash, sps_valid);
+  DataPartition *dp;
+  seq_parameter_set_rbsp_t *sps;
+
+  // a repeat of the stored set: equal to it, so neither the active SPS nor the stored one changes
+  if (id >= 0)
+  {
+    p_Dec->stats.parset_repeats++;
+    set_sps_globals(p_Vid, &p_Vid->SeqParSet[id]);
+    return;
+  }
+
+  dp = AllocPartition(1);
+  sps = AllocSPS();
 
   memcpy (dp->bitstream->streamBuffer, &nalu->buf[1], nalu->len-1);
   dp->bitstream->code_len = dp->bitstream->bitstream_length = RBSPtoSODB (dp->bitstream->streamBuffer, nalu->len-1);
@@ -592,23 +728,15 @@ void ProcessSPS (VideoParameters *p_Vid, NALU_t *nalu)
     }
     // SPSConsistencyCheck (pps);
     MakeSPSavailable (p_Vid, sps->seq_parameter_set_id, sps);
-#if (MVC_EXTENSION_ENABLE)
-    if (p_Vid->profile_idc < (int) sps->profile_idc)
-    {
-      p_Vid->profile_idc = sps->profile_idc;
-    }
-#else
-    p_Vid->profile_idc = sps->profile_idc;
-#endif
-    p_Vid->separate_colour_plane_flag = sps->separate_colour_plane_flag;
-    if( p_Vid->separate_colour_plane_flag )
-    {
-      p_Vid->ChromaArrayType = 0;
-    }
-    else
+    set_sps_globals(p_Vid, sps);
+
+    // a PPS is read with the SPS it refers to, its bytes alone no longer identify it
+    for (id = 0; id < MAXPPS; id++)
     {
-      p_Vid->ChromaArrayType = sps->chroma_format_idc;
+      if (p_Vid->PicParSet[id].Valid == TRUE && p_Vid->PicParSet[id].seq_parameter_set_id == sps->seq_parameter_set_id)
+        cache->pps[id].len = 0;
     }
+    store_parset_raw(&cache->sps[sps->seq_parameter_set_id], &nalu->buf[1], nalu->len-1, hash);
   }
 
   FreePartition (dp, 1);
@@ -627,6 +755,7 @@ void ProcessSubsetSPS (VideoParameters *p_Vid, NALU_t *nalu)
   dp->bitstream->ei_flag = 0;
   dp->bitstream->read_len = dp->bitstream->frame_bitoffset = 0;
   InterpretSubsetSPS (p_Vid, dp, &curr_seq_set_id);		//sps
+  p_Vid->format_sps = NULL;
 
   subset_sps = p_Vid->SubsetSeqParSet + curr_seq_set_id;
   get_max_dec_frame_buf_size(&(subset_sps->sps));
@@ -664,8 +793,20 @@ void ProcessSubsetSPS (VideoParameters *p_Vid, NALU_t *nalu)
 
 void ProcessPPS (VideoParameters *p_Vid, NALU_t *nalu)
 {
-  DataPartition *dp = AllocPartition(1);
-  pic_parameter_set_rbsp_t *pps = AllocPPS();	//sps
+  ParSetCache *cache = get_parset_cache(p_Vid);
+  uint64 hash = parset_hash(&nalu->buf[1], nalu->len-1);
+  DataPartition *dp;
+  pic_parameter_set_rbsp_t *pps;
+
+  // a repeat of the stored set (read with the same SPS) changes nothing
+  if (find_parset_repeat(p_Vid, cache->pps, MAXPPS, &nalu->buf[1], nalu->len-1, hash, pps_valid) >= 0)
+  {
+    p_Dec->stats.parset_repeats++;
+    return;
+  }
+
+  dp = AllocPartition(1);
+  pps = AllocPPS();	//sps
 
   memcpy (dp->bitstream->streamBuffer, &nalu->buf[1], nalu->len-1);
   dp->bitstream->code_len = dp->bitstream->bitstream_length = RBSPtoSODB (dp->bitstream->streamBuffer, nalu->len-1);
@@ -692,6 +833,10 @@ void ProcessPPS (VideoParameters *p_Vid, NALU_t *nalu)
       }
     }
   }
+  if (pps->Valid)
+    store_parset_raw(&cache->pps[pps->pic_parameter_set_id], &nalu->buf[1], nalu->len-1, hash);
+  else
+    cache->pps[pps->pic_parameter_set_id].len = 0;
   MakePPSavailable (p_Vid, pps->pic_parameter_set_id, pps);
   FreePartition (dp, 1);
   FreePPS (pps);
@@ -1003,6 +1148,7 @@ void activate_sps (VideoParameters *p_Vid, seq_parameter_set_rbsp_t *sps)
       exit_picture(p_Vid, &p_Vid->dec_picture);
     }
     p_Vid->active_sps = sps;
+    p_Vid->format_sps = NULL;
 
     if(p_Vid->dpb_layer_id==0 && is_BL_profile(sps->profile_idc) /*&& !p_Vid->p_Dpb_layer[0]->init_done*/)
     {
@@ -1078,8 +1224,15 @@ void activate_sps (VideoParameters *p_Vid, seq_parameter_set_rbsp_t *sps)
     //init_dpb(p_Vid, p_Vid->p_Dpb_layer[1], 2);
 #endif
   }
-  
-  reset_format_info(sps, p_Vid, &p_Inp->source, &p_Inp->output);
+
+  // re-activation of the active set: the format info derived from it still holds
+  if (p_Vid->format_sps != sps)
+  {
+    reset_format_info(sps, p_Vid, &p_Inp->source, &p_Inp->output);
+    p_Vid->format_sps = sps;
+  }
+  else
+    p_Dec->stats.reactivations_skipped++;
 }
 
 void activate_pps(VideoParameters *p_Vid, pic_parameter_set_rbsp_t *pps)
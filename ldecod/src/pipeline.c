@@ -0,0 +1,269 @@
+
+/*!
+ ************************************************************************
+ * \file pipeline.c
+ *
+ * \brief
+ *    Pipelined decoding, see pipeline.h.
+ *
+ *    The splitter owns depth NALU_t slots. A filled slot goes to the
+ *    parser on the ready queue; the parser swaps it with its own
+ *    NALU_t (no copy of the payload) and hands the slot back on the
+ *    free queue, so at most depth NAL units are buffered ahead.
+ *
+ *    The writer applies the key units in the order the parser records
+ *    them. They always lie in NAL units the splitter has finished with,
+ *    so the write-back never races the reads of the splitter. The
+ *    writer has its own IoBackend, the io_uring queues are not shared
+ *    between threads.
+ ************************************************************************
+ */
+
+#include <pthread.h>
+
+#include "global.h"
+#include "memalloc.h"
+#include "pipeline.h"
+#include "spsc.h"
+#include "nalu.h"
+#include "keyunit.h"
+#include "iobackend.h"
+#include "stagetimer.h"
+
+typedef struct pipe_nalu
+{
+  NALU_t *nalu;
+  int     ret;               //!< result of get_nalu() for this slot
+} PipeNalu;
+
+struct decode_pipeline
+{
+  VideoParameters *p_Vid;
+  int              depth;
+  NALU_t         **slots;
+  SpscQueue        free_q;   //!< parser -> splitter, empty slots
+  SpscQueue        ready_q;  //!< splitter -> parser, NAL units in file order
+  SpscQueue        key_q;    //!< parser -> writer, KeyUnit
+  pthread_t        splitter;
+  pthread_t        writer;
+  int              with_writer;
+  int              eos;      //!< the parser has seen the end of the stream
+  volatile int     stop;     //!< ask the splitter to quit early
+  IoBackend       *key_io;
+  IoBackend       *parser_key_io;
+};
+
+void init_spsc_queue(SpscQueue *q, int capacity, int elem_size)
+{
+  int size = 1;
+
+  while (size < capacity)
+    size <<= 1;
+  memset(q, 0, sizeof(SpscQueue));
+  if ((q->data = (byte *) malloc((size_t) size * elem_size)) == NULL)
+    no_mem_exit("init_spsc_queue: data");
+  q->elem_size = elem_size;
+  q->mask      = size - 1;
+}
+
+void free_spsc_queue(SpscQueue *q)
+{
+  free(q->data);
+  q->data = NULL;
+}
+
+static void *splitter_thread(void *arg)
+{
+  DecodePipeline *pl = (DecodePipeline *) arg;
+  PipeNalu pn;
+  int spins;
+
+  STAGE_THREAD_INIT();
+  do
+  {
+    spins = 0;
+    while (!spsc_try_pop(&pl->free_q, &pn.nalu))
+    {
+      if (pl->stop)
+      {
+        STAGE_THREAD_EXIT("splitter");
+        return NULL;
+      }
+      spsc_backoff(&spins);
+    }
+    pn.ret = get_nalu(pl->p_Vid, pn.nalu);
+
+    spins = 0;
+    while (!spsc_try_push(&pl->ready_q, &pn))
+      spsc_backoff(&spins);
+  } while (pn.ret > 0);
+
+  STAGE_THREAD_EXIT("splitter");
+  return NULL;
+}
+
+static void *writer_thread(void *arg)
+{
+  DecodePipeline *pl = (DecodePipeline *) arg;
+  KeyUnit ku;
+  int units = 0;
+  int spins = 0;
+
+  STAGE_THREAD_INIT();
+  for (;;)
+  {
+    if (!spsc_try_pop(&pl->key_q, &ku))
+    {
+      spsc_backoff(&spins);
+      continue;
+    }
+    spins = 0;
+    if (ku.key_data_len < 0)
+      break;
+    STAGE_BEGIN(STAGE_KEY_RECORD);
+    Generate_Key(ku.byte_offset, ku.bit_offset, ku.key_data_len, 0);
+    STAGE_END(STAGE_KEY_RECORD);
+    units++;
+  }
+  if (units > 0)
+  {
+    STAGE_BEGIN(STAGE_ENCRYPT);
+    Generate_Key(0, 0, 0, 1);
+    STAGE_END(STAGE_ENCRYPT);
+  }
+
+  STAGE_THREAD_EXIT("writer");
+  return NULL;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Start the splitter, and the writer if with_writer is set. Call
+ *    after the bit stream and the key file are open and before the
+ *    first NAL unit is read.
+ ************************************************************************
+ */
+DecodePipeline *open_pipeline(VideoParameters *p_Vid, int depth, int with_writer)
+{
+  DecodePipeline *pl = (DecodePipeline *) calloc(1, sizeof(DecodePipeline));
+  int i;
+
+  if (pl == NULL)
+    no_mem_exit("open_pipeline: pl");
+  pl->p_Vid       = p_Vid;
+  pl->depth       = depth;
+  pl->with_writer = with_writer;
+
+  init_spsc_queue(&pl->free_q,  depth, sizeof(NALU_t *));
+  init_spsc_queue(&pl->ready_q, depth, sizeof(PipeNalu));
+  if ((pl->slots = (NALU_t **) calloc(depth, sizeof(NALU_t *))) == NULL)
+    no_mem_exit("open_pipeline: slots");
+  for (i = 0; i < depth; ++i)
+  {
+    pl->slots[i] = AllocNALU(p_Vid->nalu->max_size);
+    spsc_try_push(&pl->free_q, &pl->slots[i]);
+  }
+
+  if (with_writer)
+  {
+    init_spsc_queue(&pl->key_q, PIPELINE_KEY_QUEUE_SIZE, sizeof(KeyUnit));
+    pl->key_io = io_open(p_Dec->BitStreamFile, p_Dec->p_Inp->io_backend, p_Dec->p_Inp->io_queue_depth, 0);
+    pl->parser_key_io = p_Dec->key_io;
+    p_Dec->key_io = pl->key_io;
+    if (pthread_create(&pl->writer, NULL, writer_thread, pl) != 0)
+      error("open_pipeline: cannot start the writer thread", 500);
+  }
+  if (pthread_create(&pl->splitter, NULL, splitter_thread, pl) != 0)
+    error("open_pipeline: cannot start the splitter thread", 500);
+
+  return pl;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Stop the splitter, let the writer apply the remaining key units
+ *    and release the slots
+ ************************************************************************
+ */
+void close_pipeline(DecodePipeline *pl)
+{
+  PipeNalu pn;
+  int i;
+
+  if (pl == NULL)
+    return;
+
+  // the splitter is either done or waits for a free slot
+  pl->stop = 1;
+  pthread_join(pl->splitter, NULL);
+  while (spsc_try_pop(&pl->ready_q, &pn))
+    ;
+
+  if (pl->with_writer)
+  {
+    KeyUnit end = { 0, 0, -1 };
+    int spins = 0;
+
+    while (!spsc_try_push(&pl->key_q, &end))
+      spsc_backoff(&spins);
+    pthread_join(pl->writer, NULL);
+    p_Dec->key_io = pl->parser_key_io;
+    io_close(pl->key_io);
+    free_spsc_queue(&pl->key_q);
+  }
+
+  for (i = 0; i < pl->depth; ++i)
+    FreeNALU(pl->slots[i]);
+  free(pl->slots);
+  free_spsc_queue(&pl->free_q);
+  free_spsc_queue(&pl->ready_q);
+  free(pl);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Take the next NAL unit from the splitter. The slot and nalu trade
+ *    their contents, the slot goes back to the splitter with the
+ *    buffer nalu held before.
+ ************************************************************************
+ */
+int pipeline_get_nalu(DecodePipeline *pl, NALU_t *nalu)
+{
+  PipeNalu pn;
+  NALU_t tmp;
+  int spins = 0;
+
+  if (pl->eos)
+    return 0;
+
+  while (!spsc_try_pop(&pl->ready_q, &pn))
+    spsc_backoff(&spins);
+
+  if (pn.ret <= 0)
+  {
+    pl->eos = 1;
+    return pn.ret;
+  }
+
+  tmp = *nalu;
+  *nalu = *pn.nalu;
+  *pn.nalu = tmp;
+  spsc_try_push(&pl->free_q, &pn.nalu);
+
+  return pn.ret;
+}
+
+void pipeline_put_key_unit(DecodePipeline *pl, int byte_offset, int bit_offset, int key_data_len)
+{
+  KeyUnit ku;
+  int spins = 0;
+
+  ku.byte_offset  = byte_offset;
+  ku.bit_offset   = bit_offset;
+  ku.key_data_len = key_data_len;
+  while (!spsc_try_push(&pl->key_q, &ku))
+    spsc_backoff(&spins);
+}
@@ -419,7 +419,7 @@ static void read_comp_coeff_8x8_MB_CABAC_ls (Macroblock *currMB, SyntaxElement *
  *    from the NAL
  ************************************************************************
  */
-static void read_CBP_and_coeffs_from_NAL_CABAC_420(Macroblock *currMB)
+void read_CBP_and_coeffs_from_NAL_CABAC_420(Macroblock *currMB)
 {
   int i,j;
   int level;
@@ -23,7 +23,7 @@
 #if TRACE
 #define TRACE_STRING(s) strncpy(currSE.tracestring, s, TRACESTRING_SIZE)
 #define TRACE_DECBITS(i) dectracebitcnt(1)
-#define TRACE_PRINTF(s) sprintf(type, "%s", s);
+#define TRACE_PRINTF(s) type = s;
 #define TRACE_STRING_P(s) strncpy(currSE->tracestring, s, TRACESTRING_SIZE)
 #else
 #define TRACE_STRING(s)
@@ -35,6 +35,19 @@
 extern void  check_dp_neighbors (Macroblock *currMB);
 extern void  read_delta_quant   (SyntaxElement *currSE, DataPartition *dP, Macroblock *currMB, const byte *partMap, int type);
 
+/*!
+ ************************************************************************
+ * \brief
+ *    A neighbour whose nz_coeff entries were not written in the current
+ *    picture (its MB was not decoded) is not available
+ ************************************************************************
+ */
+static inline void check_nz_epoch(VideoParameters *p_Vid, PixelPos *pix)
+{
+  if (pix->available && p_Vid->nz_epoch[pix->mb_addr] != p_Vid->pic_epoch)
+    pix->available = FALSE;
+}
+
 /*!
  ************************************************************************
  * \brief
@@ -56,6 +69,7 @@ static int predict_nnz(Macroblock *currMB, int block_type, int i,int j)
 
   // left block
   get4x4Neighbour(currMB, i - 1, j, p_Vid->mb_size[IS_LUMA], &pix);
+  check_nz_epoch(p_Vid, &pix);
 
   if ((currMB->is_intra_block == TRUE) && pix.available && p_Vid->active_pps->constrained_intra_pred_flag && (currSlice->dp_mode == PAR_DP_3))
   {
@@ -88,6 +102,7 @@ static int predict_nnz(Macroblock *currMB, int block_type, int i,int j)
 
   // top block
   get4x4Neighbour(currMB, i, j - 1, p_Vid->mb_size[IS_LUMA], &pix);
+  check_nz_epoch(p_Vid, &pix);
 
   if ((currMB->is_intra_block == TRUE) && pix.available && p_Vid->active_pps->constrained_intra_pred_flag && (currSlice->dp_mode==PAR_DP_3))
   {
@@ -152,6 +167,7 @@ static int predict_nnz_chroma(Macroblock *currMB, int i,int j)
     //YUV420 and YUV422
     // left block
     get4x4Neighbour(currMB, ((i&0x01)<<2) - 1, j, p_Vid->mb_size[IS_CHROMA], &pix);
+    check_nz_epoch(p_Vid, &pix);
 
     if ((currMB->is_intra_block == TRUE) && pix.available && p_Vid->active_pps->constrained_intra_pred_flag && (currSlice->dp_mode==PAR_DP_3))
     {
@@ -168,6 +184,7 @@ static int predict_nnz_chroma(Macroblock *currMB, int i,int j)
 
     // top block
     get4x4Neighbour(currMB, ((i&0x01)<<2), j - 1, p_Vid->mb_size[IS_CHROMA], &pix);
+    check_nz_epoch(p_Vid, &pix);
 
     if ((currMB->is_intra_block == TRUE) && pix.available && p_Vid->active_pps->constrained_intra_pred_flag && (currSlice->dp_mode==PAR_DP_3))
     {
@@ -222,7 +239,7 @@ void read_coeff_4x4_CAVLC (Macroblock *currMB,
   int numones, totzeros, abslevel, cdc=0, cac=0;
   int zerosleft, ntr, dptype = 0;
   int max_coeff_num = 0, nnz;
-  char type[15];
+  const char *type = "";
   static const int incVlc[] = {0, 3, 6, 12, 24, 48, 32768};    // maximum vlc = 6
 
   switch (block_type)
@@ -305,8 +322,7 @@ void read_coeff_4x4_CAVLC (Macroblock *currMB,
       currSE.len = numtrailingones;
 
 #if TRACE
-      snprintf(currSE.tracestring,
-        TRACESTRING_SIZE, "%s trailing ones sign (%d,%d)", type, i, j);
+      trace_format(&currSE, "%s trailing ones sign (%d,%d)", type, i, j, 0, 0);
 #endif
 
       readSyntaxElement_FLC (&currSE, currStream);
@@ -328,8 +344,7 @@ void read_coeff_4x4_CAVLC (Macroblock *currMB,
     {
 
 #if TRACE
-      snprintf(currSE.tracestring,
-        TRACESTRING_SIZE, "%s lev (%d,%d) k=%d vlc=%d ", type, i, j, k, vlcnum);
+      trace_format(&currSE, "%s lev (%d,%d) k=%d vlc=%d ", type, i, j, k, vlcnum);
 #endif
 
       if (vlcnum == 0)
@@ -363,8 +378,7 @@ void read_coeff_4x4_CAVLC (Macroblock *currMB,
       currSE.value1 = vlcnum;
 
 #if TRACE
-      snprintf(currSE.tracestring,
-        TRACESTRING_SIZE, "%s totalrun (%d,%d) vlc=%d ", type, i,j, vlcnum);
+      trace_format(&currSE, "%s totalrun (%d,%d) vlc=%d ", type, i, j, vlcnum, 0);
 #endif
       if (cdc)
         readSyntaxElement_TotalZerosChromaDC(p_Vid, &currSE, currStream);
@@ -391,9 +405,7 @@ void read_coeff_4x4_CAVLC (Macroblock *currMB,
 
         currSE.value1 = vlcnum;
 #if TRACE
-        snprintf(currSE.tracestring,
-          TRACESTRING_SIZE, "%s run (%d,%d) k=%d vlc=%d ",
-          type, i, j, i, vlcnum);
+        trace_format(&currSE, "%s run (%d,%d) k=%d vlc=%d ", type, i, j, i, vlcnum);
 #endif
 
         readSyntaxElement_Run(&currSE, currStream);
@@ -407,6 +419,58 @@ void read_coeff_4x4_CAVLC (Macroblock *currMB,
   } // if numcoeff
 }
 
+/*!
+ ************************************************************************
+ * \brief
+ *    Reads an 4x4 block (CAVLC) for its TotalCoeff only: nz_coeff is
+ *    set as read_coeff_4x4_CAVLC() does, the level and run codes are
+ *    skipped and levarr / runarr are not written
+ ************************************************************************
+ */
+void read_coeff_4x4_CAVLC_count (Macroblock *currMB, 
+                                 int block_type,
+                                 int i, int j, int levarr[16], int runarr[16],
+                                 int *number_coefficients)
+{
+  Slice *currSlice = currMB->p_Slice;
+  VideoParameters *p_Vid = currMB->p_Vid;
+  int mb_nr = currMB->mbAddrX;
+  const byte *partMap = assignSE2partition[currSlice->dp_mode];
+  int dptype, nnz;
+  Bitstream *currStream;
+
+  switch (block_type)
+  {
+  case LUMA:
+    dptype = (currMB->is_intra_block == TRUE) ? SE_LUM_AC_INTRA : SE_LUM_AC_INTER;
+    break;
+  case LUMA_INTRA16x16DC:
+    dptype = SE_LUM_DC_INTRA;
+    break;
+  case LUMA_INTRA16x16AC:
+    dptype = SE_LUM_AC_INTRA;
+    break;
+  case CHROMA_DC:
+    dptype = (currMB->is_intra_block == TRUE) ? SE_CHR_DC_INTRA : SE_CHR_DC_INTER;
+    currStream = currSlice->partArr[partMap[dptype]].bitstream;
+    p_Vid->nz_coeff[mb_nr][0][j][i] = 0;
+    *number_coefficients = skip_coeff_chroma_DC_CAVLC(p_Vid, currStream, p_Vid->num_cdc_coeff);
+    return;
+  case CHROMA_AC:
+    dptype = (currMB->is_intra_block == TRUE) ? SE_CHR_AC_INTRA : SE_CHR_AC_INTER;
+    break;
+  default:
+    error ("read_coeff_4x4_CAVLC_count: invalid block type", 600);
+    return;
+  }
+
+  currStream = currSlice->partArr[partMap[dptype]].bitstream;
+  nnz = (block_type != CHROMA_AC) ? predict_nnz(currMB, LUMA, i<<2, j<<2) : predict_nnz_chroma(currMB, i, ((j-4)<<2));
+  *number_coefficients = skip_coeff_4x4_CAVLC(currStream, (nnz < 2) ? 0 : ((nnz < 4) ? 1 : ((nnz < 8) ? 2 : 3)),
+    (block_type == LUMA || block_type == LUMA_INTRA16x16DC) ? 16 : 15);
+  p_Vid->nz_coeff[mb_nr][0][j][i] = (byte) *number_coefficients;
+}
+
 /*!
  ************************************************************************
  * \brief
@@ -436,7 +500,7 @@ void read_coeff_4x4_CAVLC_444 (Macroblock *currMB,
   int numones, totzeros, abslevel, cdc=0, cac=0;
   int zerosleft, ntr, dptype = 0;
   int max_coeff_num = 0, nnz;
-  char type[15];
+  const char *type = "";
   static const int incVlc[] = {0, 3, 6, 12, 24, 48, 32768};    // maximum vlc = 6
 
   switch (block_type)
@@ -571,8 +635,7 @@ void read_coeff_4x4_CAVLC_444 (Macroblock *currMB,
       currSE.len = numtrailingones;
 
 #if TRACE
-      snprintf(currSE.tracestring,
-        TRACESTRING_SIZE, "%s trailing ones sign (%d,%d)", type, i, j);
+      trace_format(&currSE, "%s trailing ones sign (%d,%d)", type, i, j, 0, 0);
 #endif
 
       readSyntaxElement_FLC (&currSE, currStream);
@@ -594,8 +657,7 @@ void read_coeff_4x4_CAVLC_444 (Macroblock *currMB,
     {
 
 #if TRACE
-      snprintf(currSE.tracestring,
-        TRACESTRING_SIZE, "%s lev (%d,%d) k=%d vlc=%d ", type, i, j, k, vlcnum);
+      trace_format(&currSE, "%s lev (%d,%d) k=%d vlc=%d ", type, i, j, k, vlcnum);
 #endif
 
       if (vlcnum == 0)
@@ -629,8 +691,7 @@ void read_coeff_4x4_CAVLC_444 (Macroblock *currMB,
       currSE.value1 = vlcnum;
 
 #if TRACE
-      snprintf(currSE.tracestring,
-        TRACESTRING_SIZE, "%s totalrun (%d,%d) vlc=%d ", type, i,j, vlcnum);
+      trace_format(&currSE, "%s totalrun (%d,%d) vlc=%d ", type, i, j, vlcnum, 0);
 #endif
       if (cdc)
         readSyntaxElement_TotalZerosChromaDC(p_Vid, &currSE, currStream);
@@ -657,9 +718,7 @@ void read_coeff_4x4_CAVLC_444 (Macroblock *currMB,
 
         currSE.value1 = vlcnum;
 #if TRACE
-        snprintf(currSE.tracestring,
-          TRACESTRING_SIZE, "%s run (%d,%d) k=%d vlc=%d ",
-          type, i, j, i, vlcnum);
+        trace_format(&currSE, "%s run (%d,%d) k=%d vlc=%d ", type, i, j, i, vlcnum);
 #endif
 
         readSyntaxElement_Run(&currSE, currStream);
@@ -684,7 +743,7 @@ static void read_comp_coeff_4x4_CAVLC (Macroblock *currMB, ColorPlane pl,/* int
 {
   int block_y, block_x, b8;
   int i, j;
-  int levarr[16] = {0}, runarr[16] = {0}, numcoeff;
+  int levarr[16], runarr[16], numcoeff;
   Slice *currSlice = currMB->p_Slice;
   VideoParameters *p_Vid = currMB->p_Vid;
   int cur_context; 
@@ -751,7 +810,7 @@ static void read_comp_coeff_4x4_CAVLC_ls (Macroblock *currMB, ColorPlane pl,/* i
 {
   int block_y, block_x, b8;
   int i, j;
-  int levarr[16] = {0}, runarr[16] = {0}, numcoeff;
+  int levarr[16], runarr[16], numcoeff;
   Slice *currSlice = currMB->p_Slice;
   VideoParameters *p_Vid = currMB->p_Vid;
   int cur_context; 
@@ -814,7 +873,7 @@ static void read_comp_coeff_8x8_CAVLC (Macroblock *currMB, ColorPlane pl,/* int
   int block_y, block_x, b4, b8;
   int block_y4, block_x4;
   int i, j, k;
-  int levarr[16] = {0}, runarr[16] = {0}, numcoeff;
+  int levarr[16], runarr[16], numcoeff;
   Slice *currSlice = currMB->p_Slice;
   VideoParameters *p_Vid = currMB->p_Vid;
   int  cur_context; 
@@ -879,7 +938,7 @@ static void read_comp_coeff_8x8_CAVLC_ls (Macroblock *currMB, ColorPlane pl,/* i
 {
   int block_y, block_x, b8;
   int i, j;
-  int levarr[16] = {0}, runarr[16] = {0}, numcoeff;
+  int levarr[16], runarr[16], numcoeff;
   Slice *currSlice = currMB->p_Slice;
   VideoParameters *p_Vid = currMB->p_Vid;
   int cur_context; 
@@ -1330,7 +1389,7 @@ static void read_CBP_and_coeffs_from_NAL_CAVLC_444(Macroblock *currMB)
  *    from the NAL
  ************************************************************************
  */
-static void read_CBP_and_coeffs_from_NAL_CAVLC_420(Macroblock *currMB)
+void read_CBP_and_coeffs_from_NAL_CAVLC_420(Macroblock *currMB)
 {
   int i,j,k;
   int mb_nr = currMB->mbAddrX;
@@ -1486,6 +1545,58 @@ static void read_CBP_and_coeffs_from_NAL_CAVLC_420(Macroblock *currMB)
 }
 
 
+/*!
+************************************************************************
+* \brief
+*    Read CBP, transform_size_8x8_flag and mb_qp_delta of a data
+*    partitioned slice with PartitionAOnly: they are in partition A,
+*    the residual in B and C is not read. nz_coeff is left as it is,
+*    only the residual readers predict from it.
+************************************************************************
+*/
+static void read_CBP_and_qp_from_NAL_CAVLC(Macroblock *currMB)
+{
+  SyntaxElement currSE;
+  DataPartition *dP = NULL;
+  Slice *currSlice = currMB->p_Slice;
+  const byte *partMap = assignSE2partition[currSlice->dp_mode];
+  VideoParameters *p_Vid = currMB->p_Vid;
+
+  if (!IS_I16MB (currMB))
+  {
+    int intra_cbp = (currMB->mb_type == I4MB || currMB->mb_type == SI4MB || currMB->mb_type == I8MB);
+
+    currSE.type    = intra_cbp ? SE_CBP_INTRA : SE_CBP_INTER;
+    currSE.mapping = intra_cbp ? currSlice->linfo_cbp_intra : currSlice->linfo_cbp_inter;
+    dP = &(currSlice->partArr[partMap[currSE.type]]);
+
+    TRACE_STRING("coded_block_pattern");
+    dP->readSyntaxElement(currMB, &currSE, dP);
+    currMB->cbp = currSE.value1;
+
+    if ((((currMB->mb_type >= 1 && currMB->mb_type <= 3)||
+      (IS_DIRECT(currMB) && p_Vid->active_sps->direct_8x8_inference_flag) ||
+      (currMB->NoMbPartLessThan8x8Flag))
+      && currMB->mb_type != I8MB && currMB->mb_type != I4MB
+      && (currMB->cbp&15)
+      && currSlice->Transform8x8Mode))
+    {
+      dP = &(currSlice->partArr[partMap[SE_HEADER]]);
+      TRACE_STRING("transform_size_8x8_flag");
+      currSE.len = 1;
+      readSyntaxElement_FLC(&currSE, dP->bitstream);
+      currMB->luma_transform_size_8x8_flag = (Boolean) currSE.value1;
+    }
+
+    if (currMB->cbp != 0)
+      read_delta_quant(&currSE, dP, currMB, partMap, ((currMB->is_intra_block == FALSE)) ? SE_DELTA_QUANT_INTER : SE_DELTA_QUANT_INTRA);
+  }
+  else
+    read_delta_quant(&currSE, dP, currMB, partMap, SE_DELTA_QUANT_INTRA);
+
+  update_qp(currMB, currSlice->qp);
+}
+
 /*!
 ************************************************************************
 * \brief
@@ -1510,6 +1621,12 @@ void set_read_comp_coeff_cavlc(Macroblock *currMB)
 
 void set_read_CBP_and_coeffs_cavlc(Slice *currSlice)
 {
+  if (currSlice->dp_mode && currSlice->p_Vid->p_Inp->partition_a_only)
+  {
+    currSlice->read_CBP_and_coeffs_from_NAL = read_CBP_and_qp_from_NAL_CAVLC;
+    return;
+  }
+
   switch (currSlice->p_Vid->active_sps->chroma_format_idc)
   {
   case YUV444:
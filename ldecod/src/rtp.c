@@ -98,9 +98,69 @@
 #include "fmo.h"
 #include "sei.h"
 #include "memalloc.h"
+#include "iobackend.h"
+#include "stream.h"
 
 int RTPReadPacket (RTPpacket_t *p, int bitstream);
 
+//! RTP packets and their buffers, allocated once per file instead of once per packet
+typedef struct rtp_packet_pool
+{
+  RTPpacket_t  packets[RTP_POOL_SIZE];
+  RTPpacket_t *free_list[RTP_POOL_SIZE];
+  int          num_free;
+  int64        filepos;                 //!< offset of the next packet in the file
+} RTPPacketPool;
+
+static RTPPacketPool *rtp_pool = NULL;
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Allocates the packet pool. The payload of a packet points into
+ *    its packet buffer, so DecomposeRTPpacket does not copy it.
+ ************************************************************************
+ */
+static void init_rtp_pool(void)
+{
+  int i;
+
+  if ((rtp_pool = (RTPPacketPool *) calloc(1, sizeof(RTPPacketPool))) == NULL)
+    no_mem_exit ("init_rtp_pool: rtp_pool");
+  for (i = 0; i < RTP_POOL_SIZE; ++i)
+  {
+    RTPpacket_t *p = &rtp_pool->packets[i];
+    if ((p->packet = malloc (MAXRTPPACKETSIZE)) == NULL)
+      no_mem_exit ("init_rtp_pool: packet");
+    p->payload = &p->packet[12];
+    rtp_pool->free_list[rtp_pool->num_free++] = p;
+  }
+}
+
+static void free_rtp_pool(void)
+{
+  int i;
+
+  if (rtp_pool == NULL)
+    return;
+  for (i = 0; i < RTP_POOL_SIZE; ++i)
+    free (rtp_pool->packets[i].packet);
+  free (rtp_pool);
+  rtp_pool = NULL;
+}
+
+static RTPpacket_t *get_rtp_packet(void)
+{
+  if (rtp_pool->num_free == 0)
+    error ("get_rtp_packet: RTP packet pool exhausted", 500);
+  return rtp_pool->free_list[--rtp_pool->num_free];
+}
+
+static void put_rtp_packet(RTPpacket_t *p)
+{
+  rtp_pool->free_list[rtp_pool->num_free++] = p;
+}
+
 /*!
  ************************************************************************
  * \brief
@@ -111,11 +171,25 @@ int RTPReadPacket (RTPpacket_t *p, int bitstream);
  */
 void OpenRTPFile (char *fn, int *p_BitStreamFile)
 {
-  if (((*p_BitStreamFile) = open(fn, OPENFLAGS_READ)) == -1)
+  if (is_stream_input(fn))
+  {
+    snprintf (errortext, ET_SIZE, "RTP file '%s' is not seekable, streaming needs Annex B input (FileFormat = 0)", fn);
+    error(errortext,500);
+  }
+  // read/write, the key units are scrambled in place as for Annex B input unless OutputFile is set
+  if (((*p_BitStreamFile) = open(fn, p_Dec->p_Inp->outfile[0] ? O_RDONLY : O_RDWR)) == -1)
   {
     snprintf (errortext, ET_SIZE, "Cannot open RTP file '%s'", fn);
     error(errortext,500);
   }
+  init_rtp_pool();
+
+	p_Dec->BitStreamFile = *p_BitStreamFile;
+	p_Dec->BitStreamFileLen = lseek(*p_BitStreamFile, 0, 2);
+	lseek(*p_BitStreamFile,0,0);
+
+  // packets are read with read(), the backend only carries the key write-back
+  p_Dec->io = p_Dec->key_io = io_open(*p_BitStreamFile, p_Dec->p_Inp->io_backend, p_Dec->p_Inp->io_queue_depth, 0);
 }
 
 
@@ -127,11 +201,14 @@ void OpenRTPFile (char *fn, int *p_BitStreamFile)
  */
 void CloseRTPFile(int *p_BitStreamFile)
 {
+  io_close(p_Dec->io);
+  p_Dec->io = p_Dec->key_io = NULL;
   if ((*p_BitStreamFile) != -1)
   {
     close(*p_BitStreamFile);
     (*p_BitStreamFile) = - 1;
   }
+  free_rtp_pool();
 }
 
 
@@ -155,16 +232,9 @@ int GetRTPNALU (VideoParameters *p_Vid, NALU_t *nalu, int BitStreamFile)
   static uint16 first_call = 1;  //!< triggers sequence number initialization on first call
   static uint16 old_seq = 0;     //!< store the last RTP sequence number for loss detection
 
-  RTPpacket_t *p;
+  RTPpacket_t *p = get_rtp_packet();
   int ret;
 
-  if ((p=malloc (sizeof (RTPpacket_t)))== NULL)
-    no_mem_exit ("GetRTPNALU-1");
-  if ((p->packet=malloc (MAXRTPPACKETSIZE))== NULL)
-    no_mem_exit ("GetRTPNALU-2");
-  if ((p->payload=malloc (MAXRTPPACKETSIZE))== NULL)
-    no_mem_exit ("GetRTPNALU-3");
-
   ret = RTPReadPacket (p, BitStreamFile);
   nalu->forbidden_bit = 1;
   nalu->len = 0;
@@ -187,16 +257,14 @@ int GetRTPNALU (VideoParameters *p_Vid, NALU_t *nalu, int BitStreamFile)
     nalu->forbidden_bit = (nalu->buf[0]>>7) & 1;
     nalu->nal_reference_idc = (NalRefIdc) ((nalu->buf[0]>>5) & 3);
     nalu->nal_unit_type = (NaluType) ((nalu->buf[0]) & 0x1f);
+    nalu->file_pos = p->filepos + 8 + (p->packlen - p->paylen);   // length and time fields, RTP header
     if (nalu->lost_packets)
     {
       printf ("Warning: RTP sequence number discontinuity detected\n");
     }
   }
 
-  // free memory
-  free (p->payload);
-  free (p->packet);
-  free (p);
+  put_rtp_packet (p);
 
 //  printf ("Got an RTP NALU, len %d, first byte %x\n", nalu->len, nalu->buf[0]);
   
@@ -273,7 +341,8 @@ int DecomposeRTPpacket (RTPpacket_t *p)
     return -1;
   }
   p->paylen = p->packlen-12;
-  memcpy (p->payload, &p->packet[12], p->paylen);
+  if (p->payload != &p->packet[12])
+    memcpy (p->payload, &p->packet[12], p->paylen);
   return 0;
 }
 
@@ -353,7 +422,8 @@ int RTPReadPacket (RTPpacket_t *p, int bitstream)
   assert (p->packet != NULL);
   assert (p->payload != NULL);
 
-  Filepos = tell (bitstream);
+  // the position is tracked in the pool rather than asked from the file
+  Filepos = rtp_pool->filepos;
   if (4 != read (bitstream, &p->packlen, 4))
   {
     return 0;
@@ -380,6 +450,8 @@ int RTPReadPacket (RTPpacket_t *p, int bitstream)
     printf ("Errors reported by DecomposePacket(), exit\n");
     exit (-700);
   }
+  p->filepos = Filepos;
+  rtp_pool->filepos = Filepos + 8 + p->packlen;
   assert (p->pt == H264PAYLOADTYPE);
   assert (p->ssrc == H264SSRC);
   return p->packlen;
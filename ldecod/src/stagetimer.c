@@ -0,0 +1,352 @@
+
+/*!
+ ************************************************************************
+ * \file stagetimer.c
+ *
+ * \brief
+ *    Hierarchical per-stage timers, see stagetimer.h.
+ *    Ticks are converted to ns by calibrating the tick counter against
+ *    CLOCK_MONOTONIC_RAW over the whole run.
+ *    Hardware counters (STAGE_COUNTERS) are one perf_event_open group
+ *    per thread, user space only; events the PMU does not offer are
+ *    reported as 0, and without perf access the counters are disabled.
+ *    The statistics of the other threads are kept when they exit and
+ *    reported after those of the main thread.
+ ************************************************************************
+ */
+
+#include <pthread.h>
+
+#include "global.h"
+#include "stagetimer.h"
+
+#if (STAGE_COUNTERS)
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#if (STAGE_TIMERS)
+
+#define STAGE_MAX_THREADS       8     //!< threads other than the main one that are reported
+
+__thread StageStat  g_stage_stat[STAGE_COUNT][STAGE_CTX_SLICE_TYPES * STAGE_CTX_ENTROPY];
+__thread int        g_stage_parent[STAGE_COUNT];
+__thread StageFrame g_stage_stack[STAGE_MAX_DEPTH];
+__thread int        g_stage_depth;
+__thread int        g_stage_ctx = STAGE_CTX_NONE;
+__thread int64      g_stage_mbs[STAGE_CTX_SLICE_TYPES * STAGE_CTX_ENTROPY];
+
+//! statistics of an exited thread
+typedef struct stage_thread_stats
+{
+  const char *name;
+  StageStat   stat[STAGE_COUNT][STAGE_CTX_SLICE_TYPES * STAGE_CTX_ENTROPY];
+  int         parent[STAGE_COUNT];
+  int64       mbs[STAGE_CTX_SLICE_TYPES * STAGE_CTX_ENTROPY];
+  int         pmu_on;
+} StageThreadStats;
+
+static StageThreadStats exited[STAGE_MAX_THREADS];
+static int              num_exited;
+static pthread_mutex_t  exited_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64 start_ticks;
+static uint64 start_ns;
+
+static const char *stage_name[STAGE_COUNT] =
+{
+  "decode", "nalu_read", "ebsp_to_rbsp", "slice_header", "mb_parse", "key_record", "encrypt"
+};
+static const char *slice_type_name[STAGE_CTX_SLICE_TYPES] = { "P", "B", "I", "SP", "SI", "-" };
+static const char *entropy_name[STAGE_CTX_ENTROPY] = { "cavlc", "cabac", "-" };
+
+#if (STAGE_COUNTERS)
+__thread int g_stage_pmu_on;           //!< the calling thread has a counter group
+
+static __thread int pmu_fd[PMU_EVENTS];
+static __thread int pmu_leader = -1;
+static __thread int pmu_slot[PMU_EVENTS];  //!< position of each event in the group read, -1 if not available
+static __thread int pmu_count;
+
+static const char *pmu_name[PMU_EVENTS] = { "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses" };
+
+static int pmu_open(uint32 type, uint64 config, int group)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size           = sizeof(attr);
+  attr.type           = type;
+  attr.config         = config;
+  attr.disabled       = (group < 0);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv     = 1;
+  attr.read_format    = PERF_FORMAT_GROUP;
+  return (int) syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+static void stage_pmu_open(void)
+{
+  static const uint32 type[PMU_EVENTS] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE };
+  static const uint64 config[PMU_EVENTS] =
+  {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_BRANCH_MISSES,
+    PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+    PERF_COUNT_HW_CACHE_MISSES
+  };
+  int i, fd;
+
+  pmu_count  = 0;
+  pmu_leader = -1;
+  for (i = 0; i < PMU_EVENTS; ++i)
+  {
+    pmu_slot[i] = -1;
+    pmu_fd[i]   = fd = pmu_open(type[i], config[i], pmu_leader);
+    if (fd < 0)
+    {
+      if (i == PMU_CYCLES)
+      {
+        static int warned = 0;
+        if (!__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED))
+          fprintf(stderr, "perf_event_open failed, hardware counters disabled (check perf_event_paranoid)\n");
+        return;
+      }
+      continue;
+    }
+    if (pmu_leader < 0)
+      pmu_leader = fd;
+    pmu_slot[i] = pmu_count++;
+  }
+
+  ioctl(pmu_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(pmu_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  g_stage_pmu_on = 1;
+}
+
+static void stage_pmu_close(void)
+{
+  int i;
+
+  if (pmu_leader < 0)
+    return;
+  for (i = PMU_EVENTS - 1; i >= 0; --i)
+  {
+    if (pmu_fd[i] >= 0)
+      close(pmu_fd[i]);
+    pmu_fd[i] = -1;
+  }
+  pmu_leader     = -1;
+  g_stage_pmu_on = 0;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Read the running totals of the counter group into v[PMU_EVENTS]
+ ************************************************************************
+ */
+void stage_pmu_read(uint64 *v)
+{
+  uint64 buf[1 + PMU_EVENTS];
+  int i;
+
+  if (read(pmu_leader, buf, sizeof(uint64) * (1 + pmu_count)) <= 0)
+    buf[0] = 0;
+  for (i = 0; i < PMU_EVENTS; ++i)
+    v[i] = (pmu_slot[i] >= 0 && pmu_slot[i] < (int) buf[0]) ? buf[1 + pmu_slot[i]] : 0;
+}
+
+static void print_counters(FILE *f, const uint64 *pmu, int64 mbs, int pmu_on)
+{
+  int i;
+
+  if (!pmu_on)
+    return;
+  fprintf(f, ", \"ipc\": %.3f", pmu[PMU_CYCLES] ? (double) pmu[PMU_INSTRUCTIONS] / pmu[PMU_CYCLES] : 0.0);
+  for (i = 0; i < PMU_EVENTS; ++i)
+    fprintf(f, ", \"%s\": %llu", pmu_name[i], (unsigned long long) pmu[i]);
+  if (mbs > 0)
+  {
+    for (i = PMU_BRANCH_MISSES; i < PMU_EVENTS; ++i)
+      fprintf(f, ", \"%s_per_mb\": %.2f", pmu_name[i], (double) pmu[i] / mbs);
+  }
+}
+#else
+#define print_counters(f, pmu, mbs, pmu_on)
+#endif
+
+static uint64 raw_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return (uint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//! the "stages" array of one thread
+static void print_stages(FILE *f, double ns_per_tick, StageStat stat[STAGE_COUNT][STAGE_CTX_SLICE_TYPES * STAGE_CTX_ENTROPY],
+                         const int *parent, const int64 *ctx_mbs, int pmu_on, const char *indent)
+{
+  int64 mbs = 0;
+  int i, c, first;
+
+  for (c = 0; c < STAGE_CTX_SLICE_TYPES * STAGE_CTX_ENTROPY; ++c)
+    mbs += ctx_mbs[c];
+
+  for (i = 0; i < STAGE_COUNT; ++i)
+  {
+    StageStat sum;
+
+    memset(&sum, 0, sizeof(sum));
+    for (c = 0; c < STAGE_CTX_SLICE_TYPES * STAGE_CTX_ENTROPY; ++c)
+    {
+      sum.calls += stat[i][c].calls;
+      sum.total += stat[i][c].total;
+      sum.self  += stat[i][c].self;
+#if (STAGE_COUNTERS)
+      {
+        int e;
+        for (e = 0; e < PMU_EVENTS; ++e)
+          sum.pmu[e] += stat[i][c].pmu[e];
+      }
+#endif
+    }
+
+    fprintf(f, "%s  {\"name\": \"%s\", \"parent\": %s%s%s, \"calls\": %llu, \"total_ns\": %.0f, \"self_ns\": %.0f",
+      indent, stage_name[i], parent[i] < 0 ? "" : "\"", parent[i] < 0 ? "null" : stage_name[parent[i]],
+      parent[i] < 0 ? "" : "\"", (unsigned long long) sum.calls, sum.total * ns_per_tick, sum.self * ns_per_tick);
+    if ((STAGE_PMU_MASK >> i) & 1)
+      print_counters(f, sum.pmu, mbs, pmu_on);
+    fprintf(f, ", \"by_context\": [");
+
+    for (c = 0, first = 1; c < STAGE_CTX_SLICE_TYPES * STAGE_CTX_ENTROPY; ++c)
+    {
+      StageStat *s = &stat[i][c];
+      if (s->calls == 0)
+        continue;
+      fprintf(f, "%s\n%s    {\"slice_type\": \"%s\", \"entropy\": \"%s\", \"calls\": %llu, \"total_ns\": %.0f, \"self_ns\": %.0f",
+        first ? "" : ",", indent, slice_type_name[c / STAGE_CTX_ENTROPY], entropy_name[c % STAGE_CTX_ENTROPY],
+        (unsigned long long) s->calls, s->total * ns_per_tick, s->self * ns_per_tick);
+      if ((STAGE_PMU_MASK >> i) & 1)
+        print_counters(f, s->pmu, ctx_mbs[c], pmu_on);
+      fprintf(f, "}");
+      first = 0;
+    }
+    fprintf(f, "%s%s]}%s\n", first ? "" : "\n  ", first ? "" : indent, i + 1 < STAGE_COUNT ? "," : "");
+  }
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Write the JSON summary to STAGE_TIMERS_FILE (registered with atexit).
+ *    "stages" are those of the main thread, "threads" those of the
+ *    threads that called STAGE_THREAD_EXIT().
+ ************************************************************************
+ */
+static void stage_timers_report(void)
+{
+  uint64 wall_ns = raw_ns() - start_ns;
+  double ns_per_tick = wall_ns ? (double) wall_ns / (double) (stage_clock() - start_ticks) : 1.0;
+  FILE *f = fopen(STAGE_TIMERS_FILE, "w");
+  int64 mbs = 0;
+  int c, t;
+
+  if (f == NULL)
+  {
+    fprintf(stderr, "cannot write %s\n", STAGE_TIMERS_FILE);
+    return;
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+  fprintf(f, "{\n  \"clock\": \"rdtsc\",\n");
+#else
+  fprintf(f, "{\n  \"clock\": \"monotonic_raw\",\n");
+#endif
+  for (c = 0; c < STAGE_CTX_SLICE_TYPES * STAGE_CTX_ENTROPY; ++c)
+    mbs += g_stage_mbs[c];
+  fprintf(f, "  \"ns_per_tick\": %.6f,\n  \"wall_ns\": %llu,\n  \"macroblocks\": %lld,\n  \"stages\": [\n",
+    ns_per_tick, (unsigned long long) wall_ns, (long long) mbs);
+#if (STAGE_COUNTERS)
+  print_stages(f, ns_per_tick, g_stage_stat, g_stage_parent, g_stage_mbs, g_stage_pmu_on, "  ");
+#else
+  print_stages(f, ns_per_tick, g_stage_stat, g_stage_parent, g_stage_mbs, 0, "  ");
+#endif
+  fprintf(f, "  ],\n  \"threads\": [");
+
+  pthread_mutex_lock(&exited_lock);
+  for (t = 0; t < num_exited; ++t)
+  {
+    fprintf(f, "%s\n    {\"name\": \"%s\", \"stages\": [\n", t ? "," : "", exited[t].name);
+    print_stages(f, ns_per_tick, exited[t].stat, exited[t].parent, exited[t].mbs, exited[t].pmu_on, "      ");
+    fprintf(f, "    ]}");
+  }
+  pthread_mutex_unlock(&exited_lock);
+  fprintf(f, "%s]\n}\n", num_exited ? "\n  " : "");
+  fclose(f);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Reset the statistics of the calling thread and open its counter
+ *    group
+ ************************************************************************
+ */
+void stage_thread_init(void)
+{
+  int i;
+
+  for (i = 0; i < STAGE_COUNT; ++i)
+    g_stage_parent[i] = -1;
+  memset(g_stage_stat, 0, sizeof(g_stage_stat));
+  memset(g_stage_mbs, 0, sizeof(g_stage_mbs));
+  g_stage_depth = 0;
+  g_stage_ctx   = STAGE_CTX_NONE;
+
+#if (STAGE_COUNTERS)
+  stage_pmu_open();
+#endif
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Keep the statistics of the calling thread for the report under
+ *    name and close its counter group
+ ************************************************************************
+ */
+void stage_thread_exit(const char *name)
+{
+  pthread_mutex_lock(&exited_lock);
+  if (num_exited < STAGE_MAX_THREADS)
+  {
+    StageThreadStats *t = &exited[num_exited++];
+
+    t->name = name;
+    memcpy(t->stat, g_stage_stat, sizeof(t->stat));
+    memcpy(t->parent, g_stage_parent, sizeof(t->parent));
+    memcpy(t->mbs, g_stage_mbs, sizeof(t->mbs));
+#if (STAGE_COUNTERS)
+    t->pmu_on = g_stage_pmu_on;
+#endif
+  }
+  pthread_mutex_unlock(&exited_lock);
+
+#if (STAGE_COUNTERS)
+  stage_pmu_close();
+#endif
+}
+
+void stage_timers_init(void)
+{
+  stage_thread_init();
+  start_ns    = raw_ns();
+  start_ticks = stage_clock();
+  atexit(stage_timers_report);
+}
+
+#endif
@@ -0,0 +1,137 @@
+
+/*!
+ ************************************************************************
+ * \file stream.c
+ *
+ * \brief
+ *    Streaming mode window, see stream.h.
+ ************************************************************************
+ */
+
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "global.h"
+#include "memalloc.h"
+#include "stream.h"
+
+static int stream_out_fd = -1;   //!< stdout as it was before stream_claim_stdout()
+
+/*!
+ ************************************************************************
+ * \brief
+ *    TRUE if fn names stdin ("-") or anything that is not a regular
+ *    file (FIFO, socket, character device)
+ ************************************************************************
+ */
+int is_stream_input(const char *fn)
+{
+  struct stat st;
+
+  if (strcmp(fn, "-") == 0)
+    return TRUE;
+  return stat(fn, &st) == 0 && !S_ISREG(st.st_mode);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Keep stdout for the scrambled stream and send everything the
+ *    decoder prints to stderr instead. Call before the first message.
+ ************************************************************************
+ */
+void stream_claim_stdout(void)
+{
+  if (stream_out_fd >= 0)
+    return;
+  // not flushed first: messages still in the stdio buffer follow to stderr
+  if ((stream_out_fd = dup(STDOUT_FILENO)) < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+    error("stream_claim_stdout: cannot redirect stdout", 500);
+  fflush(stdout);
+}
+
+StreamWindow *open_stream_window(void)
+{
+  StreamWindow *sw = (StreamWindow *) calloc(1, sizeof(StreamWindow));
+
+  if (sw == NULL)
+    no_mem_exit("open_stream_window: sw");
+  stream_claim_stdout();
+  sw->out_fd = stream_out_fd;
+  sw->alloc  = STREAM_WINDOW_INIT;
+  if ((sw->buf = (byte *) malloc(sw->alloc)) == NULL)
+    no_mem_exit("open_stream_window: buf");
+  return sw;
+}
+
+//! write out the whole window and release it
+void close_stream_window(StreamWindow *sw)
+{
+  if (sw == NULL)
+    return;
+  stream_finalize(sw, sw->base + sw->len);
+  printf("stream window peak: %d bytes\n", sw->peak);
+  free(sw->buf);
+  free(sw);
+}
+
+void stream_append(StreamWindow *sw, const byte *data, int len)
+{
+  if (sw->len + len > sw->alloc)
+  {
+    while (sw->len + len > sw->alloc)
+      sw->alloc <<= 1;
+    if ((sw->buf = (byte *) realloc(sw->buf, sw->alloc)) == NULL)
+      no_mem_exit("stream_append: buf");
+  }
+  memcpy(sw->buf + sw->len, data, len);
+  sw->len += len;
+  if (sw->len > sw->peak)
+    sw->peak = sw->len;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    The len bytes at stream offset offset, they must still be in the
+ *    window. The pointer is valid until the next append or finalize.
+ ************************************************************************
+ */
+byte *stream_window_at(StreamWindow *sw, int64 offset, int len)
+{
+  if (offset < sw->base || offset + len > sw->base + sw->len)
+  {
+    snprintf(errortext, ET_SIZE, "stream_window_at: bytes %lld..%lld are not in the window (%lld..%lld)",
+      (long long) offset, (long long) (offset + len), (long long) sw->base, (long long) (sw->base + sw->len));
+    error(errortext, 500);
+  }
+  return sw->buf + (offset - sw->base);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Write the bytes before stream offset upto to the output and drop
+ *    them from the window
+ ************************************************************************
+ */
+void stream_finalize(StreamWindow *sw, int64 upto)
+{
+  int n = (int) ((upto < sw->base + sw->len ? upto : sw->base + sw->len) - sw->base);
+  int done = 0;
+
+  if (n <= 0)
+    return;
+  while (done < n)
+  {
+    ssize_t w = write(sw->out_fd, sw->buf + done, n - done);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w <= 0)
+      error("stream_finalize: cannot write the output stream", 500);
+    done += (int) w;
+  }
+  sw->len -= n;
+  memmove(sw->buf, sw->buf + n, sw->len);
+  sw->base += n;
+}
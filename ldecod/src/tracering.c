@@ -0,0 +1,284 @@
+
+/*!
+ ************************************************************************
+ * \file tracering.c
+ *
+ * \brief
+ *    Binary trace rings and their flusher thread, see tracering.h.
+ ************************************************************************
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "global.h"
+#include "memalloc.h"
+#include "spsc.h"
+#include "tracering.h"
+
+#if TRACE
+
+#define TRACE_SYM_SLOTS     (2 * TRACE_MAX_SYMBOLS)  //!< open addressing, at most half full
+#define TRACE_FLUSH_BATCH   4096
+
+typedef struct trace_state
+{
+  FILE           *f;
+  pthread_t       flusher;
+  int             running;
+  int             stop;
+
+  SpscQueue       ring[TRACE_MAX_THREADS];
+  int             num_rings;
+  pthread_mutex_t lock;                            //!< ring registration and symbol insertion
+
+  uint16          slot[TRACE_SYM_SLOTS];           //!< symbol id, 0 = empty
+  uint32          sym_hash[TRACE_MAX_SYMBOLS];
+  char           *sym_name[TRACE_MAX_SYMBOLS];
+  int             num_syms;
+} TraceState;
+
+static TraceState trace = { .lock = PTHREAD_MUTEX_INITIALIZER };
+static __thread SpscQueue *trace_ring;             //!< ring of the calling thread
+static __thread int        trace_thread;
+
+//! symbol ids of the (format, type) pairs of trace_put_format(), by the pointers
+typedef struct trace_format_id
+{
+  const char *format;
+  const char *type;
+  int         id;
+} TraceFormatId;
+
+#define TRACE_FORMAT_IDS    256
+static __thread TraceFormatId trace_format_ids[TRACE_FORMAT_IDS];
+
+//! write the records of all rings, returns their count
+static int drain_rings(void)
+{
+  static TraceRecord buf[TRACE_FLUSH_BATCH];
+  int rings = __atomic_load_n(&trace.num_rings, __ATOMIC_ACQUIRE);
+  int i, n, total = 0;
+
+  for (i = 0; i < rings; ++i)
+  {
+    while ((n = spsc_pop_batch(&trace.ring[i], buf, TRACE_FLUSH_BATCH)) > 0)
+    {
+      fwrite(buf, sizeof(TraceRecord), n, trace.f);
+      total += n;
+      if (n < TRACE_FLUSH_BATCH)
+        break;
+    }
+  }
+  return total;
+}
+
+static void *flusher_thread(void *arg)
+{
+  int spins = 0;
+
+  (void) arg;
+  while (!__atomic_load_n(&trace.stop, __ATOMIC_ACQUIRE))
+  {
+    if (drain_rings() > 0)
+      spins = 0;
+    else
+      spsc_backoff(&spins);
+  }
+  drain_rings();
+  return NULL;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Write the file header and start the flusher thread. The trace is
+ *    also flushed at exit(), so error() keeps the records before it.
+ ************************************************************************
+ */
+void open_trace(FILE *f)
+{
+  int32 version = TRACE_VERSION;
+
+  trace.f = f;
+  fwrite(TRACE_MAGIC, 1, 4, f);
+  fwrite(&version, sizeof(version), 1, f);
+  trace.stop = FALSE;
+  if (pthread_create(&trace.flusher, NULL, flusher_thread, NULL) != 0)
+    error("open_trace: cannot create the trace flusher thread", 500);
+  trace.running = TRUE;
+  atexit(close_trace);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Stop the flusher after the records pushed so far are written
+ ************************************************************************
+ */
+void close_trace(void)
+{
+  int i;
+
+  if (!trace.running)
+    return;
+  trace.running = FALSE;
+  __atomic_store_n(&trace.stop, TRUE, __ATOMIC_RELEASE);
+  pthread_join(trace.flusher, NULL);
+  fflush(trace.f);
+
+  for (i = 0; i < trace.num_rings; ++i)
+    free_spsc_queue(&trace.ring[i]);
+  trace.num_rings = 0;
+  for (i = 1; i <= trace.num_syms; ++i)
+    free(trace.sym_name[i]);
+  trace.num_syms = 0;
+  memset(trace.slot, 0, sizeof(trace.slot));
+}
+
+static void push_record(const void *r)
+{
+  int spins = 0;
+
+  // a full ring waits for the flusher, the trace drops nothing
+  while (!spsc_try_push(trace_ring, r))
+    spsc_backoff(&spins);
+}
+
+static void register_thread(void)
+{
+  pthread_mutex_lock(&trace.lock);
+  if (trace.num_rings == TRACE_MAX_THREADS)
+  {
+    pthread_mutex_unlock(&trace.lock);
+    error("trace_put: too many tracing threads", 500);
+  }
+  trace_thread = trace.num_rings;
+  trace_ring = &trace.ring[trace_thread];
+  init_spsc_queue(trace_ring, TRACE_RING_SIZE, sizeof(TraceRecord));
+  __atomic_store_n(&trace.num_rings, trace.num_rings + 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&trace.lock);
+}
+
+//! id of name, a new one is defined in the ring of the calling thread
+static int trace_symbol(const char *name)
+{
+  uint32 h = 2166136261u;
+  const char *c;
+  unsigned i, start;
+  int id, len;
+
+  for (c = name; *c; ++c)
+    h = (h ^ (byte) *c) * 16777619u;
+
+  start = h & (TRACE_SYM_SLOTS - 1);
+  for (i = start; (id = __atomic_load_n(&trace.slot[i], __ATOMIC_ACQUIRE)) != 0; i = (i + 1) & (TRACE_SYM_SLOTS - 1))
+  {
+    if (trace.sym_hash[id] == h && !strcmp(trace.sym_name[id], name))
+      return id;
+  }
+
+  pthread_mutex_lock(&trace.lock);
+  // another thread may have inserted it since
+  for (i = start; (id = trace.slot[i]) != 0; i = (i + 1) & (TRACE_SYM_SLOTS - 1))
+  {
+    if (trace.sym_hash[id] == h && !strcmp(trace.sym_name[id], name))
+    {
+      pthread_mutex_unlock(&trace.lock);
+      return id;
+    }
+  }
+  if (trace.num_syms == TRACE_MAX_SYMBOLS - 1)
+  {
+    pthread_mutex_unlock(&trace.lock);
+    return 0;
+  }
+  id = ++trace.num_syms;
+  len = (int) strnlen(name, 255);
+  if ((trace.sym_name[id] = (char *) calloc(len + TRACE_NAME_CHARS, 1)) == NULL)
+    no_mem_exit("trace_symbol: name");
+  memcpy(trace.sym_name[id], name, len);
+  trace.sym_hash[id] = h;
+  __atomic_store_n(&trace.slot[i], (uint16) id, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&trace.lock);
+
+  {
+    TraceRecord r;
+    const char *p;
+
+    memset(&r, 0, sizeof(r));
+    r.sym  = (uint16) id;
+    r.kind = (byte) (TRACE_SYMDEF | (trace_thread << 4));
+    r.len  = (byte) len;
+    push_record(&r);
+    for (p = trace.sym_name[id]; p < trace.sym_name[id] + len; p += TRACE_NAME_CHARS)
+      push_record(p);
+  }
+  return id;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Trace one record from the calling thread
+ ************************************************************************
+ */
+void trace_put(int kind, const char *name, unsigned pos, int len, int info, int value)
+{
+  TraceRecord r;
+
+  if (!trace.running)
+    return;
+  if (trace_ring == NULL)
+    register_thread();
+
+  r.pos   = pos;
+  r.sym   = (uint16) trace_symbol(name);
+  r.kind  = (byte) (kind | (trace_thread << 4));
+  r.len   = (byte) len;
+  r.info  = info;
+  r.value = value;
+  push_record(&r);
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Trace one record named format with its %s replaced by type. The
+ *    name is built and interned once per pair of string constants.
+ ************************************************************************
+ */
+void trace_put_format(int kind, const char *format, const char *type, unsigned pos, int len, int info, int value)
+{
+  TraceFormatId *f = &trace_format_ids[(((uintptr_t) format ^ ((uintptr_t) type << 5)) >> 3) & (TRACE_FORMAT_IDS - 1)];
+  TraceRecord r;
+
+  if (!trace.running)
+    return;
+  if (trace_ring == NULL)
+    register_thread();
+
+  if (f->format != format || f->type != type || f->id == 0)
+  {
+    char name[256];
+    const char *s = strstr(format, "%s");
+
+    if (s != NULL)
+      snprintf(name, sizeof(name), "%.*s%s%s", (int) (s - format), format, type != NULL ? type : "", s + 2);
+    else
+      snprintf(name, sizeof(name), "%s", format);
+    f->format = format;
+    f->type   = type;
+    f->id     = trace_symbol(name);
+  }
+
+  r.pos   = pos;
+  r.sym   = (uint16) f->id;
+  r.kind  = (byte) (kind | (trace_thread << 4));
+  r.len   = (byte) len;
+  r.info  = info;
+  r.value = value;
+  push_record(&r);
+}
+
+#endif
@@ -21,13 +21,121 @@
 
 // A little trick to avoid those horrible #if TRACE all over the source code
 #if TRACE
-#define SYMTRACESTRING(s) strncpy(symbol.tracestring,s,TRACESTRING_SIZE)
+#define SYMTRACESTRING(s) snprintf(symbol.tracestring,TRACESTRING_SIZE,"%s",s)
 #else
 #define SYMTRACESTRING(s) // do nothing
 #endif
 
 // Note that all NA values are filled with 0
 
+//! coeff_token (Table 9-5, 0 <= nC < 8), indexed [nC table][TrailingOnes][TotalCoeff]
+const byte coeff_token_lentab[3][4][17] =
+{
+  {   // 0702
+    { 1, 6, 8, 9,10,11,13,13,13,14,14,15,15,16,16,16,16},
+    { 0, 2, 6, 8, 9,10,11,13,13,14,14,15,15,15,16,16,16},
+    { 0, 0, 3, 7, 8, 9,10,11,13,13,14,14,15,15,16,16,16},
+    { 0, 0, 0, 5, 6, 7, 8, 9,10,11,13,14,14,15,15,16,16},
+  },
+  {
+    { 2, 6, 6, 7, 8, 8, 9,11,11,12,12,12,13,13,13,14,14},
+    { 0, 2, 5, 6, 6, 7, 8, 9,11,11,12,12,13,13,14,14,14},
+    { 0, 0, 3, 6, 6, 7, 8, 9,11,11,12,12,13,13,13,14,14},
+    { 0, 0, 0, 4, 4, 5, 6, 6, 7, 9,11,11,12,13,13,13,14},
+  },
+  {
+    { 4, 6, 6, 6, 7, 7, 7, 7, 8, 8, 9, 9, 9,10,10,10,10},
+    { 0, 4, 5, 5, 5, 5, 6, 6, 7, 8, 8, 9, 9, 9,10,10,10},
+    { 0, 0, 4, 5, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9,10,10,10},
+    { 0, 0, 0, 4, 4, 4, 4, 4, 5, 6, 7, 8, 8, 9,10,10,10},
+  },
+};
+
+const byte coeff_token_codtab[3][4][17] =
+{
+  {
+    { 1, 5, 7, 7, 7, 7,15,11, 8,15,11,15,11,15,11, 7,4},
+    { 0, 1, 4, 6, 6, 6, 6,14,10,14,10,14,10, 1,14,10,6},
+    { 0, 0, 1, 5, 5, 5, 5, 5,13, 9,13, 9,13, 9,13, 9,5},
+    { 0, 0, 0, 3, 3, 4, 4, 4, 4, 4,12,12, 8,12, 8,12,8},
+  },
+  {
+    { 3,11, 7, 7, 7, 4, 7,15,11,15,11, 8,15,11, 7, 9,7},
+    { 0, 2, 7,10, 6, 6, 6, 6,14,10,14,10,14,10,11, 8,6},
+    { 0, 0, 3, 9, 5, 5, 5, 5,13, 9,13, 9,13, 9, 6,10,5},
+    { 0, 0, 0, 5, 4, 6, 8, 4, 4, 4,12, 8,12,12, 8, 1,4},
+  },
+  {
+    {15,15,11, 8,15,11, 9, 8,15,11,15,11, 8,13, 9, 5,1},
+    { 0,14,15,12,10, 8,14,10,14,14,10,14,10, 7,12, 8,4},
+    { 0, 0,13,14,11, 9,13, 9,13,10,13, 9,13, 9,11, 7,3},
+    { 0, 0, 0,12,11,10, 9, 8,13,12,12,12, 8,12,10, 6,2},
+  },
+};
+
+//! total_zeros for 4x4 blocks (Tables 9-7, 9-8), indexed [TotalCoeff - 1][total_zeros]
+const byte total_zeros_lentab[TOTRUN_NUM][16] =
+{
+  { 1,3,3,4,4,5,5,6,6,7,7,8,8,9,9,9},
+  { 3,3,3,3,3,4,4,4,4,5,5,6,6,6,6},
+  { 4,3,3,3,4,4,3,3,4,5,5,6,5,6},
+  { 5,3,4,4,3,3,3,4,3,4,5,5,5},
+  { 4,4,4,3,3,3,3,3,4,5,4,5},
+  { 6,5,3,3,3,3,3,3,4,3,6},
+  { 6,5,3,3,3,2,3,4,3,6},
+  { 6,4,5,3,2,2,3,3,6},
+  { 6,6,4,2,2,3,2,5},
+  { 5,5,3,2,2,2,4},
+  { 4,4,3,3,1,3},
+  { 4,4,2,1,3},
+  { 3,3,1,2},
+  { 2,2,1},
+  { 1,1},
+};
+
+const byte total_zeros_codtab[TOTRUN_NUM][16] =
+{
+  {1,3,2,3,2,3,2,3,2,3,2,3,2,3,2,1},
+  {7,6,5,4,3,5,4,3,2,3,2,3,2,1,0},
+  {5,7,6,5,4,3,4,3,2,3,2,1,1,0},
+  {3,7,5,4,6,5,4,3,3,2,2,1,0},
+  {5,4,3,7,6,5,4,3,2,1,1,0},
+  {1,1,7,6,5,4,3,2,1,1,0},
+  {1,1,5,4,3,3,2,1,1,0},
+  {1,1,1,3,3,2,2,1,0},
+  {1,0,1,3,2,1,1,1,},
+  {1,0,1,3,2,1,1,},
+  {0,1,1,2,1,3},
+  {0,1,1,1,1},
+  {0,1,1,1},
+  {0,1,1},
+  {0,1},
+};
+
+//! run_before (Table 9-10), indexed [min(zerosLeft, 7) - 1][run_before]
+const byte run_before_lentab[TOTRUN_NUM][16] =
+{
+  {1,1},
+  {1,2,2},
+  {2,2,2,2},
+  {2,2,2,3,3},
+  {2,2,3,3,3,3},
+  {2,3,3,3,3,3,3},
+  {3,3,3,3,3,3,3,4,5,6,7,8,9,10,11},
+};
+
+const byte run_before_codtab[TOTRUN_NUM][16] =
+{
+  {1,0},
+  {1,1,0},
+  {3,2,1,0},
+  {3,2,1,1,0},
+  {3,2,3,2,1,0},
+  {3,0,1,3,2,5,4},
+  {7,6,5,4,3,2,1,1,1,1,1,1,1,1,1},
+};
+
+
 /*!
  *************************************************************************************
  * \brief
@@ -52,7 +160,7 @@ int read_ue_v (char *tracestring, Bitstream *bitstream, int *used_bits)
   //assert (bitstream->streamBuffer != NULL);
   symbol.type = SE_HEADER;
   symbol.mapping = linfo_ue;   // Mapping rule
-  //SYMTRACESTRING(tracestring);
+  SYMTRACESTRING(tracestring);
   readSyntaxElement_VLC (&symbol, bitstream);
   *used_bits+=symbol.len;
   return symbol.value1;
@@ -83,7 +191,7 @@ int read_se_v (char *tracestring, Bitstream *bitstream, int *used_bits)
   //assert (bitstream->streamBuffer != NULL);
   symbol.type = SE_HEADER;
   symbol.mapping = linfo_se;   // Mapping rule: signed integer
-  //SYMTRACESTRING(tracestring);
+  SYMTRACESTRING(tracestring);
   readSyntaxElement_VLC (&symbol, bitstream);
   *used_bits+=symbol.len;
   return symbol.value1;
@@ -119,7 +227,7 @@ int read_u_v (int LenInBits, char*tracestring, Bitstream *bitstream, int *used_b
   symbol.type = SE_HEADER;
   symbol.mapping = linfo_ue;   // Mapping rule
   symbol.len = LenInBits;
-  //SYMTRACESTRING(tracestring);
+  SYMTRACESTRING(tracestring);
   readSyntaxElement_FLC (&symbol, bitstream);
   *used_bits+=symbol.len;
 
@@ -155,7 +263,7 @@ int read_i_v (int LenInBits, char*tracestring, Bitstream *bitstream, int *used_b
   symbol.type = SE_HEADER;
   symbol.mapping = linfo_ue;   // Mapping rule
   symbol.len = LenInBits;
-  //SYMTRACESTRING(tracestring);
+  SYMTRACESTRING(tracestring);
   readSyntaxElement_FLC (&symbol, bitstream);
   *used_bits+=symbol.len;
 
@@ -412,7 +520,7 @@ int readSyntaxElement_Intra4x4PredictionMode(SyntaxElement *sym, Bitstream   *cu
   sym->value1       = (sym->len == 1) ? -1 : sym->inf;
 
 #if TRACE
-  tracebits2(sym->tracestring, sym->len, sym->value1);
+  trace_se_bits(sym, sym->len, sym->value1);
 #endif
 
   return 1;
@@ -676,7 +784,7 @@ int readSyntaxElement_FLC(SyntaxElement *sym, Bitstream *currStream)
   currStream->frame_bitoffset += sym->len; // move bitstream pointer
 
 #if TRACE
-  tracebits2(sym->tracestring, sym->len, sym->inf);
+  trace_se_bits(sym, sym->len, sym->inf);
 #endif
 
   return 1;
@@ -693,57 +801,13 @@ int readSyntaxElement_FLC(SyntaxElement *sym, Bitstream *currStream)
 
 int readSyntaxElement_NumCoeffTrailingOnes(SyntaxElement *sym,  
                                            Bitstream *currStream,
-                                           char *type)
+                                           const char *type)
 {
   int frame_bitoffset        = currStream->frame_bitoffset;
   int BitstreamLengthInBytes = currStream->bitstream_length;
   int BitstreamLengthInBits  = (BitstreamLengthInBytes << 3) + 7;
   byte *buf                  = currStream->streamBuffer;
 
-  static const byte lentab[3][4][17] =
-  {
-    {   // 0702
-      { 1, 6, 8, 9,10,11,13,13,13,14,14,15,15,16,16,16,16},
-      { 0, 2, 6, 8, 9,10,11,13,13,14,14,15,15,15,16,16,16},
-      { 0, 0, 3, 7, 8, 9,10,11,13,13,14,14,15,15,16,16,16},
-      { 0, 0, 0, 5, 6, 7, 8, 9,10,11,13,14,14,15,15,16,16},
-    },
-    {
-      { 2, 6, 6, 7, 8, 8, 9,11,11,12,12,12,13,13,13,14,14},
-      { 0, 2, 5, 6, 6, 7, 8, 9,11,11,12,12,13,13,14,14,14},
-      { 0, 0, 3, 6, 6, 7, 8, 9,11,11,12,12,13,13,13,14,14},
-      { 0, 0, 0, 4, 4, 5, 6, 6, 7, 9,11,11,12,13,13,13,14},
-    },
-    {
-      { 4, 6, 6, 6, 7, 7, 7, 7, 8, 8, 9, 9, 9,10,10,10,10},
-      { 0, 4, 5, 5, 5, 5, 6, 6, 7, 8, 8, 9, 9, 9,10,10,10},
-      { 0, 0, 4, 5, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9,10,10,10},
-      { 0, 0, 0, 4, 4, 4, 4, 4, 5, 6, 7, 8, 8, 9,10,10,10},
-    },
-  };
-
-  static const byte codtab[3][4][17] =
-  {
-    {
-      { 1, 5, 7, 7, 7, 7,15,11, 8,15,11,15,11,15,11, 7,4},
-      { 0, 1, 4, 6, 6, 6, 6,14,10,14,10,14,10, 1,14,10,6},
-      { 0, 0, 1, 5, 5, 5, 5, 5,13, 9,13, 9,13, 9,13, 9,5},
-      { 0, 0, 0, 3, 3, 4, 4, 4, 4, 4,12,12, 8,12, 8,12,8},
-    },
-    {
-      { 3,11, 7, 7, 7, 4, 7,15,11,15,11, 8,15,11, 7, 9,7},
-      { 0, 2, 7,10, 6, 6, 6, 6,14,10,14,10,14,10,11, 8,6},
-      { 0, 0, 3, 9, 5, 5, 5, 5,13, 9,13, 9,13, 9, 6,10,5},
-      { 0, 0, 0, 5, 4, 6, 8, 4, 4, 4,12, 8,12,12, 8, 1,4},
-    },
-    {
-      {15,15,11, 8,15,11, 9, 8,15,11,15,11, 8,13, 9, 5,1},
-      { 0,14,15,12,10, 8,14,10,14,14,10,14,10, 7,12, 8,4},
-      { 0, 0,13,14,11, 9,13, 9,13,10,13, 9,13, 9,11, 7,3},
-      { 0, 0, 0,12,11,10, 9, 8,13,12,12,12, 8,12,10, 6,2},
-    },
-  };
-
   int retval = 0, code;
   int vlcnum = sym->value1;
   // vlcnum is the index of Table used to code coeff_token
@@ -770,8 +834,8 @@ int readSyntaxElement_NumCoeffTrailingOnes(SyntaxElement *sym,
   }
   else
   {
-    //retval = code_from_bitstream_2d(sym, currStream, &lentab[vlcnum][0][0], &codtab[vlcnum][0][0], 17, 4, &code);    
-    retval = code_from_bitstream_2d(sym, currStream, lentab[vlcnum][0], codtab[vlcnum][0], 17, 4, &code);
+    //retval = code_from_bitstream_2d(sym, currStream, &coeff_token_lentab[vlcnum][0][0], &coeff_token_codtab[vlcnum][0][0], 17, 4, &code);    
+    retval = code_from_bitstream_2d(sym, currStream, coeff_token_lentab[vlcnum][0], coeff_token_codtab[vlcnum][0], 17, 4, &code);
     if (retval)
     {
       printf("ERROR: failed to find NumCoeff/TrailingOnes\n");
@@ -780,9 +844,8 @@ int readSyntaxElement_NumCoeffTrailingOnes(SyntaxElement *sym,
   }
 
 #if TRACE
-  snprintf(sym->tracestring, TRACESTRING_SIZE, "%s # c & tr.1s vlc=%d #c=%d #t1=%d",
-           type, vlcnum, sym->value1, sym->value2);
-  tracebits2(sym->tracestring, sym->len, code);
+  trace_format(sym, "%s # c & tr.1s vlc=%d #c=%d #t1=%d", type, vlcnum, sym->value1, sym->value2, 0);
+  trace_se_bits(sym, sym->len, code);
 #endif
 
   return retval;
@@ -847,9 +910,8 @@ int readSyntaxElement_NumCoeffTrailingOnesChromaDC(VideoParameters *p_Vid, Synta
   }
 
 #if TRACE
-  snprintf(sym->tracestring, TRACESTRING_SIZE, "ChrDC # c & tr.1s  #c=%d #t1=%d",
-    sym->value1, sym->value2);
-  tracebits2(sym->tracestring, sym->len, code);
+  trace_format(sym, "ChrDC # c & tr.1s  #c=%d #t1=%d", NULL, sym->value1, sym->value2, 0, 0);
+  trace_se_bits(sym, sym->len, code);
 
 #endif
 
@@ -907,7 +969,7 @@ int readSyntaxElement_Level_VLC0(SyntaxElement *sym, Bitstream *currStream)
   sym->len = len;
 
 #if TRACE
-  tracebits2(sym->tracestring, sym->len, code);
+  trace_se_bits(sym, sym->len, code);
 #endif
 
   currStream->frame_bitoffset = frame_bitoffset;
@@ -982,7 +1044,7 @@ int readSyntaxElement_Level_VLCN(SyntaxElement *sym, int vlc, Bitstream *currStr
   currStream->frame_bitoffset = frame_bitoffset + len;
 
 #if TRACE
-  tracebits2(sym->tracestring, sym->len, code);
+  trace_se_bits(sym, sym->len, code);
 #endif
 
   return 0;
@@ -996,48 +1058,9 @@ int readSyntaxElement_Level_VLCN(SyntaxElement *sym, int vlc, Bitstream *currStr
  */
 int readSyntaxElement_TotalZeros(SyntaxElement *sym,  Bitstream *currStream)
 {
-  static const byte lentab[TOTRUN_NUM][16] =
-  {
-
-    { 1,3,3,4,4,5,5,6,6,7,7,8,8,9,9,9},
-    { 3,3,3,3,3,4,4,4,4,5,5,6,6,6,6},
-    { 4,3,3,3,4,4,3,3,4,5,5,6,5,6},
-    { 5,3,4,4,3,3,3,4,3,4,5,5,5},
-    { 4,4,4,3,3,3,3,3,4,5,4,5},
-    { 6,5,3,3,3,3,3,3,4,3,6},
-    { 6,5,3,3,3,2,3,4,3,6},
-    { 6,4,5,3,2,2,3,3,6},
-    { 6,6,4,2,2,3,2,5},
-    { 5,5,3,2,2,2,4},
-    { 4,4,3,3,1,3},
-    { 4,4,2,1,3},
-    { 3,3,1,2},
-    { 2,2,1},
-    { 1,1},
-  };
-
-  static const byte codtab[TOTRUN_NUM][16] =
-  {
-    {1,3,2,3,2,3,2,3,2,3,2,3,2,3,2,1},
-    {7,6,5,4,3,5,4,3,2,3,2,3,2,1,0},
-    {5,7,6,5,4,3,4,3,2,3,2,1,1,0},
-    {3,7,5,4,6,5,4,3,3,2,2,1,0},
-    {5,4,3,7,6,5,4,3,2,1,1,0},
-    {1,1,7,6,5,4,3,2,1,1,0},
-    {1,1,5,4,3,3,2,1,1,0},
-    {1,1,1,3,3,2,2,1,0},
-    {1,0,1,3,2,1,1,1,},
-    {1,0,1,3,2,1,1,},
-    {0,1,1,2,1,3},
-    {0,1,1,1,1},
-    {0,1,1,1},
-    {0,1,1},
-    {0,1},
-  };
-
   int code;
   int vlcnum = sym->value1;
-  int retval = code_from_bitstream_2d(sym, currStream, &lentab[vlcnum][0], &codtab[vlcnum][0], 16, 1, &code);
+  int retval = code_from_bitstream_2d(sym, currStream, &total_zeros_lentab[vlcnum][0], &total_zeros_codtab[vlcnum][0], 16, 1, &code);
 
   if (retval)
   {
@@ -1046,7 +1069,7 @@ int readSyntaxElement_TotalZeros(SyntaxElement *sym,  Bitstream *currStream)
   }
 
 #if TRACE
-  tracebits2(sym->tracestring, sym->len, code);
+  trace_se_bits(sym, sym->len, code);
 #endif
 
   return retval;
@@ -1136,7 +1159,7 @@ int readSyntaxElement_TotalZerosChromaDC(VideoParameters *p_Vid, SyntaxElement *
   }
 
 #if TRACE
-  tracebits2(sym->tracestring, sym->len, code);
+  trace_se_bits(sym, sym->len, code);
 #endif
 
   return retval;
@@ -1151,30 +1174,9 @@ int readSyntaxElement_TotalZerosChromaDC(VideoParameters *p_Vid, SyntaxElement *
  */
 int readSyntaxElement_Run(SyntaxElement *sym, Bitstream *currStream)
 {
-  static const byte lentab[TOTRUN_NUM][16] =
-  {
-    {1,1},
-    {1,2,2},
-    {2,2,2,2},
-    {2,2,2,3,3},
-    {2,2,3,3,3,3},
-    {2,3,3,3,3,3,3},
-    {3,3,3,3,3,3,3,4,5,6,7,8,9,10,11},
-  };
-
-  static const byte codtab[TOTRUN_NUM][16] =
-  {
-    {1,0},
-    {1,1,0},
-    {3,2,1,0},
-    {3,2,1,1,0},
-    {3,2,3,2,1,0},
-    {3,0,1,3,2,5,4},
-    {7,6,5,4,3,2,1,1,1,1,1,1,1,1,1},
-  };
   int code;
   int vlcnum = sym->value1;
-  int retval = code_from_bitstream_2d(sym, currStream, &lentab[vlcnum][0], &codtab[vlcnum][0], 16, 1, &code);
+  int retval = code_from_bitstream_2d(sym, currStream, &run_before_lentab[vlcnum][0], &run_before_codtab[vlcnum][0], 16, 1, &code);
 
   if (retval)
   {
@@ -1183,13 +1185,277 @@ int readSyntaxElement_Run(SyntaxElement *sym, Bitstream *currStream)
   }
 
 #if TRACE
-  tracebits2(sym->tracestring, sym->len, code);
+  trace_se_bits(sym, sym->len, code);
 #endif
 
   return retval;
 }
 
 
+/*!
+ ************************************************************************
+ * \brief
+ *    Count only CAVLC residual reading: the codes are skipped, not
+ *    decoded into levels and runs. A code of the coeff_token,
+ *    total_zeros and run_before tables is looked up by its leading
+ *    zeros and the bits after the first one bit, in one VlcLut per
+ *    table built from the tables above.
+ ************************************************************************
+ */
+#define VLC_LUT_SIZE  256
+
+typedef struct vlc_lut
+{
+  int    max_zeros;              //!< most leading zeros of a code
+  int    zero_code;              //!< a code of max_zeros zeros only
+  byte   suffix_bits[17];        //!< bits after the first one looked at, per leading zeros
+  short  base[17];               //!< first entry per leading zeros
+  uint16 entry[VLC_LUT_SIZE];    //!< len | value1 << 5 | value2 << 10, 0 = no code
+} VlcLut;
+
+static VlcLut coeff_token_lut[3];
+static VlcLut total_zeros_lut[TOTRUN_NUM];
+static VlcLut run_before_lut[RUNBEFORE_NUM];
+
+static void build_vlc_lut(VlcLut *lut, const byte *lentab, const byte *codtab, int tabwidth, int tabheight)
+{
+  int i, j, z, n = 0;
+
+  memset(lut, 0, sizeof(VlcLut));
+  for (j = 0; j < tabheight; j++)
+  {
+    for (i = 0; i < tabwidth; i++)
+    {
+      int len = lentab[j * tabwidth + i], cod = codtab[j * tabwidth + i], s;
+
+      if (len == 0)
+        continue;
+      for (z = 0; z < len && !((cod >> (len - 1 - z)) & 1); z++)
+        ;
+      s = (z < len) ? len - z - 1 : 0;
+      lut->max_zeros = imax(lut->max_zeros, z);
+      lut->zero_code |= (z == len);
+      lut->suffix_bits[z] = (byte) imax(lut->suffix_bits[z], s);
+    }
+  }
+  for (z = 0; z <= lut->max_zeros; z++)
+  {
+    lut->base[z] = (short) n;
+    n += 1 << lut->suffix_bits[z];
+  }
+  if (n > VLC_LUT_SIZE)
+    error("build_vlc_lut: table too large", 500);
+
+  for (j = 0; j < tabheight; j++)
+  {
+    for (i = 0; i < tabwidth; i++)
+    {
+      int len = lentab[j * tabwidth + i], cod = codtab[j * tabwidth + i], s, k, first;
+
+      if (len == 0)
+        continue;
+      for (z = 0; z < len && !((cod >> (len - 1 - z)) & 1); z++)
+        ;
+      s = (z < len) ? len - z - 1 : 0;
+      first = lut->base[z] + ((cod & ((1 << s) - 1)) << (lut->suffix_bits[z] - s));
+      for (k = 0; k < (1 << (lut->suffix_bits[z] - s)); k++)
+        lut->entry[first + k] = (uint16) (len | (i << 5) | (j << 10));
+    }
+  }
+}
+
+void init_cavlc_count_tables(void)
+{
+  static int done = 0;
+  int k;
+
+  if (done)
+    return;
+  for (k = 0; k < 3; k++)
+    build_vlc_lut(&coeff_token_lut[k], coeff_token_lentab[k][0], coeff_token_codtab[k][0], 17, 4);
+  for (k = 0; k < TOTRUN_NUM; k++)
+    build_vlc_lut(&total_zeros_lut[k], total_zeros_lentab[k], total_zeros_codtab[k], 16, 1);
+  for (k = 0; k < RUNBEFORE_NUM; k++)
+    build_vlc_lut(&run_before_lut[k], run_before_lentab[k], run_before_codtab[k], 16, 1);
+  done = 1;
+}
+
+//! the 32 bits from bit offset on (the partition buffers are padded, see AllocPartition())
+static inline uint32 peek_bits32(const byte *buf, int bitoffset)
+{
+  const byte *p = buf + (bitoffset >> 3);
+  uint32 v = ((uint32) p[0] << 24) | ((uint32) p[1] << 16) | ((uint32) p[2] << 8) | p[3];
+  int s = bitoffset & 0x07;
+
+  return s ? (v << s) | (p[4] >> (8 - s)) : v;
+}
+
+//! value1 | value2 << 5 of the code at the bit offset, which is moved past it
+static inline int lut_decode(const VlcLut *lut, Bitstream *currStream)
+{
+  uint32 bits = peek_bits32(currStream->streamBuffer, currStream->frame_bitoffset);
+  int z = bits ? __builtin_clz(bits) : 32;
+  int sb;
+  uint16 e;
+
+  if (z > lut->max_zeros)
+  {
+    if (!lut->zero_code)
+      error("count only CAVLC: invalid code", 500);
+    z = lut->max_zeros;
+  }
+  sb = lut->suffix_bits[z];
+  e  = lut->entry[lut->base[z] + (sb ? (int) ((bits << (z + 1)) >> (32 - sb)) : 0)];
+  if (e == 0)
+    error("count only CAVLC: invalid code", 500);
+  currStream->frame_bitoffset += e & 31;
+  return e >> 5;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Skip the trailing one signs, levels, total_zeros and run_before
+ *    codes of a block with numcoeff coefficients. The level codes are
+ *    only decoded as far as the choice of the next VLC needs, the rare
+ *    escape codes (level_prefix >= 15) by readSyntaxElement_Level_VLC0/N.
+ ************************************************************************
+ */
+static void skip_levels_and_runs(VideoParameters *p_Vid, Bitstream *currStream, int numcoeff, int numtrailingones, int max_coeff_num, int cdc)
+{
+  static const int incVlc[] = {0, 3, 6, 12, 24, 48, 32768};    // maximum vlc = 6
+  int level_two_or_higher = (numcoeff > 3 && numtrailingones == 3) ? 0 : 1;
+  int vlcnum = (numcoeff > 10 && numtrailingones < 3) ? 1 : 0;
+  int k, totzeros, zerosleft;
+
+  currStream->frame_bitoffset += numtrailingones;
+
+  for (k = numcoeff - 1 - numtrailingones; k >= 0; k--)
+  {
+    uint32 bits = peek_bits32(currStream->streamBuffer, currStream->frame_bitoffset);
+    int prefix = bits ? __builtin_clz(bits) : 32;
+    int abslevel;
+
+    if (prefix >= 15)
+    {
+      SyntaxElement currSE;
+
+      if (vlcnum == 0)
+        readSyntaxElement_Level_VLC0(&currSE, currStream);
+      else
+        readSyntaxElement_Level_VLCN(&currSE, vlcnum, currStream);
+      abslevel = iabs(currSE.inf);
+    }
+    else if (vlcnum == 0)
+    {
+      if (prefix < 14)
+      {
+        abslevel = (prefix >> 1) + 1;
+        currStream->frame_bitoffset += prefix + 1;
+      }
+      else
+      {
+        abslevel = ((bits << 15) >> 29) + 8;
+        currStream->frame_bitoffset += 19;
+      }
+    }
+    else
+    {
+      int shift = vlcnum - 1;
+
+      abslevel = (prefix << shift) + 1 + (shift ? (int) ((bits << (prefix + 1)) >> (32 - shift)) : 0);
+      currStream->frame_bitoffset += prefix + shift + 2;
+    }
+
+    if (level_two_or_higher)
+    {
+      ++abslevel;
+      level_two_or_higher = 0;
+    }
+    if (abslevel > incVlc[vlcnum])
+      ++vlcnum;
+    if (k == numcoeff - 1 - numtrailingones && abslevel > 3)
+      vlcnum = 2;
+  }
+
+  if (numcoeff < max_coeff_num)
+  {
+    if (cdc)
+    {
+      SyntaxElement currSE;
+
+      currSE.value1 = numcoeff - 1;
+      readSyntaxElement_TotalZerosChromaDC(p_Vid, &currSE, currStream);
+      totzeros = currSE.value1;
+    }
+    else
+      totzeros = lut_decode(&total_zeros_lut[numcoeff - 1], currStream) & 31;
+  }
+  else
+    totzeros = 0;
+
+  // run_before of all but the last coefficient while there are zeros left
+  for (zerosleft = totzeros, k = numcoeff - 1; zerosleft > 0 && k > 0; k--)
+    zerosleft -= lut_decode(&run_before_lut[imin(zerosleft - 1, RUNBEFORE_NUM_M1)], currStream) & 31;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Skip a luma or chroma AC block coded with the coeff_token table
+ *    vlcnum (3 = 6 bit FLC), see read_coeff_4x4_CAVLC_count()
+ * \return
+ *    TotalCoeff of the block
+ ************************************************************************
+ */
+int skip_coeff_4x4_CAVLC(Bitstream *currStream, int vlcnum, int max_coeff_num)
+{
+  int numcoeff, numtrailingones;
+
+  if (vlcnum == 3)
+  {
+    int code = (int) (peek_bits32(currStream->streamBuffer, currStream->frame_bitoffset) >> 26);
+
+    currStream->frame_bitoffset += 6;
+    numtrailingones = code & 3;
+    numcoeff        = code >> 2;
+    if (!numcoeff && numtrailingones == 3)
+      numtrailingones = 0;
+    else
+      numcoeff++;
+  }
+  else
+  {
+    int v = lut_decode(&coeff_token_lut[vlcnum], currStream);
+
+    numcoeff        = v & 31;
+    numtrailingones = v >> 5;
+  }
+
+  if (numcoeff)
+    skip_levels_and_runs(NULL, currStream, numcoeff, numtrailingones, max_coeff_num, 0);
+  return numcoeff;
+}
+
+/*!
+ ************************************************************************
+ * \brief
+ *    Skip a chroma DC block
+ * \return
+ *    TotalCoeff of the block
+ ************************************************************************
+ */
+int skip_coeff_chroma_DC_CAVLC(VideoParameters *p_Vid, Bitstream *currStream, int max_coeff_num)
+{
+  SyntaxElement currSE;
+
+  readSyntaxElement_NumCoeffTrailingOnesChromaDC(p_Vid, &currSE, currStream);
+  if (currSE.value1)
+    skip_levels_and_runs(p_Vid, currStream, currSE.value1, currSE.value2, max_coeff_num, 1);
+  return currSE.value1;
+}
+
+
 /*!
  ************************************************************************
  * \brief